@@ -55,6 +55,7 @@ void bind_torrent_status()
         .def_readonly("total_redundant_bytes", &torrent_status::total_redundant_bytes)
         .def_readonly("download_rate", &torrent_status::download_rate)
         .def_readonly("upload_rate", &torrent_status::upload_rate)
+        .def_readonly("checking_rate", &torrent_status::checking_rate)
         .def_readonly("download_payload_rate", &torrent_status::download_payload_rate)
         .def_readonly("upload_payload_rate", &torrent_status::upload_payload_rate)
         .def_readonly("num_seeds", &torrent_status::num_seeds)
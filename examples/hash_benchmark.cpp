@@ -0,0 +1,132 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/hash_kernels.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/crc32c.hpp"
+#include "libtorrent/time.hpp"
+
+#include <boost/cstdint.hpp>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+using namespace libtorrent;
+
+// measures the throughput of every SHA-1 and CRC32C kernel the CPU we're
+// running on supports, as well as of the ones picked for it
+
+double mb_per_s(boost::int64_t bytes, ptime start)
+{
+	boost::int64_t us = total_microseconds(time_now_hires() - start);
+	if (us <= 0) us = 1;
+	return double(bytes) / us;
+}
+
+int main(int argc, char* argv[])
+{
+	int size_mb = 256;
+	if (argc > 1) size_mb = atoi(argv[1]);
+	if (size_mb <= 0)
+	{
+		fprintf(stderr, "usage: hash_benchmark [MiB to hash (default: 256)]\n");
+		return 1;
+	}
+
+	// a buffer that fits in the L2 cache, hashed over and over, to measure
+	// the kernel rather than memory bandwidth
+	int const buf_size = 128 * 1024;
+	std::vector<boost::uint64_t> buf(buf_size / 8);
+	for (int i = 0; i < int(buf.size()); ++i)
+		buf[i] = (boost::uint64_t(rand()) << 32) | rand();
+	boost::uint8_t const* data = reinterpret_cast<boost::uint8_t const*>(&buf[0]);
+	boost::int64_t const total = boost::int64_t(size_mb) * 1024 * 1024;
+
+	printf("SHA-1 kernels:\n");
+	for (sha1_kernel const* k = sha1_kernels(); k->name; ++k)
+	{
+		if (!k->supported())
+		{
+			printf("  %-10s not supported by this CPU\n", k->name);
+			continue;
+		}
+
+		// each lane hashes its own slice of the buffer
+		int const blocks = buf_size / 64 / k->lanes;
+		boost::uint32_t state[8][5] = {{0}};
+		boost::uint32_t* s[8];
+		boost::uint8_t const* lanes[8];
+		for (int l = 0; l < k->lanes; ++l)
+		{
+			s[l] = state[l];
+			lanes[l] = data + l * blocks * 64;
+		}
+
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+			k->compress(s, lanes, k->lanes, blocks);
+		printf("  %-10s %d lane(s) %8.1f MB/s\n", k->name, k->lanes
+			, mb_per_s(total, start));
+	}
+
+	printf("CRC32C kernels:\n");
+	for (crc32c_kernel const* k = crc32c_kernels(); k->name; ++k)
+	{
+		if (!k->supported())
+		{
+			printf("  %-10s not supported by this CPU\n", k->name);
+			continue;
+		}
+
+		boost::uint32_t sum = 0;
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+			sum += k->crc32c(&buf[0], int(buf.size()));
+		printf("  %-10s %8.1f MB/s (%08x)\n", k->name, mb_per_s(total, start), sum);
+	}
+
+	hash_kernels const& sel = selected_kernels();
+	printf("selected: sha1: %s multi-buffer sha1: %s (%d lanes) crc32c: %s\n"
+		, sel.sha1->name, sel.sha1_multi->name, sel.sha1_multi_lanes
+		, sel.crc32c->name);
+
+	// hasher may be backed by a crypto library rather than the kernels
+	hasher h;
+	ptime start = time_now_hires();
+	for (boost::int64_t done = 0; done < total; done += buf_size)
+		h.update(reinterpret_cast<char const*>(data), buf_size);
+	h.final();
+	printf("hasher: %8.1f MB/s\n", mb_per_s(total, start));
+
+	return 0;
+}
+
@@ -132,7 +132,10 @@ void print_usage()
 		"            the specified file\n"
 		"-f          include sha-1 file hashes in the torrent\n"
 		"            this helps supporting mixing sources from\n"
-		"            other networks\n"
+		"            other networks. implies -j\n"
+		"-j          read the files sequentially and hash pieces\n"
+		"            on all CPU cores. This is a lot faster for\n"
+		"            large torrents\n"
 		"-w url      adds a web seed to the torrent with\n"
 		"            the specified url\n"
 		"-t url      adds the specified tracker to the\n"
@@ -226,6 +229,9 @@ int main(int argc, char* argv[])
 				case 'f':
 					flags |= create_torrent::calculate_file_hashes;
 					break;
+				case 'j':
+					flags |= create_torrent::parallel_hashing;
+					break;
 				case 'l':
 					flags |= create_torrent::symlinks;
 					break;
@@ -0,0 +1,399 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/piece_picker.hpp"
+#include "libtorrent/torrent_peer.hpp"
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/time.hpp"
+
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace libtorrent;
+
+// builds a piece picker for a synthetic swarm and measures the throughput
+// of the operations the network thread performs on it. The results are
+// printed as CSV, one line per operation, to make it easy to track them
+// across versions:
+//
+//   operation,pieces,peers,swarm,ops,ns_per_op,allocs_per_op,loops_per_op
+//
+// allocs_per_op is the number of heap allocations per operation and
+// loops_per_op the number of pieces the picker looked at per operation
+// (the sum of the picker.piece_picker_*_loops counters)
+
+// counts every heap allocation made by the process
+boost::int64_t g_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+	++g_allocations;
+	void* ret = std::malloc(size == 0 ? 1 : size);
+	if (ret == 0) throw std::bad_alloc();
+	return ret;
+}
+
+void operator delete(void* p) throw() { std::free(p); }
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete[](void* p) throw() { operator delete(p); }
+
+namespace
+{
+	const int blocks_per_piece = 16;
+
+	// a fixed seed, to make runs comparable
+	boost::uint32_t g_random_state = 0x12345678;
+	boost::uint32_t rand32()
+	{
+		// xorshift32
+		g_random_state ^= g_random_state << 13;
+		g_random_state ^= g_random_state >> 17;
+		g_random_state ^= g_random_state << 5;
+		return g_random_state;
+	}
+
+	enum swarm_t { swarm_random, swarm_rare, swarm_seed, swarm_mixed };
+	char const* swarm_names[] = { "random", "rare", "seed", "mixed" };
+
+	// the fraction (in percent) of the pieces peer number i has. 100 means
+	// it's a seed
+	int peer_density(swarm_t swarm, int i)
+	{
+		switch (swarm)
+		{
+			case swarm_random: return 50;
+			case swarm_rare: return 5;
+			case swarm_seed: return 100;
+			case swarm_mixed: default:
+				if (i % 5 == 0) return 100;
+				return (i % 5) < 3 ? 50 : 5;
+		}
+	}
+
+	struct peer_t
+	{
+		peer_t(): tp(tcp::endpoint(), false, 0)
+		{
+#if TORRENT_USE_ASSERTS
+			tp.in_use = true;
+#endif
+		}
+		ipv4_peer tp;
+		bitfield have;
+		bool seed;
+	};
+
+	struct config
+	{
+		int num_pieces;
+		int num_peers;
+		swarm_t swarm;
+		int rounds;
+	};
+
+	boost::int64_t loop_count(counters const& pc)
+	{
+		boost::int64_t ret = 0;
+		for (int i = counters::piece_picker_partial_loops;
+			i <= counters::piece_picker_busy_loops; ++i)
+			ret += pc[i];
+		return ret;
+	}
+
+	// measures one operation. start() and stop() bracket the timed
+	// region, which may be entered several times
+	struct measurement
+	{
+		measurement(): time(seconds(0)), allocs(0), loops(0), ops(0) {}
+
+		void start(counters const& pc)
+		{
+			m_start_allocs = g_allocations;
+			m_start_loops = loop_count(pc);
+			m_start = time_now_hires();
+		}
+
+		void stop(counters const& pc, int num_ops)
+		{
+			// the durations are summed at full resolution, since a single
+			// operation may take less than a microsecond
+			time += time_now_hires() - m_start;
+			allocs += g_allocations - m_start_allocs;
+			loops += loop_count(pc) - m_start_loops;
+			ops += num_ops;
+		}
+
+		void print(char const* op, config const& cfg) const
+		{
+			boost::int64_t const n = (std::max)(ops, boost::int64_t(1));
+			printf("%s,%d,%d,%s,%" PRId64 ",%.1f,%.2f,%.1f\n", op
+				, cfg.num_pieces, cfg.num_peers, swarm_names[cfg.swarm]
+				, ops, double(total_microseconds(time)) * 1000. / n
+				, double(allocs) / n, double(loops) / n);
+		}
+
+		time_duration time;
+		boost::int64_t allocs;
+		boost::int64_t loops;
+		boost::int64_t ops;
+	private:
+		ptime m_start;
+		boost::int64_t m_start_allocs;
+		boost::int64_t m_start_loops;
+	};
+
+	void add_peer(piece_picker& p, peer_t& peer)
+	{
+		if (peer.seed) p.inc_refcount_all(&peer.tp);
+		else p.inc_refcount(peer.have, &peer.tp);
+	}
+
+	void remove_peer(piece_picker& p, peer_t& peer)
+	{
+		if (peer.seed) p.dec_refcount_all(&peer.tp);
+		else p.dec_refcount(peer.have, &peer.tp);
+	}
+
+	void run(config const& cfg)
+	{
+		counters pc;
+		std::vector<boost::shared_ptr<peer_t> > peers;
+		for (int i = 0; i < cfg.num_peers; ++i)
+		{
+			boost::shared_ptr<peer_t> peer(new peer_t);
+			int const density = peer_density(cfg.swarm, i);
+			peer->seed = density == 100;
+			peer->have.resize(cfg.num_pieces, peer->seed);
+			if (!peer->seed)
+			{
+				for (int k = 0; k < cfg.num_pieces; ++k)
+					if (int(rand32() % 100) < density) peer->have.set_bit(k);
+			}
+			peers.push_back(peer);
+		}
+
+		piece_picker p;
+		p.init(blocks_per_piece, blocks_per_piece, cfg.num_pieces);
+
+		// peers joining the swarm with their bitfields. The first pick
+		// afterwards is included, since it's where a picker that defers the
+		// work does it
+		std::vector<piece_block> picked;
+		std::vector<int> const suggested;
+		measurement inc;
+		inc.start(pc);
+		for (int i = 0; i < cfg.num_peers; ++i)
+			add_peer(p, *peers[i]);
+		p.pick_pieces(peers[0]->have, picked, 1, 0, 0, piece_picker::fast
+			, piece_picker::rarest_first, suggested, cfg.num_peers, pc);
+		inc.stop(pc, cfg.num_peers);
+
+		// peers leaving and rejoining, with a pick in between each
+		measurement churn;
+		churn.start(pc);
+		for (int r = 0; r < cfg.rounds; ++r)
+		{
+			peer_t& peer = *peers[r % cfg.num_peers];
+			remove_peer(p, peer);
+			picked.clear();
+			p.pick_pieces(peers[(r + 1) % cfg.num_peers]->have, picked, 1, 0, 0
+				, piece_picker::fast, piece_picker::rarest_first, suggested
+				, cfg.num_peers, pc);
+			add_peer(p, peer);
+		}
+		churn.stop(pc, cfg.rounds);
+
+		// have messages, for pieces peers don't have yet
+		measurement have;
+		for (int r = 0; r < cfg.rounds; ++r)
+		{
+			peer_t& peer = *peers[rand32() % cfg.num_peers];
+			if (peer.seed) continue;
+			int const piece = rand32() % cfg.num_pieces;
+			if (peer.have[piece]) continue;
+			have.start(pc);
+			p.inc_refcount(piece, &peer.tp);
+			have.stop(pc, 1);
+			peer.have.set_bit(piece);
+		}
+
+		// picking blocks, as request_a_block() does, from peers in turn.
+		// The picked blocks are requested to build up partial pieces
+		measurement pick;
+		for (int r = 0; r < cfg.rounds; ++r)
+		{
+			peer_t& peer = *peers[r % cfg.num_peers];
+			picked.clear();
+			pick.start(pc);
+			p.pick_pieces(peer.have, picked, 8, 0, &peer.tp, piece_picker::fast
+				, piece_picker::rarest_first | piece_picker::prioritize_partials
+				, suggested, cfg.num_peers, pc);
+			pick.stop(pc, 1);
+			int requested = 0;
+			for (std::vector<piece_block>::iterator i = picked.begin()
+				, end(picked.end()); i != end && requested < 8; ++i)
+			{
+				if (p.num_peers(*i) > 0) continue;
+				p.mark_as_downloading(*i, &peer.tp, piece_picker::fast);
+				++requested;
+			}
+		}
+
+		// downloading pieces: every block is received and written, then the
+		// piece passes the hash check and is flushed to disk. Only
+		// piece_passed() and we_have() are timed
+		std::vector<int> pieces;
+		pieces.reserve(cfg.num_pieces);
+		for (int i = 0; i < cfg.num_pieces; ++i)
+			if (!p.have_piece(i)) pieces.push_back(i);
+		for (int i = int(pieces.size()) - 1; i > 0; --i)
+			std::swap(pieces[i], pieces[rand32() % (i + 1)]);
+		if (int(pieces.size()) > cfg.rounds) pieces.resize(cfg.rounds);
+
+		measurement passed;
+		measurement we_have;
+		void* peer = &peers[0]->tp;
+		for (std::vector<int>::iterator i = pieces.begin()
+			, end(pieces.end()); i != end; ++i)
+		{
+			for (int b = 0; b < blocks_per_piece; ++b)
+			{
+				piece_block block(*i, b);
+				if (!p.is_requested(block))
+					p.mark_as_downloading(block, peer, piece_picker::fast);
+				p.mark_as_writing(block, peer);
+				p.mark_as_finished(block, peer);
+			}
+
+			passed.start(pc);
+			p.piece_passed(*i);
+			passed.stop(pc, 1);
+
+			we_have.start(pc);
+			p.we_have(*i);
+			we_have.stop(pc, 1);
+		}
+
+		inc.print("inc_refcount_bitfield", cfg);
+		churn.print("peer_churn", cfg);
+		have.print("inc_refcount_have", cfg);
+		pick.print("pick_pieces", cfg);
+		passed.print("piece_passed", cfg);
+		we_have.print("we_have", cfg);
+	}
+
+	void print_usage()
+	{
+		fprintf(stderr, "usage: picker_benchmark [options]\n\n"
+			"OPTIONS:\n"
+			"  -p <pieces>   the number of pieces in the torrent (default: 100000)\n"
+			"  -n <peers>    the number of peers in the swarm (default: 100)\n"
+			"  -s <swarm>    the kind of peers in the swarm. One of:\n"
+			"                random (peers have 50%% of the pieces),\n"
+			"                rare (peers have 5%% of the pieces),\n"
+			"                seed (all peers are seeds) or\n"
+			"                mixed (a mix of the above, the default)\n"
+			"  -r <rounds>   the number of times each operation is run\n"
+			"                (default: 10000)\n"
+			"  -h            don't print the CSV header line\n");
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	config cfg;
+	cfg.num_pieces = 100000;
+	cfg.num_peers = 100;
+	cfg.swarm = swarm_mixed;
+	cfg.rounds = 10000;
+	bool header = true;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::strcmp(argv[i], "-h") == 0)
+		{
+			header = false;
+			continue;
+		}
+		if (i + 1 >= argc || argv[i][0] != '-')
+		{
+			print_usage();
+			return 1;
+		}
+		char const* arg = argv[i + 1];
+		switch (argv[i][1])
+		{
+			case 'p': cfg.num_pieces = atoi(arg); break;
+			case 'n': cfg.num_peers = atoi(arg); break;
+			case 'r': cfg.rounds = atoi(arg); break;
+			case 's':
+			{
+				int s = 0;
+				for (; s < 4; ++s) if (std::strcmp(arg, swarm_names[s]) == 0) break;
+				if (s == 4)
+				{
+					print_usage();
+					return 1;
+				}
+				cfg.swarm = swarm_t(s);
+				break;
+			}
+			default:
+				print_usage();
+				return 1;
+		}
+		++i;
+	}
+
+	if (cfg.num_pieces <= 0 || cfg.num_pieces > piece_picker::max_pieces
+		|| cfg.num_peers <= 0 || cfg.rounds <= 0)
+	{
+		fprintf(stderr, "the number of pieces must be between 1 and %d, and "
+			"the number of peers and rounds greater than 0\n"
+			, int(piece_picker::max_pieces));
+		return 1;
+	}
+
+	if (header)
+		printf("operation,pieces,peers,swarm,ops,ns_per_op,allocs_per_op,loops_per_op\n");
+	run(cfg);
+	return 0;
+}
+
@@ -0,0 +1,208 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/pe_crypto.hpp"
+#include "libtorrent/chained_buffer.hpp"
+#include "libtorrent/time.hpp"
+
+#include <boost/cstdint.hpp>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace libtorrent;
+
+// measures the throughput of the RC4 stream cipher used for encrypted peer
+// connections, on a single core. Both encrypting buffers on their own, and
+// encrypting a send buffer made up of piece messages, the way peer
+// connections do
+
+#ifdef TORRENT_DISABLE_ENCRYPTION
+
+int main()
+{
+	fprintf(stderr, "encryption is disabled in this build\n");
+	return 1;
+}
+
+#else
+
+double gbit_per_s(boost::int64_t bytes, ptime start)
+{
+	boost::int64_t us = total_microseconds(time_now_hires() - start);
+	if (us <= 0) us = 1;
+	return double(bytes) * 8 / us / 1000.;
+}
+
+// the byte at a time RC4 loop from libtomcrypt, as a point of reference
+struct reference_rc4
+{
+	reference_rc4(unsigned char const* key, int len)
+		: x(0), y(0)
+	{
+		for (int i = 0; i < 256; ++i) s[i] = i;
+		for (int i = 0, j = 0; i < 256; ++i)
+		{
+			j = (j + s[i] + key[i % len]) & 255;
+			std::swap(s[i], s[j]);
+		}
+	}
+
+	void encrypt(unsigned char* out, int len)
+	{
+		while (len--)
+		{
+			x = (x + 1) & 255;
+			y = (y + s[x]) & 255;
+			unsigned char tmp = s[x]; s[x] = s[y]; s[y] = tmp;
+			*out++ ^= s[(s[x] + s[y]) & 255];
+		}
+	}
+
+	unsigned char x, y;
+	unsigned char s[256];
+};
+
+void nop_free(char*, void*, block_cache_reference) {}
+
+void encrypt(char* buf, int len, void* userdata)
+{
+	static_cast<encryption_handler*>(userdata)->encrypt(buf, len);
+}
+
+int main(int argc, char* argv[])
+{
+	int size_mb = 256;
+	if (argc > 1) size_mb = atoi(argv[1]);
+	if (size_mb <= 0)
+	{
+		fprintf(stderr, "usage: rc4_benchmark [MiB to encrypt (default: 256)]\n");
+		return 1;
+	}
+
+	unsigned char key[20];
+	for (int i = 0; i < 20; ++i) key[i] = rand();
+
+	// a buffer that fits in the L2 cache, encrypted over and over, to
+	// measure the cipher rather than memory bandwidth
+	int const buf_size = 128 * 1024;
+	std::vector<char> buf(buf_size);
+	std::vector<char> copy(buf_size);
+	for (int i = 0; i < buf_size; ++i) buf[i] = rand();
+	boost::int64_t const total = boost::int64_t(size_mb) * 1024 * 1024;
+
+	{
+		reference_rc4 rc4(key, 20);
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+			rc4.encrypt(reinterpret_cast<unsigned char*>(&buf[0]), buf_size);
+		printf("byte at a time:     %6.2f Gbit/s\n", gbit_per_s(total, start));
+	}
+
+	rc4_handler h;
+	h.set_outgoing_key(key, 20);
+
+	{
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+			h.encrypt(&buf[0], buf_size);
+		printf("in place:           %6.2f Gbit/s\n", gbit_per_s(total, start));
+	}
+
+	{
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+		{
+			std::memcpy(&copy[0], &buf[0], buf_size);
+			h.encrypt(&copy[0], buf_size);
+		}
+		printf("copy, then encrypt: %6.2f Gbit/s\n", gbit_per_s(total, start));
+	}
+
+	{
+		ptime start = time_now_hires();
+		for (boost::int64_t done = 0; done < total; done += buf_size)
+			h.encrypt_copy(&copy[0], &buf[0], buf_size);
+		printf("encrypt into copy:  %6.2f Gbit/s\n", gbit_per_s(total, start));
+	}
+
+	// a send buffer of piece messages, each a 13 byte header followed by a
+	// 16 kiB block
+	int const block_size = 0x4000;
+	int const header_size = 13;
+	int const num_blocks = buf_size / block_size;
+	std::vector<char> headers(num_blocks * header_size);
+	boost::int64_t const message_bytes = boost::int64_t(num_blocks)
+		* (block_size + header_size);
+
+	{
+		// each buffer encrypted as it's appended
+		boost::int64_t done = 0;
+		ptime start = time_now_hires();
+		while (done < total)
+		{
+			for (int i = 0; i < num_blocks; ++i)
+			{
+				h.encrypt(&headers[i * header_size], header_size);
+				h.encrypt(&buf[i * block_size], block_size);
+			}
+			done += message_bytes;
+		}
+		printf("per buffer:         %6.2f Gbit/s\n", gbit_per_s(done, start));
+	}
+
+	{
+		// all buffers encrypted in one pass before sending
+		boost::int64_t done = 0;
+		ptime start = time_now_hires();
+		while (done < total)
+		{
+			chained_buffer send_buffer;
+			for (int i = 0; i < num_blocks; ++i)
+			{
+				send_buffer.append_buffer(&headers[i * header_size], header_size
+					, header_size, &nop_free, NULL);
+				send_buffer.append_buffer(&buf[i * block_size], block_size
+					, block_size, &nop_free, NULL);
+			}
+			send_buffer.apply_to_tail(send_buffer.size(), &encrypt, &h);
+			done += message_bytes;
+		}
+		printf("send buffer:        %6.2f Gbit/s\n", gbit_per_s(done, start));
+	}
+
+	return 0;
+}
+
+#endif
+
@@ -105,6 +105,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert_dispatcher.hpp"
 #include "libtorrent/kademlia/dht_observer.hpp"
 #include "libtorrent/resolver.hpp"
+#include "libtorrent/receive_buffer_pool.hpp"
+#include "libtorrent/dh_key_pool.hpp"
 
 #if TORRENT_COMPLETE_TYPES_REQUIRED
 #include "libtorrent/peer_connection.hpp"
@@ -386,6 +388,8 @@ namespace libtorrent
 				sha1_hash const& info_hash, sha1_hash const& xor_mask);
 
 			void add_obfuscated_hash(sha1_hash const& obfuscated, boost::weak_ptr<torrent> const& t);
+
+			dh_key_exchange* take_dh_key();
 #endif
 
 			void on_port_map_log(char const* msg, int map_transport);
@@ -614,6 +618,9 @@ namespace libtorrent
 			void free_buffer(char* buf);
 			int send_buffer_size() const { return send_buffer_size_impl; }
 
+			void acquire_recv_buffer(buffer& b);
+			void release_recv_buffer(buffer& b);
+
 			// implements buffer_allocator_interface
 			void free_disk_buffer(char* buf);
 			char* allocate_disk_buffer(char const* category);
@@ -685,6 +692,8 @@ namespace libtorrent
 			void update_connection_speed();
 			void update_queued_disk_bytes();
 			void update_alert_queue_size();
+			void update_recv_buffer_pool();
+			void update_dh_key_pool();
 			void update_dht_upload_rate_limit();
 			void update_disk_threads();
 			void update_network_threads();
@@ -740,6 +749,10 @@ namespace libtorrent
 			boost::pool<> m_send_buffers;
 #endif
 
+			// receive buffers returned by peer connections that are waiting
+			// for the next message to arrive
+			receive_buffer_pool m_recv_buffers;
+
 			// this is where all active sockets are stored.
 			// the selector can sleep while there's no activity on
 			// them
@@ -803,6 +816,10 @@ namespace libtorrent
 			// this maps obfuscated hashes to torrents. It's only
 			// used when encryption is enabled
 			torrent_map m_obfuscated_torrents;
+
+			// DH keys for encrypted handshakes, computed ahead of time by a
+			// worker thread
+			dh_key_pool m_dh_keys;
 #endif
 
 			// this is an LRU for torrents. It's used to determine
@@ -60,6 +60,8 @@ namespace libtorrent
 {
 	class peer_connection;
 	class torrent;
+	class buffer;
+	class dh_key_exchange;
 	struct proxy_settings;
 	struct socket_job;
 #ifndef TORRENT_NO_DEPRECATE
@@ -175,6 +177,11 @@ namespace libtorrent { namespace aux
 		virtual void free_buffer(char* buf) = 0;
 		virtual int send_buffer_size() const = 0;
 
+		// receive buffers are only held by peer connections while they
+		// have a partially received message. See receive_buffer_pool
+		virtual void acquire_recv_buffer(buffer& b) = 0;
+		virtual void release_recv_buffer(buffer& b) = 0;
+
 		virtual void deferred_submit_jobs() = 0;
 
 		virtual boost::uint16_t listen_port() const = 0;
@@ -285,6 +292,10 @@ namespace libtorrent { namespace aux
 			sha1_hash const& info_hash, sha1_hash const& xor_mask) = 0;
 		virtual void add_obfuscated_hash(sha1_hash const& obfuscated
 			, boost::weak_ptr<torrent> const& t) = 0;
+
+		// returns a DH key exchange with its local key already computed, or
+		// NULL if none is ready. The caller takes ownership
+		virtual dh_key_exchange* take_dh_key() = 0;
 #endif
 
 #ifndef TORRENT_DISABLE_DHT
@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <boost/cstdint.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_array.hpp>
+#include <boost/atomic.hpp>
 #include <list>
 #include <vector>
 
@@ -50,6 +51,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/linked_list.hpp"
 #include "libtorrent/disk_buffer_pool.hpp"
 #include "libtorrent/file.hpp" // for iovec_t
+#include "libtorrent/thread.hpp"
 
 #if TORRENT_USE_ASSERTS
 #include "libtorrent/disk_io_job.hpp"
@@ -80,7 +82,7 @@ namespace libtorrent
 		// to be incremented
 		enum artificial_jobs
 		{
-			flushing = disk_io_job::num_job_ids, // 20
+			flushing = disk_io_job::num_job_ids, // 21
 			flush_expired,
 			try_flush_write_blocks,
 			try_flush_write_blocks2,
@@ -333,12 +335,26 @@ namespace libtorrent
 		return std::size_t(p.storage.get()) + p.piece;
 	}
 
+	// the block cache is split up into a number of shards. All pieces
+	// belonging to the same storage live in the same shard, and each shard
+	// has its own mutex, piece set and LRU lists. This lets disk threads
+	// working on different torrents operate on the cache concurrently. The
+	// disk buffer pool, and with it the cache size limit, is shared by all
+	// shards.
+	//
+	// none of the block_cache member functions lock a shard mutex
+	// themselves, except for the ones aggregating over all shards
+	// (update_stats_counters(), get_stats() and pinned_blocks()). All other
+	// functions require the caller to hold the mutex of the shard the piece
+	// (or storage) belongs to. At most one shard mutex may be held at a time.
 	struct TORRENT_EXTRA_EXPORT block_cache : disk_buffer_pool
 	{
 		block_cache(int block_size, io_service& ios
 			, boost::function<void()> const& trigger_trim
 			, alert_dispatcher* alert_disp);
 
+		enum { num_shards = 16 };
+
 	private:
 
 		typedef boost::unordered_set<cached_piece_entry> cache_t;
@@ -348,6 +364,19 @@ namespace libtorrent
 		typedef cache_t::iterator iterator;
 		typedef cache_t::const_iterator const_iterator;
 
+		// returns the index of the shard pieces belonging to the
+		// specified storage live in
+		int shard_index(piece_manager const* st) const;
+
+		// the mutex protecting the specified shard
+		mutex& shard_mutex(int shard) const { return m_shards[shard].mtx; }
+
+		// the mutex protecting the shard the storage (or the
+		// storage of the job) belongs to
+		mutex& cache_mutex(piece_manager const* st) const
+		{ return shard_mutex(shard_index(st)); }
+		mutex& cache_mutex(disk_io_job const* j) const;
+
 		// returns the number of blocks this job would cause to be read in
 		int pad_job(disk_io_job const* j, int blocks_in_piece
 			, int read_ahead) const;
@@ -357,15 +386,16 @@ namespace libtorrent
 
 		void reclaim_block(block_cache_reference const& ref);
 
-		// returns a range of all pieces. This migh be a very
-		// long list, use carefully
-		std::pair<iterator, iterator> all_pieces() const;
-		int num_pieces() const { return m_pieces.size(); }
+		// returns a range of all pieces in the specified shard. This migh be
+		// a very long list, use carefully
+		std::pair<iterator, iterator> all_pieces(int shard) const;
+		int num_pieces(int shard) const { return m_shards[shard].pieces.size(); }
 
-		list_iterator write_lru_pieces() const
-		{ return m_lru[cached_piece_entry::write_lru].iterate(); }
+		list_iterator write_lru_pieces(int shard) const
+		{ return m_shards[shard].lru[cached_piece_entry::write_lru].iterate(); }
 
-		int num_write_lru_pieces() const { return m_lru[cached_piece_entry::write_lru].size(); }
+		int num_write_lru_pieces(int shard) const
+		{ return m_shards[shard].lru[cached_piece_entry::write_lru].size(); }
 
 		// mark this piece for deletion. If there are no outstanding
 		// requests to this piece, it's removed immediately, and the
@@ -383,13 +413,24 @@ namespace libtorrent
 
 		// returns the number of bytes read on success (cache hit)
 		// -1 on cache miss
-		int try_read(disk_io_job* j, bool expect_no_fail = false);
+		int try_read(disk_io_job* j);
+
+		// reads the blocks of ``j`` that were just inserted into the cache
+		// with insert_blocks(), after a cache miss. Unlike try_read(), this
+		// isn't counted as a cache hit
+		int read_inserted(disk_io_job* j);
 
 		// called when we're reading and we found the piece we're
-		// reading from in the hash table (not necessarily that we
-		// hit the block we needed)
+		// reading from in the hash table. try_read() only calls it once
+		// the block was found too, or if the piece is a ghost
 		void cache_hit(cached_piece_entry* p, void* requester, bool volatile_read);
 
+		// moves the piece between the ARC lists the way a read of it does,
+		// without counting it as a hit. This is what cache_hit() does after
+		// counting the hit
+		void update_cache_state(cached_piece_entry* p, void* requester
+			, bool volatile_read);
+
 		// free block from piece entry
 		void free_block(cached_piece_entry* pe, int block);
 
@@ -410,6 +451,21 @@ namespace libtorrent
 		// delete the piece from the cache
 		bool maybe_free_piece(cached_piece_entry* p);
 
+		// called when num_blocks blocks of the piece p had to be read back
+		// from disk in order to hash it. If p is a write cache piece, this
+		// means the write cache was too small to hold on to them until they
+		// were hashed, and the adaptive write cache target grows
+		void write_cache_miss(cached_piece_entry* p, int num_blocks);
+
+		// returns the number of blocks the write cache may hold before dirty
+		// blocks should be flushed in preference to evicting read blocks, or
+		// -1 if the adaptive cache split is disabled
+		int write_cache_target() const;
+
+		// the number of dirty blocks in all shards. This locks each shard in
+		// turn
+		int write_cache_size() const;
+
 		// either returns the piece in the cache, or allocates
 		// a new empty piece and returns it.
 		// cache_state is one of cache_state_t enum
@@ -439,17 +495,66 @@ namespace libtorrent
 		void insert_blocks(cached_piece_entry* pe, int block, file::iovec_t *iov
 			, int iov_len, disk_io_job* j, int flags = 0);
 
+		// the state of one shard of the cache. See the comment on block_cache
+		struct cache_shard
+		{
+			cache_shard();
+
+			mutable mutex mtx;
+
+			// block container
+			cache_t pieces;
+
+			// linked list of all elements in pieces, in usage order
+			// the most recently used are in the tail. iterating from head
+			// to tail gives the least recently used entries first
+			// the read-list is for read blocks and the write-list is for
+			// dirty blocks that needs flushing before being evicted
+			// [0] = write-LRU
+			// [1] = read-LRU1
+			// [2] = read-LRU1-ghost
+			// [3] = read-LRU2
+			// [4] = read-LRU2-ghost
+			linked_list lru[cached_piece_entry::num_lrus];
+
+			// this is used to determine whether to evict blocks from
+			// L1 or L2. It's one of cache_op_t
+			int last_cache_op;
+
+			// the number of blocks in this shard
+			// that are in the read cache
+			int read_cache_size;
+			// the number of blocks in this shard
+			// that are in the write cache
+			int write_cache_size;
+
+			// the number of blocks that are currently sitting
+			// in peer's send buffers. If two peers are sending
+			// the same block, it counts as 2, even though there're
+			// no buffer duplication
+			boost::uint32_t send_buffer_blocks;
+
+			// the number of blocks with a refcount > 0, i.e.
+			// they may not be evicted
+			int pinned_blocks;
+
+			// the number of times a piece in each of the LRU lists
+			// was hit by cache_hit(), indexed by cache_state
+			boost::uint64_t hits[cached_piece_entry::num_lrus];
+		};
+
 #if TORRENT_USE_INVARIANT_CHECKS
-		void check_invariant() const;
+		void check_invariant(cache_shard const& s) const;
 #endif
 		
-		// try to remove num number of read cache blocks from the cache
-		// pick the least recently used ones first
+		// try to remove num number of read cache blocks from the specified
+		// shard. pick the least recently used ones first
 		// return the number of blocks that was requested to be evicted
 		// that couldn't be
-		int try_evict_blocks(int num, cached_piece_entry* ignore = 0);
+		int try_evict_blocks(int shard, int num, cached_piece_entry* ignore = 0);
 
 		// if there are any dirty blocks 
+		// this clears all shards. No shard mutex may be held by anyone
 		void clear(tailqueue& jobs);
 
 		void update_stats_counters(counters& c) const;
@@ -460,7 +565,7 @@ namespace libtorrent
 		bool inc_block_refcount(cached_piece_entry* pe, int block, int reason);
 		void dec_block_refcount(cached_piece_entry* pe, int block, int reason);
 
-		int pinned_blocks() const { return m_pinned_blocks; }
+		int pinned_blocks() const;
 
 #if TORRENT_USE_ASSERTS
 		void mark_deleted(file_storage const& fs);
@@ -476,53 +581,45 @@ namespace libtorrent
 		void free_piece(cached_piece_entry* p);
 		int drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf);
 
-		// block container
-		cache_t m_pieces;
-
-		// linked list of all elements in m_pieces, in usage order
-		// the most recently used are in the tail. iterating from head
-		// to tail gives the least recently used entries first
-		// the read-list is for read blocks and the write-list is for
-		// dirty blocks that needs flushing before being evicted
-		// [0] = write-LRU
-		// [1] = read-LRU1
-		// [2] = read-LRU1-ghost
-		// [3] = read-LRU2
-		// [4] = read-LRU2-ghost
-		linked_list m_lru[cached_piece_entry::num_lrus];
-
-		// this is used to determine whether to evict blocks from
-		// L1 or L2.
+		cache_shard& shard_for(piece_manager const* st)
+		{ return m_shards[shard_index(st)]; }
+		cache_shard& shard_for(cached_piece_entry const* p)
+		{ return m_shards[shard_index(p->storage.get())]; }
+
+		cache_shard m_shards[num_shards];
+
 		enum cache_op_t
 		{
 			cache_miss,
 			ghost_hit_lru1,
 			ghost_hit_lru2
 		};
-		int m_last_cache_op;
 
-		// the number of pieces to keep in the ARC ghost lists
+		// the number of pieces to keep in the ARC ghost lists, per shard.
 		// this is determined by being a fraction of the cache size
 		int m_ghost_size;
 
-		// the number of blocks in the cache
-		// that are in the read cache
-		boost::uint32_t m_read_cache_size;
-		// the number of blocks in the cache
-		// that are in the write cache
-		boost::uint32_t m_write_cache_size;
+		// adjusts the adaptive write cache target by delta blocks, keeping
+		// it within [0, m_max_write_target]
+		void adjust_write_target(int delta);
 
-		// the number of blocks that are currently sitting
-		// in peer's send buffers. If two peers are sending
-		// the same block, it counts as 2, even though there're
-		// no buffer duplication
-		boost::uint32_t m_send_buffer_blocks;
+		// true if the adaptive_cache_split setting is enabled
+		bool m_adaptive_split;
 
-		// the number of blocks with a refcount > 0, i.e.
-		// they may not be evicted
-		int m_pinned_blocks;
+		// the adaptive write cache target, in blocks. This is shared by all
+		// shards, and adjusted without holding any particular shard mutex
+		boost::atomic<int> m_write_target;
+
+		// the upper bound of m_write_target, the size of the cache
+		int m_max_write_target;
 
 #if TORRENT_USE_ASSERTS
+		// returns true if the job's storage was marked as deleted
+		bool is_deleted_storage(disk_io_job const* j) const;
+
+		// marking storages as deleted is done with the storage's shard
+		// locked, so this list needs a mutex of its own
+		mutable mutex m_deleted_storages_mutex;
 		std::vector<std::pair<std::string, void const*> > m_deleted_storages;
 #endif
 	};
@@ -164,6 +164,7 @@ namespace libtorrent
 		
 		virtual void get_specific_peer_info(peer_info& p) const;
 		virtual bool in_handshake() const;
+		virtual int expected_piece_header_size() const;
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		bool supports_holepunch() const { return m_holepunch_id != 0; }
@@ -221,6 +222,8 @@ namespace libtorrent
 		void write_have(int index);
 		void write_dont_have(int index);
 		void write_piece(peer_request const& r, disk_buffer_holder& buffer);
+		void write_piece_from_file(peer_request const& r, file_region* region);
+		bool can_send_from_file() const;
 		void write_handshake(bool plain_handshake = false);
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		void write_extensions();
@@ -253,6 +256,7 @@ namespace libtorrent
 	private:
 
 		bool dispatch_message(int received);
+		void write_piece_header(peer_request const& r);
 		// returns the block currently being
 		// downloaded. And the progress of that
 		// block. If the peer isn't downloading
@@ -293,7 +297,9 @@ public:
 
 		// these functions encrypt the send buffer if m_rc4_encrypted
 		// is true, otherwise it passes the call to the
-		// peer_connection functions of the same names
+		// peer_connection functions of the same names. Buffers we own are
+		// encrypted in place, in a single pass over everything appended
+		// since the last send, right before it's sent
 		virtual void append_const_send_buffer(char const* buffer, int size
 			, chained_buffer::free_buffer_fun destructor = &nop
 			, void* userdata = NULL, block_cache_reference ref
@@ -307,8 +313,16 @@ public:
 			, void* userdata = NULL, block_cache_reference ref
 			= block_cache_reference(), bool encrypted = false);
 
+		virtual void setup_send();
+
 private:
 
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// encrypts the bytes at the end of the send buffer that have been
+		// appended but not encrypted yet
+		void encrypt_pending_send_buffer();
+#endif
+
 		enum state_t
 		{
 #ifndef TORRENT_DISABLE_ENCRYPTION
@@ -423,6 +437,10 @@ private:
 		// used to disconnect peer if sync points are not found within
 		// the maximum number of bytes
 		int m_sync_bytes_read;
+
+		// the number of bytes at the end of the send buffer that are
+		// still to be encrypted
+		int m_encrypt_pending;
 #endif
 
 #ifndef TORRENT_DISABLE_EXTENSIONS
@@ -43,7 +43,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #endif
 #include <deque>
 #include <vector>
+#include <utility> // for pair
 #include <string.h> // for memcpy
+#include <boost/cstdint.hpp>
 
 #include "libtorrent/disk_io_job.hpp" // for block_cache_reference
 #include "libtorrent/debug.hpp"
@@ -55,7 +57,7 @@ namespace libtorrent
 #endif
 	struct TORRENT_EXTRA_EXPORT chained_buffer : private single_threaded
 	{
-		chained_buffer(): m_bytes(0), m_capacity(0)
+		chained_buffer(): m_bytes(0), m_capacity(0), m_hold(false), m_hold_tag(0)
 		{
 			thread_started();
 #if TORRENT_USE_ASSERTS
@@ -76,6 +78,14 @@ namespace libtorrent
 			int size; // the total size of the buffer
 			int used_size; // this is the number of bytes to send/receive
 			block_cache_reference ref;
+			// if this is not -1, this entry doesn't refer to memory (buf and
+			// start are NULL), but to used_size bytes of this file, starting
+			// at file_offset
+			int fd;
+			size_type file_offset;
+			// true if this buffer may be sent without the kernel copying it
+			// (MSG_ZEROCOPY). See set_zero_copy_back()
+			bool zero_copy;
 		};
 
 		bool empty() const { return m_bytes == 0; }
@@ -88,6 +98,17 @@ namespace libtorrent
 			, free_buffer_fun destructor, void* userdata
 			, block_cache_reference ref = block_cache_reference());
 
+		// appends a range of a file, to be sent straight from the file
+		// rather than from memory. Once it has been sent, the destructor
+		// is called with a NULL buffer
+		void append_file(int fd, size_type offset, int size
+			, free_buffer_fun destructor, void* userdata);
+
+		// if the first entry in the chain is a file range, returns its file
+		// descriptor and sets offset and size to the part of it that hasn't
+		// been sent yet. Otherwise returns -1
+		int front_file(size_type& offset, int& size) const;
+
 		// returns the number of bytes available at the
 		// end of the last chained buffer.
 		int space_in_last_buffer();
@@ -102,8 +123,42 @@ namespace libtorrent
 		// enough room, returns 0
 		char* allocate_appendix(int s);
 
+		// the returned buffers end at the first file range in the chain
 		std::vector<asio::const_buffer> const& build_iovec(int to_send);
 
+		// calls ``fun`` on the last ``bytes`` bytes in the chain, in order,
+		// one contiguous range at a time. This is used to encrypt data in
+		// place, after it has been appended. The range must not include
+		// any file ranges
+		void apply_to_tail(int bytes, void (*fun)(char*, int, void*)
+			, void* userdata);
+
+		// marks the last buffer in the chain as one the kernel may send
+		// straight from memory, without copying it (MSG_ZEROCOPY). Its
+		// contents must not change until it's freed
+		void set_zero_copy_back();
+
+		// returns how many of the first ``to_send`` bytes are in buffers
+		// marked by set_zero_copy_back()
+		int zero_copy_bytes(int to_send) const;
+
+		// the kernel may still be reading from buffers sent with
+		// MSG_ZEROCOPY after they have been popped. While holding, popped
+		// buffers are not freed, but kept and tagged with ``tag`` until
+		// release_held() is called with that tag. Passing false stops
+		// holding buffers popped from then on, it doesn't free the ones
+		// already held
+		void hold_popped(bool hold, boost::uint32_t tag = 0);
+
+		// frees the held buffers tagged with ``tag`` or an earlier tag.
+		// Tags are compared allowing for wrap-around
+		void release_held(boost::uint32_t tag);
+
+		int num_held() const { return int(m_held.size()); }
+
+		// frees the buffers in the chain. Held buffers are kept, since the
+		// kernel may still be reading from them, until they're released by
+		// release_held() (or the chain is destructed)
 		void clear();
 
 		~chained_buffer();
@@ -127,6 +182,15 @@ namespace libtorrent
 		// invoking the async write call
 		std::vector<asio::const_buffer> m_tmp_vec;
 
+		// buffers that have been popped but may still be read by the
+		// kernel, and the tag each one was held with. See hold_popped()
+		std::deque<std::pair<boost::uint32_t, buffer_t> > m_held;
+
+		// true while popped buffers are held rather than freed, and the
+		// tag they're held with
+		bool m_hold;
+		boost::uint32_t m_hold_tag;
+
 #if TORRENT_USE_ASSERTS
 		bool m_destructed;
 #endif
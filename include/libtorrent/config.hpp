@@ -217,6 +217,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #define TORRENT_USE_NETLINK 1
 #define TORRENT_USE_IFCONF 1
 #define TORRENT_HAS_SALEN 0
+#ifndef TORRENT_USE_SENDFILE
+#define TORRENT_USE_SENDFILE 1
+#endif
+#ifndef TORRENT_USE_MSG_ZEROCOPY
+#define TORRENT_USE_MSG_ZEROCOPY 1
+#endif
 
 // ===== ANDROID ===== (almost linux, sort of)
 #if defined __ANDROID__
@@ -521,6 +527,30 @@ int snprintf(char* buf, int len, char const* fmt, ...)
 #define TORRENT_USE_PREAD 1
 #endif
 
+// io_uring is only available on linux 5.1 and later, and has to be
+// enabled explicitly at build time
+#ifndef TORRENT_USE_IO_URING
+#define TORRENT_USE_IO_URING 0
+#endif
+
+#if TORRENT_USE_IO_URING && !defined TORRENT_LINUX
+#error "io_uring is only supported on linux"
+#endif
+
+// sendfile() from a regular file to a socket. Only the linux flavour
+// of it is supported
+#ifndef TORRENT_USE_SENDFILE
+#define TORRENT_USE_SENDFILE 0
+#endif
+
+// sending from memory with MSG_ZEROCOPY, and being notified through the
+// socket's error queue once the kernel is done with it (linux 4.14 and
+// later). Where the running kernel doesn't support it, regular sends are
+// used instead
+#ifndef TORRENT_USE_MSG_ZEROCOPY
+#define TORRENT_USE_MSG_ZEROCOPY 0
+#endif
+
 #ifndef TORRENT_NO_FPU
 #define TORRENT_NO_FPU 0
 #endif
@@ -35,10 +35,12 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/config.hpp"
 #include <cstring>
+#include <boost/cstdint.hpp>
 
 #if defined _MSC_VER && TORRENT_HAS_SSE
 #include <intrin.h>
 #include <nmmintrin.h>
+#include <immintrin.h>
 #endif
 
 namespace libtorrent
@@ -57,6 +59,55 @@ namespace libtorrent
 		std::memset(info, 0, sizeof(info));
 #endif
 	}
+
+	// returns the contents of the XCR0 register, which tells which register
+	// files the operating system saves on context switches. Instructions
+	// using the YMM registers (AVX and AVX2) can only be used if bit 1 and 2
+	// are set.
+	inline boost::uint64_t xgetbv0()
+	{
+#if TORRENT_HAS_SSE && defined _MSC_VER && _MSC_FULL_VER >= 160040219
+		return _xgetbv(0);
+#elif TORRENT_HAS_SSE && defined __GNUC__
+		boost::uint32_t eax, edx;
+		asm volatile (".byte 0x0f, 0x01, 0xd0" : "=a" (eax), "=d" (edx) : "c" (0));
+		return (boost::uint64_t(edx) << 32) | eax;
+#else
+		return 0;
+#endif
+	}
+
+	inline bool supports_sse41()
+	{
+		unsigned int cpui[4];
+		cpuid(cpui, 1);
+		return (cpui[2] & (1 << 19)) != 0;
+	}
+
+	inline bool supports_avx2()
+	{
+		unsigned int cpui[4];
+		cpuid(cpui, 0);
+		if (cpui[0] < 7) return false;
+		cpuid(cpui, 1);
+		// the OS must have enabled XSAVE for the AVX state to be preserved
+		if ((cpui[2] & (1 << 27)) == 0) return false;
+		if ((xgetbv0() & 6) != 6) return false;
+		cpuid(cpui, 7);
+		return (cpui[1] & (1 << 5)) != 0;
+	}
+
+	// the SHA extensions (SHA-NI). These operate on XMM registers and also
+	// require SSSE3 and SSE4.1
+	inline bool supports_sha_ni()
+	{
+		unsigned int cpui[4];
+		cpuid(cpui, 0);
+		if (cpui[0] < 7) return false;
+		if (!supports_sse41()) return false;
+		cpuid(cpui, 7);
+		return (cpui[1] & (1 << 29)) != 0;
+	}
 }
 
 #endif // TORRENT_CPUID_HPP_INCLUDED
@@ -0,0 +1,106 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DH_KEY_POOL_HPP
+#define TORRENT_DH_KEY_POOL_HPP
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/thread_pool.hpp"
+#include "libtorrent/thread.hpp"
+
+#include <vector>
+
+namespace libtorrent
+{
+	class dh_key_exchange;
+
+	struct dh_key_job
+	{
+		// the random secret to compute the public key for. Secrets are
+		// generated on the network thread, since the random number generator
+		// isn't thread safe
+		char secret[96];
+	};
+
+	// Diffie-Hellman key exchanges with their local public key already
+	// computed, for encrypted handshakes. Computing the public key is the
+	// expensive part of the key exchange, and doing it as the handshake
+	// starts stalls the network thread when many encrypted connections are
+	// made at once. Keys are computed ahead of time by a worker thread, which
+	// refills the pool as keys are taken out of it. take() is only called
+	// from the network thread
+	struct TORRENT_EXTRA_EXPORT dh_key_pool : thread_pool<dh_key_job>
+	{
+		dh_key_pool();
+		~dh_key_pool();
+
+		// sets the number of keys to keep ready. The worker thread is only
+		// running while this is greater than 0
+		void set_size(int num_keys);
+
+		// returns a key exchange from the pool, or NULL if there are none
+		// ready. The caller takes ownership of the returned object
+		dh_key_exchange* take();
+
+		// the number of keys ready to be taken
+		int size() const;
+
+	protected:
+
+		void process_job(dh_key_job const& j, bool post);
+
+	private:
+
+		// post jobs for the keys the pool is short of, counting the ones
+		// already being computed
+		void refill();
+
+		// protects m_keys, m_outstanding and m_max_keys, which are shared
+		// with the worker thread
+		mutable mutex m_pool_mutex;
+
+		std::vector<dh_key_exchange*> m_keys;
+
+		// the number of jobs posted to the worker thread that haven't
+		// completed yet
+		int m_outstanding;
+
+		int m_max_keys;
+	};
+}
+
+#endif // TORRENT_DISABLE_ENCRYPTION
+
+#endif // TORRENT_DH_KEY_POOL_HPP
+
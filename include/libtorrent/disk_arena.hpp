@@ -0,0 +1,127 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DISK_ARENA_HPP_INCLUDED
+#define TORRENT_DISK_ARENA_HPP_INCLUDED
+
+#include <boost/noncopyable.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/atomic.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent
+{
+	// a single region of memory, reserved up front, that fixed size disk
+	// buffers are carved out of. On linux the region is backed by 2 MiB huge
+	// pages (MAP_HUGETLB) if the system has any reserved, and otherwise
+	// transparent huge pages are requested for it. With a large disk cache
+	// this saves a lot of TLB misses when copying and hashing blocks.
+	//
+	// Free blocks are kept in a lock-free stack, so allocate() and free()
+	// may be called from any thread without synchronization. Recently freed
+	// blocks are handed out first, which keeps the set of pages in use
+	// small.
+	struct TORRENT_EXTRA_EXPORT disk_arena : boost::noncopyable
+	{
+		// the unit fragmentation is measured in. This is the size of a huge
+		// page on x86
+		enum { huge_page_size = 2 * 1024 * 1024 };
+
+		disk_arena();
+		~disk_arena();
+
+		// reserves memory for ``num_blocks`` blocks of ``block_size`` bytes
+		// each. ``block_size`` must divide huge_page_size. On failure, ec is
+		// set and the arena is left closed
+		void open(int block_size, int num_blocks, error_code& ec);
+
+		// releases the memory. All blocks must have been freed
+		void close();
+		bool is_open() const { return m_base != NULL; }
+
+		// returns NULL if there are no free blocks left
+		char* allocate();
+		void free(char* buf);
+
+		// returns true if buf was allocated from this arena
+		bool contains(char const* buf) const
+		{ return buf >= m_base && buf < m_base + boost::uint64_t(m_num_blocks) * m_block_size; }
+
+		int num_blocks() const { return m_num_blocks; }
+		int num_free() const { return m_num_free; }
+
+		// true if the memory is backed by explicitly allocated huge pages.
+		// Otherwise the kernel may or may not have given us transparent huge
+		// pages
+		bool huge_pages() const { return m_huge_pages; }
+
+		// the number of huge pages that are neither completely used nor
+		// completely free. This is a measure of how fragmented the arena is
+		int fragmented_pages() const;
+
+	private:
+
+		enum { end_of_list = 0xffffffff };
+
+		// the start of the memory blocks are carved out of
+		char* m_base;
+
+		// the address and size of the mapping, including any padding used
+		// to align m_base to a huge page boundary
+		char* m_mapping;
+		boost::uint64_t m_mapping_size;
+
+		int m_block_size;
+		int m_num_blocks;
+		int m_blocks_per_page;
+		int m_num_pages;
+		bool m_huge_pages;
+
+		// the top of the free stack. The low 32 bits are the index of the
+		// first free block (or end_of_list), the high 32 bits are a counter
+		// incremented on every pop, to avoid the ABA problem
+		boost::atomic<boost::uint64_t> m_head;
+
+		// for every free block, the index of the next free block in the stack
+		boost::atomic<boost::uint32_t>* m_next;
+
+		// the number of blocks in use, in each huge page
+		boost::atomic<int>* m_page_use;
+
+		boost::atomic<int> m_num_free;
+	};
+}
+
+#endif // TORRENT_DISK_ARENA_HPP_INCLUDED
+
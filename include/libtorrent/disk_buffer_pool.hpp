@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/thread.hpp"
 #include "libtorrent/io_service_fwd.hpp"
+#include "libtorrent/disk_arena.hpp"
 #include <vector>
 #include <boost/shared_ptr.hpp>
 #include <boost/function.hpp>
@@ -57,6 +58,7 @@ namespace libtorrent
 	class alert;
 	struct alert_dispatcher;
 	struct disk_observer;
+	struct counters;
 
 	struct TORRENT_EXTRA_EXPORT disk_buffer_pool : boost::noncopyable
 	{
@@ -99,6 +101,9 @@ namespace libtorrent
 
 		void set_settings(aux::session_settings const& sett);
 
+		// reports the state of the disk cache arena, if it's in use
+		void update_stats_counters(counters& c) const;
+
 		struct handler_t
 		{
 			char* buffer; // argument to the callback
@@ -168,6 +173,11 @@ namespace libtorrent
 		std::vector<int> m_free_list;
 #endif
 
+		// when use_disk_cache_arena is enabled, buffers are allocated from
+		// here first. Once it runs out (if the cache size is increased after
+		// the arena was set up), buffers are allocated the normal way
+		disk_arena m_arena;
+
 		alert_dispatcher* m_post_alert;
 
 #ifndef TORRENT_DISABLE_POOL_ALLOCATOR
@@ -38,6 +38,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/tailqueue.hpp"
 #include "libtorrent/peer_id.hpp"
+#include "libtorrent/file.hpp" // for file_handle
 #include <boost/function/function1.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/shared_ptr.hpp>
@@ -55,6 +56,16 @@ namespace libtorrent
 		int block;
 	};
 
+	// the result of a read job that completed with the zero_copy flag
+	// still set. Rather than the block itself, the job's buffer points to
+	// one of these, describing where in which file the block is stored.
+	// The receiver of the job takes ownership of it.
+	struct file_region
+	{
+		file_handle file;
+		size_type offset;
+	};
+
 	// disk_io_jobs are allocated in a pool allocator in disk_io_thread
 	// they are always allocated from the network thread, posted
 	// (as pointers) to the disk I/O thread, and then passed back
@@ -96,6 +107,7 @@ namespace libtorrent
 			, load_torrent
 			, clear_piece
 			, tick_storage
+			, check_pieces
 
 			, num_job_ids
 		};
@@ -128,6 +140,12 @@ namespace libtorrent
 
 			// turns into file::coalesce_buffers in the file operation
 			coalesce_buffers = 0x40,
+
+			// for read jobs, if the block isn't in the cache and it's stored
+			// contiguously in a single file, don't read it. Instead set
+			// buffer to point to a file_region. If the flag is cleared when
+			// the job completes, the block was read into buffer as usual
+			zero_copy = 0x80,
 		};
 
 		// for write jobs, returns true if its block
@@ -146,6 +164,10 @@ namespace libtorrent
 		// for aiocb_complete this points to the aiocb that completed
 		// for get_cache_info this points to a cache_status object which
 		// is filled in
+		// for read jobs that completed with the zero_copy flag set, this
+		// points to a file_region
+		// for check_pieces, this is an array of the piece hashes, 20 bytes
+		// each, allocated with malloc()
 		char* buffer;
 
 		// the disk storage this job applies to (if applicable)
@@ -159,6 +181,10 @@ namespace libtorrent
 		// file the disk operation failed on
 		storage_error error;
 
+		// the time the job was issued. Used to measure how long jobs wait
+		// to be started
+		ptime issue_time;
+
 		union
 		{
 			// result for hash jobs
@@ -187,6 +213,10 @@ namespace libtorrent
 			// number of bytes 'buffer' points to. Used for read & write
 			boost::uint16_t buffer_size;
 			} io;
+
+			// for check_pieces, the number of pieces to hash, starting
+			// with ``piece``
+			int num_pieces;
 		} d;
 
 		// arguments used for read and write
@@ -39,6 +39,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/sliding_average.hpp"
 #include "libtorrent/disk_io_job.hpp"
 #include "libtorrent/disk_job_pool.hpp"
+#include "libtorrent/disk_job_scheduler.hpp"
 #include "libtorrent/block_cache.hpp"
 #include "libtorrent/file_pool.hpp"
 #include "libtorrent/disk_interface.hpp"
@@ -296,6 +297,8 @@ namespace libtorrent
 			, int flags = 0);
 		void async_hash(piece_manager* storage, int piece, int flags
 			, boost::function<void(disk_io_job const*)> const& handler, void* requester);
+		void async_check_pieces(piece_manager* storage, int piece, int num_pieces
+			, boost::function<void(disk_io_job const*)> const& handler);
 		void async_move_storage(piece_manager* storage, std::string const& p, int flags
 			, boost::function<void(disk_io_job const*)> const& handler);
 		void async_release_files(piece_manager* storage
@@ -390,12 +393,22 @@ namespace libtorrent
 		void maybe_issue_queued_read_jobs(cached_piece_entry* pe, tailqueue& completed_jobs);
 		int do_read(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_read(disk_io_job* j);
+		int do_zero_copy_read(disk_io_job* j);
+
+		// the phases of a cached read, split up to allow the reads of
+		// several jobs to be in flight at the same time
+		int read_iovec_len(disk_io_job const* j) const;
+		bool prep_read(disk_io_job* j, file::iovec_t* iov, int iov_len
+			, int& ret, tailqueue& completed_jobs);
+		int finish_read(disk_io_job* j, file::iovec_t* iov, int iov_len
+			, int ret, tailqueue& completed_jobs);
 
 		int do_write(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_write(disk_io_job* j);
 
 		int do_hash(disk_io_job* j, tailqueue& completed_jobs);
 		int do_uncached_hash(disk_io_job* j);
+		int do_uncached_hash_batched(disk_io_job* j, io_uring_queue& ring);
 
 		int do_move_storage(disk_io_job* j, tailqueue& completed_jobs);
 		int do_release_files(disk_io_job* j, tailqueue& completed_jobs);
@@ -417,6 +430,7 @@ namespace libtorrent
 		int do_load_torrent(disk_io_job* j, tailqueue& completed_jobs);
 		int do_clear_piece(disk_io_job* j, tailqueue& completed_jobs);
 		int do_tick(disk_io_job* j, tailqueue& completed_jobs);
+		int do_check_pieces(disk_io_job* j, tailqueue& completed_jobs);
 
 		void call_job_handlers(void* userdata);
 
@@ -441,15 +455,39 @@ namespace libtorrent
 		void fail_jobs(storage_error const& e, tailqueue& jobs_);
 		void fail_jobs_impl(storage_error const& e, tailqueue& src, tailqueue& dst);
 
-		void check_cache_level(mutex::scoped_lock& l, tailqueue& completed_jobs);
+		void check_cache_level(int shard, tailqueue& completed_jobs);
 
 		void perform_job(disk_io_job* j, tailqueue& completed_jobs);
 
+		// used by the io_uring back-end
+		void perform_read_batch(disk_io_job** jobs, int num_jobs
+			, io_uring_queue& ring, tailqueue& completed_jobs);
+
+		// used when reading in elevator order (read_elevator_window). The
+		// jobs are sorted, and adjacent uncached reads are performed as one
+		void perform_sorted_reads(disk_io_job** jobs, int num_jobs
+			, tailqueue& completed_jobs);
+		void perform_coalesced_read(disk_io_job** jobs, int num_jobs
+			, tailqueue& completed_jobs);
+
+		// used by the hasher threads to hash several pieces at a time
+		void perform_hash_batch(disk_io_job** jobs, int num_jobs
+			, tailqueue& completed_jobs);
+		void update_thread_ring(io_uring_queue& ring, bool& failed);
+
 		// this queues up another job to be submitted
 		void add_job(disk_io_job* j);
 		void add_fence_job(piece_manager* storage, disk_io_job* j);
 
-		// assumes l is locked (cache mutex).
+		// moves the jobs added to m_incoming_jobs to the job queues they
+		// belong in. m_job_mutex must be held
+		void queue_incoming_jobs();
+
+		// updates the queue time counters for a job that's about to
+		// be performed
+		void count_queue_time(disk_io_job const* j, ptime now);
+
+		// assumes l is locked (the mutex of p's cache shard).
 		// writes out the blocks [start, end) (releases the lock
 		// during the file operation)
 		int flush_range(cached_piece_entry* p, int start, int end
@@ -465,7 +503,7 @@ namespace libtorrent
 			, storage_error const& error
 			, tailqueue& completed_jobs);
 
-		// assumes l is locked (the cache mutex).
+		// assumes l is locked (the mutex of pe's cache shard).
 		// assumes pe->hash to be set.
 		// If there are new blocks in piece 'pe' that have not been
 		// hashed by the partial_hash object attached to this piece,
@@ -487,12 +525,12 @@ namespace libtorrent
 			flush_expect_clear = 8
 		};
 		void flush_cache(piece_manager* storage, boost::uint32_t flags, tailqueue& completed_jobs, mutex::scoped_lock& l);
-		void flush_expired_write_blocks(tailqueue& completed_jobs, mutex::scoped_lock& l);
+		void flush_expired_write_blocks(int shard, tailqueue& completed_jobs, mutex::scoped_lock& l);
 		void flush_piece(cached_piece_entry* pe, int flags, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
 		int try_flush_hashed(cached_piece_entry* p, int cont_blocks, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
-		void try_flush_write_blocks(int num, tailqueue& completed_jobs, mutex::scoped_lock& l);
+		void try_flush_write_blocks(int shard, int num, tailqueue& completed_jobs, mutex::scoped_lock& l);
 
 		// used to batch reclaiming of blocks to once per cycle
 		void commit_reclaimed_blocks();
@@ -524,8 +562,8 @@ namespace libtorrent
 		// LRU cache of open files
 		file_pool m_file_pool;
 
-		// disk cache
-		mutable mutex m_cache_mutex;
+		// disk cache. Each shard of the cache is protected by its own
+		// mutex, see block_cache::cache_mutex()
 		block_cache m_disk_cache;
 
 		// total number of blocks in use by both the read
@@ -586,14 +624,26 @@ namespace libtorrent
 		// mutex to protect the m_queued_jobs list
 		mutable mutex m_job_mutex;
 
-		// jobs queued for servicing
-		tailqueue m_queued_jobs;
+		// jobs queued for servicing by the generic disk threads. The
+		// scheduler decides which job runs next, based on the job's class
+		// and storage
+		disk_job_scheduler m_queued_jobs;
+
+		// jobs added by add_job(). Adding jobs doesn't take m_job_mutex,
+		// they're moved to m_queued_jobs or the hash job queues by the next
+		// thread to take m_job_mutex, see queue_incoming_jobs()
+		atomic_tailqueue m_incoming_jobs;
 
 		// when using more than 2 threads, this is
 		// used for just hashing jobs, just for threads
 		// dedicated to do hashing
 		condition_variable m_hash_job_cond;
 		tailqueue m_queued_hash_jobs;
+
+		// check_pieces jobs, from torrents checking their files. These are
+		// also performed by the hasher threads, but only when there are no
+		// hash jobs, which peers are waiting for
+		tailqueue m_queued_check_jobs;
 		
 		// used to rate limit disk performance warnings
 		ptime m_last_disk_aio_performance_warning;
@@ -606,9 +656,9 @@ namespace libtorrent
 		// whenever the queue size grows from 0 to 1
 		// a message is posted to the network thread, which
 		// will then drain the queue and execute the jobs'
-		// handler functions
-		mutex m_completed_jobs_mutex;
-		tailqueue m_completed_jobs;
+		// handler functions. The disk threads add to it
+		// without taking a lock
+		atomic_tailqueue m_completed_jobs;
 
 		// these are blocks that have been returned by the main thread
 		// but they haven't been freed yet. This is used to batch
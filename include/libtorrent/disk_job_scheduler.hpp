@@ -0,0 +1,163 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DISK_JOB_SCHEDULER_HPP
+#define TORRENT_DISK_JOB_SCHEDULER_HPP
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/tailqueue.hpp"
+
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <map>
+#include <deque>
+
+namespace libtorrent
+{
+	struct disk_io_job;
+	class piece_manager;
+
+	// the queue of disk jobs waiting for a disk thread. Rather than
+	// running them in the order they were issued, jobs are put in one of
+	// a few classes, and each class gets a share of the disk threads
+	// proportional to its weight (stride scheduling). Within a class, the
+	// storages with queued jobs take turns, one job at a time, so a
+	// single torrent with a lot of queued jobs can't hold up the others.
+	// Jobs of the same class and storage run in the order they were
+	// issued.
+	//
+	// This is not thread safe, the disk_io_thread only accesses it with
+	// m_job_mutex held.
+	struct TORRENT_EXTRA_EXPORT disk_job_scheduler : boost::noncopyable
+	{
+		enum job_class_t
+		{
+			// reads requested by peers
+			read_class,
+			// writes and flushing the write cache
+			write_class,
+			// hashing downloaded pieces
+			hash_class,
+			// everything else, checking files, moving and deleting them etc.
+			maintenance_class,
+			num_job_classes
+		};
+
+		// returns the class of jobs with the given disk_io_job::action_t
+		static job_class_t job_class(int action);
+
+		// sorts read jobs by where they read from, storage by storage and
+		// in the order of their offsets into the torrent. Reading them in
+		// this order sweeps across the disk in one direction, rather than
+		// seeking back and forth (elevator order). Reads of the same block
+		// keep their order
+		static void sort_reads(disk_io_job** jobs, int num_jobs);
+
+		// returns the number of read jobs, starting with the first one,
+		// that read adjacent ranges of the same piece and could be
+		// performed by a single read. This is at least 1
+		static int contiguous_reads(disk_io_job* const* jobs, int num_jobs);
+
+		disk_job_scheduler();
+
+		// sets the share of the disk threads the class gets relative
+		// to the other classes. The weight is at least 1
+		void set_weight(int job_class, int weight);
+
+		// queues a job to be scheduled with the other jobs of its class
+		void push_back(disk_io_job* j);
+		void append(tailqueue& jobs);
+
+		// queues a job to be run before any other. This is used for
+		// jobs that other jobs are waiting for, like fence jobs
+		void push_front(disk_io_job* j);
+
+		// returns the next job to run, or NULL if there are none
+		disk_io_job* pop_front();
+
+		// returns the next job of the given class, or NULL if there are
+		// none. peek() returns the same job without removing it
+		disk_io_job* pop_front(int job_class);
+		disk_io_job* peek(int job_class) const;
+
+		// removes all the jobs belonging to the storage and appends them
+		// to 'jobs'
+		void remove_jobs(piece_manager const* storage, tailqueue& jobs);
+
+		bool empty() const { return m_size == 0; }
+		int size() const { return m_size; }
+
+		// the number of jobs of the class that are queued. Jobs added
+		// with push_front() aren't counted here
+		int size(int job_class) const;
+
+	private:
+
+		typedef std::map<piece_manager const*, tailqueue> storage_jobs_t;
+
+		struct class_queue
+		{
+			class_queue(): size(0), pass(0), stride(0) {}
+
+			// the queued jobs, per storage
+			storage_jobs_t jobs;
+
+			// the storages with jobs queued, in the order they'll get to
+			// run their next job
+			std::deque<piece_manager const*> turns;
+
+			// the number of jobs in 'jobs'
+			int size;
+
+			// the class with the lowest pass runs next. Every time a job
+			// from the class runs, the pass is increased by the stride,
+			// which is inversely proportional to the class' weight
+			boost::int64_t pass;
+			boost::int64_t stride;
+		};
+
+		class_queue m_classes[num_job_classes];
+
+		// jobs added with push_front()
+		tailqueue m_urgent;
+
+		// the pass of the last class a job was run from. Classes that have
+		// been idle start from here, so they can't save up credit for a
+		// burst that would hold up the other classes
+		boost::int64_t m_pass;
+
+		// the total number of jobs in all queues
+		int m_size;
+	};
+}
+
+#endif // TORRENT_DISK_JOB_SCHEDULER_HPP
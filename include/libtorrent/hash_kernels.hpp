@@ -0,0 +1,101 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_HASH_KERNELS_HPP_INCLUDED
+#define TORRENT_HASH_KERNELS_HPP_INCLUDED
+
+#include <boost/cstdint.hpp>
+
+#include "libtorrent/config.hpp"
+
+namespace libtorrent
+{
+	// compresses ``blocks`` consecutive 64 byte blocks from each of the
+	// ``num_lanes`` buffers in ``data`` into the corresponding SHA-1 state
+	// (5 words) in ``state``.
+	typedef void (*sha1_compress_fun)(boost::uint32_t* const* state
+		, boost::uint8_t const* const* data, int num_lanes, int blocks);
+
+	// an implementation of the SHA-1 compression function
+	struct sha1_kernel
+	{
+		char const* name;
+		sha1_compress_fun compress;
+
+		// the number of lanes compressed in lockstep. Kernels with a single
+		// lane compress the lanes one after another
+		int lanes;
+
+		// returns true if the CPU we're running on can run this kernel
+		bool (*supported)();
+	};
+
+	// an implementation of CRC32C
+	struct crc32c_kernel
+	{
+		char const* name;
+		boost::uint32_t (*crc32c)(boost::uint64_t const* buf, int num_words);
+		boost::uint32_t (*crc32c_32)(boost::uint32_t v);
+		bool (*supported)();
+	};
+
+	// the kernels compiled into this build, whether the CPU supports them or
+	// not, in order of preference. The lists are terminated by an entry
+	// whose name is NULL.
+	TORRENT_EXPORT sha1_kernel const* sha1_kernels();
+	TORRENT_EXPORT crc32c_kernel const* crc32c_kernels();
+
+	// the kernels picked for the CPU we're running on. These are selected
+	// the first time this is called.
+	struct hash_kernels
+	{
+		// the fastest single lane SHA-1 kernel. Used by hasher, unless it's
+		// backed by a crypto library
+		sha1_kernel const* sha1;
+
+		// the fastest kernel for hashing several messages at a time. Used by
+		// multi_hasher
+		sha1_kernel const* sha1_multi;
+
+		// the number of messages worth hashing at a time with sha1_multi.
+		// This is 1 when there's no hardware support, as there's nothing to
+		// gain from it then
+		int sha1_multi_lanes;
+
+		crc32c_kernel const* crc32c;
+	};
+
+	TORRENT_EXPORT hash_kernels const& selected_kernels();
+}
+
+#endif // TORRENT_HASH_KERNELS_HPP_INCLUDED
+
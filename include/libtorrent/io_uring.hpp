@@ -0,0 +1,183 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#ifndef TORRENT_IO_URING_HPP_INCLUDED
+#define TORRENT_IO_URING_HPP_INCLUDED
+
+#include <vector>
+#include <boost/noncopyable.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/error_code.hpp"
+
+namespace libtorrent
+{
+	// a submission queue for file operations. On linux, when built with
+	// TORRENT_USE_IO_URING, this is backed by an io_uring instance, which
+	// lets a single disk thread have many reads and writes in flight at the
+	// same time. Operations are queued with prep_readv() and prep_writev()
+	// and then issued together by submit_and_wait(), which blocks until
+	// all of them have completed.
+	//
+	// Every operation is tagged with a *slot*, identifying what it belongs
+	// to (typically a disk job). The number of bytes transferred and the
+	// first error are accumulated per slot.
+	//
+	// When io_uring is not available, open() fails and the prep functions
+	// always return false, in which case the caller is expected to perform
+	// the operation synchronously.
+	struct TORRENT_EXTRA_EXPORT io_uring_queue : boost::noncopyable
+	{
+		io_uring_queue();
+		~io_uring_queue();
+
+		// sets up the ring with room for ``entries`` operations in flight
+		// at a time
+		void open(int entries, error_code& ec);
+		void close();
+		bool is_open() const;
+
+		// clears the results and prepares for a new batch with ``num_slots``
+		// slots. This must not be called while there are operations pending
+		void reset(int num_slots);
+
+		// queue a vectored read or write from/to ``f`` at ``offset``. The
+		// iovec array is copied and a reference to the file is held until the
+		// operation completes, but the buffers themselves must stay valid
+		// until submit_and_wait() returns. ``file_index`` is only used to
+		// report errors. Returns false if the operation could not be queued.
+		bool prep_readv(file_handle const& f, size_type offset
+			, file::iovec_t const* bufs, int num_bufs, int slot, int file_index);
+		bool prep_writev(file_handle const& f, size_type offset
+			, file::iovec_t const* bufs, int num_bufs, int slot, int file_index);
+
+		// submits all queued operations and blocks until every one of them
+		// has completed. Returns the number of operations that completed
+		// through the ring since the last call to reset().
+		int submit_and_wait();
+
+		// the number of operations queued or in flight
+		int num_pending() const { return m_num_queued + m_num_in_flight; }
+
+		// the total number of bytes transferred by the operations of
+		// ``slot`` in the last batch
+		int bytes_transferred(int slot) const;
+
+		// the first error any operation belonging to ``slot`` failed with.
+		// error_file() is the file index that was passed in with that
+		// operation
+		error_code const& error(int slot) const;
+		int error_file(int slot) const;
+
+	private:
+
+		bool prep(int opcode, file_handle const& f, size_type offset
+			, file::iovec_t const* bufs, int num_bufs, int slot, int file_index);
+
+		// submits queued entries to the kernel, and waits for at least
+		// ``min_complete`` operations to complete
+		int enter(int min_complete, error_code& ec);
+
+		// moves completed operations off of the completion queue and
+		// records their results. Returns the number of operations reaped
+		int reap();
+
+		// performs the queued (but not yet submitted) operations
+		// synchronously. Used as a fall-back if submitting fails
+		void run_queued();
+
+		struct slot_result
+		{
+			slot_result() : bytes(0), file(-1) {}
+			int bytes;
+			int file;
+			error_code ec;
+		};
+
+		// an operation in the ring. The user_data field of the submission
+		// refers to an index in m_ops
+		struct operation
+		{
+			operation() : slot(-1), file_index(-1), opcode(0), offset(0) {}
+			file_handle file;
+			std::vector<file::iovec_t> iov;
+			int slot;
+			int file_index;
+			int opcode;
+			size_type offset;
+		};
+
+		void record(operation& op, int res);
+
+		std::vector<slot_result> m_results;
+		std::vector<operation> m_ops;
+
+		// indices into m_ops that are not in use
+		std::vector<int> m_free_ops;
+
+		// the io_uring file descriptor, or -1 if not open
+		int m_ring_fd;
+
+		// the number of operations in the submission queue that have not
+		// been submitted yet, and the number submitted but not completed
+		int m_num_queued;
+		int m_num_in_flight;
+
+		// the number of operations completed by the kernel since reset()
+		int m_num_completed;
+
+		// the mapped submission and completion rings
+		void* m_sq_ring;
+		void* m_cq_ring;
+		void* m_sqes;
+		int m_sq_ring_size;
+		int m_cq_ring_size;
+		int m_sqes_size;
+
+		// pointers into the mapped rings
+		unsigned* m_sq_head;
+		unsigned* m_sq_tail;
+		unsigned* m_sq_mask;
+		unsigned* m_sq_array;
+		unsigned* m_cq_head;
+		unsigned* m_cq_tail;
+		unsigned* m_cq_mask;
+		void* m_cqes;
+
+		int m_sq_entries;
+	};
+}
+
+#endif // TORRENT_IO_URING_HPP_INCLUDED
+
@@ -0,0 +1,97 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_MULTI_HASHER_HPP_INCLUDED
+#define TORRENT_MULTI_HASHER_HPP_INCLUDED
+
+#include <boost/cstdint.hpp>
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/sha1_hash.hpp"
+
+namespace libtorrent
+{
+	// computes the SHA-1 digest of several independent messages at the same
+	// time. Each message is a *lane*. When the CPU supports it, the lanes are
+	// compressed in lockstep, one SIMD register holding the same state word of
+	// 4 (SSE4.1) or 8 (AVX2) lanes. On CPUs with the SHA extensions but not
+	// AVX2, the lanes are compressed one after another with those
+	// instructions instead, as that is faster than SSE4.1. The implementation
+	// is picked at runtime, see hash_kernels.hpp.
+	//
+	// The lanes are fed together, by passing one buffer per lane to
+	// update(). This works best when all lanes are fed the same number of
+	// bytes, in multiples of 64 bytes, like blocks of pieces of the same size.
+	class TORRENT_EXTRA_EXPORT multi_hasher
+	{
+	public:
+
+		enum { max_lanes = 8 };
+
+		explicit multi_hasher(int num_lanes = max_lanes);
+
+		int num_lanes() const { return m_num_lanes; }
+
+		// appends ``len`` bytes to each lane. ``data`` is an array of
+		// num_lanes() pointers, lanes whose pointer is NULL are left as they
+		// are.
+		void update(char const* const* data, int len);
+
+		// returns the SHA-1 digest of the bytes passed in to ``lane``. This
+		// leaves the lane in an undefined state, until reset() is called.
+		sha1_hash final(int lane);
+
+		// restore all lanes to the state of a newly constructed hasher
+		void reset();
+
+		// the number of lanes worth hashing together on this CPU. This is 1
+		// when there is no accelerated implementation, in which case there's
+		// no point in using a multi_hasher over hashing the messages one at a
+		// time.
+		static int preferred_lanes();
+
+	private:
+
+		struct lane_t
+		{
+			boost::uint32_t state[5];
+			boost::uint64_t count;
+			boost::uint8_t buffer[64];
+		};
+
+		lane_t m_lanes[max_lanes];
+		int m_num_lanes;
+	};
+}
+
+#endif // TORRENT_MULTI_HASHER_HPP_INCLUDED
+
@@ -42,25 +42,43 @@ POSSIBILITY OF SUCH DAMAGE.
 #elif defined TORRENT_USE_OPENSSL
 #include <openssl/rc4.h>
 #else
-// RC4 state from libtomcrypt
+#include <boost/cstdint.hpp>
+
+// RC4 state from libtomcrypt. The permutation is kept as words rather
+// than bytes, which makes the swaps cheaper to update
 struct rc4 {
 	int x, y;
-	unsigned char buf[256];
+	boost::uint32_t buf[256];
 };
 
 void TORRENT_EXTRA_EXPORT rc4_init(const unsigned char* in, unsigned long len, rc4 *state);
 unsigned long TORRENT_EXTRA_EXPORT rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state);
+// encrypts ``len`` bytes from ``in`` into ``out``. The buffers may be the same
+void TORRENT_EXTRA_EXPORT rc4_encrypt(unsigned char* out, unsigned char const* in
+	, unsigned long len, rc4* state);
 #endif
 
 #include "libtorrent/peer_id.hpp" // For sha1_hash
 #include "libtorrent/assert.hpp"
 
+#include <cstring> // for memcpy
+
 namespace libtorrent
 {
 	class TORRENT_EXTRA_EXPORT dh_key_exchange
 	{
 	public:
 		dh_key_exchange();
+
+		// use the given 96 byte secret instead of a random one. This is
+		// used by dh_key_pool, to generate the random secret on the network
+		// thread and the public key from it on a worker thread
+		explicit dh_key_exchange(char const* secret);
+
+		// fills in a random 96 byte secret. This must be called from the
+		// network thread
+		static void random_secret(char* secret);
+
 		bool good() const { return true; }
 
 		// Get local public key, always 96 bytes
@@ -79,6 +97,8 @@ namespace libtorrent
 		int get_local_key_size() const
 		{ return sizeof(m_dh_local_key); }
 
+		void compute_local_key();
+
 		char m_dh_local_key[96];
 		char m_dh_local_secret[96];
 		char m_dh_shared_secret[96];
@@ -91,6 +111,15 @@ namespace libtorrent
 		virtual void set_outgoing_key(unsigned char const* key, int len) = 0;
 		virtual void encrypt(char* pos, int len) = 0;
 		virtual void decrypt(char* pos, int len) = 0;
+
+		// encrypts ``len`` bytes from ``src`` into ``dst``. This is used to
+		// encrypt buffers that can't be modified, without first copying them
+		virtual void encrypt_copy(char* dst, char const* src, int len)
+		{
+			std::memcpy(dst, src, len);
+			encrypt(dst, len);
+		}
+
 		virtual ~encryption_handler() {}
 	};
 
@@ -166,6 +195,27 @@ namespace libtorrent
 #endif
 		}
 
+		void encrypt_copy(char* dst, char const* src, int len)
+		{
+			if (!m_encrypt)
+			{
+				std::memcpy(dst, src, len);
+				return;
+			}
+
+			TORRENT_ASSERT(len >= 0);
+			TORRENT_ASSERT(dst);
+			TORRENT_ASSERT(src);
+
+#ifdef TORRENT_USE_GCRYPT
+			gcry_cipher_encrypt(m_rc4_outgoing, dst, len, src, len);
+#elif defined TORRENT_USE_OPENSSL
+			RC4(&m_local_key, len, (const unsigned char*)src, (unsigned char*)dst);
+#else
+			rc4_encrypt((unsigned char*)dst, (unsigned char const*)src, len, &m_rc4_outgoing);
+#endif
+		}
+
 		void decrypt(char* pos, int len)
 		{
 			if (!m_decrypt) return;
@@ -72,6 +72,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/assert.hpp"
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/disk_buffer_holder.hpp"
+#include "libtorrent/receive_buffer.hpp"
 #include "libtorrent/bitfield.hpp"
 #include "libtorrent/bandwidth_socket.hpp"
 #include "libtorrent/socket_type_fwd.hpp"
@@ -199,8 +200,6 @@ namespace libtorrent
 			, m_choked(true)
 			, m_corked(false)
 			, m_ignore_stats(false)
-			, m_recv_pos(0)
-			, m_packet_size(0)
 		{}
 
 	protected:
@@ -273,15 +272,6 @@ namespace libtorrent
 		// when this is set, the transfer stats for this connection
 		// is not included in the torrent or session stats
 		bool m_ignore_stats:1;
-
-		// the byte offset in m_recv_buffer that we have
-		// are passing on to the upper layer. This is
-		// always <= m_recv_end
-		int m_recv_pos:24;
-
-		// the size (in bytes) of the bittorrent message
-		// we're currently receiving
-		int m_packet_size;
 	};
 
 	class TORRENT_EXTRA_EXPORT peer_connection
@@ -463,6 +453,11 @@ namespace libtorrent
 		// bytes as if they've been requested
 		time_duration download_queue_time(int extra_bytes = 0) const;
 
+		// estimate of how long it would take for extra_bytes requested
+		// now to arrive. This is the download_queue_time() plus the
+		// transport round-trip time. See libtorrent::block_arrival_time()
+		time_duration block_arrival_time(int extra_bytes) const;
+
 		bool is_interesting() const { return m_interesting; }
 		bool is_choked() const { return m_choked; }
 
@@ -673,6 +668,15 @@ namespace libtorrent
 		void cancel_request(piece_block const& b, bool force = false);
 		void send_block_requests();
 
+		// instead of picking blocks right away, ask the torrent to do it at
+		// the end of the current round of network events. Every piece
+		// received from this peer in that round then results in a single
+		// pick for all of its free request slots, and the torrent picks for
+		// all its peers in one batch. Once the torrent gets to this peer it
+		// calls request_deferred_blocks()
+		void defer_block_requests();
+		void request_deferred_blocks();
+
 		void assign_bandwidth(int channel, int amount);
 
 #if TORRENT_USE_INVARIANT_CHECKS
@@ -718,6 +722,28 @@ namespace libtorrent
 			, void* userdata = NULL, block_cache_reference ref
 			= block_cache_reference());
 
+		// calls ``fun`` on the last ``bytes`` bytes of the send buffer. See
+		// chained_buffer::apply_to_tail()
+		void apply_to_send_buffer_tail(int bytes, void (*fun)(char*, int, void*)
+			, void* userdata)
+		{ m_send_buffer.apply_to_tail(bytes, fun, userdata); }
+
+		// marks the buffer just appended to the send buffer as one that may
+		// be sent without the kernel copying it. See the zero_copy_send
+		// setting
+		void allow_zero_copy_send() { m_send_buffer.set_zero_copy_back(); }
+
+		// appends a block to the send buffer that will be sent straight from
+		// the file it's stored in, using sendfile(). Takes ownership of
+		// region
+		void append_send_file(file_region* region, int size);
+
+		// returns true if blocks may be sent to this peer straight from the
+		// file they're stored in, rather than being read into memory first.
+		// Connections that return true here must implement
+		// write_piece_from_file()
+		virtual bool can_send_from_file() const { return false; }
+
 #ifndef TORRENT_DISABLE_RESOLVE_COUNTRIES	
 		void set_country(char const* c)
 		{
@@ -736,12 +762,12 @@ namespace libtorrent
 		int send_buffer_capacity() const
 		{ return m_send_buffer.capacity(); }
 
-		int packet_size() const { return m_packet_size; }
+		int packet_size() const { return m_recv_buffer.packet_size(); }
 
 		bool packet_finished() const
-		{ return m_packet_size <= m_recv_pos; }
+		{ return m_recv_buffer.packet_finished(); }
 
-		int receive_pos() const { return m_recv_pos; }
+		int receive_pos() const { return m_recv_buffer.pos(); }
 
 		void max_out_request_queue(int s)
 		{ m_max_out_request_queue = s; }
@@ -799,6 +825,8 @@ namespace libtorrent
 		virtual void write_dont_have(int index) = 0;
 		virtual void write_keepalive() = 0;
 		virtual void write_piece(peer_request const& r, disk_buffer_holder& buffer) = 0;
+		virtual void write_piece_from_file(peer_request const& /* r */, file_region* region)
+		{ TORRENT_ASSERT(false); delete region; }
 		virtual void write_suggest(int piece) = 0;
 		virtual void write_bitfield() = 0;
 		
@@ -810,46 +838,36 @@ namespace libtorrent
 	
 		virtual void on_receive(error_code const& error
 			, std::size_t bytes_transferred) = 0;
+
+		// if the next message to be received is likely to be a piece
+		// message, this returns the number of bytes (counted from the
+		// current receive position) that precede its payload. In that
+		// case the header and the payload are received with a single read,
+		// the payload straight into a disk buffer. Otherwise this returns 0
+		virtual int expected_piece_header_size() const { return 0; }
+
 		virtual void on_sent(error_code const& error
 			, std::size_t bytes_transferred) = 0;
 
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		buffer::interval wr_recv_buffer()
-		{
-			if (m_recv_buffer.empty())
-			{
-				TORRENT_ASSERT(m_recv_pos == 0);
-				return buffer::interval(0,0);
-			}
-			TORRENT_ASSERT(!m_disk_recv_buffer);
-			TORRENT_ASSERT(m_disk_recv_buffer_size == 0);
-			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
-			return buffer::interval(&m_recv_buffer[0] + m_recv_start
-				, &m_recv_buffer[0] + m_recv_start + rcv_pos);
-		}
+		{ return m_recv_buffer.mutable_buffer(); }
 
-		std::pair<buffer::interval, buffer::interval> wr_recv_buffers(int bytes);
+		std::pair<buffer::interval, buffer::interval> wr_recv_buffers(int bytes)
+		{ return m_recv_buffer.mutable_buffers(bytes); }
 #endif
 		
 		buffer::const_interval receive_buffer() const
-		{
-			if (m_recv_buffer.empty())
-			{
-				TORRENT_ASSERT(m_recv_pos == 0);
-				return buffer::interval(0,0);
-			}
-			int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
-			return buffer::const_interval(&m_recv_buffer[0] + m_recv_start
-				, &m_recv_buffer[0] + m_recv_start + rcv_pos);
-		}
+		{ return m_recv_buffer.get(); }
 
 		bool allocate_disk_receive_buffer(int disk_buffer_size);
 		char* release_disk_receive_buffer();
-		bool has_disk_receive_buffer() const { return m_disk_recv_buffer; }
+		bool has_disk_receive_buffer() const { return m_recv_buffer.has_disk_buffer(); }
+		bool has_spec_receive_buffer() const { return m_recv_buffer.has_spec_buffer(); }
 		void cut_receive_buffer(int size, int packet_size, int offset = 0);
 		void reset_recv_buffer(int packet_size);
 		void normalize_receive_buffer();
-		void set_soft_packet_size(int size) { m_soft_packet_size = size; }
+		void set_soft_packet_size(int size) { m_recv_buffer.set_soft_packet_size(size); }
 
 		// if allow_encrypted is false, and the torrent 'ih' turns out
 		// to be an encrypted torrent (AES-256 encrypted) the peer will
@@ -861,6 +879,16 @@ namespace libtorrent
 
 		void update_desired_queue_size();
 
+		// the round-trip time the transport (uTP or TCP) has measured for
+		// this connection, in microseconds, or 0 if it's not available
+		int transport_rtt() const;
+
+		// the download rate download_queue_time() assumes for this peer,
+		// and the number of bytes it has yet to receive from it, including
+		// extra_bytes
+		int queue_download_rate() const;
+		boost::int64_t queued_bytes(int extra_bytes) const;
+
 		// called from the main loop when this connection has any
 		// work to do.
 		void on_send_data(error_code const& error
@@ -888,6 +916,18 @@ namespace libtorrent
 		void on_disk_write_complete(disk_io_job const* j
 			, peer_request r, boost::shared_ptr<torrent> t);
 		void on_seed_mode_hashed(disk_io_job const* j);
+#if TORRENT_USE_SENDFILE
+		void send_from_file(int amount);
+#endif
+#if TORRENT_USE_MSG_ZEROCOPY
+		bool can_send_zero_copy();
+		void send_zero_copy(int amount);
+		void reap_zero_copy_completions();
+		void abort_zero_copy_sends();
+#endif
+#if TORRENT_USE_SENDFILE || TORRENT_USE_MSG_ZEROCOPY
+		void on_send_ready(error_code const& error);
+#endif
 
 		int wanted_transfer(int channel);
 		int request_bandwidth(int channel, int bytes = 0);
@@ -927,7 +967,7 @@ namespace libtorrent
 
 	protected:
 
-		buffer m_recv_buffer;
+		libtorrent::receive_buffer m_recv_buffer;
 
 		// number of bytes this peer can send and receive
 		int m_quota[2];
@@ -935,9 +975,7 @@ namespace libtorrent
 		// the blocks we have reserved in the piece
 		// picker and will request from this peer.
 		std::vector<pending_block> m_request_queue;
-		
-		// the start of the logical receive buffer
-		int m_recv_start:24;
+
 
 		// this is the limit on the number of outstanding requests
 		// we have to this peer. This is initialized to the settings
@@ -956,6 +994,25 @@ namespace libtorrent
 		chained_buffer m_send_buffer;
 	private:
 
+#if TORRENT_USE_MSG_ZEROCOPY
+		// the number of sends made with MSG_ZEROCOPY on this socket. The
+		// kernel numbers them the same way, starting at 0, when it reports
+		// that it's done with them
+		boost::uint32_t m_zerocopy_sends;
+
+		// all MSG_ZEROCOPY sends before this one have completed. Buffers
+		// held by m_send_buffer are released up to here
+		boost::uint32_t m_zerocopy_done;
+
+		// ranges of sends (first, last) reported as completed out of order,
+		// past m_zerocopy_done
+		std::vector<std::pair<boost::uint32_t, boost::uint32_t> > m_zerocopy_completed;
+
+		// 0 until SO_ZEROCOPY is enabled on the socket, 1 once it is, and -1
+		// if this connection can't or shouldn't use MSG_ZEROCOPY
+		boost::int8_t m_zerocopy_state;
+#endif
+
 		// the disk thread to use to issue disk jobs to
 		disk_interface& m_disk_thread;
 
@@ -981,6 +1038,12 @@ namespace libtorrent
 		// message
 		sliding_average<50> m_rtt;
 
+		// the round-trip time of the connection as measured by the transport
+		// (uTP, or TCP_INFO for TCP on linux), in microseconds. 0 if it's not
+		// known. This is only sampled when bdp_request_queue or
+		// streaming_deadline_estimates is enabled
+		int m_transport_rtt;
+
 		// keep the io_service running as long as we
 		// have peer connections
 		io_service::work m_work;
@@ -1048,12 +1111,6 @@ namespace libtorrent
 		// for the round-robin unchoke algorithm.
 		size_type m_uploaded_at_last_unchoke;
 
-		// some messages needs to be read from the socket
-		// buffer in multiple stages. This soft packet
-		// size limits the read size between message handler
-		// dispatch. Ignored when set to 0
-		int m_soft_packet_size;
-
 		// the number of bytes that the other
 		// end has to send us in order to respond
 		// to all outstanding piece requests we
@@ -1084,12 +1141,6 @@ namespace libtorrent
 		std::string m_inet_as_name;
 #endif
 
-		// if this peer is receiving a piece, this
-		// points to a disk buffer that the data is
-		// read into. This eliminates a memcopy from
-		// the receive buffer into the disk buffer
-		disk_buffer_holder m_disk_recv_buffer;
-
 		// we have suggested these pieces to the peer
 		// don't suggest it again
 		bitfield m_sent_suggested_pieces;
@@ -1162,39 +1213,6 @@ namespace libtorrent
 		// immediately
 		int m_queued_time_critical;
 
-		// the number of valid, received bytes in m_recv_buffer
-		int m_recv_end:24;
-
-//#error 1 byte
-
-		// recv_buf.begin (start of actual receive buffer)
-		// |
-		// |      m_recv_start (logical start of current
-		// |      |  receive buffer, as perceived by upper layers)
-		// |      |
-		// |      |    m_recv_pos (number of bytes consumed
-		// |      |    |  by upper layer, from logical receive buffer)
-		// |      |    |
-		// |      x---------x
-		// |      |         |        recv_buf.end (end of actual receive buffer)
-		// |      |         |        |
-		// v      v         v        v
-		// *------==========---------
-		//                     ^
-		//                     |
-		//                     |
-		// ------------------->x  m_recv_end (end of received data,
-		//                          beyond this point is garbage)
-		// m_recv_buffer
-
-		// when not using contiguous receive buffers, there
-		// may be a disk_recv_buffer in the mix as well. Whenever
-		// m_disk_recv_buffer_size > 0 (and presumably also
-		// m_disk_recv_buffer != NULL) the disk buffer is imagined
-		// to be appended to the receive buffer right after m_recv_end.
-
-		int m_disk_recv_buffer_size;
-
 		// the number of bytes we are currently reading
 		// from disk, that will be added to the send
 		// buffer as soon as they complete
@@ -35,6 +35,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/socket.hpp"
 #include "libtorrent/error_code.hpp"
+#include "libtorrent/time.hpp"
 
 namespace libtorrent
 {
@@ -85,6 +86,9 @@ namespace libtorrent
 		virtual bool failed() const = 0;
 		virtual stat const& statistics() const = 0;
 		virtual void get_peer_info(peer_info& p) const = 0;
+		// estimate of how long it would take for extra_bytes requested
+		// now to arrive
+		virtual time_duration block_arrival_time(int extra_bytes) const = 0;
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
 		virtual void peer_log(char const* fmt, ...) const = 0;
 #endif
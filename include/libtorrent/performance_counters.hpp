@@ -85,6 +85,13 @@ namespace libtorrent
 			interesting_piece_picks,
 			hash_fail_piece_picks,
 
+			// time critical pieces that completed before and after their
+			// deadline, and time critical blocks requested from more than
+			// one peer
+			piece_deadlines_met,
+			piece_deadlines_missed,
+			redundant_time_critical_requests,
+
 			// these counters indicate which parts
 			// of the piece picker CPU is spent in
 			piece_picker_partial_loops,
@@ -114,6 +121,13 @@ namespace libtorrent
 			// successful incoming connections (not rejected for any reason)
 			incoming_connections,
 
+			// encrypted handshakes that took a precomputed DH key from the
+			// pool and ones that had to compute it on the network thread, and
+			// the time the network thread spent computing DH keys
+			dh_key_pool_hits,
+			dh_key_pool_misses,
+			dh_handshake_time,
+
 			// counts events where the network
 			// thread wakes up
 			on_read_counter,
@@ -184,12 +198,35 @@ namespace libtorrent
 			num_write_ops,
 			num_read_ops,
 			num_read_back,
+			num_io_uring_batches,
+			num_io_uring_ops,
+			num_zero_copy_reads,
+
+			// accesses to pieces in each of the disk cache's ARC lists
+			arc_write_hits,
+			arc_volatile_hits,
+			arc_mru_hits,
+			arc_mru_ghost_hits,
+			arc_mfu_hits,
+			arc_mfu_ghost_hits,
 
 			disk_read_time,
 			disk_write_time,
 			disk_hash_time,
 			disk_job_time,
 
+			// the time disk jobs spent queued and the number of jobs started,
+			// per disk_job_scheduler::job_class_t. These must be in the same
+			// order as the job classes
+			disk_read_queue_time,
+			disk_write_queue_time,
+			disk_hash_queue_time,
+			disk_maintenance_queue_time,
+			disk_read_jobs,
+			disk_write_jobs,
+			disk_hash_jobs,
+			disk_maintenance_jobs,
+
 			waste_piece_timed_out,
 			waste_piece_cancelled,
 			waste_piece_unknown,
@@ -209,6 +246,12 @@ namespace libtorrent
 			recv_failed_bytes,
 			recv_redundant_bytes,
 
+			sent_zero_copy_bytes,
+			sent_msg_zerocopy_bytes,
+			msg_zerocopy_copied,
+			recv_zero_copy_bytes,
+			recv_copied_bytes,
+
 			dht_messages_in,
 			dht_messages_out,
 			dht_messages_out_dropped,
@@ -352,6 +395,10 @@ namespace libtorrent
 			pinned_blocks,
 			disk_blocks_in_use,
 			queued_disk_jobs,
+			queued_read_jobs,
+			queued_write_jobs,
+			queued_hash_jobs,
+			queued_maintenance_jobs,
 			num_read_jobs,
 			num_write_jobs,
 			num_jobs,
@@ -367,6 +414,12 @@ namespace libtorrent
 			arc_mfu_ghost_size,
 			arc_write_size,
 			arc_volatile_size,
+			arc_write_target,
+
+			arena_blocks,
+			arena_free_blocks,
+			arena_fragmented_pages,
+			arena_huge_pages,
 
 			dht_nodes,
 			dht_node_cache,
@@ -52,6 +52,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/config.hpp"
 #include "libtorrent/assert.hpp"
 #include "libtorrent/time.hpp"
+#include "libtorrent/bitfield.hpp"
 
 //#define TORRENT_PICKER_LOG
 //#define TORRENT_DEBUG_REFCOUNTS
@@ -69,9 +70,9 @@ namespace libtorrent
 
 	class torrent;
 	class peer_connection;
-	struct bitfield;
 	struct logger;
 	struct counters;
+	struct torrent_peer;
 
 	struct TORRENT_EXTRA_EXPORT piece_block
 	{
@@ -120,9 +121,13 @@ namespace libtorrent
 		{
 			block_info(): peer(0), num_peers(0), state(state_none) {}
 			// the peer this block was requested or
-			// downloaded from. This is a pointer to
-			// a torrent_peer object
-			void* peer;
+			// downloaded from. This is an index into the
+			// piece picker's table of peers, 0 means no
+			// peer. Use piece_picker::block_peer() to get
+			// the torrent_peer object. Storing an index
+			// rather than a pointer keeps this struct at
+			// 4 bytes
+			unsigned peer:16;
 			// the number of peers that has this block in their
 			// download or request queues
 			unsigned num_peers:14;
@@ -419,6 +424,14 @@ namespace libtorrent
 
 		void* get_downloader(piece_block block) const;
 
+		// returns the peer the block was requested or downloaded from
+		// (a torrent_peer pointer), or 0 if there is none
+		void* block_peer(block_info const& info) const
+		{
+			TORRENT_ASSERT(info.peer < m_block_peers.size());
+			return m_block_peers[info.peer].peer;
+		}
+
 		// the number of filtered pieces we don't have
 		int num_filtered() const { return m_num_filtered; }
 
@@ -475,6 +488,23 @@ namespace libtorrent
 
 		bool can_pick(int piece, bitfield const& bitmask) const;
 		bool is_piece_free(int piece, bitfield const& bitmask) const;
+
+		// returns the first piece in the range [start, end) that's set both
+		// in bitmask and in the packed column (either m_free_pieces or
+		// m_open_pieces). Returns end if there is no such piece
+		int find_first_piece(bitfield const& column, bitfield const& bitmask
+			, int start, int end) const;
+		// returns the last piece in the range [start, end) that's set both
+		// in bitmask and in the packed column. Returns start - 1 if there is
+		// no such piece
+		int find_last_piece(bitfield const& column, bitfield const& bitmask
+			, int start, int end) const;
+
+		// updates the bits for this piece in m_free_pieces and
+		// m_open_pieces, to match its piece_pos entry. This must be called
+		// whenever the have, filtered or downloading state of a piece changes
+		void update_pick_state(int index);
+
 		std::pair<int, int> expand_piece(int piece, int whole_pieces
 			, bitfield const& have, int options) const;
 
@@ -488,6 +518,7 @@ namespace libtorrent
 				, state(piece_pos::piece_open)
 				, piece_priority(1)
 				, index(index_)
+				, download_index(0)
 			{
 				TORRENT_ASSERT(peer_count_ >= 0);
 				TORRENT_ASSERT(index_ >= 0);
@@ -509,15 +540,17 @@ namespace libtorrent
 				piece_zero_prio
 			};
 
+			// all fields are 64 bit, to have them packed into a single
+			// word on all compilers
 			// the number of peers that has this piece
 			// (availability)
 #if TORRENT_OPTIMIZE_MEMORY_USAGE
-			boost::uint32_t peer_count : 9;
+			boost::uint64_t peer_count : 9;
 #else
-			boost::uint32_t peer_count : 16;
+			boost::uint64_t peer_count : 16;
 #endif
 
-			boost::uint32_t state : 3;
+			boost::uint64_t state : 3;
 
 			// is 0 if the piece is filtered (not to be downloaded)
 			// 1 is normal priority (default)
@@ -526,12 +559,21 @@ namespace libtorrent
 			// 4 is higher priority than partial pieces
 			// 5 and 6 same priority as availability 1 (ignores availability)
 			// 7 is maximum priority (ignores availability)
-			boost::uint32_t piece_priority : 3;
+			boost::uint64_t piece_priority : 3;
 			// index in to the piece_info vector
 #if TORRENT_OPTIMIZE_MEMORY_USAGE
-			boost::uint32_t index : 17;
+			boost::uint64_t index : 18;
+#else
+			boost::uint64_t index : 20;
+#endif
+
+			// when the piece is downloading (state is not piece_open), this
+			// is the position of its downloading_piece entry in the
+			// m_downloads list for its state
+#if TORRENT_OPTIMIZE_MEMORY_USAGE
+			boost::uint64_t download_index : 18;
 #else
-			boost::uint32_t index;
+			boost::uint64_t download_index : 20;
 #endif
 
 #ifdef TORRENT_DEBUG_REFCOUNTS
@@ -547,7 +589,7 @@ namespace libtorrent
 #if TORRENT_OPTIMIZE_MEMORY_USAGE
 				we_have_index = 0x3ffff,
 #else
-				we_have_index = 0xffffffff,
+				we_have_index = 0xfffff,
 #endif
 				// the priority value that means the piece is filtered
 				filter_priority = 0,
@@ -616,15 +658,18 @@ namespace libtorrent
 	private:
 
 #ifndef TORRENT_DEBUG_REFCOUNTS
-#if TORRENT_OPTIMIZE_MEMORY_USAGE
-		BOOST_STATIC_ASSERT(sizeof(piece_pos) == sizeof(char) * 4);
-#else
 		BOOST_STATIC_ASSERT(sizeof(piece_pos) == sizeof(char) * 8);
 #endif
+#if !TORRENT_USE_ASSERTS
+		BOOST_STATIC_ASSERT(sizeof(block_info) == 4);
 #endif
 
 		void break_one_seed();
 
+		// moves one piece from the availability bucket 'from' to 'to' in
+		// m_availability
+		void move_availability(int from, int to);
+
 		void update_pieces() const;
 
 		// fills in the range [start, end) of pieces in
@@ -646,9 +691,26 @@ namespace libtorrent
 		dlpiece_iter add_download_piece(int index);
 		void erase_download_piece(dlpiece_iter i);
 
+		// sets the peer of the block, maintaining the reference counts in
+		// m_block_peers. Passing 0 clears it. If the table is full, the
+		// block is left without a peer
+		void set_block_peer(block_info& info, void* peer);
+
+		// returns the entry in m_block_peers referring to this peer, or 0
+		// if it doesn't have one. This is constant time, the entry is
+		// remembered in torrent_peer::picker_slot
+		int find_block_peer(torrent_peer const* peer) const;
+
+		// these are constant time. The position of a piece in its download
+		// list is kept in its piece_pos entry
 		std::vector<downloading_piece>::const_iterator find_dl_piece(int queue, int index) const;
 		std::vector<downloading_piece>::iterator find_dl_piece(int queue, int index);
 
+		// removes the entry from its download list by moving the last entry
+		// in the list into its place. Any iterator into the list is
+		// invalidated
+		void remove_dl_piece(int queue, dlpiece_iter i);
+
 		// returns an iterator to the downloading piece, whichever
 		// download list it may live in now
 		std::vector<downloading_piece>::iterator update_piece_state(std::vector<downloading_piece>::iterator dp);
@@ -669,10 +731,33 @@ namespace libtorrent
 		// TODO: should this be allocated lazily?
 		mutable std::vector<piece_pos> m_piece_map;
 
+		// packed copies of the piece_pos state that's tested for every
+		// candidate piece when picking, one bit per piece. On large torrents
+		// m_piece_map is too big to stay in the CPU cache, these columns are
+		// 1/64th of its size and can be scanned (and AND:ed with a peer's
+		// bitfield) 32 or more pieces at a time.
+
+		// set for pieces that we don't have and that aren't filtered, i.e.
+		// the pieces is_piece_free() considers
+		bitfield m_free_pieces;
+
+		// the subset of m_free_pieces that aren't downloading either, i.e.
+		// the pieces can_pick() considers
+		bitfield m_open_pieces;
+
 		// the number of seeds. These are not added to
 		// the availability counters of the pieces
 		int m_seeds;
 
+		// histogram of piece availability (not counting seeds). Element n
+		// is the number of pieces whose peer_count is n, where pieces we
+		// have count ourself as one more peer. Element 0 is therefore the
+		// number of pieces we don't have that no peer has either, which is
+		// what decides whether the first seed joining (or the last one
+		// leaving) changes what's pickable. It also makes
+		// distributed_copies() independent of the number of pieces.
+		std::vector<int> m_availability;
+
 		// the number of pieces that have passed the hash check
 		int m_num_passed;
 
@@ -689,10 +774,10 @@ namespace libtorrent
 		// each piece that's currently being downloaded
 		// has an entry in this list with block allocations.
 		// i.e. it says wich parts of the piece that
-		// is being downloaded. This list is ordered
-		// by piece index to make lookups efficient
-		// there are 3 buckets of downloading pieces, each
-		// is individually sorted by piece index.
+		// is being downloaded. The lists are not in any
+		// particular order, piece_pos::download_index is
+		// the position of a piece in its list.
+		// there are 4 buckets of downloading pieces:
 		// 0: downloading pieces with unrequested blocks
 		// 1: downloading pieces where every block is busy
 		//    and some are still in the requested state
@@ -708,6 +793,30 @@ namespace libtorrent
 		// point into this vector for its storage
 		std::vector<block_info> m_block_info;
 
+		// the slots in m_block_info (in units of m_blocks_per_piece blocks)
+		// that aren't used by any downloading piece
+		std::vector<int> m_free_block_infos;
+
+		// the table of peers block_info::peer refers to. Entry 0 is the
+		// null peer. An entry is freed as soon as no block refers to it,
+		// so the table only holds the peers we're currently downloading
+		// partial pieces from (or have downloaded blocks from)
+		struct block_peer_entry
+		{
+			block_peer_entry(void* p): peer(p), refs(0) {}
+			void* peer;
+			// the number of blocks referring to this entry
+			int refs;
+		};
+		std::vector<block_peer_entry> m_block_peers;
+
+		// the largest index block_info::peer can hold
+		enum { max_block_peers = 0xffff };
+
+		// entries in m_block_peers that aren't in use. A peer's
+		// entry is found through torrent_peer::picker_slot
+		std::vector<int> m_free_block_peers;
+
 		boost::uint16_t m_blocks_per_piece;
 		boost::uint16_t m_blocks_in_last_piece;
 
@@ -0,0 +1,268 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RECEIVE_BUFFER_HPP_INCLUDED
+#define TORRENT_RECEIVE_BUFFER_HPP_INCLUDED
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/buffer.hpp"
+#include "libtorrent/disk_buffer_holder.hpp"
+
+#include <utility> // for pair
+#include <boost/array.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/version.hpp>
+#if BOOST_VERSION < 103500
+#include <asio/buffer.hpp>
+#else
+#include <boost/asio/buffer.hpp>
+#endif
+
+namespace libtorrent
+{
+#if BOOST_VERSION >= 103500
+	namespace asio = boost::asio;
+#endif
+	struct counters;
+
+	// the buffer a peer connection receives messages into. The message
+	// currently being received is the ``packet_size()`` bytes starting at
+	// the logical start of the buffer. ``pos()`` bytes of it have been
+	// passed on to the protocol layer, and more bytes may have been received
+	// past that.
+	//
+	// The payload of a piece message may be received straight into a disk
+	// buffer, in which case the disk buffer stands in for the end of the
+	// message. See assign_disk_buffer().
+	//
+	// When the next message is likely to be a piece, its header and payload
+	// can be received with a single read, the payload speculatively into a
+	// disk buffer. See speculate()
+	struct TORRENT_EXTRA_EXPORT receive_buffer : boost::noncopyable
+	{
+		receive_buffer(buffer_allocator_interface& allocator, counters& cnt);
+
+		int packet_size() const { return m_packet_size; }
+		bool packet_finished() const { return m_packet_size <= m_recv_pos; }
+		int pos() const { return m_recv_pos; }
+
+		// true when nothing of the current message has been received (and
+		// nothing past it)
+		bool empty() const { return m_recv_end == 0; }
+
+		// the memory held by this buffer, including the disk buffer
+		int capacity() const
+		{ return int(m_recv_buffer.capacity()) + m_disk_recv_buffer_size; }
+
+		// the number of bytes of the current message received into the
+		// regular buffer, i.e. not into the disk buffer
+		int regular_buffer_size() const
+		{ return m_packet_size - m_disk_recv_buffer_size; }
+
+		// while the soft packet size is set and not yet reached, the
+		// current message is received in chunks of at most that many bytes
+		void set_soft_packet_size(int size) { m_soft_packet_size = size; }
+		int soft_packet_size() const { return m_soft_packet_size; }
+
+		// the max number of bytes to read next, without reading past the
+		// current message (or soft packet)
+		int max_receive();
+
+		// the regular buffer. This is exposed to have the session lend it
+		// out to (and take it back from) connections that aren't receiving
+		// anything
+		buffer& storage() { return m_recv_buffer; }
+
+		// returns the space for reading ``size`` more bytes at the end of
+		// what has been received, in the regular buffer. Used when the
+		// number of bytes to read is determined by what the socket has
+		// available, not by the current message
+		char* reserve(int size);
+
+		// fills in ``vec`` with the buffers to receive the next ``size``
+		// bytes of the current message into. Returns the number of buffers
+		// used. ``size`` may not exceed max_receive()
+		int reserve(boost::array<asio::mutable_buffer, 2>& vec, int size);
+
+		// the next ``header_size`` bytes will be received into the regular
+		// buffer and the bytes following them into ``buf``, a disk buffer.
+		// The buffer takes ownership of ``buf``. If the message turns out
+		// to be a piece with its payload there, adopt_spec_buffer() makes
+		// ``buf`` the disk buffer of the message. Otherwise the bytes are
+		// copied to the regular buffer before they're passed on
+		void speculate(char* buf, int header_size);
+		bool has_spec_buffer() const { return m_spec_recv_buffer.get() != 0; }
+
+		// a speculative read that was cut short, before reaching the disk
+		// buffer, leaves it empty. This frees it
+		void reset_spec_buffer();
+
+		// called when ``bytes`` bytes have been read into the buffers
+		// returned by reserve()
+		void received(int bytes);
+
+		// marks up to ``bytes`` of the received bytes as passed on to the
+		// protocol layer, but not past the end of the current message (or
+		// soft packet). Returns the number of bytes passed on
+		int advance_pos(int bytes);
+
+		// removes ``size`` bytes, starting ``offset`` bytes into the
+		// current message. The next message is expected to be
+		// ``packet_size`` bytes
+		void cut(int size, int packet_size, int offset = 0);
+
+		// drops the current message and starts receiving a new one of
+		// ``packet_size`` bytes
+		void reset(int packet_size);
+
+		// moves the received bytes to the start of the regular buffer, to
+		// free up the space of the messages that have been cut
+		void normalize();
+
+		// if the current message was received speculatively into the
+		// disk buffer passed to speculate(), and the last
+		// ``disk_buffer_size`` bytes of the message are exactly what was
+		// received into it, that buffer becomes the disk buffer of the
+		// message and this returns true. Otherwise the speculatively
+		// received bytes are copied to the regular buffer (if there are any)
+		// and this returns false
+		bool adopt_spec_buffer(int disk_buffer_size);
+
+		// the last ``size`` bytes of the current message will be received
+		// into ``buf``, a disk buffer. The buffer takes ownership of it
+		void assign_disk_buffer(char* buf, int size);
+		bool has_disk_buffer() const { return m_disk_recv_buffer.get() != 0; }
+
+		// returns the disk buffer, and the responsibility to free it, once
+		// the message has been received
+		char* release_disk_buffer();
+
+		// frees the disk buffer and the speculative disk buffer, if there
+		// are any
+		void free_disk_buffers();
+
+		// the part of the current message that has been passed on
+		buffer::const_interval get() const;
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// the same, but mutable, for decrypting it in place. Only valid
+		// without a disk buffer
+		buffer::interval mutable_buffer();
+
+		// the last ``bytes`` bytes passed on. They may span the regular
+		// buffer and the disk buffer
+		std::pair<buffer::interval, buffer::interval> mutable_buffers(int bytes);
+#endif
+
+#if TORRENT_USE_INVARIANT_CHECKS
+		void check_invariant() const;
+#endif
+
+	private:
+
+		// moves the bytes received into m_spec_recv_buffer to the regular
+		// buffer, where they would have been if the read hadn't been
+		// speculative, and frees the disk buffer
+		void copy_spec_buffer();
+
+		counters& m_counters;
+
+		buffer m_recv_buffer;
+
+		// if this peer is receiving a piece, this
+		// points to a disk buffer that the data is
+		// read into. This eliminates a memcopy from
+		// the receive buffer into the disk buffer
+		disk_buffer_holder m_disk_recv_buffer;
+
+		// when the header of a piece message is received speculatively
+		// (see speculate()), the bytes following it are received into this
+		// disk buffer. When the message turns out to be the piece message,
+		// this becomes m_disk_recv_buffer. Otherwise the bytes are copied
+		// into m_recv_buffer before they're passed on
+		disk_buffer_holder m_spec_recv_buffer;
+
+		// the size (in bytes) of the bittorrent message
+		// we're currently receiving
+		int m_packet_size;
+
+		// some messages needs to be read from the socket
+		// buffer in multiple stages. This soft packet
+		// size limits the read size between message handler
+		// dispatch. Ignored when set to 0
+		int m_soft_packet_size;
+
+		// recv_buf.begin (start of actual receive buffer)
+		// |
+		// |      m_recv_start (logical start of current
+		// |      |  receive buffer, as perceived by upper layers)
+		// |      |
+		// |      |    m_recv_pos (number of bytes consumed
+		// |      |    |  by upper layer, from logical receive buffer)
+		// |      |    |
+		// |      x---------x
+		// |      |         |        recv_buf.end (end of actual receive buffer)
+		// |      |         |        |
+		// v      v         v        v
+		// *------==========---------
+		//                     ^
+		//                     |
+		//                     |
+		// ------------------->x  m_recv_end (end of received data,
+		//                          beyond this point is garbage)
+		// m_recv_buffer
+
+		// the start of the logical receive buffer
+		int m_recv_start;
+
+		// the byte offset in m_recv_buffer that we have
+		// are passing on to the upper layer. This is
+		// always <= m_recv_end
+		int m_recv_pos;
+
+		// the number of valid, received bytes in m_recv_buffer
+		int m_recv_end;
+
+		// when not using contiguous receive buffers, there
+		// may be a disk_recv_buffer in the mix as well. Whenever
+		// m_disk_recv_buffer_size > 0 (and presumably also
+		// m_disk_recv_buffer != NULL) the disk buffer is imagined
+		// to be appended to the receive buffer right after m_recv_end.
+		int m_disk_recv_buffer_size;
+
+		// the offset into m_recv_buffer m_spec_recv_buffer stands in for.
+		// m_recv_end includes the bytes received into m_spec_recv_buffer
+		int m_spec_recv_offset;
+	};
+}
+
+#endif // TORRENT_RECEIVE_BUFFER_HPP_INCLUDED
@@ -0,0 +1,80 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_RECEIVE_BUFFER_POOL_HPP
+#define TORRENT_RECEIVE_BUFFER_POOL_HPP
+
+#include "libtorrent/config.hpp"
+#include "libtorrent/buffer.hpp"
+
+#include <deque>
+#include <boost/noncopyable.hpp>
+
+namespace libtorrent
+{
+	// receive buffers of peer connections that don't have a partially
+	// received message. Connections that are waiting for data to arrive
+	// return their receive buffer here and pick one up again once the socket
+	// becomes readable, so that idle connections don't hold on to any
+	// memory. This is only used from the network thread
+	struct TORRENT_EXTRA_EXPORT receive_buffer_pool : boost::noncopyable
+	{
+		receive_buffer_pool();
+
+		// if ``b`` doesn't have any memory allocated, it's swapped with one of
+		// the buffers in the pool (if there are any). The returned buffer is
+		// empty, but may have any capacity
+		void acquire(buffer& b);
+
+		// returns the memory held by ``b`` to the pool and leaves ``b`` empty
+		// without any capacity. If the pool already holds its max number of
+		// buffers, or ``b`` is larger than buffers are allowed to be when
+		// pooled, the memory is freed instead
+		void release(buffer& b);
+
+		// the max number of buffers held by the pool, and the max capacity
+		// of each of them. Excess buffers are freed right away
+		void set_limits(int max_buffers, int max_capacity);
+
+		// the number of idle buffers held by the pool
+		int size() const { return int(m_buffers.size()); }
+
+	private:
+
+		std::deque<buffer> m_buffers;
+		int m_max_buffers;
+		int m_max_capacity;
+	};
+}
+
+#endif // TORRENT_RECEIVE_BUFFER_POOL_HPP
+
@@ -33,6 +33,16 @@ POSSIBILITY OF SUCH DAMAGE.
 #ifndef TORRENT_REQUEST_BLOCKS_HPP_INCLUDED
 #define TORRENT_REQUEST_BLOCKS_HPP_INCLUDED
 
+#include "libtorrent/config.hpp"
+#include "libtorrent/time.hpp"
+#include "libtorrent/piece_picker.hpp"
+
+#include <vector>
+#include <algorithm> // for find, stable_sort
+#include <utility> // for pair
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+
 namespace libtorrent
 {
 	class torrent;
@@ -43,6 +53,98 @@ namespace libtorrent
 	// shouldn't be incremented, since it won't use any significant
 	// amount of CPU
 	bool request_a_block(torrent& t, peer_connection& c);
+
+	// the time it takes to download ``bytes`` at ``rate`` bytes per second.
+	// Rates below 50 bytes per second are assumed to be 50 bytes per second
+	TORRENT_EXTRA_EXPORT time_duration download_time(boost::int64_t bytes, int rate);
+
+	// the time it takes for the last of ``queued_bytes``, requested from a
+	// peer sending at ``rate`` bytes per second, to arrive. ``rtt`` is the
+	// round-trip time measured by the transport, in microseconds, 0 if
+	// it's not known. It's not the request round-trip time of the peer
+	// (peer_connection::m_rtt), since that includes the time the request
+	// waited behind the ones before it, which is already in the download
+	// time of ``queued_bytes``
+	TORRENT_EXTRA_EXPORT time_duration block_arrival_time(
+		boost::int64_t queued_bytes, int rate, int rtt);
+
+	// returns true if any of the outstanding requests for blocks in this piece
+	// isn't expected to arrive before the deadline, given the download rate
+	// and round-trip time of the peer it was requested from (see
+	// peer_connection_interface::block_arrival_time())
+	TORRENT_EXTRA_EXPORT bool deadline_at_risk(piece_picker const& picker
+		, piece_picker::downloading_piece const& pi
+		, int blocks_in_piece, ptime deadline, ptime now);
+
+	// the number of requests to keep outstanding to a peer downloading at
+	// ``rate`` bytes per second. With the round-trip time ``rtt`` (in
+	// microseconds) it's twice the bandwidth-delay product, otherwise
+	// ``queue_time`` seconds worth of blocks. If ``rtt`` is 0 it's not
+	// known. The result is at least 2 and at most ``max_queue``
+	TORRENT_EXTRA_EXPORT int desired_queue_size(int rate, int block_size
+		, int queue_time, int rtt, int max_queue);
+
+	// the peers of a torrent waiting to have blocks requested for them, at
+	// the end of the current round of network events. See
+	// peer_connection::defer_block_requests(). ``Peer`` is peer_connection,
+	// it's a template to have it testable without a session
+	template <class Peer>
+	struct deferred_requests
+	{
+		// adds the peer to the batch, unless it's already in it. Returns
+		// true if the batch was empty, in which case a call to
+		// request_blocks() needs to be scheduled
+		bool add(boost::shared_ptr<Peer> const& p)
+		{
+			bool const first = m_peers.empty();
+			if (std::find(m_peers.begin(), m_peers.end(), p) == m_peers.end())
+				m_peers.push_back(p);
+			return first;
+		}
+
+		bool empty() const { return m_peers.empty(); }
+		int size() const { return int(m_peers.size()); }
+
+		// calls request_deferred_blocks() on every peer in the batch that's
+		// still connected, the fast peers first. They pick with affinity to
+		// pieces other fast peers are downloading, and get the first go at
+		// the rarest pieces and partial pieces, which they'll complete sooner.
+		// Peers of the same speed are served in the order they were added
+		void request_blocks()
+		{
+			// the peers are held by shared_ptr, since they may be
+			// disconnected while picking for the ones before them
+			std::vector<boost::shared_ptr<Peer> > peers;
+			peers.swap(m_peers);
+
+			// peer_speed() is evaluated once per peer, since it updates the
+			// speed class of the peer and isn't a stable sort key
+			std::vector<std::pair<int, int> > order;
+			order.reserve(peers.size());
+			for (int i = 0; i < int(peers.size()); ++i)
+			{
+				if (peers[i]->is_disconnecting()) continue;
+				order.push_back(std::make_pair(int(peers[i]->peer_speed()), i));
+			}
+			std::stable_sort(order.begin(), order.end(), &faster);
+
+			for (std::vector<std::pair<int, int> >::iterator i = order.begin()
+				, end(order.end()); i != end; ++i)
+			{
+				Peer& p = *peers[i->second];
+				if (p.is_disconnecting()) continue;
+				p.request_deferred_blocks();
+			}
+		}
+
+	private:
+
+		static bool faster(std::pair<int, int> const& lhs
+			, std::pair<int, int> const& rhs)
+		{ return lhs.first > rhs.first; }
+
+		std::vector<boost::shared_ptr<Peer> > m_peers;
+	};
 }
 
 #endif
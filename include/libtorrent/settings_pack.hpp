@@ -619,6 +619,76 @@ namespace libtorrent
 			// configured proxy, if any.
 			proxy_peer_connections,
 
+			// when enabled, the share of the disk cache used by the write cache
+			// adapts to the workload. Every time a block needs to be read back
+			// from disk to be hashed (because it was flushed and evicted) the
+			// write cache is allowed to grow, and every time a piece that was
+			// recently evicted from the read cache is requested again (an ARC
+			// ghost hit) it shrinks. When the cache is full and the write cache
+			// is above its share, dirty blocks are flushed before read blocks
+			// are evicted. The current target is reported by the
+			// ``disk.arc_write_target`` counter.
+			adaptive_cache_split,
+
+			// when enabled, blocks requested by peers on plain, unencrypted TCP
+			// connections that aren't already in the disk cache are not read
+			// into memory. Instead the disk thread hands back the file they are
+			// stored in, and they are sent with ``sendfile()`` straight from the
+			// file to the socket. This bypasses the read cache, so it's most
+			// useful when seeding large torrents whose working set doesn't fit
+			// in the cache anyway. This is only supported on linux, on other
+			// systems the setting is ignored. The number of bytes sent this way
+			// is reported by the ``net.sent_zero_copy_bytes`` counter.
+			zero_copy_upload,
+
+			// when enabled, the whole disk cache (``cache_size``) is reserved
+			// up front as one arena that disk buffers are carved out of. On
+			// linux the arena is backed by 2 MiB huge pages if any are reserved
+			// on the system (``vm.nr_hugepages``), otherwise transparent huge
+			// pages are requested. This reduces TLB misses with large caches.
+			// The arena is only set up (or torn down) while no disk buffers are
+			// in use, typically at startup. It's not used together with
+			// ``mmap_cache``.
+			use_disk_cache_arena,
+
+			// when enabled, blocks of time critical pieces (see
+			// torrent_handle::set_piece_deadline()) are requested from the peer
+			// expected to deliver them soonest, based on its measured download
+			// rate, what's already requested from it and the round-trip time
+			// measured by the transport (see ``bdp_request_queue``). If a block
+			// that's already requested isn't expected to arrive before its
+			// piece's deadline, it's requested from a second peer that is.
+			// Deadlines that are met and missed are counted by the
+			// ``picker.piece_deadlines_met`` and ``picker.piece_deadlines_missed``
+			// counters regardless of this setting.
+			streaming_deadline_estimates,
+
+			// when enabled, the number of outstanding requests to a peer is
+			// sized from the bandwidth-delay product of the connection instead
+			// of ``request_queue_time``. The round-trip time is the one
+			// measured by the transport, uTP's own estimate or ``TCP_INFO`` for
+			// TCP on linux. Requests covering twice the download rate times the
+			// round-trip time are kept outstanding. This lets high latency
+			// peers ramp up until their link is saturated, without queuing
+			// seconds worth of requests on low latency ones. Peers whose
+			// round-trip time isn't known use ``request_queue_time``. The
+			// number of requests is still limited by ``max_out_request_queue``.
+			bdp_request_queue,
+
+			// when enabled, send buffers that contain blocks read from disk
+			// are sent to TCP peers (not uTP or SSL) with ``MSG_ZEROCOPY``.
+			// The kernel then transmits the blocks straight from the disk
+			// buffers instead of copying them into the socket buffer, and the
+			// blocks are kept until the kernel reports it's done with them.
+			// For RC4 encrypted peers, the encrypted copy of the block is
+			// sent this way instead.
+			// This saves CPU when seeding at high rates, but pins more memory.
+			// This is only supported on linux 4.14 and later, elsewhere (and
+			// for peers on the loopback interface, where the kernel copies
+			// anyway) regular sends are used. The number of bytes sent this way
+			// is reported by the ``net.sent_msg_zerocopy_bytes`` counter.
+			zero_copy_send,
+
 			max_bool_setting_internal,
 			num_bool_settings = max_bool_setting_internal - bool_type_base
 		};
@@ -1331,7 +1401,9 @@ namespace libtorrent
 
 			// the number of blocks to keep outstanding at any given time when
 			// checking torrents. Higher numbers give faster re-checks but uses
-			// more memory. Specified in number of 16 kiB blocks
+			// more memory. Specified in number of 16 kiB blocks. The pieces
+			// are read and hashed in runs of consecutive pieces, with this
+			// budget split across a few runs in flight at a time.
 			checking_mem_usage,
 
 			// if set to > 0, pieces will be announced to other peers before they
@@ -1455,6 +1527,52 @@ namespace libtorrent
 			// .. _i2p: http://www.i2p2.de
 			i2p_port,
 
+			// selects how the disk threads perform file I/O. See
+			// disk_io_backend_t. With the io_uring back-end, ``aio_max`` is the
+			// max number of read and write operations each disk thread keeps in
+			// flight.
+			disk_io_backend,
+
+			// the share of the disk threads' time each class of disk jobs
+			// gets, relative to the other classes, when there are jobs of more
+			// than one class queued. The classes are reads requested by peers,
+			// writes (including flushing the write cache), hashing of
+			// downloaded pieces and everything else, like checking and moving
+			// files. Within a class, the torrents with queued jobs take turns,
+			// so one torrent can't hold up the others. The weights are at
+			// least 1.
+			disk_read_weight,
+			disk_write_weight,
+			disk_hash_weight,
+			disk_maintenance_weight,
+
+			// when set to a value > 0, the disk threads read in elevator
+			// order, which saves seeking on rotating disks. Read jobs are
+			// collected for up to this many milliseconds after they were
+			// issued (or until there are ``aio_max`` of them), then performed
+			// sorted by where in the torrent they read from. Reads of
+			// adjacent blocks of the same piece that don't go through the
+			// read cache are merged into a single read. This is the most
+			// time a read is held back waiting for others. 0 means reads are
+			// performed as soon as a disk thread picks them up.
+			read_elevator_window,
+
+			// peer connections only hold on to a receive buffer while they
+			// have a partially received message. Buffers of connections
+			// waiting for the next message are returned to a pool shared by
+			// all connections in the session. This is the max number of idle
+			// buffers kept in the pool, excess buffers are freed.
+			recv_buffer_pool_size,
+
+			// the number of Diffie-Hellman keys for encrypted handshakes to
+			// compute ahead of time, on a separate thread. Computing the key
+			// is the most expensive part of an encrypted handshake, and doing
+			// it on the network thread slows down all peers while many
+			// encrypted connections are being made. When the pool runs out,
+			// keys are computed on the network thread. 0 disables the pool
+			// and its thread.
+			dh_key_pool_size,
+
 			max_int_setting_internal,
 
 			num_int_settings = max_int_setting_internal - int_type_base
@@ -1488,6 +1606,19 @@ namespace libtorrent
 			disable_os_cache = 2
 		};
 
+		enum disk_io_backend_t
+		{
+			// each disk job is performed synchronously by one of the disk
+			// threads, using preadv()/pwritev() or their equivalents
+			posix_disk_io = 0,
+
+			// the reads and writes of disk jobs are submitted to an io_uring,
+			// letting a single disk thread have many of them in flight at
+			// once. This requires linux 5.1 or later and libtorrent built with
+			// io_uring support. When not available, posix_disk_io is used.
+			io_uring_disk_io = 1
+		};
+
 		enum bandwidth_mixed_algo_t
 		{
 			// disables the mixed mode bandwidth balancing
@@ -155,6 +155,7 @@ namespace libtorrent
 	struct cache_status;
 	namespace aux { struct session_settings; }
 	struct cached_piece_entry;
+	struct io_uring_queue;
 
 	TORRENT_EXTRA_EXPORT std::vector<std::pair<size_type, std::time_t> > get_filesizes(
 		file_storage const& t
@@ -262,6 +263,40 @@ namespace libtorrent
 		virtual int writev(file::iovec_t const* bufs, int num_bufs
 			, int piece, int offset, int flags, storage_error& ec) = 0;
 
+		// These are like readv() and writev(), except that the file
+		// operations may be queued on ``q`` rather than performed right away.
+		// This is used by the disk threads when the io_uring back-end is
+		// enabled, to have many operations in flight at once. Queued
+		// operations are tagged with ``slot`` and complete when the disk
+		// thread calls ``q.submit_and_wait()``. Their results are reported
+		// through the queue, so the return value only counts the bytes that
+		// were transferred immediately.
+		//
+		// The default implementations just call readv() and writev(), so
+		// custom storages don't need to implement these.
+		virtual int submit_readv(io_uring_queue& /* q */, int /* slot */
+			, file::iovec_t const* bufs, int num_bufs, int piece, int offset
+			, int flags, storage_error& ec)
+		{ return readv(bufs, num_bufs, piece, offset, flags, ec); }
+		virtual int submit_writev(io_uring_queue& /* q */, int /* slot */
+			, file::iovec_t const* bufs, int num_bufs, int piece, int offset
+			, int flags, storage_error& ec)
+		{ return writev(bufs, num_bufs, piece, offset, flags, ec); }
+
+		// If the ``size`` bytes at ``offset`` in ``piece`` are stored
+		// contiguously in a single file, this opens that file for reading and
+		// returns it, and sets ``file_offset`` to where in the file the range
+		// starts. This is used to send blocks to peers straight from the file.
+		// If the range can't be mapped to a single file, an empty handle is
+		// returned and the block is read with readv() instead. ``ec`` is only
+		// set if opening the file failed.
+		//
+		// The default implementation always returns an empty handle.
+		virtual file_handle map_file_region(int /* piece */, int /* offset */
+			, int /* size */, int /* flags */, size_type& /* file_offset */
+			, storage_error& /* ec */)
+		{ return file_handle(); }
+
 		// This function is called when first checking (or re-checking) the
 		// storage for a torrent. It should return true if any of the files that
 		// is used in this storage exists on disk. If so, the storage will be
@@ -427,6 +462,14 @@ namespace libtorrent
 			, int piece, int offset, int flags, storage_error& ec);
 		int writev(file::iovec_t const* bufs, int num_bufs
 			, int piece, int offset, int flags, storage_error& ec);
+		int submit_readv(io_uring_queue& q, int slot
+			, file::iovec_t const* bufs, int num_bufs, int piece, int offset
+			, int flags, storage_error& ec);
+		int submit_writev(io_uring_queue& q, int slot
+			, file::iovec_t const* bufs, int num_bufs, int piece, int offset
+			, int flags, storage_error& ec);
+		file_handle map_file_region(int piece, int offset, int size
+			, int flags, size_type& file_offset, storage_error& ec);
 
 		// if the files in this storage are mapped, returns the mapped
 		// file_storage, otherwise returns the original file_storage object.
@@ -451,6 +494,12 @@ namespace libtorrent
 			int mode;
 			// used for error reporting
 			int operation_type;
+			// if set, file operations are queued here instead of being
+			// performed synchronously. Pad files and part files are
+			// still handled synchronously
+			io_uring_queue* queue;
+			// the slot queued operations are tagged with
+			int slot;
 		};
 
 		void delete_one_file(std::string const& p, error_code& ec);
@@ -35,6 +35,8 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/assert.hpp"
 
+#include <boost/atomic.hpp>
+
 namespace libtorrent
 {
 	struct tailqueue_node
@@ -87,6 +89,31 @@ namespace libtorrent
 		tailqueue_node* m_last;
 		int m_size;
 	};
+
+	// a queue any number of threads can add nodes to without taking a
+	// lock. The nodes can only be taken out all at once, by get_all().
+	// Internally the nodes are kept as a stack, newest first, and get_all()
+	// reverses them back into the order they were added in
+	struct TORRENT_EXTRA_EXPORT atomic_tailqueue
+	{
+		atomic_tailqueue();
+
+		// these return true if the queue was empty before the call
+		bool push_back(tailqueue_node* e);
+		bool append(tailqueue& rhs);
+
+		// moves all nodes to the end of 'out'
+		void get_all(tailqueue& out);
+
+		bool empty() const
+		{ return m_head.load(boost::memory_order_relaxed) == 0; }
+	private:
+		// pushes the chain [first, last], which is linked newest first
+		bool push_chain(tailqueue_node* first, tailqueue_node* last);
+
+		// the most recently added node
+		boost::atomic<tailqueue_node*> m_head;
+	};
 };
 
 #endif // TAILQUEUE_HPP
@@ -64,6 +64,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/stat.hpp"
 #include "libtorrent/alert.hpp"
 #include "libtorrent/piece_picker.hpp"
+#include "libtorrent/request_blocks.hpp"
 #include "libtorrent/config.hpp"
 #include "libtorrent/escape_string.hpp"
 #include "libtorrent/bandwidth_limit.hpp"
@@ -313,7 +314,7 @@ namespace libtorrent
 
 		void on_resume_data_checked(disk_io_job const* j);
 		void on_force_recheck(disk_io_job const* j);
-		void on_piece_hashed(disk_io_job const* j);
+		void on_pieces_checked(disk_io_job const* j);
 		void files_checked();
 		void start_checking();
 
@@ -1073,6 +1074,11 @@ namespace libtorrent
 		int num_time_critical_pieces() const
 		{ return m_time_critical_pieces.size(); }
 
+		// adds the peer to the batch of peers to request blocks for at the
+		// end of the current round of network events. See
+		// peer_connection::defer_block_requests()
+		void defer_block_requests(peer_connection* c);
+
 	private:
 
 		void inc_stats_counter(int c, int value = 1);
@@ -1124,6 +1130,9 @@ namespace libtorrent
 		void remove_time_critical_pieces(std::vector<int> const& priority);
 		void request_time_critical_pieces();
 
+		// requests blocks for all peers in m_deferred_requests
+		void request_deferred_blocks();
+
 		void need_policy();
 
 		// all time totals of uploaded and downloaded payload
@@ -1207,6 +1216,10 @@ namespace libtorrent
 		// this list is sorted by time_critical_piece::deadline
 		std::vector<time_critical_piece> m_time_critical_pieces;
 
+		// peers that have room in their request queues and are waiting for
+		// request_deferred_blocks() to pick blocks for them
+		deferred_requests<peer_connection> m_deferred_requests;
+
 		std::string m_trackerid;
 		std::string m_username;
 		std::string m_password;
@@ -1314,6 +1327,13 @@ namespace libtorrent
 		// the number of pieces we completed the check of
 		int m_num_checked_pieces;
 
+		// the checking rate, in pieces per second. It's measured over a
+		// window of about a second, starting at m_checking_rate_start,
+		// during which m_checking_rate_pieces pieces were checked
+		int m_checking_rate;
+		int m_checking_rate_pieces;
+		ptime m_checking_rate_start;
+
 		// the number of async. operations that need this torrent
 		// loaded in RAM. having a refcount > 0 prevents it from
 		// being unloaded.
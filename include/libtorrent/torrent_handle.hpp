@@ -1450,6 +1450,11 @@ namespace libtorrent
 		int download_rate;
 		int upload_rate;
 
+		// while the torrent is checking its files, the number of pieces
+		// checked per second, measured over the last second or so. 0 when
+		// not checking.
+		int checking_rate;
+
 		// the total transfer rate of payload only, not counting protocol
 		// chatter. This might be slightly smaller than the other rates, but if
 		// projected over a long time (e.g. when calculating ETA:s) the
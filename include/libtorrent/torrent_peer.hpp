@@ -113,6 +113,12 @@ namespace libtorrent
 		// the port this torrent_peer is or was connected on
 		boost::uint16_t port;
 
+		// the entry in the torrent's piece_picker table of block peers
+		// that refers to this torrent_peer, or 0 if it has none. It's
+		// only a hint, the piece picker checks that the entry actually
+		// refers to this peer before using it
+		boost::uint16_t picker_slot;
+
 		// the number of times this torrent_peer has been
 		// part of a piece that failed the hash check
 		boost::uint8_t hashfails;
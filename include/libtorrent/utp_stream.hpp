@@ -240,6 +240,9 @@ public:
 	int send_delay() const;
 	int recv_delay() const;
 
+	// the mean round-trip time of acked packets, in milliseconds
+	int rtt() const;
+
 	void do_connect(tcp::endpoint const& ep, connect_handler_t h);
 
 	endpoint_type local_endpoint() const
@@ -112,7 +112,7 @@ POSSIBILITY OF SUCH DAMAGE.
 	allocated (because it's not known what the block will be used for),
 	evictions are not done at the time of allocating blocks. Instead, whenever
 	an operation requires to add a new piece to the cache, it also records the
-	cache event leading to it, in m_last_cache_op. This is one of cache_miss
+	cache event leading to it, in last_cache_op. This is one of cache_miss
 	(piece did not exist in cache), lru1_ghost_hit (the piece was found in
 	lru1_ghost and it was promoted) or lru2_ghost_hit (the piece was found in
 	lru2_ghost and it was promoted). This cache operation then guides the cache
@@ -162,8 +162,37 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #define DLOG if (DEBUG_CACHE) fprintf
 
+#if TORRENT_USE_INVARIANT_CHECKS
+// the regular INVARIANT_CHECK would look at every shard, but the caller only
+// holds the mutex of one of them. This checks the invariant of a single shard
+#define SHARD_INVARIANT_CHECK(s) \
+	shard_invariant_checker const _invariant_check(*this, s); \
+	(void)_invariant_check; \
+	do {} while (false)
+#else
+#define SHARD_INVARIANT_CHECK(s) do {} while (false)
+#endif
+
 namespace libtorrent {
 
+#if TORRENT_USE_INVARIANT_CHECKS
+namespace {
+
+	struct shard_invariant_checker
+	{
+		shard_invariant_checker(block_cache const& c
+			, block_cache::cache_shard const& s)
+			: cache(c), shard(s)
+		{ cache.check_invariant(shard); }
+		~shard_invariant_checker() { cache.check_invariant(shard); }
+
+		block_cache const& cache;
+		block_cache::cache_shard const& shard;
+	};
+
+} // anonymous namespace
+#endif
+
 #if DEBUG_CACHE
 void log_refcounts(cached_piece_entry const* pe)
 {
@@ -268,29 +297,49 @@ block_cache::block_cache(int block_size, io_service& ios
 	, boost::function<void()> const& trigger_trim
 	, alert_dispatcher* alert_disp)
 	: disk_buffer_pool(block_size, ios, trigger_trim, alert_disp)
-	, m_last_cache_op(cache_miss)
 	, m_ghost_size(8)
-	, m_read_cache_size(0)
-	, m_write_cache_size(0)
-	, m_send_buffer_blocks(0)
-	, m_pinned_blocks(0)
+	, m_adaptive_split(false)
+	, m_write_target(0)
+	, m_max_write_target(0)
 {}
 
+block_cache::cache_shard::cache_shard()
+	: last_cache_op(cache_miss)
+	, read_cache_size(0)
+	, write_cache_size(0)
+	, send_buffer_blocks(0)
+	, pinned_blocks(0)
+{
+	std::fill(hits, hits + cached_piece_entry::num_lrus, 0);
+}
+
+int block_cache::shard_index(piece_manager const* st) const
+{
+	// piece_manager objects are heap allocated, so the lowest bits of
+	// their addresses carry no information
+	std::size_t const p = std::size_t(st);
+	return int(((p >> 4) ^ (p >> 12)) & (num_shards - 1));
+}
+
+mutex& block_cache::cache_mutex(disk_io_job const* j) const
+{
+	return cache_mutex(j->storage.get());
+}
+
 // returns:
 // -1: not in cache
 // -2: no memory
-int block_cache::try_read(disk_io_job* j, bool expect_no_fail)
+int block_cache::try_read(disk_io_job* j)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(j->storage.get());
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_ASSERT(j->buffer == 0);
 
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	TORRENT_ASSERT(!is_deleted_storage(j));
 #endif
 
 	cached_piece_entry* p = find_piece(j);
@@ -299,15 +348,41 @@ int block_cache::try_read(disk_io_job* j, bool expect_no_fail)
 
 	// if the piece cannot be found in the cache,
 	// it's a cache miss
-	TORRENT_ASSERT(!expect_no_fail || p != NULL);
 	if (p == 0) return -1;
 
 #if TORRENT_USE_ASSERTS
 	p->piece_log.push_back(piece_log_t(j->action, j->d.io.offset / 0x4000));
 #endif
-	cache_hit(p, j->requester, j->flags & disk_io_job::volatile_read);
 
-	ret = copy_from_piece(p, j, expect_no_fail);
+	// ghost pieces don't hold any blocks. Finding one is what the ghost
+	// hit counters count, and what moves the piece back into the cache
+	bool const ghost = p->cache_state == cached_piece_entry::read_lru1_ghost
+		|| p->cache_state == cached_piece_entry::read_lru2_ghost;
+	if (ghost) cache_hit(p, j->requester, j->flags & disk_io_job::volatile_read);
+
+	ret = copy_from_piece(p, j);
+	if (ret < 0) return ret;
+
+	// only count it as a hit if the block was actually in the cache
+	if (!ghost) cache_hit(p, j->requester, j->flags & disk_io_job::volatile_read);
+
+	ret = j->d.io.buffer_size;
+	return ret;
+}
+
+int block_cache::read_inserted(disk_io_job* j)
+{
+	cache_shard& s = shard_for(j->storage.get());
+	SHARD_INVARIANT_CHECK(s);
+
+	TORRENT_ASSERT(j->buffer == 0);
+
+	cached_piece_entry* p = find_piece(j);
+	TORRENT_ASSERT(p != NULL);
+	if (p == 0) return -1;
+
+	// insert_blocks() already moved the piece to the list it belongs in
+	int ret = copy_from_piece(p, j, true);
 	if (ret < 0) return ret;
 
 	ret = j->d.io.buffer_size;
@@ -318,7 +393,8 @@ void block_cache::bump_lru(cached_piece_entry* p)
 {
 	// move to the top of the LRU list
 	TORRENT_PIECE_ASSERT(p->cache_state == cached_piece_entry::write_lru, p);
-	linked_list* lru_list = &m_lru[p->cache_state];
+	cache_shard& s = shard_for(p);
+	linked_list* lru_list = &s.lru[p->cache_state];
 
 	// move to the back (MRU) of the list
 	lru_list->erase(p);
@@ -329,6 +405,26 @@ void block_cache::bump_lru(cached_piece_entry* p)
 // this is called for pieces that we're reading from, when they
 // are in the cache (including the ghost lists)
 void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatile_read)
+{
+	TORRENT_ASSERT(p);
+	TORRENT_ASSERT(p->in_use);
+
+	++shard_for(p).hits[p->cache_state];
+
+	// a ghost hit also means the read cache as a whole would have
+	// benefitted from being larger, at the expense of the write cache
+	if (m_adaptive_split
+		&& (p->cache_state == cached_piece_entry::read_lru1_ghost
+		|| p->cache_state == cached_piece_entry::read_lru2_ghost))
+	{
+		adjust_write_target(-int(p->blocks_in_piece));
+	}
+
+	update_cache_state(p, requester, volatile_read);
+}
+
+void block_cache::update_cache_state(cached_piece_entry* p, void* requester
+	, bool volatile_read)
 {
 // this can be pretty expensive
 //	INVARIANT_CHECK;
@@ -336,6 +432,8 @@ void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatil
 	TORRENT_ASSERT(p);
 	TORRENT_ASSERT(p->in_use);
 
+	cache_shard& s = shard_for(p);
+
 	// move the piece into this queue. Whenever we have a cahe
 	// hit, we move the piece into the lru2 queue (i.e. the most
 	// frequently used piece). However, we only do that if the
@@ -384,18 +482,18 @@ void block_cache::cache_hit(cached_piece_entry* p, void* requester, bool volatil
 	// from, next time we need to reclaim blocks
 	if (p->cache_state == cached_piece_entry::read_lru1_ghost)
 	{
-		m_last_cache_op = ghost_hit_lru1;
+		s.last_cache_op = ghost_hit_lru1;
 		p->storage->add_piece(p);
 	}
 	else if (p->cache_state == cached_piece_entry::read_lru2_ghost)
 	{
-		m_last_cache_op = ghost_hit_lru2;
+		s.last_cache_op = ghost_hit_lru2;
 		p->storage->add_piece(p);
 	}
 
 	// move into L2 (frequently used)
-	m_lru[p->cache_state].erase(p);
-	m_lru[target_queue].push_back(p);
+	s.lru[p->cache_state].erase(p);
+	s.lru[target_queue].push_back(p);
 	p->cache_state = target_queue;
 	p->expire = time_now();
 #if TORRENT_USE_ASSERTS
@@ -430,8 +528,9 @@ void block_cache::update_cache_state(cached_piece_entry* p)
 
 	TORRENT_PIECE_ASSERT(state < cached_piece_entry::num_lrus, p);
 	TORRENT_PIECE_ASSERT(desired_state < cached_piece_entry::num_lrus, p);
-	linked_list* src = &m_lru[state];
-	linked_list* dst = &m_lru[desired_state];
+	cache_shard& s = shard_for(p);
+	linked_list* src = &s.lru[state];
+	linked_list* dst = &s.lru[desired_state];
 
 	src->erase(p);
 	dst->push_back(p);
@@ -455,8 +554,9 @@ void block_cache::update_cache_state(cached_piece_entry* p)
 
 cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_state)
 {
+	cache_shard& s = shard_for(j->storage.get());
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(s);
 #endif
 
 	TORRENT_ASSERT(cache_state < cached_piece_entry::num_lrus);
@@ -482,12 +582,12 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 		pe.last_requester = j->requester;
 		TORRENT_PIECE_ASSERT(pe.blocks, &pe);
 		if (!pe.blocks) return 0;
-		p = const_cast<cached_piece_entry*>(&*m_pieces.insert(pe).first);
+		p = const_cast<cached_piece_entry*>(&*s.pieces.insert(pe).first);
 
 		j->storage->add_piece(p);
 
 		TORRENT_PIECE_ASSERT(p->cache_state < cached_piece_entry::num_lrus, p);
-		linked_list* lru_list = &m_lru[p->cache_state];
+		linked_list* lru_list = &s.lru[p->cache_state];
 		lru_list->push_back(p);
 
 		// this piece is part of the ARC cache (as opposed to
@@ -496,7 +596,7 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 		// which end to evict blocks from next time we need to
 		// evict blocks
 		if (cache_state == cached_piece_entry::read_lru1)
-			m_last_cache_op = cache_miss;
+			s.last_cache_op = cache_miss;
 
 #if TORRENT_USE_ASSERTS
 		switch (p->cache_state)
@@ -539,9 +639,9 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 				// we need to add it back to the storage
 				p->storage->add_piece(p);
 			}
-			m_lru[p->cache_state].erase(p);
+			s.lru[p->cache_state].erase(p);
 			p->cache_state = cache_state;
-			m_lru[p->cache_state].push_back(p);
+			s.lru[p->cache_state].push_back(p);
 			p->expire = time_now();
 #if TORRENT_USE_ASSERTS
 			switch (p->cache_state)
@@ -566,10 +666,19 @@ cached_piece_entry* block_cache::allocate_piece(disk_io_job const* j, int cache_
 #if TORRENT_USE_ASSERTS
 void block_cache::mark_deleted(file_storage const& fs)
 {
+	mutex::scoped_lock l(m_deleted_storages_mutex);
 	m_deleted_storages.push_back(std::make_pair(fs.name(), (void const*)&fs));
 	if(m_deleted_storages.size() > 100)
 		m_deleted_storages.erase(m_deleted_storages.begin());
 }
+
+bool block_cache::is_deleted_storage(disk_io_job const* j) const
+{
+	mutex::scoped_lock l(m_deleted_storages_mutex);
+	return std::find(m_deleted_storages.begin(), m_deleted_storages.end()
+		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
+		!= m_deleted_storages.end();
+}
 #endif
 
 cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
@@ -577,20 +686,19 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 #if !defined TORRENT_DISABLE_POOL_ALLOCATOR
 	TORRENT_ASSERT(is_disk_buffer(j->buffer));
 #endif
+	cache_shard& s = shard_for(j->storage.get());
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(s);
 #endif
 
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	TORRENT_ASSERT(!is_deleted_storage(j));
 #endif
 
 	TORRENT_ASSERT(j->buffer);
-	TORRENT_ASSERT(m_write_cache_size + m_read_cache_size + 1 <= in_use());
+	TORRENT_ASSERT(s.write_cache_size + s.read_cache_size + 1 <= int(in_use()));
 
 	cached_piece_entry* pe = allocate_piece(j, cached_piece_entry::write_lru);
 	TORRENT_ASSERT(pe);
@@ -609,7 +717,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 	// this only evicts read blocks
 
 	int evict = num_to_evict(1);
-	if (evict > 0) try_evict_blocks(evict, pe);
+	if (evict > 0) try_evict_blocks(shard_index(j->storage.get()), evict, pe);
 
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
 	TORRENT_PIECE_ASSERT(j->piece == pe->piece, pe);
@@ -637,7 +745,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 	b.dirty = true;
 	++pe->num_blocks;
 	++pe->num_dirty;
-	++m_write_cache_size;
+	++s.write_cache_size;
 	j->buffer = 0;
 	TORRENT_PIECE_ASSERT(j->piece == pe->piece, pe);
 	TORRENT_PIECE_ASSERT(j->flags & disk_io_job::in_progress, pe);
@@ -663,6 +771,7 @@ cached_piece_entry* block_cache::add_dirty_block(disk_io_job* j)
 void block_cache::blocks_flushed(cached_piece_entry* pe, int const* flushed, int num_flushed)
 {
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
+	cache_shard& s = shard_for(pe);
 
 	for (int i = 0; i < num_flushed; ++i)
 	{
@@ -679,16 +788,17 @@ void block_cache::blocks_flushed(cached_piece_entry* pe, int const* flushed, int
 		dec_block_refcount(pe, block, block_cache::ref_flushing);
 	}
 
-	m_write_cache_size -= num_flushed;
-	m_read_cache_size += num_flushed;
+	s.write_cache_size -= num_flushed;
+	s.read_cache_size += num_flushed;
 	pe->num_dirty -= num_flushed;
 
 	update_cache_state(pe);
 }
 
-std::pair<block_cache::iterator, block_cache::iterator> block_cache::all_pieces() const
+std::pair<block_cache::iterator, block_cache::iterator> block_cache::all_pieces(int shard) const
 {
-	return std::make_pair(m_pieces.begin(), m_pieces.end());
+	cache_shard const& s = m_shards[shard];
+	return std::make_pair(s.pieces.begin(), s.pieces.end());
 }
 
 void block_cache::free_block(cached_piece_entry* pe, int block)
@@ -699,6 +809,7 @@ void block_cache::free_block(cached_piece_entry* pe, int block)
 	TORRENT_PIECE_ASSERT(block >= 0, pe);
 
 	cached_block_entry& b = pe->blocks[block];
+	cache_shard& s = shard_for(pe);
 
 	TORRENT_PIECE_ASSERT(b.refcount == 0, pe);
 	TORRENT_PIECE_ASSERT(!b.pending, pe);
@@ -708,13 +819,13 @@ void block_cache::free_block(cached_piece_entry* pe, int block)
 	{
 		--pe->num_dirty;
 		b.dirty = false;
-		TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-		--m_write_cache_size;
+		TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+		--s.write_cache_size;
 	}
 	else
 	{
-		TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-		--m_read_cache_size;
+		TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+		--s.read_cache_size;
 	}
 	TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 	--pe->num_blocks;
@@ -724,7 +835,8 @@ void block_cache::free_block(cached_piece_entry* pe, int block)
 
 bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -742,16 +854,16 @@ bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 		--pe->num_blocks;
 		if (!pe->blocks[i].dirty)
 		{
-			TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-			--m_read_cache_size;
+			TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+			--s.read_cache_size;
 		}
 		else
 		{
 			TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 			--pe->num_dirty;
 			pe->blocks[i].dirty = false;
-			TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-			--m_write_cache_size;
+			TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+			--s.write_cache_size;
 		}
 		if (pe->num_blocks == 0) break;
 	}
@@ -783,7 +895,7 @@ bool block_cache::evict_piece(cached_piece_entry* pe, tailqueue& jobs)
 
 void block_cache::mark_for_deletion(cached_piece_entry* p)
 {
-	INVARIANT_CHECK;
+	SHARD_INVARIANT_CHECK(shard_for(p));
 
 	DLOG(stderr, "[%p] block_cache mark-for-deletion "
 		"piece: %d\n", this, int(p->piece));
@@ -798,12 +910,13 @@ void block_cache::mark_for_deletion(cached_piece_entry* p)
 
 void block_cache::erase_piece(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_PIECE_ASSERT(pe->ok_to_evict(), pe);
 	TORRENT_PIECE_ASSERT(pe->cache_state < cached_piece_entry::num_lrus, pe);
 	TORRENT_PIECE_ASSERT(pe->jobs.empty(), pe);
-	linked_list* lru_list = &m_lru[pe->cache_state];
+	linked_list* lru_list = &s.lru[pe->cache_state];
 	if (pe->hash)
 	{
 		TORRENT_PIECE_ASSERT(pe->hash->offset == 0, pe);
@@ -814,18 +927,20 @@ void block_cache::erase_piece(cached_piece_entry* pe)
 		&& pe->cache_state != cached_piece_entry::read_lru2_ghost)
 		pe->storage->remove_piece(pe);
 	lru_list->erase(pe);
-	m_pieces.erase(*pe);
+	s.pieces.erase(*pe);
 }
 
 // this only evicts read blocks. For write blocks, see
 // try_flush_write_blocks in disk_io_thread.cpp
-int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
+int block_cache::try_evict_blocks(int shard, int num, cached_piece_entry* ignore)
 {
-	INVARIANT_CHECK;
+	TORRENT_ASSERT(shard >= 0 && shard < num_shards);
+	cache_shard& s = m_shards[shard];
+	SHARD_INVARIANT_CHECK(s);
 
 	if (num <= 0) return 0;
 
-	DLOG(stderr, "[%p] try_evict_blocks: %d\n", this, num);
+	DLOG(stderr, "[%p] try_evict_blocks: shard: %d num: %d\n", this, shard, num);
 
 	char** to_delete = TORRENT_ALLOCA(char*, num);
 	int num_to_delete = 0;
@@ -843,37 +958,37 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 	// from the volatile list. These are low priority pieces that were
 	// specifically marked as to not survive long in the cache. These are the
 	// first pieces to go when evicting
-	lru_list[0] = &m_lru[cached_piece_entry::volatile_read_lru];
+	lru_list[0] = &s.lru[cached_piece_entry::volatile_read_lru];
 
-	if (m_last_cache_op == cache_miss)
+	if (s.last_cache_op == cache_miss)
 	{
 		// when there was a cache miss, evict from the largest list, to tend to
 		// keep the lists of equal size when we don't know which one is
 		// performing better
-		if (m_lru[cached_piece_entry::read_lru2].size()
-			> m_lru[cached_piece_entry::read_lru1].size())
+		if (s.lru[cached_piece_entry::read_lru2].size()
+			> s.lru[cached_piece_entry::read_lru1].size())
 		{
-			lru_list[1] = &m_lru[cached_piece_entry::read_lru2];
-			lru_list[2] = &m_lru[cached_piece_entry::read_lru1];
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru2];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru1];
 		}
 		else
 		{
-			lru_list[1] = &m_lru[cached_piece_entry::read_lru1];
-			lru_list[2] = &m_lru[cached_piece_entry::read_lru2];
+			lru_list[1] = &s.lru[cached_piece_entry::read_lru1];
+			lru_list[2] = &s.lru[cached_piece_entry::read_lru2];
 		}
 	}
-	else if (m_last_cache_op == ghost_hit_lru1)
+	else if (s.last_cache_op == ghost_hit_lru1)
 	{
 		// when we insert new items or move things from L1 to L2
 		// evict blocks from L2
-		lru_list[1] = &m_lru[cached_piece_entry::read_lru2];
-		lru_list[2] = &m_lru[cached_piece_entry::read_lru1];
+		lru_list[1] = &s.lru[cached_piece_entry::read_lru2];
+		lru_list[2] = &s.lru[cached_piece_entry::read_lru1];
 	}
 	else
 	{
 		// when we get cache hits in L2 evict from L1
-		lru_list[1] = &m_lru[cached_piece_entry::read_lru1];
-		lru_list[2] = &m_lru[cached_piece_entry::read_lru2];
+		lru_list[1] = &s.lru[cached_piece_entry::read_lru1];
+		lru_list[2] = &s.lru[cached_piece_entry::read_lru2];
 	}
 
 	// end refers to which end of the ARC cache we're evicting
@@ -922,8 +1037,8 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 				b.buf = NULL;
 				TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 				--pe->num_blocks;
-				TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-				--m_read_cache_size;
+				TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+				--s.read_cache_size;
 				--num;
 			}
 
@@ -946,11 +1061,11 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 	// cache, and we might not get to evict anything.
 
 	// TODO: this should probably only be done every n:th time
-	if (num > 0 && m_read_cache_size > m_pinned_blocks)
+	if (num > 0 && s.read_cache_size > s.pinned_blocks)
 	{
 		for (int pass = 0; pass < 2 && num > 0; ++pass)
 		{
-			for (list_iterator i = m_lru[cached_piece_entry::write_lru].iterate(); i.get() && num > 0;)
+			for (list_iterator i = s.lru[cached_piece_entry::write_lru].iterate(); i.get() && num > 0;)
 			{
 				cached_piece_entry* pe = reinterpret_cast<cached_piece_entry*>(i.get());
 				TORRENT_PIECE_ASSERT(pe->in_use, pe);
@@ -994,8 +1109,8 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 					b.buf = NULL;
 					TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 					--pe->num_blocks;
-					TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-					--m_read_cache_size;
+					TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+					--s.read_cache_size;
 					--num;
 				}
 
@@ -1022,36 +1137,40 @@ int block_cache::try_evict_blocks(int num, cached_piece_entry* ignore)
 
 void block_cache::clear(tailqueue& jobs)
 {
-	INVARIANT_CHECK;
-
 	// this holds all the block buffers we want to free
 	// at the end
 	std::vector<char*> bufs;
 
-	for (iterator p = m_pieces.begin()
-		, end(m_pieces.end()); p != end; ++p)
+	for (int k = 0; k < num_shards; ++k)
 	{
-		cached_piece_entry& pe = const_cast<cached_piece_entry&>(*p);
+		cache_shard& s = m_shards[k];
+		SHARD_INVARIANT_CHECK(s);
+
+		for (iterator p = s.pieces.begin()
+			, end(s.pieces.end()); p != end; ++p)
+		{
+			cached_piece_entry& pe = const_cast<cached_piece_entry&>(*p);
 #if TORRENT_USE_ASSERTS
-		for (tailqueue_iterator i = pe.jobs.iterate(); i.get(); i.next())
-			TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
-		for (tailqueue_iterator i = pe.read_jobs.iterate(); i.get(); i.next())
-			TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
+			for (tailqueue_iterator i = pe.jobs.iterate(); i.get(); i.next())
+				TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
+			for (tailqueue_iterator i = pe.read_jobs.iterate(); i.get(); i.next())
+				TORRENT_PIECE_ASSERT(((disk_io_job*)i.get())->piece == pe.piece, &pe);
 #endif
-		// this also removes the jobs from the piece
-		jobs.append(pe.jobs);
-		jobs.append(pe.read_jobs);
+			// this also removes the jobs from the piece
+			jobs.append(pe.jobs);
+			jobs.append(pe.read_jobs);
 
-		drain_piece_bufs(pe, bufs);
-	}
+			drain_piece_bufs(pe, bufs);
+		}
 
-	if (!bufs.empty()) free_multiple_buffers(&bufs[0], bufs.size());
+		// clear lru lists
+		for (int i = 0; i < cached_piece_entry::num_lrus; ++i)
+			s.lru[i].get_all();
 
-	// clear lru lists
-	for (int i = 0; i < cached_piece_entry::num_lrus; ++i)
-		m_lru[i].get_all();
+		s.pieces.clear();
+	}
 
-	m_pieces.clear();
+	if (!bufs.empty()) free_multiple_buffers(&bufs[0], bufs.size());
 }
 
 void block_cache::move_to_ghost(cached_piece_entry* pe)
@@ -1076,8 +1195,10 @@ void block_cache::move_to_ghost(cached_piece_entry* pe)
 		&& pe->cache_state != cached_piece_entry::read_lru2)
 		return;
 
+	cache_shard& s = shard_for(pe);
+
 	// if the ghost list is growing too big, remove the oldest entry
-	linked_list* ghost_list = &m_lru[pe->cache_state + 1];
+	linked_list* ghost_list = &s.lru[pe->cache_state + 1];
 	while (ghost_list->size() >= m_ghost_size)
 	{
 		cached_piece_entry* p = (cached_piece_entry*)ghost_list->front();
@@ -1089,7 +1210,7 @@ void block_cache::move_to_ghost(cached_piece_entry* pe)
 	}
 
 	pe->storage->remove_piece(pe);
-	m_lru[pe->cache_state].erase(pe);
+	s.lru[pe->cache_state].erase(pe);
 	pe->cache_state += 1;
 	ghost_list->push_back(pe);
 }
@@ -1139,7 +1260,8 @@ void block_cache::free_iovec(file::iovec_t* iov, int iov_len)
 void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t *iov
 	, int iov_len, disk_io_job* j, int flags)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_ASSERT(pe);
 	TORRENT_ASSERT(pe->in_use);
@@ -1148,12 +1270,12 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 #if TORRENT_USE_ASSERTS
 	// we're not allowed to add dirty blocks
 	// for a deleted storage!
-	TORRENT_ASSERT(std::find(m_deleted_storages.begin(), m_deleted_storages.end()
-		, std::make_pair(j->storage->files()->name(), (void const*)j->storage->files()))
-		== m_deleted_storages.end());
+	TORRENT_ASSERT(!is_deleted_storage(j));
 #endif
 
-	cache_hit(pe, j->requester, j->flags & disk_io_job::volatile_read);
+	// blocks being inserted weren't found in the cache, so this isn't
+	// counted as a hit
+	update_cache_state(pe, j->requester, j->flags & disk_io_job::volatile_read);
 
 	TORRENT_ASSERT(pe->in_use);
 
@@ -1187,7 +1309,7 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 			TORRENT_PIECE_ASSERT(iov[i].iov_base != NULL, pe);
 			TORRENT_PIECE_ASSERT(pe->blocks[block].dirty == false, pe);
 			++pe->num_blocks;
-			++m_read_cache_size;
+			++s.read_cache_size;
 
 			if (flags & blocks_inc_refcount)
 			{
@@ -1214,7 +1336,7 @@ void block_cache::insert_blocks(cached_piece_entry* pe, int block, file::iovec_t
 					free_buffer(pe->blocks[block].buf);
 					pe->blocks[block].buf = NULL;
 					--pe->num_blocks;
-					--m_read_cache_size;
+					--s.read_cache_size;
 				}
 #endif
 			}
@@ -1239,6 +1361,7 @@ bool block_cache::inc_block_refcount(cached_piece_entry* pe, int block, int reas
 	TORRENT_PIECE_ASSERT(block < pe->blocks_in_piece, pe);
 	TORRENT_PIECE_ASSERT(block >= 0, pe);
 	if (pe->blocks[block].buf == NULL) return false;
+	cache_shard& s = shard_for(pe);
 	TORRENT_PIECE_ASSERT(pe->blocks[block].refcount < cached_block_entry::max_refcount, pe);
 	if (pe->blocks[block].refcount == 0)
 	{
@@ -1264,13 +1387,13 @@ bool block_cache::inc_block_refcount(cached_piece_entry* pe, int block, int reas
 				free_buffer(pe->blocks[block].buf);
 				pe->blocks[block].buf = NULL;
 				--pe->num_blocks;
-				--m_read_cache_size;
+				--s.read_cache_size;
 				return false;
 			}
 		}
 #endif
 		++pe->pinned;
-		++m_pinned_blocks;
+		++s.pinned_blocks;
 	}
 	++pe->blocks[block].refcount;
 	++pe->refcount;
@@ -1293,6 +1416,7 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 
 	TORRENT_PIECE_ASSERT(pe->blocks[block].buf != NULL, pe);
 	TORRENT_PIECE_ASSERT(pe->blocks[block].refcount > 0, pe);
+	cache_shard& s = shard_for(pe);
 	--pe->blocks[block].refcount;
 	TORRENT_PIECE_ASSERT(pe->refcount > 0, pe);
 	--pe->refcount;
@@ -1300,8 +1424,8 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 	{
 		TORRENT_PIECE_ASSERT(pe->pinned > 0, pe);
 		--pe->pinned;
-		TORRENT_PIECE_ASSERT(m_pinned_blocks > 0, pe);
-		--m_pinned_blocks;
+		TORRENT_PIECE_ASSERT(s.pinned_blocks > 0, pe);
+		--s.pinned_blocks;
 
 #if TORRENT_USE_PURGABLE_CONTROL && TORRENT_DISABLE_POOL_ALLOCATOR
 		// we're removing the last refcount to this block, first make sure
@@ -1325,7 +1449,7 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 				free_buffer(pe->blocks[block].buf);
 				pe->blocks[block].buf = NULL;
 				--pe->num_blocks;
-				--m_read_cache_size;
+				--s.read_cache_size;
 			}
 		}
 #endif
@@ -1342,7 +1466,8 @@ void block_cache::dec_block_refcount(cached_piece_entry* pe, int block, int reas
 
 void block_cache::abort_dirty(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -1361,8 +1486,8 @@ void block_cache::abort_dirty(cached_piece_entry* pe)
 		pe->blocks[i].dirty = false;
 		TORRENT_PIECE_ASSERT(pe->num_blocks > 0, pe);
 		--pe->num_blocks;
-		TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-		--m_write_cache_size;
+		TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+		--s.write_cache_size;
 		TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 		--pe->num_dirty;
 	}
@@ -1375,7 +1500,8 @@ void block_cache::abort_dirty(cached_piece_entry* pe)
 // be called for pieces with a refcount of 0
 void block_cache::free_piece(cached_piece_entry* pe)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
 
@@ -1399,15 +1525,15 @@ void block_cache::free_piece(cached_piece_entry* pe)
 		--pe->num_blocks;
 		if (pe->blocks[i].dirty)
 		{
-			TORRENT_PIECE_ASSERT(m_write_cache_size > 0, pe);
-			--m_write_cache_size;
+			TORRENT_PIECE_ASSERT(s.write_cache_size > 0, pe);
+			--s.write_cache_size;
 			TORRENT_PIECE_ASSERT(pe->num_dirty > 0, pe);
 			--pe->num_dirty;
 		}
 		else
 		{
-			TORRENT_PIECE_ASSERT(m_read_cache_size > 0, pe);
-			--m_read_cache_size;
+			TORRENT_PIECE_ASSERT(s.read_cache_size > 0, pe);
+			--s.read_cache_size;
 		}
 	}
 	if (num_to_delete) free_multiple_buffers(to_delete, num_to_delete);
@@ -1419,6 +1545,7 @@ int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 	int piece_size = p.storage->files()->piece_size(p.piece);
 	int blocks_in_piece = (piece_size + block_size() - 1) / block_size();
 	int ret = 0;
+	cache_shard& s = shard_for(&p);
 
 	TORRENT_PIECE_ASSERT(p.in_use, &p);
 
@@ -1434,15 +1561,15 @@ int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 
 		if (p.blocks[i].dirty)
 		{
-			TORRENT_ASSERT(m_write_cache_size > 0);
-			--m_write_cache_size;
+			TORRENT_ASSERT(s.write_cache_size > 0);
+			--s.write_cache_size;
 			TORRENT_PIECE_ASSERT(p.num_dirty > 0, &p);
 			--p.num_dirty;
 		}
 		else
 		{
-			TORRENT_ASSERT(m_read_cache_size > 0);
-			--m_read_cache_size;
+			TORRENT_ASSERT(s.read_cache_size > 0);
+			--s.read_cache_size;
 		}
 	}
 	update_cache_state(&p);
@@ -1451,33 +1578,118 @@ int block_cache::drain_piece_bufs(cached_piece_entry& p, std::vector<char*>& buf
 
 void block_cache::update_stats_counters(counters& c) const
 {
-	c.set_value(counters::write_cache_blocks, m_write_cache_size);
-	c.set_value(counters::read_cache_blocks, m_read_cache_size);
-	c.set_value(counters::pinned_blocks, m_pinned_blocks);
-
-	c.set_value(counters::arc_mru_size, m_lru[cached_piece_entry::read_lru1].size());
-	c.set_value(counters::arc_mru_ghost_size, m_lru[cached_piece_entry::read_lru1_ghost].size());
-	c.set_value(counters::arc_mfu_size, m_lru[cached_piece_entry::read_lru2].size());
-	c.set_value(counters::arc_mfu_ghost_size, m_lru[cached_piece_entry::read_lru2_ghost].size());
-	c.set_value(counters::arc_write_size, m_lru[cached_piece_entry::write_lru].size());
-	c.set_value(counters::arc_volatile_size, m_lru[cached_piece_entry::volatile_read_lru].size());
+	disk_buffer_pool::update_stats_counters(c);
+
+	cache_status st;
+	get_stats(&st);
+
+	boost::uint64_t hits[cached_piece_entry::num_lrus];
+	std::fill(hits, hits + cached_piece_entry::num_lrus, 0);
+	for (int i = 0; i < num_shards; ++i)
+	{
+		cache_shard const& s = m_shards[i];
+		mutex::scoped_lock l(s.mtx);
+		for (int k = 0; k < cached_piece_entry::num_lrus; ++k)
+			hits[k] += s.hits[k];
+	}
+
+	c.set_value(counters::arc_write_hits, hits[cached_piece_entry::write_lru]);
+	c.set_value(counters::arc_volatile_hits, hits[cached_piece_entry::volatile_read_lru]);
+	c.set_value(counters::arc_mru_hits, hits[cached_piece_entry::read_lru1]);
+	c.set_value(counters::arc_mru_ghost_hits, hits[cached_piece_entry::read_lru1_ghost]);
+	c.set_value(counters::arc_mfu_hits, hits[cached_piece_entry::read_lru2]);
+	c.set_value(counters::arc_mfu_ghost_hits, hits[cached_piece_entry::read_lru2_ghost]);
+	c.set_value(counters::arc_write_target, m_adaptive_split ? int(m_write_target) : 0);
+
+	c.set_value(counters::write_cache_blocks, st.write_cache_size);
+	c.set_value(counters::read_cache_blocks, st.read_cache_size);
+	c.set_value(counters::pinned_blocks, st.pinned_blocks);
+
+	c.set_value(counters::arc_mru_size, st.arc_mru_size);
+	c.set_value(counters::arc_mru_ghost_size, st.arc_mru_ghost_size);
+	c.set_value(counters::arc_mfu_size, st.arc_mfu_size);
+	c.set_value(counters::arc_mfu_ghost_size, st.arc_mfu_ghost_size);
+	c.set_value(counters::arc_write_size, st.arc_write_size);
+	c.set_value(counters::arc_volatile_size, st.arc_volatile_size);
 }
 
+// sums up the stats of all shards, locking them one at a time
 void block_cache::get_stats(cache_status* ret) const
 {
-	ret->write_cache_size = m_write_cache_size;
-	ret->read_cache_size = m_read_cache_size;
-	ret->pinned_blocks = m_pinned_blocks;
+	ret->write_cache_size = 0;
+	ret->read_cache_size = 0;
+	ret->pinned_blocks = 0;
+	ret->arc_mru_size = 0;
+	ret->arc_mru_ghost_size = 0;
+	ret->arc_mfu_size = 0;
+	ret->arc_mfu_ghost_size = 0;
+	ret->arc_write_size = 0;
+	ret->arc_volatile_size = 0;
+
+	for (int i = 0; i < num_shards; ++i)
+	{
+		cache_shard const& s = m_shards[i];
+		mutex::scoped_lock l(s.mtx);
+
+		ret->write_cache_size += s.write_cache_size;
+		ret->read_cache_size += s.read_cache_size;
+		ret->pinned_blocks += s.pinned_blocks;
+
+		ret->arc_mru_size += s.lru[cached_piece_entry::read_lru1].size();
+		ret->arc_mru_ghost_size += s.lru[cached_piece_entry::read_lru1_ghost].size();
+		ret->arc_mfu_size += s.lru[cached_piece_entry::read_lru2].size();
+		ret->arc_mfu_ghost_size += s.lru[cached_piece_entry::read_lru2_ghost].size();
+		ret->arc_write_size += s.lru[cached_piece_entry::write_lru].size();
+		ret->arc_volatile_size += s.lru[cached_piece_entry::volatile_read_lru].size();
+	}
 #ifndef TORRENT_NO_DEPRECATE
-	ret->cache_size = m_read_cache_size + m_write_cache_size;
+	ret->cache_size = ret->read_cache_size + ret->write_cache_size;
 #endif
+}
 
-	ret->arc_mru_size = m_lru[cached_piece_entry::read_lru1].size();
-	ret->arc_mru_ghost_size = m_lru[cached_piece_entry::read_lru1_ghost].size();
-	ret->arc_mfu_size = m_lru[cached_piece_entry::read_lru2].size();
-	ret->arc_mfu_ghost_size = m_lru[cached_piece_entry::read_lru2_ghost].size();
-	ret->arc_write_size = m_lru[cached_piece_entry::write_lru].size();
-	ret->arc_volatile_size = m_lru[cached_piece_entry::volatile_read_lru].size();
+int block_cache::write_cache_size() const
+{
+	int ret = 0;
+	for (int i = 0; i < num_shards; ++i)
+	{
+		mutex::scoped_lock l(m_shards[i].mtx);
+		ret += m_shards[i].write_cache_size;
+	}
+	return ret;
+}
+
+int block_cache::write_cache_target() const
+{
+	if (!m_adaptive_split) return -1;
+	return m_write_target;
+}
+
+void block_cache::write_cache_miss(cached_piece_entry* p, int num_blocks)
+{
+	if (!m_adaptive_split) return;
+	if (p->cache_state != cached_piece_entry::write_lru) return;
+	adjust_write_target(num_blocks);
+}
+
+void block_cache::adjust_write_target(int delta)
+{
+	int target = m_write_target;
+	int new_target;
+	do
+	{
+		new_target = (std::max)(0, (std::min)(target + delta, m_max_write_target));
+	} while (!m_write_target.compare_exchange_weak(target, new_target));
+}
+
+int block_cache::pinned_blocks() const
+{
+	int ret = 0;
+	for (int i = 0; i < num_shards; ++i)
+	{
+		mutex::scoped_lock l(m_shards[i].mtx);
+		ret += m_shards[i].pinned_blocks;
+	}
+	return ret;
 }
 
 void block_cache::set_settings(aux::session_settings const& sett)
@@ -1490,10 +1702,21 @@ void block_cache::set_settings(aux::session_settings const& sett)
 	m_ghost_size = (std::max)(8, sett.get_int(settings_pack::cache_size)
 		/ (std::max)(sett.get_int(settings_pack::read_cache_line_size), 4) / 2);
 	disk_buffer_pool::set_settings(sett);
+
+	bool const was_adaptive = m_adaptive_split;
+	m_adaptive_split = sett.get_bool(settings_pack::adaptive_cache_split);
+	m_max_write_target = (std::max)(m_max_use, 0);
+
+	// when first enabled, start out by giving half of the cache to the
+	// write cache, and let it adapt from there
+	if (m_adaptive_split && !was_adaptive)
+		m_write_target = m_max_write_target / 2;
+	else if (m_write_target > m_max_write_target)
+		m_write_target = m_max_write_target;
 }
 
 #if TORRENT_USE_INVARIANT_CHECKS
-void block_cache::check_invariant() const
+void block_cache::check_invariant(cache_shard const& s) const
 {
 	int cached_write_blocks = 0;
 	int cached_read_blocks = 0;
@@ -1505,7 +1728,7 @@ void block_cache::check_invariant() const
 	{
 		ptime timeout = min_time();
 
-		for (list_iterator p = m_lru[i].iterate(); p.get(); p.next())
+		for (list_iterator p = s.lru[i].iterate(); p.get(); p.next())
 		{
 			cached_piece_entry* pe = (cached_piece_entry*)p.get();
 			TORRENT_PIECE_ASSERT(pe->cache_state == i, pe);
@@ -1554,7 +1777,7 @@ void block_cache::check_invariant() const
 	}
 
 	boost::unordered_set<char*> buffers;
-	for (iterator i = m_pieces.begin(), end(m_pieces.end()); i != end; ++i)
+	for (iterator i = s.pieces.begin(), end(s.pieces.end()); i != end; ++i)
 	{
 		cached_piece_entry const& p = *i;
 		TORRENT_PIECE_ASSERT(p.blocks, &p);
@@ -1618,10 +1841,10 @@ void block_cache::check_invariant() const
 		TORRENT_PIECE_ASSERT(num_refcount == p.refcount, &p);
 		TORRENT_PIECE_ASSERT(num_dirty == p.num_dirty, &p);
 	}
-	TORRENT_ASSERT(m_read_cache_size == cached_read_blocks);
-	TORRENT_ASSERT(m_write_cache_size == cached_write_blocks);
-	TORRENT_ASSERT(m_pinned_blocks == num_pinned);
-	TORRENT_ASSERT(m_write_cache_size + m_read_cache_size <= in_use());
+	TORRENT_ASSERT(s.read_cache_size == cached_read_blocks);
+	TORRENT_ASSERT(s.write_cache_size == cached_write_blocks);
+	TORRENT_ASSERT(s.pinned_blocks == num_pinned);
+	TORRENT_ASSERT(s.write_cache_size + s.read_cache_size <= int(in_use()));
 }
 #endif
 
@@ -1631,7 +1854,8 @@ void block_cache::check_invariant() const
 
 int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool expect_no_fail)
 {
-	INVARIANT_CHECK;
+	cache_shard& s = shard_for(pe);
+	SHARD_INVARIANT_CHECK(s);
 
 	TORRENT_PIECE_ASSERT(j->buffer == 0, pe);
 	TORRENT_PIECE_ASSERT(pe->in_use, pe);
@@ -1677,7 +1901,7 @@ int block_cache::copy_from_piece(cached_piece_entry* pe, disk_io_job* j, bool ex
 		j->d.io.ref.piece = pe->piece;
 		j->d.io.ref.block = start_block;
 		j->buffer = bl.buf + (j->d.io.offset & (block_size()-1));
-		++m_send_buffer_blocks;
+		++s.send_buffer_blocks;
 #if TORRENT_USE_ASSERTS
 		++bl.reading_count;
 #endif
@@ -1728,8 +1952,9 @@ void block_cache::reclaim_block(block_cache_reference const& ref)
 	TORRENT_PIECE_ASSERT(pe->blocks[ref.block].buf, pe);
 	dec_block_refcount(pe, ref.block, block_cache::ref_reading);
 
-	TORRENT_PIECE_ASSERT(m_send_buffer_blocks > 0, pe);
-	--m_send_buffer_blocks;
+	cache_shard& s = shard_for(pe);
+	TORRENT_PIECE_ASSERT(s.send_buffer_blocks > 0, pe);
+	--s.send_buffer_blocks;
 
 	maybe_free_piece(pe);
 }
@@ -1770,9 +1995,10 @@ cached_piece_entry* block_cache::find_piece(piece_manager* st, int piece)
 	cached_piece_entry model;
 	model.storage = st->shared_from_this();
 	model.piece = piece;
-	iterator i = m_pieces.find(model);
-	TORRENT_ASSERT(i == m_pieces.end() || (i->storage.get() == st && i->piece == piece));
-	if (i == m_pieces.end()) return 0;
+	cache_shard& s = shard_for(st);
+	iterator i = s.pieces.find(model);
+	TORRENT_ASSERT(i == s.pieces.end() || (i->storage.get() == st && i->piece == piece));
+	if (i == s.pieces.end()) return 0;
 	TORRENT_PIECE_ASSERT(i->in_use, &*i);
 
 #if TORRENT_USE_ASSERTS
@@ -111,6 +111,7 @@ namespace libtorrent
 		, m_our_peer_id(pid)
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		, m_sync_bytes_read(0)
+		, m_encrypt_pending(0)
 #endif
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		, m_upload_only_id(0)
@@ -412,6 +413,15 @@ namespace libtorrent
 		return m_state < read_packet_size;
 	}
 
+	int bt_peer_connection::expected_piece_header_size() const
+	{
+		// at the start of a message, a piece message has a 4 byte length
+		// prefix, the message id and the piece index and offset in front
+		// of the payload
+		if (m_state != read_packet_size || receive_pos() != 0) return 0;
+		return 4 + 1 + 8;
+	}
+
 #ifndef TORRENT_DISABLE_ENCRYPTION
 
 	void bt_peer_connection::write_pe1_2_dhkey()
@@ -428,7 +438,21 @@ namespace libtorrent
 			peer_log("*** initiating encrypted handshake");
 #endif
 
-		m_dh_key_exchange.reset(new (std::nothrow) dh_key_exchange);
+		// computing the local key is expensive. Take one that was computed
+		// ahead of time if there is one
+		m_dh_key_exchange.reset(m_ses.take_dh_key());
+		if (m_dh_key_exchange)
+		{
+			stats_counters().inc_stats_counter(counters::dh_key_pool_hits);
+		}
+		else
+		{
+			stats_counters().inc_stats_counter(counters::dh_key_pool_misses);
+			ptime const start = time_now_hires();
+			m_dh_key_exchange.reset(new (std::nothrow) dh_key_exchange);
+			stats_counters().inc_stats_counter(counters::dh_handshake_time
+				, total_microseconds(time_now_hires() - start));
+		}
 		if (!m_dh_key_exchange || !m_dh_key_exchange->good())
 		{
 			disconnect(errors::no_memory, op_encryption);
@@ -692,16 +716,21 @@ namespace libtorrent
 #ifndef TORRENT_DISABLE_ENCRYPTION
 		if (m_encrypted && m_rc4_encrypted)
 		{
-			// if we're encrypting this buffer, we need to make a copy
-			// since we'll mutate it
+			// we can't mutate this buffer, so it's encrypted into a copy
+			// of it. Everything in front of it has to be encrypted first
+			encrypt_pending_send_buffer();
 			char* buf = (char*)malloc(size);
-			memcpy(buf, buffer, size);
-			bt_peer_connection::append_send_buffer(buf, size, &regular_c_free, NULL);
+			m_enc_handler->encrypt_copy(buf, buffer, size);
+			peer_connection::append_send_buffer(buf, size, &regular_c_free
+				, NULL, block_cache_reference(), true);
 			destructor((char*)buffer, userdata, ref);
 		}
 		else
 #endif
 		{
+#ifndef TORRENT_DISABLE_ENCRYPTION
+			encrypt_pending_send_buffer();
+#endif
 			peer_connection::append_const_send_buffer(buffer, size, destructor
 				, userdata, ref);
 		}
@@ -713,18 +742,36 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(encrypted == false);
 #ifndef TORRENT_DISABLE_ENCRYPTION
-		if (m_rc4_encrypted)
-			m_enc_handler->encrypt(buffer, size);
+		if (m_rc4_encrypted) m_encrypt_pending += size;
+		else encrypt_pending_send_buffer();
 #endif
 		peer_connection::append_send_buffer(buffer, size, destructor
 			, userdata, ref, true);
 	}
 
+	void bt_peer_connection::setup_send()
+	{
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		encrypt_pending_send_buffer();
+#endif
+		peer_connection::setup_send();
+	}
+
 #ifndef TORRENT_DISABLE_ENCRYPTION
 	void encrypt(char* buf, int len, void* userdata)
 	{
-		rc4_handler* rc4 = (rc4_handler*)userdata;
-		rc4->encrypt(buf, len);
+		encryption_handler* h = (encryption_handler*)userdata;
+		h->encrypt(buf, len);
+	}
+
+	void bt_peer_connection::encrypt_pending_send_buffer()
+	{
+		if (m_encrypt_pending == 0) return;
+		int const bytes = (std::min)(m_encrypt_pending, send_buffer_size());
+		m_encrypt_pending = 0;
+		if (is_disconnecting()) return;
+		TORRENT_ASSERT(m_enc_handler);
+		apply_to_send_buffer_tail(bytes, &encrypt, m_enc_handler.get());
 	}
 #endif
 
@@ -735,18 +782,16 @@ namespace libtorrent
 		TORRENT_ASSERT(ud == 0);
 		TORRENT_ASSERT(buf);
 		TORRENT_ASSERT(size > 0);
-		
-		void* userdata = 0;
-		void (*fun)(char*, int, void*) = 0;
+
 #ifndef TORRENT_DISABLE_ENCRYPTION
-		if (m_encrypted && m_rc4_encrypted)
-		{
-			fun = encrypt;
-			userdata = m_enc_handler.get();
-		}
+		// the buffer is encrypted along with everything else appended
+		// before the next send. peer_connection::send_buffer() may call
+		// setup_send() once it has appended all of it
+		if (m_encrypted && m_rc4_encrypted) m_encrypt_pending += size;
+		else encrypt_pending_send_buffer();
 #endif
-		
-		peer_connection::send_buffer(buf, size, flags, fun, userdata);
+
+		peer_connection::send_buffer(buf, size, flags);
 	}
 
 	void bt_peer_connection::write_handshake(bool plain_handshake)
@@ -1177,7 +1222,11 @@ namespace libtorrent
 					return;
 				}
 
-				if (!m_settings.get_bool(settings_pack::contiguous_recv_buffer))
+				// with the contiguous receive buffer, the payload is only
+				// received into a disk buffer if it was received
+				// speculatively
+				if (!m_settings.get_bool(settings_pack::contiguous_recv_buffer)
+					|| has_spec_receive_buffer())
 				{
 					if (!allocate_disk_receive_buffer(packet_size() - 9))
 					{
@@ -2449,10 +2498,10 @@ namespace libtorrent
 		buf->free_disk_buffer(buffer);
 	}
 
-	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	// writes the header of a piece message (and the merkle hashes, if
+	// any), the caller appends the block itself
+	void bt_peer_connection::write_piece_header(peer_request const& r)
 	{
-		INVARIANT_CHECK;
-
 		TORRENT_ASSERT(m_sent_handshake && m_sent_bitfield);
 
 		boost::shared_ptr<torrent> t = associated_torrent().lock();
@@ -2505,6 +2554,13 @@ namespace libtorrent
 		{
 			send_buffer(msg, 13);
 		}
+	}
+
+	void bt_peer_connection::write_piece(peer_request const& r, disk_buffer_holder& buffer)
+	{
+		INVARIANT_CHECK;
+
+		write_piece_header(r);
 
 		if (buffer.ref().storage == 0)
 		{
@@ -2517,6 +2573,9 @@ namespace libtorrent
 				, &buffer_reclaim_block, &m_allocator, buffer.ref());
 		}
 		buffer.release();
+		// the block (or the encrypted copy of it) isn't modified again once
+		// it's in the send buffer
+		allow_zero_copy_send();
 
 		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
 		setup_send();
@@ -2524,6 +2583,36 @@ namespace libtorrent
 		stats_counters().inc_stats_counter(counters::num_outgoing_piece);
 	}
 
+	void bt_peer_connection::write_piece_from_file(peer_request const& r
+		, file_region* region)
+	{
+		INVARIANT_CHECK;
+
+		TORRENT_ASSERT(can_send_from_file());
+
+		write_piece_header(r);
+		append_send_file(region, r.length);
+
+		m_payloads.push_back(range(send_buffer_size() - r.length, r.length));
+		setup_send();
+
+		stats_counters().inc_stats_counter(counters::num_outgoing_piece);
+	}
+
+	bool bt_peer_connection::can_send_from_file() const
+	{
+#if TORRENT_USE_SENDFILE
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// the payload has to go out exactly as it's stored on disk
+		if (m_rc4_encrypted) return false;
+#endif
+		return m_settings.get_bool(settings_pack::zero_copy_upload)
+			&& get_socket()->get<tcp::socket>() != NULL;
+#else
+		return false;
+#endif
+	}
+
 	// --------------------------
 	// RECEIVE DATA
 	// --------------------------
@@ -2578,7 +2667,11 @@ namespace libtorrent
 			if (is_disconnecting()) return;
 			
 			// read dh key, generate shared secret
-			if (m_dh_key_exchange->compute_secret(recv_buffer.begin) == -1)
+			ptime const start = time_now_hires();
+			int const ret = m_dh_key_exchange->compute_secret(recv_buffer.begin);
+			stats_counters().inc_stats_counter(counters::dh_handshake_time
+				, total_microseconds(time_now_hires() - start));
+			if (ret == -1)
 			{
 				disconnect(errors::no_memory, op_encryption);
 				return;
@@ -33,6 +33,8 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/chained_buffer.hpp"
 #include "libtorrent/assert.hpp"
 
+#include <algorithm> // for min
+
 namespace libtorrent
 {
 	void chained_buffer::pop_front(int bytes_to_pop)
@@ -44,7 +46,8 @@ namespace libtorrent
 			buffer_t& b = m_vec.front();
 			if (b.used_size > bytes_to_pop)
 			{
-				b.start += bytes_to_pop;
+				if (b.fd != -1) b.file_offset += bytes_to_pop;
+				else b.start += bytes_to_pop;
 				b.used_size -= bytes_to_pop;
 				m_bytes -= bytes_to_pop;
 				TORRENT_ASSERT(m_bytes <= m_capacity);
@@ -53,7 +56,8 @@ namespace libtorrent
 				break;
 			}
 
-			b.free_fun(b.buf, b.userdata, b.ref);
+			if (m_hold) m_held.push_back(std::make_pair(m_hold_tag, b));
+			else b.free_fun(b.buf, b.userdata, b.ref);
 			m_bytes -= b.used_size;
 			m_capacity -= b.size;
 			bytes_to_pop -= b.used_size;
@@ -78,6 +82,9 @@ namespace libtorrent
 		b.free_fun = destructor;
 		b.userdata = userdata;
 		b.ref = ref;
+		b.fd = -1;
+		b.file_offset = 0;
+		b.zero_copy = false;
 		m_vec.push_back(b);
 
 		m_bytes += used_size;
@@ -85,6 +92,41 @@ namespace libtorrent
 		TORRENT_ASSERT(m_bytes <= m_capacity);
 	}
 
+	void chained_buffer::append_file(int fd, size_type offset, int size
+		, free_buffer_fun destructor, void* userdata)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(fd != -1);
+		TORRENT_ASSERT(size > 0);
+		buffer_t b;
+		b.buf = NULL;
+		b.size = size;
+		b.start = NULL;
+		b.used_size = size;
+		b.free_fun = destructor;
+		b.userdata = userdata;
+		b.ref = block_cache_reference();
+		b.fd = fd;
+		b.file_offset = offset;
+		b.zero_copy = false;
+		m_vec.push_back(b);
+
+		m_bytes += size;
+		m_capacity += size;
+		TORRENT_ASSERT(m_bytes <= m_capacity);
+	}
+
+	int chained_buffer::front_file(size_type& offset, int& size) const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		if (m_vec.empty()) return -1;
+		buffer_t const& b = m_vec.front();
+		if (b.fd == -1) return -1;
+		offset = b.file_offset;
+		size = b.used_size;
+		return b.fd;
+	}
+
 	// returns the number of bytes available at the
 	// end of the last chained buffer.
 	int chained_buffer::space_in_last_buffer()
@@ -92,6 +134,7 @@ namespace libtorrent
 		TORRENT_ASSERT(is_single_thread());
 		if (m_vec.empty()) return 0;
 		buffer_t& b = m_vec.back();
+		if (b.fd != -1) return 0;
 		return b.size - b.used_size - (b.start - b.buf);
 	}
 
@@ -115,6 +158,7 @@ namespace libtorrent
 		TORRENT_ASSERT(is_single_thread());
 		if (m_vec.empty()) return 0;
 		buffer_t& b = m_vec.back();
+		if (b.fd != -1) return 0;
 		char* insert = b.start + b.used_size;
 		if (insert + s > b.buf + b.size) return 0;
 		b.used_size += s;
@@ -131,6 +175,7 @@ namespace libtorrent
 		for (std::deque<buffer_t>::iterator i = m_vec.begin()
 			, end(m_vec.end()); to_send > 0 && i != end; ++i)
 		{
+			if (i->fd != -1) break;
 			if (i->used_size > to_send)
 			{
 				TORRENT_ASSERT(to_send > 0);
@@ -144,6 +189,82 @@ namespace libtorrent
 		return m_tmp_vec;
 	}
 
+	void chained_buffer::apply_to_tail(int bytes
+		, void (*fun)(char*, int, void*), void* userdata)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(bytes >= 0);
+		TORRENT_ASSERT(bytes <= m_bytes);
+		if (bytes <= 0) return;
+
+		// find the buffer the tail starts in
+		std::deque<buffer_t>::iterator i = m_vec.end();
+		int offset = 0;
+		int left = bytes;
+		while (left > 0)
+		{
+			TORRENT_ASSERT(i != m_vec.begin());
+			--i;
+			if (i->used_size >= left)
+			{
+				offset = i->used_size - left;
+				break;
+			}
+			left -= i->used_size;
+		}
+
+		for (std::deque<buffer_t>::iterator end(m_vec.end()); i != end; ++i)
+		{
+			TORRENT_ASSERT(i->fd == -1);
+			int const size = i->used_size - offset;
+			if (size > 0) fun(i->start + offset, size, userdata);
+			offset = 0;
+		}
+	}
+
+	void chained_buffer::set_zero_copy_back()
+	{
+		TORRENT_ASSERT(is_single_thread());
+		TORRENT_ASSERT(!m_vec.empty());
+		if (m_vec.empty()) return;
+		TORRENT_ASSERT(m_vec.back().fd == -1);
+		m_vec.back().zero_copy = true;
+	}
+
+	int chained_buffer::zero_copy_bytes(int to_send) const
+	{
+		TORRENT_ASSERT(is_single_thread());
+		int ret = 0;
+		for (std::deque<buffer_t>::const_iterator i = m_vec.begin()
+			, end(m_vec.end()); to_send > 0 && i != end; ++i)
+		{
+			if (i->fd != -1) break;
+			int const size = (std::min)(i->used_size, to_send);
+			if (i->zero_copy) ret += size;
+			to_send -= size;
+		}
+		return ret;
+	}
+
+	void chained_buffer::hold_popped(bool hold, boost::uint32_t tag)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		m_hold = hold;
+		m_hold_tag = tag;
+	}
+
+	void chained_buffer::release_held(boost::uint32_t tag)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		// buffers are held in the order they're popped, with increasing tags
+		while (!m_held.empty() && boost::int32_t(tag - m_held.front().first) >= 0)
+		{
+			buffer_t& b = m_held.front().second;
+			b.free_fun(b.buf, b.userdata, b.ref);
+			m_held.pop_front();
+		}
+	}
+
 	void chained_buffer::clear()
 	{
 		for (std::deque<buffer_t>::iterator i = m_vec.begin()
@@ -154,6 +275,7 @@ namespace libtorrent
 		m_bytes = 0;
 		m_capacity = 0;
 		m_vec.clear();
+		m_hold = false;
 	}
 
 	chained_buffer::~chained_buffer()
@@ -166,6 +288,15 @@ namespace libtorrent
 		TORRENT_ASSERT(m_bytes >= 0);
 		TORRENT_ASSERT(m_capacity >= 0);
 		clear();
+
+		// nothing can tell us about the kernel being done with the held
+		// buffers anymore. The owner is expected to have made sure it is
+		// (see release_held())
+		for (std::deque<std::pair<boost::uint32_t, buffer_t> >::iterator i
+			= m_held.begin(), end(m_held.end()); i != end; ++i)
+		{
+			i->second.free_fun(i->second.buf, i->second.userdata, i->second.ref);
+		}
 	}
 
 }
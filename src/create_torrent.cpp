@@ -37,15 +37,29 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/disk_io_thread.hpp"
 #include "libtorrent/torrent_info.hpp" // for merkle_*()
 #include "libtorrent/performance_counters.hpp" // for counters
+#include "libtorrent/multi_hasher.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/allocator.hpp" // for page_aligned_allocator
+#include "libtorrent/thread.hpp"
+#include "libtorrent/file.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/next_prior.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <deque>
+#include <vector>
+#include <cstring> // for memset
 
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifndef TORRENT_WINDOWS
+#include <unistd.h> // for sysconf
+#endif
+
 #define MAX_SYMLINK_PATH 200
 
 namespace libtorrent
@@ -182,6 +196,378 @@ namespace libtorrent
 		iothread->submit_jobs();
 	}
 
+	namespace
+	{
+		int num_cpu_cores()
+		{
+#if defined TORRENT_WINDOWS
+			SYSTEM_INFO si;
+			GetSystemInfo(&si);
+			return (std::max)(int(si.dwNumberOfProcessors), 1);
+#elif defined _SC_NPROCESSORS_ONLN
+			long n = sysconf(_SC_NPROCESSORS_ONLN);
+			return n < 1 ? 1 : int(n);
+#else
+			return 1;
+#endif
+		}
+
+		// the parallel mode of set_piece_hashes(). The calling thread reads
+		// the files front to back, a chunk of whole pieces at a time, and
+		// hands each chunk to a pool of hasher threads, one per core. File
+		// hashes need to see the data in order, so they are computed by one
+		// more thread, which sees every chunk in the order it was read. A
+		// chunk's buffer is reused once both have let go of it, which bounds
+		// the read-ahead to the number of chunks allocated up-front.
+		struct parallel_hasher : boost::noncopyable
+		{
+			parallel_hasher(create_torrent& t, std::string const& path
+				, boost::function<void(int)> const& f);
+			~parallel_hasher();
+
+			void run(error_code& ec);
+
+		private:
+
+			struct chunk
+			{
+				char* buffer;
+				int first_piece;
+				int num_pieces;
+				int size;
+				// the number of threads (piece and file hashing) that
+				// still need this chunk's buffer
+				int refs;
+			};
+
+			bool read_chunk(chunk& c, error_code& ec);
+			void release_chunk(chunk* c);
+
+			void piece_thread();
+			void file_thread();
+
+			// the size of a chunk we aim for, and the total amount of
+			// read-ahead. Both are rounded up to whole pieces, and there are
+			// always enough chunks to keep every hasher thread busy.
+			enum
+			{
+				chunk_size = 4 * 1024 * 1024,
+				read_ahead = 64 * 1024 * 1024
+			};
+
+			create_torrent& m_torrent;
+			file_storage const& m_files;
+			std::string const& m_path;
+			boost::function<void(int)> const& m_progress;
+
+			// the file we're currently reading from, and its index. Only
+			// touched by the reading thread
+			boost::intrusive_ptr<file> m_file;
+			int m_file_index;
+
+			std::vector<chunk> m_chunks;
+			std::vector<boost::shared_ptr<thread> > m_threads;
+
+			// the file hashes, indexed by file. Only touched by the file
+			// hashing thread until it's been joined
+			std::vector<sha1_hash> m_file_hashes;
+
+			// protects everything below
+			mutex m_mutex;
+			condition_variable m_cond;
+
+			std::vector<chunk*> m_free_chunks;
+			std::deque<chunk*> m_piece_queue;
+			std::deque<chunk*> m_file_queue;
+
+			// piece hashes that have been computed but not yet passed on to
+			// the create_torrent object. The calling thread picks them up
+			std::vector<std::pair<int, sha1_hash> > m_hashes;
+
+			// set when there are no more chunks coming. Once the queues are
+			// empty, the threads exit
+			bool m_done_reading;
+
+			// set on error, to make the threads exit without finishing the
+			// chunks in their queues
+			bool m_abort;
+		};
+
+		parallel_hasher::parallel_hasher(create_torrent& t, std::string const& path
+			, boost::function<void(int)> const& f)
+			: m_torrent(t)
+			, m_files(t.files())
+			, m_path(path)
+			, m_progress(f)
+			, m_file_index(-1)
+			, m_done_reading(false)
+			, m_abort(false)
+		{}
+
+		parallel_hasher::~parallel_hasher()
+		{
+			TORRENT_ASSERT(m_threads.empty());
+			for (std::vector<chunk>::iterator i = m_chunks.begin()
+				, end(m_chunks.end()); i != end; ++i)
+				page_aligned_allocator::free(i->buffer);
+		}
+
+		void parallel_hasher::run(error_code& ec)
+		{
+			int const num_pieces = m_torrent.num_pieces();
+			int const piece_length = m_torrent.piece_length();
+			int const num_threads = num_cpu_cores();
+			bool const file_hashes = m_torrent.should_add_file_hashes();
+
+			int const pieces_per_chunk = (std::max)(int(chunk_size) / piece_length, 1);
+			int const num_chunks = (std::min)((std::max)(
+				int(read_ahead) / (pieces_per_chunk * piece_length), num_threads + 2)
+				, (num_pieces + pieces_per_chunk - 1) / pieces_per_chunk);
+
+			m_chunks.resize(num_chunks);
+			for (int i = 0; i < num_chunks; ++i)
+			{
+				m_chunks[i].buffer = page_aligned_allocator::malloc(
+					pieces_per_chunk * piece_length);
+				if (m_chunks[i].buffer == NULL)
+				{
+					m_chunks.resize(i);
+					ec = error_code(boost::system::errc::not_enough_memory
+						, get_posix_category());
+					return;
+				}
+				m_free_chunks.push_back(&m_chunks[i]);
+			}
+
+			if (file_hashes) m_file_hashes.resize(m_files.num_files());
+
+			for (int i = 0; i < num_threads; ++i)
+			{
+				m_threads.push_back(boost::shared_ptr<thread>(
+					new thread(boost::bind(&parallel_hasher::piece_thread, this))));
+			}
+			if (file_hashes)
+			{
+				m_threads.push_back(boost::shared_ptr<thread>(
+					new thread(boost::bind(&parallel_hasher::file_thread, this))));
+			}
+
+			std::vector<std::pair<int, sha1_hash> > hashes;
+			int next_piece = 0;
+			int completed = 0;
+			bool failed = false;
+			while (completed < num_pieces)
+			{
+				chunk* c = NULL;
+				{
+					mutex::scoped_lock l(m_mutex);
+					while (m_hashes.empty()
+						&& (m_free_chunks.empty() || next_piece == num_pieces))
+						m_cond.wait(l);
+					hashes.swap(m_hashes);
+					if (next_piece < num_pieces && !m_free_chunks.empty())
+					{
+						c = m_free_chunks.back();
+						m_free_chunks.pop_back();
+					}
+				}
+
+				// the progress callback and the create_torrent object are
+				// only ever touched from this thread
+				for (std::vector<std::pair<int, sha1_hash> >::iterator i = hashes.begin()
+					, end(hashes.end()); i != end; ++i)
+				{
+					m_torrent.set_hash(i->first, i->second);
+					m_progress(completed);
+					++completed;
+				}
+				hashes.clear();
+
+				if (c == NULL) continue;
+
+				c->first_piece = next_piece;
+				c->num_pieces = (std::min)(pieces_per_chunk, num_pieces - next_piece);
+				next_piece += c->num_pieces;
+				c->size = (c->num_pieces - 1) * piece_length
+					+ m_torrent.piece_size(next_piece - 1);
+
+				if (!read_chunk(*c, ec))
+				{
+					failed = true;
+					break;
+				}
+
+				mutex::scoped_lock l(m_mutex);
+				c->refs = file_hashes ? 2 : 1;
+				m_piece_queue.push_back(c);
+				if (file_hashes) m_file_queue.push_back(c);
+				m_cond.notify_all();
+			}
+
+			{
+				mutex::scoped_lock l(m_mutex);
+				m_done_reading = true;
+				m_abort = failed;
+				m_cond.notify_all();
+			}
+
+			for (std::vector<boost::shared_ptr<thread> >::iterator i = m_threads.begin()
+				, end(m_threads.end()); i != end; ++i)
+				(*i)->join();
+			m_threads.clear();
+			m_file.reset();
+
+			if (failed || !file_hashes) return;
+
+			for (int i = 0; i < m_files.num_files(); ++i)
+			{
+				if (m_files.pad_file_at(i)) continue;
+				// empty files never show up in a chunk
+				if (m_files.file_size(i) == 0) m_file_hashes[i] = hasher().final();
+				m_torrent.set_file_hash(i, m_file_hashes[i]);
+			}
+		}
+
+		bool parallel_hasher::read_chunk(chunk& c, error_code& ec)
+		{
+			std::vector<file_slice> slices = m_files.map_block(c.first_piece, 0, c.size);
+			char* buf = c.buffer;
+			for (std::vector<file_slice>::iterator i = slices.begin()
+				, end(slices.end()); i != end; ++i)
+			{
+				int const size = int(i->size);
+				if (m_files.pad_file_at(i->file_index))
+				{
+					std::memset(buf, 0, size);
+					buf += size;
+					continue;
+				}
+
+				if (i->file_index != m_file_index)
+				{
+					m_file_index = i->file_index;
+					m_file = new file;
+					if (!m_file->open(m_files.file_path(m_file_index, m_path)
+						, file::read_only | file::no_atime, ec))
+						return false;
+				}
+
+				file::iovec_t b = { buf, size_t(size) };
+				size_type ret = m_file->readv(i->offset, &b, 1, ec);
+				if (ec) return false;
+				if (ret != size)
+				{
+					ec = error_code(errors::file_too_short, get_libtorrent_category());
+					return false;
+				}
+				buf += size;
+			}
+			TORRENT_ASSERT(buf == c.buffer + c.size);
+			return true;
+		}
+
+		// must be called with m_mutex held
+		void parallel_hasher::release_chunk(chunk* c)
+		{
+			TORRENT_ASSERT(c->refs > 0);
+			if (--c->refs > 0) return;
+			m_free_chunks.push_back(c);
+			m_cond.notify_all();
+		}
+
+		void parallel_hasher::piece_thread()
+		{
+			int const piece_length = m_torrent.piece_length();
+			int const lanes = multi_hasher::preferred_lanes();
+			std::vector<std::pair<int, sha1_hash> > hashes;
+
+			mutex::scoped_lock l(m_mutex);
+			for (;;)
+			{
+				while (m_piece_queue.empty() && !m_done_reading) m_cond.wait(l);
+				if (m_piece_queue.empty() || m_abort) break;
+				chunk* c = m_piece_queue.front();
+				m_piece_queue.pop_front();
+				l.unlock();
+
+				// hash the pieces of the chunk in groups of as many as the
+				// CPU can do at once. Only the last piece of the torrent may
+				// be shorter, it's hashed on its own
+				for (int i = 0; i < c->num_pieces;)
+				{
+					int const piece = c->first_piece + i;
+					char const* data[multi_hasher::max_lanes] = { NULL };
+					int n = 0;
+					while (n < lanes && i + n < c->num_pieces
+						&& m_torrent.piece_size(piece + n) == piece_length)
+					{
+						data[n] = c->buffer + (i + n) * piece_length;
+						++n;
+					}
+
+					if (n == 0)
+					{
+						hasher h(c->buffer + i * piece_length, m_torrent.piece_size(piece));
+						hashes.push_back(std::make_pair(piece, h.final()));
+						++i;
+						continue;
+					}
+
+					multi_hasher h(n);
+					h.update(data, piece_length);
+					for (int k = 0; k < n; ++k)
+						hashes.push_back(std::make_pair(piece + k, h.final(k)));
+					i += n;
+				}
+
+				l.lock();
+				m_hashes.insert(m_hashes.end(), hashes.begin(), hashes.end());
+				hashes.clear();
+				release_chunk(c);
+				m_cond.notify_all();
+			}
+		}
+
+		void parallel_hasher::file_thread()
+		{
+			hasher h;
+			int file_index = -1;
+
+			mutex::scoped_lock l(m_mutex);
+			for (;;)
+			{
+				while (m_file_queue.empty() && !m_done_reading) m_cond.wait(l);
+				if (m_file_queue.empty() || m_abort) break;
+				chunk* c = m_file_queue.front();
+				m_file_queue.pop_front();
+				l.unlock();
+
+				std::vector<file_slice> slices = m_files.map_block(c->first_piece, 0, c->size);
+				char const* buf = c->buffer;
+				for (std::vector<file_slice>::iterator i = slices.begin()
+					, end(slices.end()); i != end; ++i)
+				{
+					int const size = int(i->size);
+					if (!m_files.pad_file_at(i->file_index))
+					{
+						if (i->file_index != file_index)
+						{
+							if (file_index >= 0) m_file_hashes[file_index] = h.final();
+							h.reset();
+							file_index = i->file_index;
+						}
+						h.update(buf, size);
+					}
+					buf += size;
+				}
+
+				l.lock();
+				release_chunk(c);
+			}
+			if (file_index >= 0 && !m_abort) m_file_hashes[file_index] = h.final();
+		}
+	}
+
 	void set_piece_hashes(create_torrent& t, std::string const& p
 		, boost::function<void(int)> const& f, error_code& ec)
 	{
@@ -200,6 +586,13 @@ namespace libtorrent
 			return;
 		}
 
+		if (t.should_hash_in_parallel())
+		{
+			parallel_hasher h(t, path, f);
+			h.run(ec);
+			return;
+		}
+
 		// dummy torrent object pointer
 		boost::shared_ptr<char> dummy;
 		counters cnt;
@@ -252,6 +645,7 @@ namespace libtorrent
 		, m_include_mtime((flags & modification_time) != 0)
 		, m_include_symlinks((flags & symlinks) != 0)
 		, m_calculate_file_hashes((flags & calculate_file_hashes) != 0)
+		, m_parallel_hashing((flags & parallel_hashing) != 0)
 	{
 		TORRENT_ASSERT(fs.num_files() > 0);
 
@@ -307,6 +701,7 @@ namespace libtorrent
 		, m_include_mtime(false)
 		, m_include_symlinks(false)
 		, m_calculate_file_hashes(false)
+		, m_parallel_hashing(false)
 	{
 		TORRENT_ASSERT(ti.is_valid());
 		if (ti.creation_date()) m_creation_date = *ti.creation_date();
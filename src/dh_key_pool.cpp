@@ -0,0 +1,131 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+
+#include "libtorrent/dh_key_pool.hpp"
+#include "libtorrent/pe_crypto.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <new>
+
+namespace libtorrent
+{
+	dh_key_pool::dh_key_pool()
+		: m_outstanding(0)
+		, m_max_keys(0)
+	{}
+
+	dh_key_pool::~dh_key_pool()
+	{
+		// the worker thread calls into this object, it must be stopped
+		// before the members go away
+		stop();
+		for (std::vector<dh_key_exchange*>::iterator i = m_keys.begin()
+			, end(m_keys.end()); i != end; ++i)
+			delete *i;
+	}
+
+	void dh_key_pool::set_size(int num_keys)
+	{
+		TORRENT_ASSERT(num_keys >= 0);
+		mutex::scoped_lock l(m_pool_mutex);
+		m_max_keys = num_keys;
+		while (int(m_keys.size()) > m_max_keys)
+		{
+			delete m_keys.back();
+			m_keys.pop_back();
+		}
+		// reserving the space up front means the worker thread never has to
+		// allocate while holding the mutex
+		m_keys.reserve(m_max_keys);
+		l.unlock();
+
+		// when stopping, the worker finishes the jobs already posted
+		// first. The keys they produce are discarded
+		set_num_threads(num_keys > 0 ? 1 : 0);
+		refill();
+	}
+
+	dh_key_exchange* dh_key_pool::take()
+	{
+		mutex::scoped_lock l(m_pool_mutex);
+		if (m_keys.empty()) return NULL;
+		dh_key_exchange* ret = m_keys.back();
+		m_keys.pop_back();
+		l.unlock();
+
+		refill();
+		return ret;
+	}
+
+	int dh_key_pool::size() const
+	{
+		mutex::scoped_lock l(m_pool_mutex);
+		return int(m_keys.size());
+	}
+
+	void dh_key_pool::refill()
+	{
+		mutex::scoped_lock l(m_pool_mutex);
+		int const num_jobs = m_max_keys - int(m_keys.size()) - m_outstanding;
+		if (num_jobs <= 0) return;
+		m_outstanding += num_jobs;
+		l.unlock();
+
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			dh_key_job j;
+			dh_key_exchange::random_secret(j.secret);
+			post_job(j);
+		}
+	}
+
+	void dh_key_pool::process_job(dh_key_job const& j, bool)
+	{
+		dh_key_exchange* k = new (std::nothrow) dh_key_exchange(j.secret);
+
+		mutex::scoped_lock l(m_pool_mutex);
+		TORRENT_ASSERT(m_outstanding > 0);
+		--m_outstanding;
+		if (k == NULL || int(m_keys.size()) >= m_max_keys)
+		{
+			l.unlock();
+			delete k;
+			return;
+		}
+		m_keys.push_back(k);
+	}
+}
+
+#endif // TORRENT_DISABLE_ENCRYPTION
+
@@ -0,0 +1,225 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/disk_arena.hpp"
+#include "libtorrent/allocator.hpp" // for page_aligned_allocator
+#include "libtorrent/assert.hpp"
+
+#if TORRENT_HAVE_MMAP
+#include <sys/mman.h>
+#include <errno.h>
+#endif
+
+#if TORRENT_HAVE_MMAP && !defined MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+namespace libtorrent
+{
+	disk_arena::disk_arena()
+		: m_base(NULL)
+		, m_mapping(NULL)
+		, m_mapping_size(0)
+		, m_block_size(0)
+		, m_num_blocks(0)
+		, m_blocks_per_page(0)
+		, m_num_pages(0)
+		, m_huge_pages(false)
+		, m_head(end_of_list)
+		, m_next(NULL)
+		, m_page_use(NULL)
+		, m_num_free(0)
+	{}
+
+	disk_arena::~disk_arena()
+	{
+		close();
+	}
+
+	void disk_arena::open(int block_size, int num_blocks, error_code& ec)
+	{
+		TORRENT_ASSERT(!is_open());
+		TORRENT_ASSERT(block_size > 0);
+		TORRENT_ASSERT(num_blocks > 0);
+		TORRENT_ASSERT((huge_page_size % block_size) == 0);
+
+		boost::uint64_t const size = (boost::uint64_t(block_size) * num_blocks
+			+ huge_page_size - 1) & ~boost::uint64_t(huge_page_size - 1);
+
+#if TORRENT_HAVE_MMAP
+#ifdef MAP_HUGETLB
+		// this only succeeds if the administrator has reserved enough huge
+		// pages (vm.nr_hugepages)
+		void* p = mmap(0, size, PROT_READ | PROT_WRITE
+			, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+		{
+			m_mapping = (char*)p;
+			m_mapping_size = size;
+			m_base = m_mapping;
+			m_huge_pages = true;
+		}
+#endif
+		if (m_base == NULL)
+		{
+			// map an extra huge page, to be able to align the start of the
+			// arena to a huge page boundary. Transparent huge pages can only
+			// be used for aligned ranges
+			void* p = mmap(0, size + huge_page_size, PROT_READ | PROT_WRITE
+				, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (p == MAP_FAILED)
+			{
+				ec.assign(errno, boost::system::generic_category());
+				return;
+			}
+			m_mapping = (char*)p;
+			m_mapping_size = size + huge_page_size;
+			m_base = (char*)((boost::uint64_t(m_mapping) + huge_page_size - 1)
+				& ~boost::uint64_t(huge_page_size - 1));
+#ifdef MADV_HUGEPAGE
+			madvise(m_base, size, MADV_HUGEPAGE);
+#endif
+		}
+#else
+		m_mapping = page_aligned_allocator::malloc(size);
+		if (m_mapping == NULL)
+		{
+			ec.assign(boost::system::errc::not_enough_memory
+				, boost::system::generic_category());
+			return;
+		}
+		m_mapping_size = size;
+		m_base = m_mapping;
+#endif
+
+		m_block_size = block_size;
+		m_num_blocks = num_blocks;
+		m_blocks_per_page = huge_page_size / block_size;
+		m_num_pages = (num_blocks + m_blocks_per_page - 1) / m_blocks_per_page;
+
+		m_next = new boost::atomic<boost::uint32_t>[num_blocks];
+		m_page_use = new boost::atomic<int>[m_num_pages];
+		for (int i = 0; i < m_num_pages; ++i) m_page_use[i] = 0;
+
+		// link all blocks in address order, so the first allocations are
+		// packed at the start of the arena
+		for (int i = 0; i < num_blocks - 1; ++i) m_next[i] = i + 1;
+		m_next[num_blocks - 1] = boost::uint32_t(end_of_list);
+		m_head = 0;
+		m_num_free = num_blocks;
+	}
+
+	void disk_arena::close()
+	{
+		if (m_base == NULL) return;
+		TORRENT_ASSERT(m_num_free == m_num_blocks);
+
+#if TORRENT_HAVE_MMAP
+		munmap(m_mapping, m_mapping_size);
+#else
+		page_aligned_allocator::free(m_mapping);
+#endif
+		delete[] m_next;
+		delete[] m_page_use;
+		m_next = NULL;
+		m_page_use = NULL;
+		m_base = NULL;
+		m_mapping = NULL;
+		m_mapping_size = 0;
+		m_num_blocks = 0;
+		m_num_pages = 0;
+		m_num_free = 0;
+		m_huge_pages = false;
+		m_head = end_of_list;
+	}
+
+	char* disk_arena::allocate()
+	{
+		TORRENT_ASSERT(is_open());
+
+		boost::uint64_t head = m_head.load(boost::memory_order_acquire);
+		boost::uint32_t index;
+		for (;;)
+		{
+			index = boost::uint32_t(head);
+			if (index == end_of_list) return NULL;
+
+			// if another thread pops this block and pushes it back before
+			// we're done, the counter in the high bits will have changed and
+			// the exchange fails, even though the index is the same
+			boost::uint64_t const next = ((head >> 32) + 1) << 32
+				| m_next[index].load(boost::memory_order_relaxed);
+			if (m_head.compare_exchange_weak(head, next
+				, boost::memory_order_acquire, boost::memory_order_acquire))
+				break;
+		}
+
+		--m_num_free;
+		++m_page_use[index / m_blocks_per_page];
+		return m_base + boost::uint64_t(index) * m_block_size;
+	}
+
+	void disk_arena::free(char* buf)
+	{
+		TORRENT_ASSERT(contains(buf));
+		TORRENT_ASSERT(((buf - m_base) % m_block_size) == 0);
+
+		boost::uint32_t const index = boost::uint32_t((buf - m_base) / m_block_size);
+		TORRENT_ASSERT(m_page_use[index / m_blocks_per_page] > 0);
+		--m_page_use[index / m_blocks_per_page];
+		++m_num_free;
+
+		boost::uint64_t head = m_head.load(boost::memory_order_relaxed);
+		for (;;)
+		{
+			m_next[index].store(boost::uint32_t(head), boost::memory_order_relaxed);
+			boost::uint64_t const new_head = (head & ~boost::uint64_t(0xffffffff)) | index;
+			if (m_head.compare_exchange_weak(head, new_head
+				, boost::memory_order_release, boost::memory_order_relaxed))
+				break;
+		}
+	}
+
+	int disk_arena::fragmented_pages() const
+	{
+		int ret = 0;
+		for (int i = 0; i < m_num_pages; ++i)
+		{
+			int const blocks_in_page = (i == m_num_pages - 1)
+				? m_num_blocks - i * m_blocks_per_page : m_blocks_per_page;
+			int const used = m_page_use[i];
+			if (used > 0 && used < blocks_in_page) ++ret;
+		}
+		return ret;
+	}
+}
+
@@ -40,6 +40,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alert_types.hpp"
 #include "libtorrent/alert_dispatcher.hpp"
 #include "libtorrent/disk_observer.hpp"
+#include "libtorrent/performance_counters.hpp"
 
 #include <algorithm>
 #include <boost/bind.hpp>
@@ -243,6 +244,8 @@ namespace libtorrent
 		return page_aligned_allocator::in_use(buffer);
 #endif
 
+		if (m_arena.contains(buffer)) return true;
+
 #ifdef TORRENT_DISABLE_POOL_ALLOCATOR
 		return true;
 #else
@@ -304,9 +307,19 @@ namespace libtorrent
 		TORRENT_ASSERT(m_settings_set);
 		TORRENT_ASSERT(m_magic == 0x1337);
 
-		char* ret;
+		char* ret = NULL;
+
+		// the arena doesn't need the pool mutex, but the accounting of the
+		// number of buffers in use does
+		if (m_arena.is_open())
+			ret = m_arena.allocate();
+
+		if (ret != NULL)
+		{
+			TORRENT_ASSERT(is_disk_buffer(ret, l));
+		}
 #if TORRENT_HAVE_MMAP
-		if (m_cache_pool)
+		else if (m_cache_pool)
 		{
 			if (m_free_list.size() <= (m_max_use - m_low_watermark) / 2 && !m_exceeded_max_size)
 			{
@@ -319,8 +332,8 @@ namespace libtorrent
 			ret = m_cache_pool + (slot_index * 0x4000);
 			TORRENT_ASSERT(is_disk_buffer(ret, l));
 		}
-		else
 #endif
+		else
 		{
 #if defined TORRENT_DISABLE_POOL_ALLOCATOR
 
@@ -576,6 +589,37 @@ namespace libtorrent
 			}
 		}
 #endif
+
+		// the arena can only be set up, resized or torn down while there
+		// are no buffers in use. It's not used together with the mmap cache
+		bool const want_arena = sett.get_bool(settings_pack::use_disk_cache_arena)
+#if TORRENT_HAVE_MMAP
+			&& m_cache_pool == 0
+#endif
+			&& m_max_use > 0;
+
+		if (m_in_use == 0 && m_arena.is_open()
+			&& (!want_arena || m_arena.num_blocks() != m_max_use))
+		{
+			m_arena.close();
+		}
+
+		if (m_in_use == 0 && want_arena && !m_arena.is_open())
+		{
+			error_code ec;
+			m_arena.open(m_block_size, m_max_use, ec);
+			if (ec && m_post_alert)
+				m_ios.post(boost::bind(alert_callback, m_post_alert, new mmap_cache_alert(ec)));
+		}
+	}
+
+	void disk_buffer_pool::update_stats_counters(counters& c) const
+	{
+		mutex::scoped_lock l(m_pool_mutex);
+		c.set_value(counters::arena_blocks, m_arena.num_blocks());
+		c.set_value(counters::arena_free_blocks, m_arena.num_free());
+		c.set_value(counters::arena_fragmented_pages, m_arena.fragmented_pages());
+		c.set_value(counters::arena_huge_pages, m_arena.huge_pages() ? 1 : 0);
 	}
 
 	void disk_buffer_pool::free_buffer_impl(char* buf, mutex::scoped_lock& l)
@@ -600,8 +644,12 @@ namespace libtorrent
 		--m_allocations;
 #endif
 
+		if (m_arena.contains(buf))
+		{
+			m_arena.free(buf);
+		}
 #if TORRENT_HAVE_MMAP
-		if (m_cache_pool)
+		else if (m_cache_pool)
 		{
 			TORRENT_ASSERT(buf >= m_cache_pool);
 			TORRENT_ASSERT(buf <  m_cache_pool + boost::uint64_t(m_max_use) * 0x4000);
@@ -620,8 +668,8 @@ namespace libtorrent
 			madvise(buf, 0x4000, MADV_DONTNEED);
 #endif
 		}
-		else
 #endif
+		else
 		{
 #if defined TORRENT_DISABLE_POOL_ALLOCATOR
 
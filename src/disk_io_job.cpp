@@ -60,7 +60,8 @@ namespace libtorrent
 
 	disk_io_job::~disk_io_job()
 	{
-		if (action == rename_file || action == move_storage)
+		if (action == rename_file || action == move_storage
+			|| action == check_pieces)
 			free(buffer);
 		if (action == save_resume_data)
 			delete (entry*)buffer;
@@ -38,6 +38,9 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/error_code.hpp"
 #include "libtorrent/error.hpp"
 #include "libtorrent/file_pool.hpp"
+#include "libtorrent/io_uring.hpp"
+#include "libtorrent/multi_hasher.hpp"
+#include "libtorrent/allocator.hpp" // for page_aligned_allocator
 #include <boost/scoped_array.hpp>
 #include <boost/bind.hpp>
 #include <boost/tuple/tuple.hpp>
@@ -159,6 +162,29 @@ namespace libtorrent
 		return ret;
 	}
 
+#if TORRENT_USE_IO_URING
+	// the io_uring owned by the calling disk thread, when it's using the
+	// io_uring back-end. This lets the job functions submit their file
+	// operations in batches without having it passed down to them
+	static __thread io_uring_queue* disk_thread_ring = NULL;
+#endif
+
+	static io_uring_queue* current_ring()
+	{
+#if TORRENT_USE_IO_URING
+		return disk_thread_ring;
+#else
+		return NULL;
+#endif
+	}
+
+	static void count_ring_ops(counters& c, int num_ops)
+	{
+		if (num_ops == 0) return;
+		c.inc_stats_counter(counters::num_io_uring_batches);
+		c.inc_stats_counter(counters::num_io_uring_ops, num_ops);
+	}
+
 // ------- disk_io_thread ------
 
 	disk_io_thread::disk_io_thread(io_service& ios
@@ -219,9 +245,8 @@ namespace libtorrent
 
 #if TORRENT_USE_ASSERTS
 		// by now, all pieces should have been evicted
-		std::pair<block_cache::iterator, block_cache::iterator> pieces
-			= m_disk_cache.all_pieces();
-		TORRENT_ASSERT(pieces.first == pieces.second);
+		for (int i = 0; i < block_cache::num_shards; ++i)
+			TORRENT_ASSERT(m_disk_cache.num_pieces(i) == 0);
 #endif
 
 #ifdef TORRENT_DISK_STATS
@@ -292,18 +317,37 @@ namespace libtorrent
 		TORRENT_ASSERT(m_magic == 0x1337);
 		TORRENT_ASSERT(m_outstanding_reclaim_message);
 		m_outstanding_reclaim_message = false;
-		mutex::scoped_lock l(m_cache_mutex);
 		for (int i = 0; i < m_blocks_to_reclaim.size(); ++i)
-			m_disk_cache.reclaim_block(m_blocks_to_reclaim[i]);
+		{
+			block_cache_reference const& ref = m_blocks_to_reclaim[i];
+			mutex::scoped_lock l(m_disk_cache.cache_mutex((piece_manager*)ref.storage));
+			m_disk_cache.reclaim_block(ref);
+		}
 		m_blocks_to_reclaim.clear();
 	}
 
 	void disk_io_thread::set_settings(settings_pack* pack)
 	{
 		TORRENT_ASSERT(m_magic == 0x1337);
-		mutex::scoped_lock l(m_cache_mutex);
+		// the settings are read by disk threads with any one shard locked.
+		// This is the only place more than one shard mutex is held at a
+		// time, and they are always locked in the same order
+		for (int i = 0; i < block_cache::num_shards; ++i)
+			m_disk_cache.shard_mutex(i).lock();
 		apply_pack(pack, m_settings);
 		m_disk_cache.set_settings(m_settings);
+		for (int i = block_cache::num_shards - 1; i >= 0; --i)
+			m_disk_cache.shard_mutex(i).unlock();
+
+		mutex::scoped_lock l(m_job_mutex);
+		m_queued_jobs.set_weight(disk_job_scheduler::read_class
+			, m_settings.get_int(settings_pack::disk_read_weight));
+		m_queued_jobs.set_weight(disk_job_scheduler::write_class
+			, m_settings.get_int(settings_pack::disk_write_weight));
+		m_queued_jobs.set_weight(disk_job_scheduler::hash_class
+			, m_settings.get_int(settings_pack::disk_hash_weight));
+		m_queued_jobs.set_weight(disk_job_scheduler::maintenance_class
+			, m_settings.get_int(settings_pack::disk_maintenance_weight));
 	}
 
 	// flush all blocks that are below p->hash.offset, since we've
@@ -551,7 +595,8 @@ namespace libtorrent
 		// if the cache is under high pressure, we need to evict
 		// the blocks we just flushed to make room for more write pieces
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(
+			m_disk_cache.shard_index(p->storage.get()), evict);
 
 		return iov_len;
 	}
@@ -653,19 +698,43 @@ namespace libtorrent
 		int piece = pe->piece;
 		int blocks_in_piece = pe->blocks_in_piece;
 		bool failed = false;
+
+		// with the io_uring back-end, all the contiguous ranges are
+		// submitted at once and written in parallel
+		io_uring_queue* ring = current_ring();
+		if (ring) ring->reset(1);
+
 		for (int i = 1; i <= num_blocks; ++i)
 		{
 			if (i < num_blocks && flushing[i] == flushing[i-1]+1) continue;
-			int ret = pe->storage->get_storage_impl()->writev(iov_start
-				, i - flushing_start
-				, piece + flushing[flushing_start] / blocks_in_piece
-				, (flushing[flushing_start] % blocks_in_piece) * block_size
-				, 0, error);
+			int ret = ring
+				? pe->storage->get_storage_impl()->submit_writev(*ring, 0, iov_start
+					, i - flushing_start
+					, piece + flushing[flushing_start] / blocks_in_piece
+					, (flushing[flushing_start] % blocks_in_piece) * block_size
+					, 0, error)
+				: pe->storage->get_storage_impl()->writev(iov_start
+					, i - flushing_start
+					, piece + flushing[flushing_start] / blocks_in_piece
+					, (flushing[flushing_start] % blocks_in_piece) * block_size
+					, 0, error);
 			if (ret < 0 || error) failed = true;
 			iov_start = &iov[i];
 			flushing_start = i;
 		}
 
+		if (ring)
+		{
+			count_ring_ops(m_stats_counters, ring->submit_and_wait());
+			if (ring->error(0) && !error)
+			{
+				error.ec = ring->error(0);
+				error.file = ring->error_file(0);
+				error.operation = storage_error::write;
+				failed = true;
+			}
+		}
+
 		m_stats_counters.inc_stats_counter(counters::num_writing_threads, -1);
 
 		if (!failed)
@@ -779,7 +848,8 @@ namespace libtorrent
 		// if the cache is under high pressure, we need to evict
 		// the blocks we just flushed to make room for more write pieces
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(
+			m_disk_cache.shard_index(pe->storage.get()), evict);
 
 		m_disk_cache.maybe_free_piece(pe);
 
@@ -835,78 +905,64 @@ namespace libtorrent
 		}
 	}
 
+	// l is expected to hold the mutex of the shard storage belongs to
 	void disk_io_thread::flush_cache(piece_manager* storage, boost::uint32_t flags
 		, tailqueue& completed_jobs, mutex::scoped_lock& l)
 	{
-		if (storage)
+		TORRENT_ASSERT(storage);
+		TORRENT_ASSERT(l.locked());
+
+		boost::unordered_set<cached_piece_entry*> const& pieces = storage->cached_pieces();
+		// TODO: 2 should this be allocated on the stack?
+		std::vector<int> piece_index;
+		piece_index.reserve(pieces.size());
+		for (boost::unordered_set<cached_piece_entry*>::const_iterator i = pieces.begin()
+			, end(pieces.end()); i != end; ++i)
 		{
-			boost::unordered_set<cached_piece_entry*> const& pieces = storage->cached_pieces();
-			// TODO: 2 should this be allocated on the stack?
-			std::vector<int> piece_index;
-			piece_index.reserve(pieces.size());
-			for (boost::unordered_set<cached_piece_entry*>::const_iterator i = pieces.begin()
-				, end(pieces.end()); i != end; ++i)
-			{
-				piece_index.push_back((*i)->piece);
-			}
+			piece_index.push_back((*i)->piece);
+		}
 
-			for (std::vector<int>::iterator i = piece_index.begin()
-				, end(piece_index.end()); i != end; ++i)
-			{
-				cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
-				if (pe == NULL) continue;
-				TORRENT_PIECE_ASSERT(pe->storage.get() == storage, pe);
-				flush_piece(pe, flags, completed_jobs, l);
-			}
-#if TORRENT_USE_ASSERTS
-			TORRENT_ASSERT(l.locked());
-			// if the user asked to delete the cache for this storage
-			// we really should not have any pieces left. This is only called
-			// from disk_io_thread::do_delete, which is a fence job and should
-			// have any other jobs active, i.e. there should not be any references
-			// keeping pieces or blocks alive
-			if ((flags & flush_delete_cache) && (flags & flush_expect_clear))
-			{
-				boost::unordered_set<cached_piece_entry*> const& storage_pieces = storage->cached_pieces();
-				for (boost::unordered_set<cached_piece_entry*>::const_iterator i = storage_pieces.begin()
-					, end(storage_pieces.end()); i != end; ++i)
-				{
-					cached_piece_entry* pe = m_disk_cache.find_piece(storage, (*i)->piece);
-					TORRENT_PIECE_ASSERT(pe->num_dirty == 0, pe);
-				}
-			}
-#endif
+		for (std::vector<int>::iterator i = piece_index.begin()
+			, end(piece_index.end()); i != end; ++i)
+		{
+			cached_piece_entry* pe = m_disk_cache.find_piece(storage, *i);
+			if (pe == NULL) continue;
+			TORRENT_PIECE_ASSERT(pe->storage.get() == storage, pe);
+			flush_piece(pe, flags, completed_jobs, l);
 		}
-		else
+#if TORRENT_USE_ASSERTS
+		TORRENT_ASSERT(l.locked());
+		// if the user asked to delete the cache for this storage
+		// we really should not have any pieces left. This is only called
+		// from disk_io_thread::do_delete, which is a fence job and should
+		// have any other jobs active, i.e. there should not be any references
+		// keeping pieces or blocks alive
+		if ((flags & flush_delete_cache) && (flags & flush_expect_clear))
 		{
-			std::pair<block_cache::iterator, block_cache::iterator> range = m_disk_cache.all_pieces();
-			while (range.first != range.second)
+			boost::unordered_set<cached_piece_entry*> const& storage_pieces = storage->cached_pieces();
+			for (boost::unordered_set<cached_piece_entry*>::const_iterator i = storage_pieces.begin()
+				, end(storage_pieces.end()); i != end; ++i)
 			{
-				// TODO: 2 we're not flushing the read cache at all?
-				while (range.first->num_dirty == 0)
-				{
-					++range.first;
-					if (range.first == range.second) return;
-				}
-				cached_piece_entry* pe = const_cast<cached_piece_entry*>(&*range.first);
-				flush_piece(pe, flags, completed_jobs, l);
-				range = m_disk_cache.all_pieces();
+				cached_piece_entry* pe = m_disk_cache.find_piece(storage, (*i)->piece);
+				TORRENT_PIECE_ASSERT(pe->num_dirty == 0, pe);
 			}
 		}
+#endif
 	}
 
 	// this is called if we're exceeding (or about to exceed) the cache
 	// size limit. This means we should not restrict ourselves to contiguous
 	// blocks of write cache line size, but try to flush all old blocks
 	// this is why we pass in 1 as cont_block to the flushing functions
-	void disk_io_thread::try_flush_write_blocks(int num, tailqueue& completed_jobs
-		, mutex::scoped_lock& l)
+	// l is expected to hold the mutex of the specified cache shard
+	void disk_io_thread::try_flush_write_blocks(int shard, int num
+		, tailqueue& completed_jobs, mutex::scoped_lock& l)
 	{
-		DLOG("try_flush_write_blocks: %d\n", num);
+		DLOG("try_flush_write_blocks: shard: %d num: %d\n", shard, num);
 
-		list_iterator range = m_disk_cache.write_lru_pieces();
+		list_iterator range = m_disk_cache.write_lru_pieces(shard);
 		std::vector<std::pair<piece_manager*, int> > pieces;
-		pieces.reserve(m_disk_cache.num_write_lru_pieces());
+		pieces.reserve(m_disk_cache.num_write_lru_pieces(shard));
 
 		for (list_iterator p = range; p.get() && num > 0; p.next())
 		{
@@ -971,9 +1027,11 @@ namespace libtorrent
 		}
 	}
 
-	void disk_io_thread::flush_expired_write_blocks(tailqueue& completed_jobs, mutex::scoped_lock& l)
+	// l is expected to hold the mutex of the specified cache shard
+	void disk_io_thread::flush_expired_write_blocks(int shard
+		, tailqueue& completed_jobs, mutex::scoped_lock& l)
 	{
-		DLOG("flush_expired_write_blocks\n");
+		DLOG("flush_expired_write_blocks: shard: %d\n", shard);
 
 		ptime now = time_now();
 		time_duration expiration_limit = seconds(m_settings.get_int(settings_pack::cache_expiry));
@@ -985,7 +1043,7 @@ namespace libtorrent
 		cached_piece_entry** to_flush = TORRENT_ALLOCA(cached_piece_entry*, 200);
 		int num_flush = 0;
 
-		for (list_iterator p = m_disk_cache.write_lru_pieces(); p.get(); p.next())
+		for (list_iterator p = m_disk_cache.write_lru_pieces(shard); p.get(); p.next())
 		{
 			cached_piece_entry* e = (cached_piece_entry*)p.get();
 #if TORRENT_USE_ASSERTS
@@ -1045,6 +1103,7 @@ namespace libtorrent
 		&disk_io_thread::do_load_torrent,
 		&disk_io_thread::do_clear_piece,
 		&disk_io_thread::do_tick,
+		&disk_io_thread::do_check_pieces,
 	};
 
 	const char* job_action_name[] =
@@ -1069,6 +1128,7 @@ namespace libtorrent
 		"load_torrent",
 		"clear_piece",
 		"tick_storage",
+		"check_pieces",
 	};
 
 #if TORRENT_USE_ASSERTS || DEBUG_DISK_THREAD
@@ -1092,20 +1152,54 @@ namespace libtorrent
 	// below the number of blocks we flushed by the time we're done flushing
 	// that's why we need to call this fairly often. Both before and after
 	// a disk job is executed
-	void disk_io_thread::check_cache_level(mutex::scoped_lock& l, tailqueue& completed_jobs)
+	// the cache size limit is global, but eviction is done one shard at a
+	// time, starting with 'shard' (typically the one the current job's
+	// storage belongs to) and then moving on to the following ones. No shard
+	// mutex may be held when calling this function
+	void disk_io_thread::check_cache_level(int shard, tailqueue& completed_jobs)
 	{
 		int evict = m_disk_cache.num_to_evict(0);
-		if (evict > 0)
+		if (evict <= 0) return;
+
+		// with adaptive_cache_split, if the write cache is using more than
+		// its share of the cache, start by flushing the excess write blocks
+		// rather than evicting read blocks
+		int const write_target = m_disk_cache.write_cache_target();
+		if (write_target >= 0
+			&& m_stats_counters[counters::num_writing_threads] == 0)
 		{
-			evict = m_disk_cache.try_evict_blocks(evict);
-			// don't evict write jobs if at least one other thread
-			// is flushing right now. Doing so could result in
-			// unnecessary flushing of the wrong pieces
-			if (evict > 0 && m_stats_counters[counters::num_writing_threads] == 0)
+			int excess = m_disk_cache.write_cache_size() - write_target;
+			for (int i = 0; i < block_cache::num_shards && excess > 0; ++i)
 			{
-				try_flush_write_blocks(evict, completed_jobs, l);
+				int const s = (shard + i) % block_cache::num_shards;
+				mutex::scoped_lock l(m_disk_cache.shard_mutex(s));
+				try_flush_write_blocks(s, (std::min)(evict, excess), completed_jobs, l);
+				l.unlock();
+				excess = m_disk_cache.write_cache_size() - write_target;
+				evict = m_disk_cache.num_to_evict(0);
+				if (evict <= 0) return;
 			}
 		}
+
+		for (int i = 0; i < block_cache::num_shards && evict > 0; ++i)
+		{
+			int const s = (shard + i) % block_cache::num_shards;
+			mutex::scoped_lock l(m_disk_cache.shard_mutex(s));
+			evict = m_disk_cache.try_evict_blocks(s, evict);
+		}
+
+		// don't evict write jobs if at least one other thread
+		// is flushing right now. Doing so could result in
+		// unnecessary flushing of the wrong pieces
+		for (int i = 0; i < block_cache::num_shards && evict > 0
+			&& m_stats_counters[counters::num_writing_threads] == 0; ++i)
+		{
+			int const s = (shard + i) % block_cache::num_shards;
+			mutex::scoped_lock l(m_disk_cache.shard_mutex(s));
+			try_flush_write_blocks(s, evict, completed_jobs, l);
+			l.unlock();
+			evict = m_disk_cache.num_to_evict(0);
+		}
 	}
 
 	void disk_io_thread::perform_job(disk_io_job* j, tailqueue& completed_jobs)
@@ -1114,9 +1208,7 @@ namespace libtorrent
 		TORRENT_ASSERT(j->next == 0);
 		TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
 
-		mutex::scoped_lock l(m_cache_mutex);
-
-		check_cache_level(l, completed_jobs);
+		check_cache_level(m_disk_cache.shard_index(j->storage.get()), completed_jobs);
 
 		DLOG("perform_job job: %s ( %s%s) piece: %d offset: %d outstanding: %d\n"
 			, job_action_name[j->action]
@@ -1125,8 +1217,6 @@ namespace libtorrent
 			, j->piece, j->d.io.offset
 			, j->storage ? j->storage->num_outstanding_jobs() : -1);
 
-		l.unlock();
-
 		boost::shared_ptr<piece_manager> storage = j->storage;
 
 		// TODO: instead of doing this. pass in the settings to each storage_interface
@@ -1172,7 +1262,7 @@ namespace libtorrent
 		if (j->action == disk_io_job::hash && !j->error.ec)
 		{
 			// a hash job should never return without clearing pe->hash
-			l.lock();
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe != NULL)
 			{
@@ -1191,6 +1281,481 @@ namespace libtorrent
 		completed_jobs.push_back(j);
 	}
 
+	// this is the io_uring counterpart to perform_job() for read jobs. All
+	// jobs are prepared first, then their reads are submitted to the ring
+	// together and once they have all completed, the jobs are completed
+	void disk_io_thread::perform_read_batch(disk_io_job** jobs, int num_jobs
+		, io_uring_queue& ring, tailqueue& completed_jobs)
+	{
+		TORRENT_ASSERT(num_jobs > 0);
+		check_cache_level(m_disk_cache.shard_index(jobs[0]->storage.get()), completed_jobs);
+
+		DLOG("perform_read_batch: %d jobs\n", num_jobs);
+
+		bool const use_cache = m_settings.get_bool(settings_pack::use_read_cache)
+			&& m_settings.get_int(settings_pack::cache_size) > 0;
+		int const block_size = m_disk_cache.block_size();
+
+		// each job's buffers are a range of this array
+		int* iov_start = TORRENT_ALLOCA(int, num_jobs);
+		int* iov_len = TORRENT_ALLOCA(int, num_jobs);
+		int* ret = TORRENT_ALLOCA(int, num_jobs);
+		// true for the jobs whose read was submitted to the ring
+		bool* issued = TORRENT_ALLOCA(bool, num_jobs);
+
+		int total_iov = 0;
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			iov_start[i] = total_iov;
+			iov_len[i] = use_cache ? read_iovec_len(jobs[i]) : 1;
+			total_iov += iov_len[i];
+		}
+		std::vector<file::iovec_t> iov(total_iov);
+
+		ring.reset(num_jobs);
+		ptime start_time = time_now_hires();
+
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+			TORRENT_ASSERT(j->action == disk_io_job::read);
+			TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
+
+			if (j->storage->get_storage_impl()->m_settings == 0)
+				j->storage->get_storage_impl()->m_settings = &m_settings;
+
+			++m_outstanding_jobs;
+			issued[i] = false;
+			ret[i] = 0;
+
+			file::iovec_t* v = &iov[iov_start[i]];
+			int offset = j->d.io.offset;
+			if (use_cache)
+			{
+				if (!prep_read(j, v, iov_len[i], ret[i], completed_jobs))
+					continue;
+				offset &= ~(block_size-1);
+			}
+			else
+			{
+				j->buffer = m_disk_cache.allocate_buffer("send buffer");
+				if (j->buffer == 0)
+				{
+					j->error.ec = error::no_memory;
+					j->error.operation = storage_error::alloc_cache_piece;
+					ret[i] = -1;
+					continue;
+				}
+				v->iov_base = j->buffer;
+				v->iov_len = j->d.io.buffer_size;
+			}
+
+			ret[i] = j->storage->get_storage_impl()->submit_readv(ring, i
+				, v, iov_len[i], j->piece, offset, file_flags_for_job(j), j->error);
+			issued[i] = true;
+		}
+
+		count_ring_ops(m_stats_counters, ring.submit_and_wait());
+
+		ptime now = time_now_hires();
+		boost::uint32_t read_time = total_microseconds(now - start_time);
+
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+
+			if (issued[i])
+			{
+				if (ret[i] >= 0 && ring.error(i))
+				{
+					j->error.ec = ring.error(i);
+					j->error.file = ring.error_file(i);
+					j->error.operation = storage_error::read;
+					ret[i] = -1;
+				}
+				else if (ret[i] >= 0)
+				{
+					ret[i] += ring.bytes_transferred(i);
+				}
+
+				if (!j->error.ec)
+				{
+					m_read_time.add_sample(read_time / iov_len[i]);
+
+					if (!use_cache) m_stats_counters.inc_stats_counter(counters::num_read_back);
+					m_stats_counters.inc_stats_counter(counters::num_blocks_read, iov_len[i]);
+					m_stats_counters.inc_stats_counter(counters::num_read_ops);
+					m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+					m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+				}
+
+				if (use_cache)
+					ret[i] = finish_read(j, &iov[iov_start[i]], iov_len[i], ret[i], completed_jobs);
+			}
+
+			if (!use_cache)
+			{
+				mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
+				cached_piece_entry* pe = m_disk_cache.find_piece(j);
+				if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
+			}
+
+			--m_outstanding_jobs;
+
+			j->ret = ret[i];
+			m_job_time.add_sample(total_microseconds(now - start_time));
+			completed_jobs.push_back(j);
+		}
+	}
+
+	// performs read jobs that have been sorted in elevator order. Reads
+	// that go through the cache already read a whole cache line at a time,
+	// so only uncached reads of adjacent blocks are merged
+	void disk_io_thread::perform_sorted_reads(disk_io_job** jobs, int num_jobs
+		, tailqueue& completed_jobs)
+	{
+		TORRENT_ASSERT(num_jobs > 0);
+
+		bool const use_cache = m_settings.get_bool(settings_pack::use_read_cache)
+			&& m_settings.get_int(settings_pack::cache_size) > 0;
+
+		for (int i = 0; i < num_jobs;)
+		{
+			int const run = use_cache ? 1
+				: disk_job_scheduler::contiguous_reads(jobs + i, num_jobs - i);
+			if (run == 1)
+				perform_job(jobs[i], completed_jobs);
+			else
+				perform_coalesced_read(jobs + i, run, completed_jobs);
+			i += run;
+		}
+	}
+
+	// reads the blocks of uncached read jobs of adjacent ranges of the
+	// same piece with a single readv() call
+	void disk_io_thread::perform_coalesced_read(disk_io_job** jobs, int num_jobs
+		, tailqueue& completed_jobs)
+	{
+		TORRENT_ASSERT(num_jobs > 1);
+
+		DLOG("perform_coalesced_read: %d jobs piece: %d offset: %d\n"
+			, num_jobs, jobs[0]->piece, jobs[0]->d.io.offset);
+
+		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, num_jobs);
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+			TORRENT_ASSERT(j->action == disk_io_job::read);
+			TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
+
+			j->buffer = m_disk_cache.allocate_buffer("send buffer");
+			if (j->buffer == 0)
+			{
+				// we're out of buffers. Give back the ones we got and let
+				// each job take its chances on its own
+				for (int k = 0; k < i; ++k)
+				{
+					m_disk_cache.free_buffer(jobs[k]->buffer);
+					jobs[k]->buffer = 0;
+				}
+				for (int k = 0; k < num_jobs; ++k)
+					perform_job(jobs[k], completed_jobs);
+				return;
+			}
+			iov[i].iov_base = j->buffer;
+			iov[i].iov_len = j->d.io.buffer_size;
+		}
+
+		disk_io_job* first = jobs[0];
+		storage_interface* storage = first->storage->get_storage_impl();
+		if (storage->m_settings == 0) storage->m_settings = &m_settings;
+
+		m_outstanding_jobs += num_jobs;
+		ptime start_time = time_now_hires();
+
+		storage_error error;
+		int ret = storage->readv(iov, num_jobs, first->piece, first->d.io.offset
+			, file_flags_for_job(first), error);
+
+		if (error.ec)
+		{
+			// the error may only affect some of the blocks. Read them one
+			// at a time to find out which
+			m_outstanding_jobs -= num_jobs;
+			for (int i = 0; i < num_jobs; ++i)
+			{
+				m_disk_cache.free_buffer(jobs[i]->buffer);
+				jobs[i]->buffer = 0;
+				perform_job(jobs[i], completed_jobs);
+			}
+			return;
+		}
+
+		ptime now = time_now_hires();
+		boost::uint32_t read_time = total_microseconds(now - start_time);
+		m_read_time.add_sample(read_time / num_jobs);
+
+		m_stats_counters.inc_stats_counter(counters::num_read_back, num_jobs);
+		m_stats_counters.inc_stats_counter(counters::num_blocks_read, num_jobs);
+		m_stats_counters.inc_stats_counter(counters::num_read_ops);
+		m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+		m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+
+		// hand each job its part of what was read. If we hit the end of
+		// the file, the jobs at the end get short reads
+		int pos = 0;
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+			j->ret = (std::min)((std::max)(ret - pos, 0), int(j->d.io.buffer_size));
+			pos += j->d.io.buffer_size;
+
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
+			cached_piece_entry* pe = m_disk_cache.find_piece(j);
+			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
+			l.unlock();
+
+			--m_outstanding_jobs;
+			m_job_time.add_sample(total_microseconds(now - start_time));
+			completed_jobs.push_back(j);
+		}
+	}
+
+	// hashes pieces in lockstep with a multi_hasher. This only makes sense
+	// for pieces that aren't in the cache, and that wouldn't be read into
+	// the cache by do_hash() either, which is what a force-recheck results
+	// in. Any other hash job is performed the normal way. The pieces are
+	// read one block at a time, the same block of every piece before moving
+	// on to the next
+	void disk_io_thread::perform_hash_batch(disk_io_job** jobs, int num_jobs
+		, tailqueue& completed_jobs)
+	{
+		TORRENT_ASSERT(num_jobs > 0);
+		TORRENT_ASSERT(num_jobs <= multi_hasher::max_lanes);
+		check_cache_level(m_disk_cache.shard_index(jobs[0]->storage.get()), completed_jobs);
+
+		bool const use_read_cache = m_settings.get_bool(settings_pack::use_read_cache)
+			&& m_settings.get_int(settings_pack::cache_size) > 0;
+
+		disk_io_job* batch[multi_hasher::max_lanes];
+		int batch_size = 0;
+		for (int i = 0; i < num_jobs; ++i)
+		{
+			disk_io_job* j = jobs[i];
+			TORRENT_ASSERT(j->action == disk_io_job::hash);
+
+			bool batched = !use_read_cache || (j->flags & disk_io_job::volatile_read);
+			if (batched)
+			{
+				mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
+				batched = m_disk_cache.find_piece(j) == NULL;
+			}
+			if (batched) batch[batch_size++] = j;
+			else perform_job(j, completed_jobs);
+		}
+
+		if (batch_size == 0) return;
+		if (batch_size == 1)
+		{
+			perform_job(batch[0], completed_jobs);
+			return;
+		}
+
+		DLOG("perform_hash_batch: %d jobs\n", batch_size);
+
+		ptime const start_time = time_now_hires();
+		int const block_size = m_disk_cache.block_size();
+		io_uring_queue* ring = current_ring();
+
+		int piece_size[multi_hasher::max_lanes];
+		int ret[multi_hasher::max_lanes];
+		// the number of bytes of the current block read synchronously
+		int bytes_read[multi_hasher::max_lanes];
+		int max_piece_size = 0;
+		for (int i = 0; i < batch_size; ++i)
+		{
+			disk_io_job* j = batch[i];
+			if (j->storage->get_storage_impl()->m_settings == 0)
+				j->storage->get_storage_impl()->m_settings = &m_settings;
+			++m_outstanding_jobs;
+			piece_size[i] = j->storage->files()->piece_size(j->piece);
+			max_piece_size = (std::max)(max_piece_size, piece_size[i]);
+			ret[i] = 0;
+		}
+
+		file::iovec_t iov[multi_hasher::max_lanes];
+		if (m_disk_cache.allocate_iovec(iov, batch_size) < 0)
+		{
+			for (int i = 0; i < batch_size; ++i)
+			{
+				batch[i]->error.ec = error::no_memory;
+				batch[i]->error.operation = storage_error::alloc_cache_piece;
+				ret[i] = -1;
+			}
+			max_piece_size = 0;
+		}
+
+		multi_hasher h(batch_size);
+		char const* data[multi_hasher::max_lanes];
+		boost::uint64_t hash_time = 0;
+		int num_hashed = 0;
+
+		for (int offset = 0; offset < max_piece_size; offset += block_size)
+		{
+			ptime const read_start = time_now_hires();
+			if (ring) ring->reset(batch_size);
+
+			int num_reads = 0;
+			for (int i = 0; i < batch_size; ++i)
+			{
+				data[i] = NULL;
+				if (ret[i] < 0 || offset >= piece_size[i]) continue;
+
+				disk_io_job* j = batch[i];
+				iov[i].iov_len = (std::min)(block_size, piece_size[i] - offset);
+				int const r = ring
+					? j->storage->get_storage_impl()->submit_readv(*ring, i
+						, &iov[i], 1, j->piece, offset, file_flags_for_job(j), j->error)
+					: j->storage->get_storage_impl()->readv(&iov[i], 1, j->piece
+						, offset, file_flags_for_job(j), j->error);
+				if (r < 0)
+				{
+					ret[i] = -1;
+					continue;
+				}
+				bytes_read[i] = r;
+				// when reading synchronously, a short read is detected here.
+				// With the ring, once the read has completed
+				if (!ring && r != int(iov[i].iov_len))
+				{
+					j->error.ec.assign(boost::asio::error::eof
+						, boost::asio::error::get_misc_category());
+					j->error.operation = storage_error::read;
+					ret[i] = -1;
+					continue;
+				}
+				data[i] = (char const*)iov[i].iov_base;
+				++num_reads;
+			}
+
+			if (ring)
+			{
+				count_ring_ops(m_stats_counters, ring->submit_and_wait());
+				for (int i = 0; i < batch_size; ++i)
+				{
+					if (data[i] == NULL) continue;
+					disk_io_job* j = batch[i];
+					if (ring->error(i))
+					{
+						j->error.ec = ring->error(i);
+						j->error.file = ring->error_file(i);
+						j->error.operation = storage_error::read;
+					}
+					else if (bytes_read[i] + ring->bytes_transferred(i) != int(iov[i].iov_len))
+					{
+						j->error.ec.assign(boost::asio::error::eof
+							, boost::asio::error::get_misc_category());
+						j->error.operation = storage_error::read;
+					}
+					else continue;
+					ret[i] = -1;
+					data[i] = NULL;
+					--num_reads;
+				}
+			}
+
+			if (num_reads == 0) continue;
+
+			ptime const hash_start = time_now_hires();
+			boost::uint32_t const read_time = total_microseconds(hash_start - read_start);
+			m_read_time.add_sample(read_time / num_reads);
+
+			m_stats_counters.inc_stats_counter(counters::num_blocks_read, num_reads);
+			m_stats_counters.inc_stats_counter(counters::num_read_ops, num_reads);
+			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+
+			// all blocks are full, except for the last block of the last
+			// piece. Whatever the lanes have in common is hashed in lockstep
+			// and the rest of the longer blocks separately
+			int len = block_size;
+			for (int i = 0; i < batch_size; ++i)
+				if (data[i]) len = (std::min)(len, int(iov[i].iov_len));
+			h.update(data, len);
+			for (int i = 0; i < batch_size; ++i)
+			{
+				if (data[i] == NULL || int(iov[i].iov_len) == len) continue;
+				char const* tail[multi_hasher::max_lanes] = { NULL };
+				tail[i] = data[i] + len;
+				h.update(tail, iov[i].iov_len - len);
+			}
+
+			hash_time += total_microseconds(time_now_hires() - hash_start);
+			num_hashed += num_reads;
+		}
+
+		if (max_piece_size > 0)
+			m_disk_cache.free_iovec(iov, batch_size);
+
+		if (num_hashed > 0)
+		{
+			m_hash_time.add_sample(hash_time / num_hashed);
+			m_stats_counters.inc_stats_counter(counters::num_blocks_hashed, num_hashed);
+			m_stats_counters.inc_stats_counter(counters::disk_hash_time, hash_time);
+			m_stats_counters.inc_stats_counter(counters::disk_job_time, hash_time);
+		}
+
+		ptime const now = time_now_hires();
+		for (int i = 0; i < batch_size; ++i)
+		{
+			disk_io_job* j = batch[i];
+			if (ret[i] >= 0)
+			{
+				sha1_hash const piece_hash = h.final(i);
+				memcpy(j->d.piece_hash, &piece_hash[0], 20);
+			}
+
+			--m_outstanding_jobs;
+			j->ret = ret[i];
+			m_job_time.add_sample(total_microseconds(now - start_time));
+			completed_jobs.push_back(j);
+		}
+	}
+
+	// opens or closes the calling disk thread's io_uring, depending on the
+	// disk_io_backend setting. If the ring can't be set up (typically
+	// because the kernel is too old), ``failed`` is set to avoid retrying
+	// it on every job. The thread falls back to synchronous I/O.
+	void disk_io_thread::update_thread_ring(io_uring_queue& ring, bool& failed)
+	{
+#if TORRENT_USE_IO_URING
+		bool const want_ring = m_settings.get_int(settings_pack::disk_io_backend)
+			== settings_pack::io_uring_disk_io;
+
+		if (want_ring && !ring.is_open() && !failed)
+		{
+			error_code ec;
+			ring.open((std::max)(m_settings.get_int(settings_pack::aio_max), 1), ec);
+			if (ec)
+			{
+				DLOG("failed to set up io_uring: (%d) %s\n"
+					, ec.value(), ec.message().c_str());
+				failed = true;
+			}
+		}
+		else if (!want_ring)
+		{
+			if (ring.is_open()) ring.close();
+			failed = false;
+		}
+
+		disk_thread_ring = ring.is_open() ? &ring : NULL;
+#else
+		(void)ring;
+		failed = true;
+#endif
+	}
+
 	int disk_io_thread::do_uncached_read(disk_io_job* j)
 	{
 		j->buffer = m_disk_cache.allocate_buffer("send buffer");
@@ -1212,44 +1777,125 @@ namespace libtorrent
 		if (!j->error.ec)
 		{
 			boost::uint32_t read_time = total_microseconds(time_now_hires() - start_time);
-			m_read_time.add_sample(read_time);
+			m_read_time.add_sample(read_time);
+
+			m_stats_counters.inc_stats_counter(counters::num_read_back);
+			m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+			m_stats_counters.inc_stats_counter(counters::num_read_ops);
+			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+		}
+		return ret;
+	}
+
+	// completes a read job by handing back the file region the block is
+	// stored in, rather than the block itself. If the block can't be sent
+	// from the file, the zero_copy flag is cleared and it's read into a
+	// buffer instead. Either way, the block cache is bypassed
+	int disk_io_thread::do_zero_copy_read(disk_io_job* j)
+	{
+		TORRENT_ASSERT(j->flags & disk_io_job::zero_copy);
+
+		size_type file_offset = 0;
+		file_handle f = j->storage->get_storage_impl()->map_file_region(j->piece
+			, j->d.io.offset, j->d.io.buffer_size, file_flags_for_job(j)
+			, file_offset, j->error);
+		if (j->error.ec) return -1;
+
+		if (!f)
+		{
+			j->flags &= ~disk_io_job::zero_copy;
+			return do_uncached_read(j);
+		}
+
+		file_region* r = new file_region;
+		r->file = f;
+		r->offset = file_offset;
+		j->buffer = (char*)r;
+
+		m_stats_counters.inc_stats_counter(counters::num_zero_copy_reads);
+		return j->d.io.buffer_size;
+	}
+
+	int disk_io_thread::do_read(disk_io_job* j, tailqueue& completed_jobs)
+	{
+		if (j->flags & disk_io_job::zero_copy)
+			return do_zero_copy_read(j);
+
+		if (!m_settings.get_bool(settings_pack::use_read_cache)
+			|| m_settings.get_int(settings_pack::cache_size) == 0)
+		{
+			// we're not using a cache. This is the simple path
+			// just read straight from the file
+			int ret = do_uncached_read(j);
+
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
+			cached_piece_entry* pe = m_disk_cache.find_piece(j);
+			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
+			return ret;
+		}
+
+		int iov_len = read_iovec_len(j);
+		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, iov_len);
+
+		int ret = 0;
+		if (!prep_read(j, iov, iov_len, ret, completed_jobs))
+			return ret;
+
+		// at this point, all the buffers are allocated and iov is initizalied
+		// and the blocks have their refcounters incremented, so no other thread
+		// can remove them. We can now release the cache mutex and dive into the
+		// disk operations.
+
+		// this is the offset that's aligned to block boundaries
+		int block_size = m_disk_cache.block_size();
+		size_type adjusted_offset = j->d.io.offset & ~(block_size-1);
+
+		int file_flags = file_flags_for_job(j);
+		ptime start_time = time_now_hires();
+
+		ret = j->storage->get_storage_impl()->readv(iov, iov_len
+			, j->piece, adjusted_offset, file_flags, j->error);
+
+		if (!j->error.ec)
+		{
+			boost::uint32_t read_time = total_microseconds(time_now_hires() - start_time);
+			m_read_time.add_sample(read_time / iov_len);
 
-			m_stats_counters.inc_stats_counter(counters::num_read_back);
-			m_stats_counters.inc_stats_counter(counters::num_blocks_read);
+			m_stats_counters.inc_stats_counter(counters::num_blocks_read, iov_len);
 			m_stats_counters.inc_stats_counter(counters::num_read_ops);
 			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
 			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
 		}
-		return ret;
+
+		return finish_read(j, iov, iov_len, ret, completed_jobs);
 	}
 
-	int disk_io_thread::do_read(disk_io_job* j, tailqueue& completed_jobs)
+	// the number of blocks a cached read job will read, including read-ahead
+	int disk_io_thread::read_iovec_len(disk_io_job const* j) const
 	{
-		if (!m_settings.get_bool(settings_pack::use_read_cache)
-			|| m_settings.get_int(settings_pack::cache_size) == 0)
-		{
-			// we're not using a cache. This is the simple path
-			// just read straight from the file
-			int ret = do_uncached_read(j);
-
-			mutex::scoped_lock l(m_cache_mutex);
-			cached_piece_entry* pe = m_disk_cache.find_piece(j);
-			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
-			return ret;
-		}
-
 		int block_size = m_disk_cache.block_size();
 		int piece_size = j->storage->files()->piece_size(j->piece);
 		int blocks_in_piece = (piece_size + block_size - 1) / block_size;
-		int iov_len = m_disk_cache.pad_job(j, blocks_in_piece
+		return m_disk_cache.pad_job(j, blocks_in_piece
 			, m_settings.get_int(settings_pack::read_cache_line_size));
+	}
 
-		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, iov_len);
+	// allocates the buffers for a cached read job into iov, which is expected
+	// to have room for read_iovec_len() entries. Returns true if the read
+	// should be issued. If it returns false, the job has already been taken
+	// care of and ret is set to its return value
+	bool disk_io_thread::prep_read(disk_io_job* j, file::iovec_t* iov, int iov_len
+		, int& ret, tailqueue& completed_jobs)
+	{
+		int block_size = m_disk_cache.block_size();
+		int piece_size = j->storage->files()->piece_size(j->piece);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		int evict = m_disk_cache.num_to_evict(iov_len);
-		if (evict > 0) m_disk_cache.try_evict_blocks(evict);
+		if (evict > 0) m_disk_cache.try_evict_blocks(
+			m_disk_cache.shard_index(j->storage.get()), evict);
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL)
@@ -1268,7 +1914,8 @@ namespace libtorrent
 				j->error.ec = error::no_memory;
 				j->error.operation = storage_error::alloc_cache_piece;
 				m_disk_cache.free_iovec(iov, iov_len);
-				return -1;
+				ret = -1;
+				return false;
 			}
 #if TORRENT_USE_ASSERTS
 			pe->piece_log.push_back(piece_log_t(piece_log_t::set_outstanding_jobs));
@@ -1280,16 +1927,14 @@ namespace libtorrent
 		l.unlock();
 
 		// then we'll actually allocate the buffers
-		int ret = m_disk_cache.allocate_iovec(iov, iov_len);
-
-		if (ret < 0)
+		if (m_disk_cache.allocate_iovec(iov, iov_len) < 0)
 		{
 			ret = do_uncached_read(j);
 
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe) maybe_issue_queued_read_jobs(pe, completed_jobs);
-			return ret;
+			return false;
 		}
 
 		// this is the offset that's aligned to block boundaries
@@ -1300,37 +1945,28 @@ namespace libtorrent
 		iov[iov_len-1].iov_len = (std::min)(int(piece_size - adjusted_offset)
 			- (iov_len-1) * block_size, block_size);
 		TORRENT_ASSERT(iov[iov_len-1].iov_len > 0);
+		return true;
+	}
 
-		// at this point, all the buffers are allocated and iov is initizalied
-		// and the blocks have their refcounters incremented, so no other thread
-		// can remove them. We can now release the cache mutex and dive into the
-		// disk operations.
-
-		int file_flags = file_flags_for_job(j);
-		ptime start_time = time_now_hires();
-
-		ret = j->storage->get_storage_impl()->readv(iov, iov_len
-			, j->piece, adjusted_offset, file_flags, j->error);
-
-		if (!j->error.ec)
-		{
-			boost::uint32_t read_time = total_microseconds(time_now_hires() - start_time);
-			m_read_time.add_sample(read_time / iov_len);
+	// inserts the blocks read by a cached read job into the cache and
+	// completes the job (and any other jobs waiting for the same piece).
+	// ret is the return value from reading into iov
+	int disk_io_thread::finish_read(disk_io_job* j, file::iovec_t* iov, int iov_len
+		, int ret, tailqueue& completed_jobs)
+	{
+		int block_size = m_disk_cache.block_size();
 
-			m_stats_counters.inc_stats_counter(counters::num_blocks_read, iov_len);
-			m_stats_counters.inc_stats_counter(counters::num_read_ops);
-			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
-			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
-		}
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
-		l.lock();
+		// the piece is pinned by its outstanding_read flag, so it
+		// can't have been evicted while we were reading
+		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 
 		if (ret < 0)
 		{
 			// read failed. free buffers and return error
 			m_disk_cache.free_iovec(iov, iov_len);
 
-			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe == NULL)
 			{
 				// the piece is supposed to be allocated when the
@@ -1351,6 +1987,7 @@ namespace libtorrent
 			return ret;
 		}
 
+		TORRENT_ASSERT(pe != NULL);
 		int block = j->d.io.offset / block_size;
 #if TORRENT_USE_ASSERT
 		pe->piece_log.push_back(piece_log_t(j->action, block));
@@ -1362,7 +1999,7 @@ namespace libtorrent
 
 		TORRENT_ASSERT(pe->blocks[block].buf);
 
-		int tmp = m_disk_cache.try_read(j, true);
+		int tmp = m_disk_cache.read_inserted(j);
 		TORRENT_ASSERT(tmp >= 0);
 
 		maybe_issue_queued_read_jobs(pe, completed_jobs);
@@ -1496,7 +2133,7 @@ namespace libtorrent
 		if (m_settings.get_bool(settings_pack::use_write_cache)
 				&& m_settings.get_int(settings_pack::cache_size) > 0)
 		{
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 			cached_piece_entry* pe = m_disk_cache.find_piece(j);
 			if (pe && pe->hashing_done)
@@ -1579,7 +2216,7 @@ namespace libtorrent
 		j->requester = requester;
 		j->callback = handler;
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		int ret = prep_read_job_impl(j);
 		l.unlock();
 
@@ -1599,7 +2236,7 @@ namespace libtorrent
 	// and if it doesn't have a picece allocated, it allocates
 	// one and it sets outstanding_read flag and possibly queues
 	// up the job in the piece read job list
-	// the cache mutex must be held when calling this
+	// the mutex of the job's cache shard must be held when calling this
 	// 
 	// returns 0 if the job succeeded immediately
 	// 1 if it needs to be added to the job queue
@@ -1618,6 +2255,8 @@ namespace libtorrent
 				m_stats_counters.inc_stats_counter(counters::num_blocks_cache_hits);
 				DLOG("do_read: cache hit\n");
 				j->flags |= disk_io_job::cache_hit;
+				// the block is already in memory, send it from there
+				j->flags &= ~disk_io_job::zero_copy;
 				j->ret = ret;
 				return 0;
 			}
@@ -1639,6 +2278,10 @@ namespace libtorrent
 				return 2;
 			}
 
+			// zero-copy reads that miss the cache are served straight from
+			// the file, without pulling the piece into the cache
+			if (j->flags & disk_io_job::zero_copy) return 1;
+
 			cached_piece_entry* pe = m_disk_cache.allocate_piece(j, cached_piece_entry::read_lru1);
 			if (pe == NULL)
 			{
@@ -1689,7 +2332,7 @@ namespace libtorrent
 		j->flags = flags;
 
 #if TORRENT_USE_ASSERT
-		mutex::scoped_lock l3_(m_cache_mutex);
+		mutex::scoped_lock l3_(m_disk_cache.cache_mutex(j));
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe)
 		{
@@ -1704,22 +2347,24 @@ namespace libtorrent
 #endif
 
 #if TORRENT_USE_ASSERT && defined TORRENT_EXPENSIVE_INVARIANT_CHECKS
-		mutex::scoped_lock l2_(m_cache_mutex);
-		std::pair<block_cache::iterator, block_cache::iterator> range = m_disk_cache.all_pieces();
-		for (block_cache::iterator i = range.first; i != range.second; ++i)
+		for (int s = 0; s < block_cache::num_shards; ++s)
 		{
-			cached_piece_entry const& p = *i;
-			int bs = m_disk_cache.block_size();
-			int piece_size = p.storage->files()->piece_size(p.piece);
-			int blocks_in_piece = (piece_size + bs - 1) / bs;
-			for (int k = 0; k < blocks_in_piece; ++k)
-				TORRENT_PIECE_ASSERT(p.blocks[k].buf != j->buffer, &p);
+			mutex::scoped_lock l2_(m_disk_cache.shard_mutex(s));
+			std::pair<block_cache::iterator, block_cache::iterator> range = m_disk_cache.all_pieces(s);
+			for (block_cache::iterator i = range.first; i != range.second; ++i)
+			{
+				cached_piece_entry const& p = *i;
+				int bs = m_disk_cache.block_size();
+				int piece_size = p.storage->files()->piece_size(p.piece);
+				int blocks_in_piece = (piece_size + bs - 1) / bs;
+				for (int k = 0; k < blocks_in_piece; ++k)
+					TORRENT_PIECE_ASSERT(p.blocks[k].buf != j->buffer, &p);
+			}
 		}
-		l2_.unlock();
 #endif
 
 #if !defined TORRENT_DISABLE_POOL_ALLOCATOR && TORRENT_USE_ASSERTS
-		mutex::scoped_lock l_(m_cache_mutex);
+		mutex::scoped_lock l_(m_disk_cache.cache_mutex(j));
 		TORRENT_ASSERT(m_disk_cache.is_disk_buffer(j->buffer));
 		l_.unlock();
 #endif
@@ -1743,7 +2388,7 @@ namespace libtorrent
 				return;
 			}
 
-			mutex::scoped_lock l(m_cache_mutex);
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 			// if we succeed in adding the block to the cache, the job will
 			// be added along with it. we may not free j if so
 			cached_piece_entry* pe = m_disk_cache.add_dirty_block(j);
@@ -1794,7 +2439,7 @@ namespace libtorrent
 		int piece_size = storage->files()->piece_size(piece);
 
 		// first check to see if the hashing is already done
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe && !pe->hashing && pe->hash && pe->hash->offset == piece_size)
 		{
@@ -1820,6 +2465,26 @@ namespace libtorrent
 		add_job(j);
 	}
 
+	void disk_io_thread::async_check_pieces(piece_manager* storage, int piece
+		, int num_pieces, boost::function<void(disk_io_job const*)> const& handler)
+	{
+#ifdef TORRENT_DEBUG
+		// the caller must increment the torrent refcount before
+		// issuing an async disk request
+		storage->assert_torrent_refcount();
+#endif
+		TORRENT_ASSERT(num_pieces > 0);
+		TORRENT_ASSERT(piece + num_pieces <= storage->files()->num_pieces());
+
+		disk_io_job* j = allocate_job(disk_io_job::check_pieces);
+		j->storage = storage->shared_from_this();
+		j->piece = piece;
+		j->d.num_pieces = num_pieces;
+		j->callback = handler;
+		j->flags = disk_io_job::sequential_access;
+		add_job(j);
+	}
+
 	void disk_io_thread::async_move_storage(piece_manager* storage, std::string const& p, int flags
 		, boost::function<void(disk_io_job const*)> const& handler)
 	{
@@ -1862,27 +2527,13 @@ namespace libtorrent
 
 		// remove outstanding jobs belonging to this torrent
 		mutex::scoped_lock l2(m_job_mutex);
+		queue_incoming_jobs();
 
-		// TODO: maybe the tailqueue_iterator should contain a pointer-pointer
-		// instead and have an unlink function
-		disk_io_job* qj = (disk_io_job*)m_queued_jobs.get_all();
 		tailqueue to_abort;
-
-		while (qj)
-		{
-			disk_io_job* next = (disk_io_job*)qj->next;
-#if TORRENT_USE_ASSERTS
-			qj->next = NULL;
-#endif
-			if (qj->storage.get() == storage)
-				to_abort.push_back(qj);
-			else
-				m_queued_jobs.push_back(qj);
-			qj = next;
-		}
+		m_queued_jobs.remove_jobs(storage, to_abort);
 		l2.unlock();
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(storage));
 		flush_cache(storage, flush_delete_cache, completed_jobs, l);
 		l.unlock();
 
@@ -1954,21 +2605,25 @@ namespace libtorrent
 	{
 		// remove outstanding hash jobs belonging to this torrent
 		mutex::scoped_lock l2(m_job_mutex);
+		queue_incoming_jobs();
 
-		disk_io_job* qj = (disk_io_job*)m_queued_hash_jobs.get_all();
 		tailqueue to_abort;
-
-		while (qj)
+		tailqueue* queues[] = { &m_queued_hash_jobs, &m_queued_check_jobs };
+		for (int i = 0; i < int(sizeof(queues)/sizeof(queues[0])); ++i)
 		{
-			disk_io_job* next = (disk_io_job*)qj->next;
+			disk_io_job* qj = (disk_io_job*)queues[i]->get_all();
+			while (qj)
+			{
+				disk_io_job* next = (disk_io_job*)qj->next;
 #if TORRENT_USE_ASSERTS
-			qj->next = NULL;
+				qj->next = NULL;
 #endif
-			if (qj->storage.get() == storage)
-				to_abort.push_back(qj);
-			else
-				m_queued_hash_jobs.push_back(qj);
-			qj = next;
+				if (qj->storage.get() == storage)
+					to_abort.push_back(qj);
+				else
+					queues[i]->push_back(qj);
+				qj = next;
+			}
 		}
 		l2.unlock();
 
@@ -2086,7 +2741,7 @@ namespace libtorrent
 
 	void disk_io_thread::clear_read_cache(piece_manager* storage)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(storage));
 
 		tailqueue jobs;
 		boost::unordered_set<cached_piece_entry*> const& cache = storage->cached_pieces();
@@ -2125,7 +2780,7 @@ namespace libtorrent
 
 	void disk_io_thread::clear_piece(piece_manager* storage, int index)	
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(storage));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(storage, index);
 		if (pe == 0) return;
@@ -2263,6 +2918,9 @@ namespace libtorrent
 		int blocks_in_piece = (piece_size + block_size - 1) / block_size;
 		int file_flags = file_flags_for_job(j);
 
+		io_uring_queue* ring = current_ring();
+		if (ring) return do_uncached_hash_batched(j, *ring);
+
 		file::iovec_t iov;
 		iov.iov_base = m_disk_cache.allocate_buffer("hashing");
 		hasher h;
@@ -2302,6 +2960,83 @@ namespace libtorrent
 		return ret >= 0 ? 0 : -1;
 	}
 
+	// like do_uncached_hash(), but reads a window of blocks at a time,
+	// submitting all of them to the ring at once
+	int disk_io_thread::do_uncached_hash_batched(disk_io_job* j, io_uring_queue& ring)
+	{
+		int piece_size = j->storage->files()->piece_size(j->piece);
+		int block_size = m_disk_cache.block_size();
+		int blocks_in_piece = (piece_size + block_size - 1) / block_size;
+		int file_flags = file_flags_for_job(j);
+
+		// the number of blocks to have in flight at a time. This bounds the
+		// number of disk buffers a single hash job can use
+		int const window = (std::min)(blocks_in_piece, 16);
+
+		file::iovec_t* iov = TORRENT_ALLOCA(file::iovec_t, window);
+		if (m_disk_cache.allocate_iovec(iov, window) < 0)
+		{
+			j->error.ec = error::no_memory;
+			j->error.operation = storage_error::alloc_cache_piece;
+			return -1;
+		}
+
+		hasher h;
+		int ret = 0;
+		for (int block = 0; block < blocks_in_piece; block += window)
+		{
+			int num_blocks = (std::min)(window, blocks_in_piece - block);
+
+			DLOG("do_hash: (uncached) reading (piece: %d blocks: %d-%d)\n"
+				, int(j->piece), block, block + num_blocks);
+
+			ptime start_time = time_now_hires();
+
+			ring.reset(num_blocks);
+			for (int i = 0; i < num_blocks; ++i)
+			{
+				int offset = (block + i) * block_size;
+				iov[i].iov_len = (std::min)(block_size, piece_size - offset);
+				ret = j->storage->get_storage_impl()->submit_readv(ring, i
+					, &iov[i], 1, j->piece, offset, file_flags, j->error);
+				if (ret < 0) break;
+			}
+
+			// even if we failed half-way through, the operations that were
+			// submitted need to complete before we can free the buffers
+			count_ring_ops(m_stats_counters, ring.submit_and_wait());
+			if (ret < 0) break;
+
+			for (int i = 0; i < num_blocks; ++i)
+			{
+				if (!ring.error(i)) continue;
+				j->error.ec = ring.error(i);
+				j->error.file = ring.error_file(i);
+				j->error.operation = storage_error::read;
+				ret = -1;
+				break;
+			}
+			if (ret < 0) break;
+
+			boost::uint32_t read_time = total_microseconds(time_now_hires() - start_time);
+			m_read_time.add_sample(read_time / num_blocks);
+
+			m_stats_counters.inc_stats_counter(counters::num_blocks_read, num_blocks);
+			m_stats_counters.inc_stats_counter(counters::num_read_ops, num_blocks);
+			m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+			m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+
+			for (int i = 0; i < num_blocks; ++i)
+				h.update((char const*)iov[i].iov_base, iov[i].iov_len);
+		}
+
+		m_disk_cache.free_iovec(iov, window);
+
+		sha1_hash piece_hash = h.final();
+		memcpy(j->d.piece_hash, &piece_hash[0], 20);
+		return ret >= 0 ? 0 : -1;
+	}
+
 	int disk_io_thread::do_hash(disk_io_job* j, tailqueue& completed_jobs)
 	{
 		INVARIANT_CHECK;
@@ -2312,7 +3047,7 @@ namespace libtorrent
 		int piece_size = j->storage->files()->piece_size(j->piece);
 		int file_flags = file_flags_for_job(j);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe)
@@ -2513,6 +3248,10 @@ namespace libtorrent
 				ph->h.update((char const*)iov.iov_base, iov.iov_len);
 
 				l.lock();
+				// having to read back a block we just flushed means the
+				// write cache was too small to hold the piece until it
+				// was hashed
+				m_disk_cache.write_cache_miss(pe, 1);
 				m_disk_cache.insert_blocks(pe, i, &iov, 1, j);
 				l.unlock();
 			}
@@ -2564,7 +3303,7 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
 		l.unlock();
 
@@ -2580,7 +3319,7 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 #if TORRENT_USE_ASSERTS
 		m_disk_cache.mark_deleted(*j->storage->files());
 #endif
@@ -2609,7 +3348,7 @@ namespace libtorrent
 		// if this assert fails, something's wrong with the fence logic
 		TORRENT_ASSERT(j->storage->num_outstanding_jobs() == 1);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
 		l.unlock();
 
@@ -2637,7 +3376,7 @@ namespace libtorrent
 
 		// issue write commands for all dirty blocks
 		// and clear all read jobs
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		flush_cache(j->storage.get(), flush_read_cache | flush_write_cache, completed_jobs, l);
 		l.unlock();
 
@@ -2658,7 +3397,7 @@ namespace libtorrent
 
 		int file_flags = file_flags_for_job(j);
 
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL)
@@ -2783,18 +3522,28 @@ namespace libtorrent
 		mutex::scoped_lock jl(m_job_mutex);
 
 		c.set_value(counters::queued_disk_jobs, m_num_blocked_jobs
-			+ m_queued_jobs.size() + m_queued_hash_jobs.size());
+			+ m_queued_jobs.size() + m_queued_hash_jobs.size()
+			+ m_queued_check_jobs.size());
+		c.set_value(counters::queued_read_jobs
+			, m_queued_jobs.size(disk_job_scheduler::read_class));
+		c.set_value(counters::queued_write_jobs
+			, m_queued_jobs.size(disk_job_scheduler::write_class));
+		c.set_value(counters::queued_hash_jobs
+			, m_queued_jobs.size(disk_job_scheduler::hash_class)
+			+ m_queued_hash_jobs.size());
+		c.set_value(counters::queued_maintenance_jobs
+			, m_queued_jobs.size(disk_job_scheduler::maintenance_class)
+			+ m_queued_check_jobs.size());
 		c.set_value(counters::num_read_jobs, read_jobs_in_use());
 		c.set_value(counters::num_write_jobs, write_jobs_in_use());
 		c.set_value(counters::num_jobs, jobs_in_use());
 
 		jl.unlock();
 
-		mutex::scoped_lock l(m_cache_mutex);
-
 		// gauges
 		c.set_value(counters::disk_blocks_in_use, m_disk_cache.in_use());
 
+		// this locks each shard of the cache in turn
 		m_disk_cache.update_stats_counters(c);
 	}
 
@@ -2802,7 +3551,8 @@ namespace libtorrent
 		, piece_manager const* storage) const
 	{
 		mutex::scoped_lock jl(m_job_mutex);
-		ret->queued_jobs = m_queued_jobs.size() + m_queued_hash_jobs.size();
+		ret->queued_jobs = m_queued_jobs.size() + m_queued_hash_jobs.size()
+			+ m_queued_check_jobs.size();
 		jl.unlock();
 
 #ifndef TORRENT_NO_DEPRECATE
@@ -2831,7 +3581,6 @@ namespace libtorrent
 		ret->total_read_back = m_stats_counters[counters::num_read_back];
 #endif
 
-		mutex::scoped_lock l(m_cache_mutex);
 		*ret = m_cache_stats;
 		ret->total_used_buffers = m_disk_cache.in_use();
 		ret->blocked_jobs = m_num_blocked_jobs;
@@ -2842,6 +3591,7 @@ namespace libtorrent
 		ret->num_write_jobs = write_jobs_in_use();
 		ret->num_writing_threads = m_stats_counters[counters::num_writing_threads];
 
+		// this locks each shard of the cache in turn
 		m_disk_cache.get_stats(ret);
 
 		ret->pieces.clear();
@@ -2852,6 +3602,7 @@ namespace libtorrent
 
 		if (storage)
 		{
+			mutex::scoped_lock l(m_disk_cache.cache_mutex(storage));
 			ret->pieces.reserve(storage->num_pieces());
 
 			for (boost::unordered_set<cached_piece_entry*>::iterator i
@@ -2869,25 +3620,29 @@ namespace libtorrent
 		}
 		else
 		{
-			ret->pieces.reserve(m_disk_cache.num_pieces());
+			for (int s = 0; s < block_cache::num_shards; ++s)
+			{
+				mutex::scoped_lock l(m_disk_cache.shard_mutex(s));
+				ret->pieces.reserve(ret->pieces.size() + m_disk_cache.num_pieces(s));
 
-			std::pair<block_cache::iterator, block_cache::iterator> range
-				= m_disk_cache.all_pieces();
+				std::pair<block_cache::iterator, block_cache::iterator> range
+					= m_disk_cache.all_pieces(s);
 
-			for (block_cache::iterator i = range.first; i != range.second; ++i)
-			{
-				if (i->cache_state == cached_piece_entry::read_lru2_ghost
-					|| i->cache_state == cached_piece_entry::read_lru1_ghost)
-					continue;
-				ret->pieces.push_back(cached_piece_info());
-				get_cache_info_impl(ret->pieces.back(), &*i, block_size);
+				for (block_cache::iterator i = range.first; i != range.second; ++i)
+				{
+					if (i->cache_state == cached_piece_entry::read_lru2_ghost
+						|| i->cache_state == cached_piece_entry::read_lru1_ghost)
+						continue;
+					ret->pieces.push_back(cached_piece_info());
+					get_cache_info_impl(ret->pieces.back(), &*i, block_size);
+				}
 			}
 		}
 	}
 
 	int disk_io_thread::do_flush_piece(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == NULL) return 0;
@@ -2905,7 +3660,7 @@ namespace libtorrent
 	// triggered by another mechanism.
 	int disk_io_thread::do_flush_hashed(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 
@@ -2956,7 +3711,7 @@ namespace libtorrent
 
 	int disk_io_thread::do_flush_storage(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 		flush_cache(j->storage.get(), flush_write_cache, completed_jobs, l);
 		return 0;
 	}
@@ -2999,7 +3754,7 @@ namespace libtorrent
 	// have been evicted
 	int disk_io_thread::do_clear_piece(disk_io_job* j, tailqueue& completed_jobs)
 	{
-		mutex::scoped_lock l(m_cache_mutex);
+		mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 
 		cached_piece_entry* pe = m_disk_cache.find_piece(j);
 		if (pe == 0) return 0;
@@ -3040,6 +3795,124 @@ namespace libtorrent
 		return j->storage->get_storage_impl()->tick();
 	}
 
+	// hashes a run of pieces of a torrent that's being checked. The whole
+	// run is read with a single read, straight into a buffer of its own
+	// rather than through the block cache, and the pieces are hashed in
+	// lockstep. The piece hashes are returned in j->buffer. Pieces that
+	// can't be read because their file is missing or too short get an all
+	// zero hash, which won't match. Any other error fails the job.
+	int disk_io_thread::do_check_pieces(disk_io_job* j, tailqueue& /* completed_jobs */)
+	{
+		file_storage const& fs = *j->storage->files();
+		storage_interface* st = j->storage->get_storage_impl();
+		int const num_pieces = j->d.num_pieces;
+		int const first_piece = j->piece;
+		int const piece_length = fs.piece_length();
+		int const size = (num_pieces - 1) * piece_length
+			+ fs.piece_size(first_piece + num_pieces - 1);
+		int const file_flags = file_flags_for_job(j);
+
+		j->buffer = (char*)malloc(num_pieces * 20);
+		char* buf = page_aligned_allocator::malloc(size);
+		if (j->buffer == NULL || buf == NULL)
+		{
+			if (buf) page_aligned_allocator::free(buf);
+			j->error.ec = error::no_memory;
+			j->error.operation = storage_error::alloc_cache_piece;
+			return -1;
+		}
+
+		ptime const start_time = time_now_hires();
+
+		// pieces that could not be read
+		std::vector<bool> failed;
+		file::iovec_t b = { buf, size_t(size) };
+		int ret = st->readv(&b, 1, first_piece, 0, file_flags, j->error);
+		int num_reads = 1;
+		if (ret != size)
+		{
+			// something is missing. Read the pieces one at a time to find out
+			// which ones
+			failed.resize(num_pieces, false);
+			for (int i = 0; i < num_pieces; ++i)
+			{
+				storage_error e;
+				b.iov_base = buf + i * piece_length;
+				b.iov_len = fs.piece_size(first_piece + i);
+				ret = st->readv(&b, 1, first_piece + i, 0, file_flags, e);
+				++num_reads;
+				if (ret == int(b.iov_len)) continue;
+				if (ret < 0 && e.ec != boost::system::errc::no_such_file_or_directory
+					&& e.ec != boost::asio::error::eof
+#ifdef TORRENT_WINDOWS
+					&& e.ec != error_code(ERROR_HANDLE_EOF, system_category())
+#endif
+					)
+				{
+					page_aligned_allocator::free(buf);
+					j->error = e;
+					return -1;
+				}
+				failed[i] = true;
+			}
+			j->error = storage_error();
+		}
+
+		ptime const hash_start = time_now_hires();
+		boost::uint32_t const read_time = total_microseconds(hash_start - start_time);
+		int const block_size = m_disk_cache.block_size();
+		int const num_blocks = (size + block_size - 1) / block_size;
+		m_read_time.add_sample(read_time / num_blocks);
+		m_stats_counters.inc_stats_counter(counters::num_blocks_read, num_blocks);
+		m_stats_counters.inc_stats_counter(counters::num_read_ops, num_reads);
+		m_stats_counters.inc_stats_counter(counters::disk_read_time, read_time);
+		m_stats_counters.inc_stats_counter(counters::disk_job_time, read_time);
+
+		// all pieces are full size, except possibly the last piece of the
+		// torrent, which is hashed on its own
+		int const lanes = multi_hasher::preferred_lanes();
+		for (int i = 0; i < num_pieces;)
+		{
+			char const* data[multi_hasher::max_lanes] = { NULL };
+			int n = 0;
+			while (n < lanes && i + n < num_pieces
+				&& fs.piece_size(first_piece + i + n) == piece_length)
+			{
+				if (failed.empty() || !failed[i + n])
+					data[n] = buf + (i + n) * piece_length;
+				++n;
+			}
+
+			if (n == 0)
+			{
+				sha1_hash h;
+				if (failed.empty() || !failed[i])
+					h = hasher(buf + i * piece_length, fs.piece_size(first_piece + i)).final();
+				memcpy(j->buffer + i * 20, &h[0], 20);
+				++i;
+				continue;
+			}
+
+			multi_hasher h(n);
+			h.update(data, piece_length);
+			for (int k = 0; k < n; ++k)
+			{
+				sha1_hash const ph = data[k] ? h.final(k) : sha1_hash();
+				memcpy(j->buffer + (i + k) * 20, &ph[0], 20);
+			}
+			i += n;
+		}
+
+		page_aligned_allocator::free(buf);
+
+		boost::uint32_t const hash_time = total_microseconds(time_now_hires() - hash_start);
+		m_hash_time.add_sample(hash_time / num_blocks);
+		m_stats_counters.inc_stats_counter(counters::num_blocks_hashed, num_blocks);
+		m_stats_counters.inc_stats_counter(counters::disk_hash_time, hash_time);
+		m_stats_counters.inc_stats_counter(counters::disk_job_time, hash_time);
+		return 0;
+	}
+
 	void disk_io_thread::add_fence_job(piece_manager* storage, disk_io_job* j)
 	{
 		// if this happens, it means we started to shut down
@@ -3053,8 +3926,11 @@ namespace libtorrent
 
 		++m_cache_stats.num_fence_jobs[j->action];
 
+		j->issue_time = time_now_hires();
+
 		disk_io_job* fj = allocate_job(disk_io_job::flush_storage);
 		fj->storage = j->storage;
+		fj->issue_time = j->issue_time;
 
 		int ret = storage->raise_fence(j, fj, &m_num_blocked_jobs);
 		if (ret == disk_job_fence::fence_post_fence)
@@ -3120,6 +3996,8 @@ namespace libtorrent
 			, job_action_name[j->action]
 			, j->storage ? j->storage->num_outstanding_jobs() : 0);
 
+		j->issue_time = time_now_hires();
+
 		// is the fence up for this storage?
 		// jobs that are instantaneous are not affected by the fence, is_blocked()
 		// will take ownership of the job and queue it up, in case the fence is up
@@ -3134,25 +4012,67 @@ namespace libtorrent
 			return;
 		}
 
-		mutex::scoped_lock l(m_job_mutex);
-
 		TORRENT_ASSERT((j->flags & disk_io_job::in_progress) || !j->storage);
-		
-		// if there are at least 3 threads, there's a hasher thread
-		// and the hash jobs go into a separate queue
-		// see set_num_threads()
-		if (m_num_threads > 3 && j->action == disk_io_job::hash)
-			m_queued_hash_jobs.push_back(j);
-		else
-			m_queued_jobs.push_back(j);
+
+		// this is called for every block we receive, so it doesn't take
+		// m_job_mutex. The job is picked up by the next submit_jobs() call,
+		// or by a disk thread looking for more work
+		m_incoming_jobs.push_back(j);
+	}
+
+	void disk_io_thread::queue_incoming_jobs()
+	{
+		if (m_incoming_jobs.empty()) return;
+
+		tailqueue jobs;
+		m_incoming_jobs.get_all(jobs);
+		bool generic_jobs = false;
+		bool hash_jobs = false;
+		while (!jobs.empty())
+		{
+			disk_io_job* j = (disk_io_job*)jobs.pop_front();
+
+			// if there are at least 3 threads, there's a hasher thread
+			// and the hash jobs go into a separate queue
+			// see set_num_threads()
+			if (m_num_threads > 3 && j->action == disk_io_job::hash)
+			{
+				m_queued_hash_jobs.push_back(j);
+				hash_jobs = true;
+			}
+			else if (m_num_threads > 3 && j->action == disk_io_job::check_pieces)
+			{
+				m_queued_check_jobs.push_back(j);
+				hash_jobs = true;
+			}
+			else
+			{
+				m_queued_jobs.push_back(j);
+				generic_jobs = true;
+			}
+		}
+
+		// the thread that moved the jobs may not be the kind that
+		// performs them
+		if (generic_jobs) m_job_cond.notify_all();
+		if (hash_jobs) m_hash_job_cond.notify_all();
+	}
+
+	void disk_io_thread::count_queue_time(disk_io_job const* j, ptime now)
+	{
+		int const job_class = disk_job_scheduler::job_class(j->action);
+		m_stats_counters.inc_stats_counter(counters::disk_read_queue_time + job_class
+			, total_microseconds(now - j->issue_time));
+		m_stats_counters.inc_stats_counter(counters::disk_read_jobs + job_class);
 	}
 
 	void disk_io_thread::submit_jobs()
 	{
 		mutex::scoped_lock l(m_job_mutex);
+		queue_incoming_jobs();
 		if (!m_queued_jobs.empty())
 			m_job_cond.notify_all();
-		if (!m_queued_hash_jobs.empty())
+		if (!m_queued_hash_jobs.empty() || !m_queued_check_jobs.empty())
 			m_hash_job_cond.notify_all();
 	}
 
@@ -3163,6 +4083,17 @@ namespace libtorrent
 		++m_num_running_threads;
 		m_stats_counters.inc_stats_counter(counters::num_running_threads, 1);
 
+		// used when the disk_io_backend is set to io_uring_disk_io
+		io_uring_queue ring;
+		bool ring_failed = false;
+		update_thread_ring(ring, ring_failed);
+
+		// read jobs to submit to the ring together
+		std::vector<disk_io_job*> read_batch;
+
+		// hash jobs to hash together, by hasher threads
+		std::vector<disk_io_job*> hash_batch;
+
 		mutex::scoped_lock l(m_job_mutex);
 		for (;;)
 		{
@@ -3170,7 +4101,12 @@ namespace libtorrent
 			if (type == generic_thread)
 			{
 				TORRENT_ASSERT(l.locked());
-				while (m_queued_jobs.empty() && thread_id < m_num_threads) m_job_cond.wait(l);
+				queue_incoming_jobs();
+				while (m_queued_jobs.empty() && thread_id < m_num_threads)
+				{
+					m_job_cond.wait(l);
+					queue_incoming_jobs();
+				}
 
 				// if the number of wanted threads is decreased,
 				// we may stop this thread
@@ -3183,13 +4119,97 @@ namespace libtorrent
 				}
 
 				j = (disk_io_job*)m_queued_jobs.pop_front();
+
+				read_batch.clear();
+				int const elevator_window = m_settings.get_int(settings_pack::read_elevator_window);
+				// zero-copy reads don't actually read anything, there's no
+				// point in batching them
+				if ((ring.is_open() || elevator_window > 0)
+					&& j->action == disk_io_job::read
+					&& (j->flags & disk_io_job::zero_copy) == 0)
+				{
+					// grab the read jobs queued up behind this one as well
+					// and have all of them in flight at once
+					int const max_batch = (std::max)(m_settings.get_int(settings_pack::aio_max), 1);
+
+					if (elevator_window > 0)
+					{
+						// to have more reads to sort this one with, wait for
+						// them, but only until the job has been queued for
+						// read_elevator_window milliseconds
+						ptime const deadline = j->issue_time + milliseconds(elevator_window);
+						for (ptime now = time_now_hires(); now < deadline
+							&& m_queued_jobs.size(disk_job_scheduler::read_class) < max_batch - 1
+							&& thread_id < m_num_threads; now = time_now_hires())
+						{
+							m_job_cond.wait_for(l, deadline - now);
+							queue_incoming_jobs();
+						}
+					}
+
+					read_batch.push_back(j);
+					for (disk_io_job* next = m_queued_jobs.peek(disk_job_scheduler::read_class);
+						next != NULL && int(read_batch.size()) < max_batch
+						&& next->action == disk_io_job::read
+						&& (next->flags & disk_io_job::zero_copy) == 0;
+						next = m_queued_jobs.peek(disk_job_scheduler::read_class))
+					{
+						read_batch.push_back(m_queued_jobs.pop_front(disk_job_scheduler::read_class));
+					}
+
+					if (elevator_window > 0)
+						disk_job_scheduler::sort_reads(&read_batch[0], int(read_batch.size()));
+				}
 			}
 			else if (type == hasher_thread)
 			{
 				TORRENT_ASSERT(l.locked());
-				while (m_queued_hash_jobs.empty() && thread_id < m_num_threads) m_hash_job_cond.wait(l);
-				if (m_queued_hash_jobs.empty() && thread_id >= m_num_threads) break;
-				j = (disk_io_job*)m_queued_hash_jobs.pop_front();
+				queue_incoming_jobs();
+				while (m_queued_hash_jobs.empty() && m_queued_check_jobs.empty()
+					&& thread_id < m_num_threads)
+				{
+					m_hash_job_cond.wait(l);
+					queue_incoming_jobs();
+				}
+				if (m_queued_hash_jobs.empty() && m_queued_check_jobs.empty()
+					&& thread_id >= m_num_threads) break;
+
+				hash_batch.clear();
+				if (m_queued_hash_jobs.empty())
+				{
+					// peers are waiting for the hash jobs, checking can wait
+					j = (disk_io_job*)m_queued_check_jobs.pop_front();
+				}
+				else
+				{
+					j = (disk_io_job*)m_queued_hash_jobs.pop_front();
+
+					// if this CPU can hash several pieces at once, take the hash
+					// jobs queued up behind this one as well
+					int const max_batch = multi_hasher::preferred_lanes();
+					if (max_batch > 1 && !m_queued_hash_jobs.empty())
+					{
+						hash_batch.push_back(j);
+						while (!m_queued_hash_jobs.empty() && int(hash_batch.size()) < max_batch)
+							hash_batch.push_back((disk_io_job*)m_queued_hash_jobs.pop_front());
+					}
+				}
+			}
+
+			ptime const started = time_now_hires();
+			if (!read_batch.empty())
+			{
+				for (int i = 0; i < int(read_batch.size()); ++i)
+					count_queue_time(read_batch[i], started);
+			}
+			else if (!hash_batch.empty())
+			{
+				for (int i = 0; i < int(hash_batch.size()); ++i)
+					count_queue_time(hash_batch[i], started);
+			}
+			else
+			{
+				count_queue_time(j, started);
 			}
 
 			l.unlock();
@@ -3202,32 +4222,62 @@ namespace libtorrent
 				ptime now = time_now_hires();
 				if (now > m_last_cache_expiry + seconds(5))
 				{
-					mutex::scoped_lock l2(m_cache_mutex);
 					DLOG("blocked_jobs: %d queued_jobs: %d num_threads %d\n"
 						, int(m_num_blocked_jobs), m_queued_jobs.size(), int(m_num_threads));
 					m_last_cache_expiry = now;
 					tailqueue completed_jobs;
-					flush_expired_write_blocks(completed_jobs, l2);
-					l2.unlock();
+					for (int s = 0; s < block_cache::num_shards; ++s)
+					{
+						mutex::scoped_lock l2(m_disk_cache.shard_mutex(s));
+						flush_expired_write_blocks(s, completed_jobs, l2);
+					}
 					if (completed_jobs.size())
 						add_completed_jobs(completed_jobs);
 				}
 			}
 
+			// j may be gone by the time the job has been performed, so
+			// pick the cache shard to start trimming from up-front
+			int const shard = m_disk_cache.shard_index(j->storage.get());
+
 			tailqueue completed_jobs;
-			perform_job(j, completed_jobs);
+			if (!read_batch.empty())
+			{
+				if (ring.is_open())
+					perform_read_batch(&read_batch[0], int(read_batch.size())
+						, ring, completed_jobs);
+				else
+					perform_sorted_reads(&read_batch[0], int(read_batch.size())
+						, completed_jobs);
+				read_batch.clear();
+			}
+			else if (!hash_batch.empty())
+			{
+				perform_hash_batch(&hash_batch[0], int(hash_batch.size())
+					, completed_jobs);
+				hash_batch.clear();
+			}
+			else
+			{
+				perform_job(j, completed_jobs);
+			}
 
-			mutex::scoped_lock l2(m_cache_mutex);
-			check_cache_level(l2, completed_jobs);
-			l2.unlock();
+			check_cache_level(shard, completed_jobs);
 
 			if (completed_jobs.size())
 				add_completed_jobs(completed_jobs);
 
+			update_thread_ring(ring, ring_failed);
+
 			l.lock();
 		}
 		l.unlock();
 
+#if TORRENT_USE_IO_URING
+		disk_thread_ring = NULL;
+#endif
+		ring.close();
+
 		// do cleanup in the last running thread 
 		m_stats_counters.inc_stats_counter(counters::num_running_threads, -1);
 		if (--m_num_running_threads > 0)
@@ -3243,14 +4293,9 @@ namespace libtorrent
 		// to read blocks in the disk cache. We need to wait until all
 		// references are removed from other threads before we can go
 		// ahead with the cleanup.
-		mutex::scoped_lock l2(m_cache_mutex);
+		// pinned_blocks() locks each shard of the cache in turn
 		while (m_disk_cache.pinned_blocks() > 0)
-		{
-			l2.unlock();
 			sleep(100);
-			l2.lock();
-		}
-		l2.unlock();
 
 		DLOG("disk thread %d is the last one alive. cleaning up\n", thread_id);
 
@@ -3268,9 +4313,8 @@ namespace libtorrent
 
 #if TORRENT_USE_ASSERTS
 		// by now, all pieces should have been evicted
-		std::pair<block_cache::iterator, block_cache::iterator> pieces
-			= m_disk_cache.all_pieces();
-		TORRENT_ASSERT(pieces.first == pieces.second);
+		for (int i = 0; i < block_cache::num_shards; ++i)
+			TORRENT_ASSERT(m_disk_cache.num_pieces(i) == 0);
 #endif
 		// release the io_service to allow the run() call to return
 		// we do this once we stop posting new callbacks to it.
@@ -3368,7 +4412,7 @@ namespace libtorrent
 
 				if (j->action == disk_io_job::write)
 				{
-					mutex::scoped_lock l(m_cache_mutex);
+					mutex::scoped_lock l(m_disk_cache.cache_mutex(j));
 					cached_piece_entry* pe = m_disk_cache.find_piece(j);
 					if (pe)
 					{
@@ -3381,10 +4425,10 @@ namespace libtorrent
 #endif
 			tailqueue other_jobs;
 			tailqueue flush_jobs;
-			mutex::scoped_lock l_(m_cache_mutex);
 			while (new_jobs.size() > 0)
 			{
 				disk_io_job* j = (disk_io_job*)new_jobs.pop_front();
+				mutex::scoped_lock l_(m_disk_cache.cache_mutex(j));
 
 				if (j->action == disk_io_job::read
 					&& m_settings.get_bool(settings_pack::use_read_cache)
@@ -3447,7 +4491,6 @@ namespace libtorrent
 					flush_jobs.push_back(fj);
 				}
 			}
-			l_.unlock();
 
 			mutex::scoped_lock l(m_job_mutex);
 			m_queued_jobs.append(other_jobs);
@@ -3459,20 +4502,18 @@ namespace libtorrent
 				add_job(j);
 			}
 
-			m_job_cond.notify_all();
+			submit_jobs();
 		}
 
-		mutex::scoped_lock l(m_completed_jobs_mutex);
-
-		bool need_post = m_completed_jobs.size() == 0;
-		m_completed_jobs.append(jobs);
-		l.unlock();
+#if DEBUG_DISK_THREAD
+		int const num_jobs = jobs.size();
+#endif
+		bool const need_post = m_completed_jobs.append(jobs);
 
 		if (need_post)
 		{
 #if DEBUG_DISK_THREAD
-			// we take this lock just to make the logging prettier (non-interleaved)
-			DLOG("posting job handlers (%d)\n", m_completed_jobs.size());
+			DLOG("posting job handlers (%d)\n", num_jobs);
 #endif
 			m_ios.post(boost::bind(&disk_io_thread::call_job_handlers, this, m_userdata));
 		}
@@ -3481,15 +4522,17 @@ namespace libtorrent
 	// This is run in the network thread
 	void disk_io_thread::call_job_handlers(void* userdata)
 	{
-		mutex::scoped_lock l(m_completed_jobs_mutex);
+		// all the jobs completed since the last time this was posted are
+		// handled in one go
+		tailqueue completed_jobs;
+		m_completed_jobs.get_all(completed_jobs);
 
 #if DEBUG_DISK_THREAD
-		DLOG("call_job_handlers (%d)\n", m_completed_jobs.size());
+		DLOG("call_job_handlers (%d)\n", completed_jobs.size());
 #endif
 
-		int num_jobs = m_completed_jobs.size();
-		disk_io_job* j = (disk_io_job*)m_completed_jobs.get_all();
-		l.unlock();
+		int num_jobs = completed_jobs.size();
+		disk_io_job* j = (disk_io_job*)completed_jobs.get_all();
 
 		uncork_interface* uncork = (uncork_interface*)userdata;
 		std::vector<disk_io_job*> to_delete;
@@ -0,0 +1,238 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/disk_job_scheduler.hpp"
+#include "libtorrent/disk_io_job.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm>
+
+namespace libtorrent
+{
+	namespace
+	{
+		// the pass of a class with weight 1 advances by this much for every
+		// job it runs
+		const boost::int64_t stride_base = 1 << 20;
+	}
+
+	disk_job_scheduler::job_class_t disk_job_scheduler::job_class(int action)
+	{
+		switch (action)
+		{
+			case disk_io_job::read:
+			case disk_io_job::cache_piece:
+				return read_class;
+			case disk_io_job::write:
+			case disk_io_job::flush_piece:
+			case disk_io_job::flush_hashed:
+			case disk_io_job::flush_storage:
+			case disk_io_job::trim_cache:
+				return write_class;
+			case disk_io_job::hash:
+				return hash_class;
+			default:
+				return maintenance_class;
+		}
+	}
+
+	namespace
+	{
+		bool read_offset_less(disk_io_job const* lhs, disk_io_job const* rhs)
+		{
+			if (lhs->storage != rhs->storage)
+				return lhs->storage.get() < rhs->storage.get();
+			if (lhs->piece != rhs->piece) return lhs->piece < rhs->piece;
+			return lhs->d.io.offset < rhs->d.io.offset;
+		}
+	}
+
+	void disk_job_scheduler::sort_reads(disk_io_job** jobs, int num_jobs)
+	{
+		std::stable_sort(jobs, jobs + num_jobs, &read_offset_less);
+	}
+
+	int disk_job_scheduler::contiguous_reads(disk_io_job* const* jobs, int num_jobs)
+	{
+		TORRENT_ASSERT(num_jobs > 0);
+		int ret = 1;
+		for (; ret < num_jobs; ++ret)
+		{
+			disk_io_job const* prev = jobs[ret - 1];
+			disk_io_job const* j = jobs[ret];
+			TORRENT_ASSERT(j->action == disk_io_job::read);
+			if (j->storage != prev->storage
+				|| j->piece != prev->piece
+				|| j->d.io.offset != prev->d.io.offset + prev->d.io.buffer_size)
+				break;
+		}
+		return ret;
+	}
+
+	disk_job_scheduler::disk_job_scheduler()
+		: m_pass(0)
+		, m_size(0)
+	{
+		// these match the defaults of the disk_*_weight settings
+		set_weight(read_class, 8);
+		set_weight(write_class, 4);
+		set_weight(hash_class, 4);
+		set_weight(maintenance_class, 1);
+	}
+
+	void disk_job_scheduler::set_weight(int job_class, int weight)
+	{
+		TORRENT_ASSERT(job_class >= 0 && job_class < num_job_classes);
+		m_classes[job_class].stride = stride_base / (std::max)(weight, 1);
+	}
+
+	void disk_job_scheduler::push_back(disk_io_job* j)
+	{
+		TORRENT_ASSERT(j->next == 0);
+		class_queue& q = m_classes[job_class(j->action)];
+
+		if (q.size == 0) q.pass = (std::max)(q.pass, m_pass);
+
+		piece_manager const* storage = j->storage.get();
+		tailqueue& jobs = q.jobs[storage];
+		if (jobs.empty()) q.turns.push_back(storage);
+		jobs.push_back(j);
+		++q.size;
+		++m_size;
+	}
+
+	void disk_job_scheduler::append(tailqueue& jobs)
+	{
+		while (!jobs.empty())
+			push_back((disk_io_job*)jobs.pop_front());
+	}
+
+	void disk_job_scheduler::push_front(disk_io_job* j)
+	{
+		m_urgent.push_front(j);
+		++m_size;
+	}
+
+	disk_io_job* disk_job_scheduler::pop_front()
+	{
+		if (!m_urgent.empty())
+		{
+			--m_size;
+			return (disk_io_job*)m_urgent.pop_front();
+		}
+
+		int next = -1;
+		for (int i = 0; i < num_job_classes; ++i)
+		{
+			if (m_classes[i].size == 0) continue;
+			if (next == -1 || m_classes[i].pass < m_classes[next].pass)
+				next = i;
+		}
+		if (next == -1) return 0;
+		return pop_front(next);
+	}
+
+	disk_io_job* disk_job_scheduler::pop_front(int job_class)
+	{
+		TORRENT_ASSERT(job_class >= 0 && job_class < num_job_classes);
+		class_queue& q = m_classes[job_class];
+		if (q.size == 0) return 0;
+
+		TORRENT_ASSERT(!q.turns.empty());
+		piece_manager const* storage = q.turns.front();
+		q.turns.pop_front();
+		storage_jobs_t::iterator i = q.jobs.find(storage);
+		TORRENT_ASSERT(i != q.jobs.end());
+		TORRENT_ASSERT(!i->second.empty());
+
+		disk_io_job* j = (disk_io_job*)i->second.pop_front();
+		if (i->second.empty()) q.jobs.erase(i);
+		else q.turns.push_back(storage);
+
+		--q.size;
+		--m_size;
+		m_pass = q.pass;
+		q.pass += q.stride;
+		return j;
+	}
+
+	disk_io_job* disk_job_scheduler::peek(int job_class) const
+	{
+		TORRENT_ASSERT(job_class >= 0 && job_class < num_job_classes);
+		class_queue const& q = m_classes[job_class];
+		if (q.size == 0) return 0;
+
+		storage_jobs_t::const_iterator i = q.jobs.find(q.turns.front());
+		TORRENT_ASSERT(i != q.jobs.end());
+		return (disk_io_job*)i->second.first();
+	}
+
+	void disk_job_scheduler::remove_jobs(piece_manager const* storage, tailqueue& jobs)
+	{
+		disk_io_job* j = (disk_io_job*)m_urgent.get_all();
+		while (j)
+		{
+			disk_io_job* next = (disk_io_job*)j->next;
+			j->next = 0;
+			if (j->storage.get() == storage)
+			{
+				jobs.push_back(j);
+				--m_size;
+			}
+			else
+			{
+				m_urgent.push_back(j);
+			}
+			j = next;
+		}
+
+		for (int k = 0; k < num_job_classes; ++k)
+		{
+			class_queue& q = m_classes[k];
+			storage_jobs_t::iterator i = q.jobs.find(storage);
+			if (i == q.jobs.end()) continue;
+
+			q.size -= i->second.size();
+			m_size -= i->second.size();
+			jobs.append(i->second);
+			q.jobs.erase(i);
+			q.turns.erase(std::remove(q.turns.begin(), q.turns.end(), storage)
+				, q.turns.end());
+		}
+	}
+
+	int disk_job_scheduler::size(int job_class) const
+	{
+		TORRENT_ASSERT(job_class >= 0 && job_class < num_job_classes);
+		return m_classes[job_class].size;
+	}
+}
@@ -0,0 +1,469 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/hash_kernels.hpp"
+#include "libtorrent/cpuid.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <boost/crc.hpp>
+
+// the SIMD implementations are compiled with the target attribute, rather
+// than requiring -mavx2 and friends on the command line, and are only used
+// once cpuid has confirmed the CPU supports them
+#if TORRENT_HAS_SSE && defined __GNUC__ \
+	&& (defined __clang__ || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define TORRENT_SHA1_SIMD 1
+#include <immintrin.h>
+#else
+#define TORRENT_SHA1_SIMD 0
+#endif
+
+#if defined __GNUC__
+#define TORRENT_SHA1_INLINE inline __attribute__((always_inline))
+#elif defined _MSC_VER
+#define TORRENT_SHA1_INLINE __forceinline
+#else
+#define TORRENT_SHA1_INLINE inline
+#endif
+
+namespace libtorrent
+{
+namespace
+{
+	typedef boost::uint32_t u32;
+	typedef boost::uint8_t u8;
+
+	TORRENT_SHA1_INLINE u32 load_be32(u8 const* p)
+	{
+		return (u32(p[0]) << 24) | (u32(p[1]) << 16) | (u32(p[2]) << 8) | u32(p[3]);
+	}
+
+	// a lane register is either a plain 32 bit integer (a single lane) or a
+	// vector of them, where each element belongs to a separate lane
+	TORRENT_SHA1_INLINE void set_lane(u32& v, int, u32 x) { v = x; }
+	TORRENT_SHA1_INLINE u32 get_lane(u32 v, int) { return v; }
+
+#if TORRENT_SHA1_SIMD
+	// the helpers taking and returning vectors are always inlined into the
+	// functions with the matching target attribute, so the calling
+	// convention GCC warns about is never used
+#if defined __GNUC__ && !defined __clang__
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+	typedef u32 u32x4 __attribute__((vector_size(16)));
+	typedef u32 u32x8 __attribute__((vector_size(32)));
+
+	template <class V>
+	TORRENT_SHA1_INLINE void set_lane(V& v, int i, u32 x) { v[i] = x; }
+	template <class V>
+	TORRENT_SHA1_INLINE u32 get_lane(V const& v, int i) { return v[i]; }
+#endif
+
+	template <int N, class V>
+	TORRENT_SHA1_INLINE V rol(V const& v) { return (v << N) | (v >> (32 - N)); }
+
+	// the message schedule. The 80 words are computed in place in a ring
+	// of 16
+	template <class V>
+	TORRENT_SHA1_INLINE V schedule(V* w, int i)
+	{
+		if (i < 16) return w[i];
+		return w[i & 15] = rol<1>(w[(i + 13) & 15] ^ w[(i + 8) & 15]
+			^ w[(i + 2) & 15] ^ w[i & 15]);
+	}
+
+#define TORRENT_SHA1_ROUND(f, k) \
+	do { \
+		V const t = rol<5>(a) + (f) + e + u32(k) + schedule(w, i); \
+		e = d; d = c; c = rol<30>(b); b = a; a = t; \
+		++i; \
+	} while (false)
+
+	// the rounds are unrolled, to let the compiler resolve the message
+	// schedule at compile time
+#define TORRENT_SHA1_ROUND4(f, k) \
+	TORRENT_SHA1_ROUND(f, k); TORRENT_SHA1_ROUND(f, k); \
+	TORRENT_SHA1_ROUND(f, k); TORRENT_SHA1_ROUND(f, k)
+
+#define TORRENT_SHA1_ROUND20(f, k) \
+	TORRENT_SHA1_ROUND4(f, k); TORRENT_SHA1_ROUND4(f, k); \
+	TORRENT_SHA1_ROUND4(f, k); TORRENT_SHA1_ROUND4(f, k); \
+	TORRENT_SHA1_ROUND4(f, k)
+
+	// compresses ``blocks`` consecutive 64 byte blocks of ``num_lanes``
+	// lanes, ``Lanes`` at a time. When there are fewer lanes than that, the
+	// unused elements of the registers are fed the first lane's data and
+	// their result is thrown away
+	template <class V, int Lanes>
+	TORRENT_SHA1_INLINE void compress_lanes(u32* const* state
+		, u8 const* const* data, int num_lanes, int blocks)
+	{
+		u32 scratch[5] = { 0, 0, 0, 0, 0 };
+		for (int first = 0; first < num_lanes; first += Lanes)
+		{
+			u32* st[Lanes];
+			u8 const* p[Lanes];
+			for (int l = 0; l < Lanes; ++l)
+			{
+				bool const used = first + l < num_lanes;
+				st[l] = used ? state[first + l] : scratch;
+				p[l] = used ? data[first + l] : data[first];
+			}
+
+			V s[5];
+			for (int i = 0; i < 5; ++i)
+				for (int l = 0; l < Lanes; ++l)
+					set_lane(s[i], l, st[l][i]);
+
+			for (int block = 0; block < blocks; ++block)
+			{
+				V w[16];
+				for (int i = 0; i < 16; ++i)
+					for (int l = 0; l < Lanes; ++l)
+						set_lane(w[i], l, load_be32(p[l] + block * 64 + i * 4));
+
+				V a = s[0];
+				V b = s[1];
+				V c = s[2];
+				V d = s[3];
+				V e = s[4];
+
+				int i = 0;
+				TORRENT_SHA1_ROUND20(((c ^ d) & b) ^ d, 0x5a827999);
+				TORRENT_SHA1_ROUND20(b ^ c ^ d, 0x6ed9eba1);
+				TORRENT_SHA1_ROUND20((b & c) | (d & (b | c)), 0x8f1bbcdc);
+				TORRENT_SHA1_ROUND20(b ^ c ^ d, 0xca62c1d6);
+
+				s[0] += a;
+				s[1] += b;
+				s[2] += c;
+				s[3] += d;
+				s[4] += e;
+			}
+
+			for (int i = 0; i < 5; ++i)
+				for (int l = 0; l < Lanes; ++l)
+					st[l][i] = get_lane(s[i], l);
+		}
+	}
+
+#undef TORRENT_SHA1_ROUND
+#undef TORRENT_SHA1_ROUND4
+#undef TORRENT_SHA1_ROUND20
+
+	void compress_portable(u32* const* state, u8 const* const* data
+		, int num_lanes, int blocks)
+	{
+		compress_lanes<u32, 1>(state, data, num_lanes, blocks);
+	}
+
+#if TORRENT_SHA1_SIMD
+	__attribute__((target("sse4.1")))
+	void compress_sse41(u32* const* state, u8 const* const* data
+		, int num_lanes, int blocks)
+	{
+		compress_lanes<u32x4, 4>(state, data, num_lanes, blocks);
+	}
+
+	__attribute__((target("avx2")))
+	void compress_avx2(u32* const* state, u8 const* const* data
+		, int num_lanes, int blocks)
+	{
+		compress_lanes<u32x8, 8>(state, data, num_lanes, blocks);
+	}
+
+	// the SHA extensions perform four rounds per sha1rnds4 instruction. The
+	// message schedule is computed four words at a time by sha1msg1, an xor
+	// and sha1msg2, spread out over the three preceding groups of rounds.
+	// ``e0`` and ``e1`` alternate between holding the E of the current group
+	// and a copy of ABCD to derive the next group's E from.
+#define TORRENT_SHANI_ROUNDS(f, e_cur, e_next, m0, m1, m2, m3) \
+	e_cur = _mm_sha1nexte_epu32(e_cur, m0); \
+	e_next = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0)
+
+#define TORRENT_SHANI_LOAD(m, offset) \
+	m = _mm_shuffle_epi8(_mm_loadu_si128( \
+		reinterpret_cast<__m128i const*>(p + offset)), byte_swap)
+
+	__attribute__((target("sha,sse4.1")))
+	void compress_sha_ni(u32* const* state, u8 const* const* data
+		, int num_lanes, int blocks)
+	{
+		__m128i const byte_swap = _mm_set_epi64x(0x0001020304050607ULL
+			, 0x08090a0b0c0d0e0fULL);
+
+		for (int l = 0; l < num_lanes; ++l)
+		{
+			u32* st = state[l];
+			u8 const* p = data[l];
+
+			__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128(
+				reinterpret_cast<__m128i const*>(st)), 0x1b);
+			__m128i e0 = _mm_set_epi32(int(st[4]), 0, 0, 0);
+			__m128i e1;
+			__m128i m0, m1, m2, m3;
+
+			for (int block = 0; block < blocks; ++block, p += 64)
+			{
+				__m128i const abcd_save = abcd;
+				__m128i const e_save = e0;
+
+				// rounds 0-15. The first four words are added to E directly,
+				// and the schedule hasn't got enough words yet to start
+				// computing new ones
+				TORRENT_SHANI_LOAD(m0, 0);
+				e0 = _mm_add_epi32(e0, m0);
+				e1 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+				TORRENT_SHANI_LOAD(m1, 16);
+				e1 = _mm_sha1nexte_epu32(e1, m1);
+				e0 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+				m0 = _mm_sha1msg1_epu32(m0, m1);
+
+				TORRENT_SHANI_LOAD(m2, 32);
+				e0 = _mm_sha1nexte_epu32(e0, m2);
+				e1 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+				m1 = _mm_sha1msg1_epu32(m1, m2);
+				m0 = _mm_xor_si128(m0, m2);
+
+				TORRENT_SHANI_LOAD(m3, 48);
+				TORRENT_SHANI_ROUNDS(0, e1, e0, m3, m0, m1, m2);
+
+				// rounds 16-67
+				TORRENT_SHANI_ROUNDS(0, e0, e1, m0, m1, m2, m3);
+				TORRENT_SHANI_ROUNDS(1, e1, e0, m1, m2, m3, m0);
+				TORRENT_SHANI_ROUNDS(1, e0, e1, m2, m3, m0, m1);
+				TORRENT_SHANI_ROUNDS(1, e1, e0, m3, m0, m1, m2);
+				TORRENT_SHANI_ROUNDS(1, e0, e1, m0, m1, m2, m3);
+				TORRENT_SHANI_ROUNDS(1, e1, e0, m1, m2, m3, m0);
+				TORRENT_SHANI_ROUNDS(2, e0, e1, m2, m3, m0, m1);
+				TORRENT_SHANI_ROUNDS(2, e1, e0, m3, m0, m1, m2);
+				TORRENT_SHANI_ROUNDS(2, e0, e1, m0, m1, m2, m3);
+				TORRENT_SHANI_ROUNDS(2, e1, e0, m1, m2, m3, m0);
+				TORRENT_SHANI_ROUNDS(2, e0, e1, m2, m3, m0, m1);
+				TORRENT_SHANI_ROUNDS(3, e1, e0, m3, m0, m1, m2);
+				TORRENT_SHANI_ROUNDS(3, e0, e1, m0, m1, m2, m3);
+
+				// rounds 68-79. The last words of the schedule are done
+				e1 = _mm_sha1nexte_epu32(e1, m1);
+				e0 = abcd;
+				m2 = _mm_sha1msg2_epu32(m2, m1);
+				abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+				m3 = _mm_xor_si128(m3, m1);
+
+				e0 = _mm_sha1nexte_epu32(e0, m2);
+				e1 = abcd;
+				m3 = _mm_sha1msg2_epu32(m3, m2);
+				abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+
+				e1 = _mm_sha1nexte_epu32(e1, m3);
+				e0 = abcd;
+				abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+				e0 = _mm_sha1nexte_epu32(e0, e_save);
+				abcd = _mm_add_epi32(abcd, abcd_save);
+			}
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(st)
+				, _mm_shuffle_epi32(abcd, 0x1b));
+			st[4] = u32(_mm_extract_epi32(e0, 3));
+		}
+	}
+
+#undef TORRENT_SHANI_ROUNDS
+#undef TORRENT_SHANI_LOAD
+#endif // TORRENT_SHA1_SIMD
+
+	bool always_supported() { return true; }
+
+	// the crc32 instruction was introduced with SSE 4.2
+	bool supports_sse42()
+	{
+#if TORRENT_HAS_SSE
+		unsigned int cpui[4];
+		cpuid(cpui, 1);
+		return (cpui[2] & (1 << 20)) != 0;
+#else
+		return false;
+#endif
+	}
+
+#if TORRENT_HAS_SSE
+	boost::uint32_t crc32c_32_sse42(boost::uint32_t v)
+	{
+		boost::uint32_t ret = 0xffffffff;
+#ifdef __GNUC__
+		// we can't use these because then we'd have to tell
+		// -msse4.2 to gcc on the command line
+//		return __builtin_ia32_crc32si(ret, v) ^ 0xffffffff;
+		asm ("crc32l\t" "%1, %0"
+			: "=r"(ret)
+			: "m"(v), "0"(ret));
+		return ret ^ 0xffffffff;
+#else
+		return _mm_crc32_u32(ret, v) ^ 0xffffffff;
+#endif
+	}
+
+	boost::uint32_t crc32c_sse42(boost::uint64_t const* buf, int num_words)
+	{
+#if defined _M_AMD64 || defined __x86_64__ \
+	|| defined __x86_64 || defined _M_X64 || defined __amd64__
+		boost::uint64_t ret = 0xffffffff;
+		for (int i = 0; i < num_words; ++i)
+		{
+#ifdef __GNUC__
+			// we can't use these because then we'd have to tell
+			// -msse4.2 to gcc on the command line
+//			ret = __builtin_ia32_crc32di(ret, buf[i]);
+			__asm__("crc32q\t" "%1, %0"
+				: "=r"(ret)
+				: "m"(buf[i]), "0"(ret));
+#else
+			ret = _mm_crc32_u64(ret, buf[i]);
+#endif
+		}
+		return boost::uint32_t(ret) ^ 0xffffffff;
+#else
+		boost::uint32_t ret = 0xffffffff;
+		boost::uint32_t const* buf0 = reinterpret_cast<boost::uint32_t const*>(buf);
+		for (int i = 0; i < num_words; ++i)
+		{
+#ifdef __GNUC__
+			// we can't use these because then we'd have to tell
+			// -msse4.2 to gcc on the command line
+//			ret = __builtin_ia32_crc32si(ret, buf0[i*2]);
+//			ret = __builtin_ia32_crc32si(ret, buf0[i*2+1]);
+			asm ("crc32l\t" "%1, %0"
+				: "=r"(ret)
+				: "m"(buf0[i*2]), "0"(ret));
+			asm ("crc32l\t" "%1, %0"
+				: "=r"(ret)
+				: "m"(buf0[i*2+1]), "0"(ret));
+#else
+			ret = _mm_crc32_u32(ret, buf0[i*2]);
+			ret = _mm_crc32_u32(ret, buf0[i*2+1]);
+#endif
+		}
+		return ret ^ 0xffffffff;
+#endif // amd64 or x86
+	}
+#endif // TORRENT_HAS_SSE
+
+	typedef boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF
+		, true, true> crc32c_t;
+
+	boost::uint32_t crc32c_32_portable(boost::uint32_t v)
+	{
+		crc32c_t crc;
+		crc.process_bytes(&v, 4);
+		return crc.checksum();
+	}
+
+	boost::uint32_t crc32c_portable(boost::uint64_t const* buf, int num_words)
+	{
+		crc32c_t crc;
+		crc.process_bytes(buf, num_words * 8);
+		return crc.checksum();
+	}
+
+	sha1_kernel const sha1_kernel_list[] =
+	{
+#if TORRENT_SHA1_SIMD
+		{ "avx2", &compress_avx2, 8, &supports_avx2 },
+		{ "sha-ni", &compress_sha_ni, 1, &supports_sha_ni },
+		{ "sse4.1", &compress_sse41, 4, &supports_sse41 },
+#endif
+		{ "portable", &compress_portable, 1, &always_supported },
+		{ NULL, NULL, 0, NULL }
+	};
+
+	crc32c_kernel const crc32c_kernel_list[] =
+	{
+#if TORRENT_HAS_SSE
+		{ "sse4.2", &crc32c_sse42, &crc32c_32_sse42, &supports_sse42 },
+#endif
+		{ "portable", &crc32c_portable, &crc32c_32_portable, &always_supported },
+		{ NULL, NULL, NULL, NULL }
+	};
+
+	hash_kernels select_kernels()
+	{
+		hash_kernels ret = { NULL, NULL, 1, NULL };
+
+		// the lists are in order of preference. 8 lanes of AVX2 outperform the
+		// SHA extensions when there are enough messages to fill them, but a
+		// single message is hashed faster with the SHA extensions than with
+		// anything else
+		for (sha1_kernel const* k = sha1_kernel_list; k->name; ++k)
+		{
+			if (!k->supported()) continue;
+			if (ret.sha1 == NULL && k->lanes == 1) ret.sha1 = k;
+			if (ret.sha1_multi == NULL) ret.sha1_multi = k;
+		}
+
+		if (ret.sha1_multi->lanes > 1)
+			ret.sha1_multi_lanes = ret.sha1_multi->lanes;
+		else if (ret.sha1_multi->supported != &always_supported)
+			ret.sha1_multi_lanes = 8;
+
+		for (crc32c_kernel const* k = crc32c_kernel_list; k->name; ++k)
+		{
+			if (!k->supported()) continue;
+			ret.crc32c = k;
+			break;
+		}
+
+		TORRENT_ASSERT(ret.sha1 != NULL);
+		TORRENT_ASSERT(ret.sha1_multi != NULL);
+		TORRENT_ASSERT(ret.crc32c != NULL);
+		return ret;
+	}
+}
+
+	sha1_kernel const* sha1_kernels() { return sha1_kernel_list; }
+	crc32c_kernel const* crc32c_kernels() { return crc32c_kernel_list; }
+
+	hash_kernels const& selected_kernels()
+	{
+		static hash_kernels const kernels = select_kernels();
+		return kernels;
+	}
+}
+
@@ -0,0 +1,421 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+
+#include "libtorrent/io_uring.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm> // for std::min
+
+#if TORRENT_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h> // for memset
+#include <boost/cstdint.hpp>
+#endif
+
+namespace libtorrent
+{
+	io_uring_queue::io_uring_queue()
+		: m_ring_fd(-1)
+		, m_num_queued(0)
+		, m_num_in_flight(0)
+		, m_num_completed(0)
+		, m_sq_ring(0)
+		, m_cq_ring(0)
+		, m_sqes(0)
+		, m_sq_ring_size(0)
+		, m_cq_ring_size(0)
+		, m_sqes_size(0)
+		, m_sq_head(0)
+		, m_sq_tail(0)
+		, m_sq_mask(0)
+		, m_sq_array(0)
+		, m_cq_head(0)
+		, m_cq_tail(0)
+		, m_cq_mask(0)
+		, m_cqes(0)
+		, m_sq_entries(0)
+	{}
+
+	io_uring_queue::~io_uring_queue()
+	{
+		close();
+	}
+
+	bool io_uring_queue::is_open() const { return m_ring_fd >= 0; }
+
+	void io_uring_queue::reset(int num_slots)
+	{
+		TORRENT_ASSERT(num_pending() == 0);
+		m_results.clear();
+		m_results.resize(num_slots);
+		m_num_completed = 0;
+	}
+
+	int io_uring_queue::bytes_transferred(int slot) const
+	{
+		TORRENT_ASSERT(slot >= 0 && slot < int(m_results.size()));
+		return m_results[slot].bytes;
+	}
+
+	error_code const& io_uring_queue::error(int slot) const
+	{
+		TORRENT_ASSERT(slot >= 0 && slot < int(m_results.size()));
+		return m_results[slot].ec;
+	}
+
+	int io_uring_queue::error_file(int slot) const
+	{
+		TORRENT_ASSERT(slot >= 0 && slot < int(m_results.size()));
+		return m_results[slot].file;
+	}
+
+	void io_uring_queue::record(operation& op, int res)
+	{
+		TORRENT_ASSERT(op.slot >= 0 && op.slot < int(m_results.size()));
+		slot_result& r = m_results[op.slot];
+		if (res < 0)
+		{
+			// only the first error is reported
+			if (!r.ec)
+			{
+				r.ec.assign(-res, get_posix_category());
+				r.file = op.file_index;
+			}
+			return;
+		}
+		r.bytes += res;
+	}
+
+#if TORRENT_USE_IO_URING
+
+	void io_uring_queue::open(int entries, error_code& ec)
+	{
+		close();
+
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		int fd = syscall(__NR_io_uring_setup, entries, &p);
+		if (fd < 0)
+		{
+			ec.assign(errno, get_posix_category());
+			return;
+		}
+
+		m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+
+		// newer kernels let both rings be mapped with a single mmap call
+		bool const single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_mmap)
+		{
+			m_sq_ring_size = (std::max)(m_sq_ring_size, m_cq_ring_size);
+			m_cq_ring_size = m_sq_ring_size;
+		}
+
+		m_sq_ring = mmap(0, m_sq_ring_size, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (m_sq_ring == MAP_FAILED)
+		{
+			ec.assign(errno, get_posix_category());
+			m_sq_ring = 0;
+			::close(fd);
+			return;
+		}
+
+		if (single_mmap)
+		{
+			m_cq_ring = m_sq_ring;
+		}
+		else
+		{
+			m_cq_ring = mmap(0, m_cq_ring_size, PROT_READ | PROT_WRITE
+				, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if (m_cq_ring == MAP_FAILED)
+			{
+				ec.assign(errno, get_posix_category());
+				m_cq_ring = 0;
+				munmap(m_sq_ring, m_sq_ring_size);
+				m_sq_ring = 0;
+				::close(fd);
+				return;
+			}
+		}
+
+		m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		m_sqes = mmap(0, m_sqes_size, PROT_READ | PROT_WRITE
+			, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if (m_sqes == MAP_FAILED)
+		{
+			ec.assign(errno, get_posix_category());
+			m_sqes = 0;
+			if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+			munmap(m_sq_ring, m_sq_ring_size);
+			m_sq_ring = 0;
+			m_cq_ring = 0;
+			::close(fd);
+			return;
+		}
+
+		char* sq = static_cast<char*>(m_sq_ring);
+		m_sq_head = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+		m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+		m_sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+		m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+
+		char* cq = static_cast<char*>(m_cq_ring);
+		m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+		m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+		m_cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+		m_cqes = cq + p.cq_off.cqes;
+
+		m_sq_entries = p.sq_entries;
+		m_ring_fd = fd;
+
+		// never have more operations outstanding than there are entries in
+		// the submission queue. The completion queue is at least as large,
+		// so it can never overflow
+		m_ops.clear();
+		m_ops.resize(m_sq_entries);
+		m_free_ops.clear();
+		m_free_ops.reserve(m_sq_entries);
+		for (int i = m_sq_entries - 1; i >= 0; --i)
+			m_free_ops.push_back(i);
+	}
+
+	void io_uring_queue::close()
+	{
+		if (m_ring_fd < 0) return;
+
+		// don't pull the rug out from under the kernel
+		if (num_pending() > 0) submit_and_wait();
+
+		munmap(m_sqes, m_sqes_size);
+		if (m_cq_ring != m_sq_ring) munmap(m_cq_ring, m_cq_ring_size);
+		munmap(m_sq_ring, m_sq_ring_size);
+		::close(m_ring_fd);
+
+		m_ring_fd = -1;
+		m_sq_ring = 0;
+		m_cq_ring = 0;
+		m_sqes = 0;
+		m_ops.clear();
+		m_free_ops.clear();
+	}
+
+	bool io_uring_queue::prep_readv(file_handle const& f, size_type offset
+		, file::iovec_t const* bufs, int num_bufs, int slot, int file_index)
+	{
+		return prep(IORING_OP_READV, f, offset, bufs, num_bufs, slot, file_index);
+	}
+
+	bool io_uring_queue::prep_writev(file_handle const& f, size_type offset
+		, file::iovec_t const* bufs, int num_bufs, int slot, int file_index)
+	{
+		return prep(IORING_OP_WRITEV, f, offset, bufs, num_bufs, slot, file_index);
+	}
+
+	bool io_uring_queue::prep(int opcode, file_handle const& f, size_type offset
+		, file::iovec_t const* bufs, int num_bufs, int slot, int file_index)
+	{
+		if (m_ring_fd < 0) return false;
+		TORRENT_ASSERT(slot >= 0 && slot < int(m_results.size()));
+		TORRENT_ASSERT(num_bufs > 0);
+		TORRENT_ASSERT(f);
+
+		while (num_bufs > 0)
+		{
+			int nbufs = (std::min)(num_bufs, TORRENT_IOV_MAX);
+
+			while (m_free_ops.empty())
+			{
+				// the ring is full. Submit what we have and wait for at
+				// least one operation to complete
+				error_code ec;
+				if (enter(1, ec) < 0) run_queued();
+				reap();
+			}
+
+			int idx = m_free_ops.back();
+			m_free_ops.pop_back();
+
+			operation& op = m_ops[idx];
+			op.file = f;
+			op.iov.assign(bufs, bufs + nbufs);
+			op.slot = slot;
+			op.file_index = file_index;
+			op.opcode = opcode;
+			op.offset = offset;
+
+			// we're the only producer, no need to synchronize
+			// the load of our own tail
+			unsigned tail = *m_sq_tail;
+			unsigned index = tail & *m_sq_mask;
+			io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+			memset(sqe, 0, sizeof(io_uring_sqe));
+			sqe->opcode = opcode;
+			sqe->fd = f->native_handle();
+			sqe->off = offset;
+			sqe->addr = reinterpret_cast<boost::uint64_t>(&op.iov[0]);
+			sqe->len = nbufs;
+			sqe->user_data = idx;
+			m_sq_array[index] = index;
+			__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+			++m_num_queued;
+
+			for (int i = 0; i < nbufs; ++i) offset += bufs[i].iov_len;
+			bufs += nbufs;
+			num_bufs -= nbufs;
+		}
+		return true;
+	}
+
+	int io_uring_queue::enter(int min_complete, error_code& ec)
+	{
+		for (;;)
+		{
+			int ret = syscall(__NR_io_uring_enter, m_ring_fd, m_num_queued
+				, min_complete, min_complete > 0 ? IORING_ENTER_GETEVENTS : 0
+				, NULL, 0);
+			if (ret < 0)
+			{
+				if (errno == EINTR) continue;
+				ec.assign(errno, get_posix_category());
+				return -1;
+			}
+			TORRENT_ASSERT(ret <= m_num_queued);
+			m_num_queued -= ret;
+			m_num_in_flight += ret;
+			return ret;
+		}
+	}
+
+	int io_uring_queue::reap()
+	{
+		unsigned head = *m_cq_head;
+		unsigned const tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+		int ret = 0;
+		while (head != tail)
+		{
+			io_uring_cqe const* cqe = static_cast<io_uring_cqe const*>(m_cqes)
+				+ (head & *m_cq_mask);
+			int idx = int(cqe->user_data);
+			TORRENT_ASSERT(idx >= 0 && idx < int(m_ops.size()));
+			operation& op = m_ops[idx];
+			record(op, cqe->res);
+			op.file.reset();
+			m_free_ops.push_back(idx);
+			--m_num_in_flight;
+			++m_num_completed;
+			++ret;
+			++head;
+		}
+		__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+		return ret;
+	}
+
+	void io_uring_queue::run_queued()
+	{
+		// take back the entries the kernel hasn't consumed yet
+		// and perform them right here
+		unsigned const head = __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE);
+		unsigned const tail = *m_sq_tail;
+		for (unsigned i = head; i != tail; ++i)
+		{
+			io_uring_sqe const* sqe = static_cast<io_uring_sqe const*>(m_sqes)
+				+ m_sq_array[i & *m_sq_mask];
+			int idx = int(sqe->user_data);
+			operation& op = m_ops[idx];
+
+			error_code ec;
+			size_type ret = op.opcode == IORING_OP_READV
+				? op.file->readv(op.offset, &op.iov[0], op.iov.size(), ec)
+				: op.file->writev(op.offset, &op.iov[0], op.iov.size(), ec);
+			record(op, ec ? -ec.value() : int(ret));
+			op.file.reset();
+			m_free_ops.push_back(idx);
+		}
+		__atomic_store_n(m_sq_tail, head, __ATOMIC_RELEASE);
+		m_num_queued = 0;
+	}
+
+	int io_uring_queue::submit_and_wait()
+	{
+		while (num_pending() > 0)
+		{
+			error_code ec;
+			if (enter(num_pending(), ec) < 0)
+			{
+				// if we can't hand the remaining operations to the kernel,
+				// perform them synchronously. We still need to wait for
+				// the ones already in flight though, since they refer to
+				// buffers owned by the caller
+				run_queued();
+			}
+			reap();
+		}
+		return m_num_completed;
+	}
+
+#else // TORRENT_USE_IO_URING
+
+	void io_uring_queue::open(int, error_code& ec)
+	{
+		ec.assign(boost::system::errc::not_supported, get_posix_category());
+	}
+
+	void io_uring_queue::close() {}
+
+	bool io_uring_queue::prep_readv(file_handle const&, size_type
+		, file::iovec_t const*, int, int, int)
+	{ return false; }
+
+	bool io_uring_queue::prep_writev(file_handle const&, size_type
+		, file::iovec_t const*, int, int, int)
+	{ return false; }
+
+	bool io_uring_queue::prep(int, file_handle const&, size_type
+		, file::iovec_t const*, int, int, int)
+	{ return false; }
+
+	int io_uring_queue::enter(int, error_code&) { return -1; }
+	int io_uring_queue::reap() { return 0; }
+	void io_uring_queue::run_queued() {}
+	int io_uring_queue::submit_and_wait() { return 0; }
+
+#endif // TORRENT_USE_IO_URING
+}
+
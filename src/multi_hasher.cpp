@@ -0,0 +1,176 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/multi_hasher.hpp"
+#include "libtorrent/hash_kernels.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <cstring>
+#include <algorithm>
+#include <climits>
+
+namespace libtorrent
+{
+namespace
+{
+	typedef boost::uint32_t u32;
+	typedef boost::uint8_t u8;
+}
+
+	multi_hasher::multi_hasher(int num_lanes)
+		: m_num_lanes(num_lanes)
+	{
+		TORRENT_ASSERT(num_lanes > 0);
+		TORRENT_ASSERT(num_lanes <= max_lanes);
+		reset();
+	}
+
+	void multi_hasher::reset()
+	{
+		for (int i = 0; i < m_num_lanes; ++i)
+		{
+			lane_t& l = m_lanes[i];
+			l.state[0] = 0x67452301;
+			l.state[1] = 0xefcdab89;
+			l.state[2] = 0x98badcfe;
+			l.state[3] = 0x10325476;
+			l.state[4] = 0xc3d2e1f0;
+			l.count = 0;
+		}
+	}
+
+	void multi_hasher::update(char const* const* data, int len)
+	{
+		TORRENT_ASSERT(len >= 0);
+
+		lane_t* lanes[max_lanes];
+		u32* state[max_lanes];
+		u8 const* ptr[max_lanes];
+		int left[max_lanes];
+		int num_active = 0;
+		int common_blocks = INT_MAX;
+		hash_kernels const& k = selected_kernels();
+
+		for (int i = 0; i < m_num_lanes; ++i)
+		{
+			if (data[i] == NULL) continue;
+
+			lane_t& l = m_lanes[i];
+			u8 const* p = reinterpret_cast<u8 const*>(data[i]);
+			int n = len;
+			int const buffered = int(l.count & 63);
+			l.count += len;
+
+			// first complete the block left over from the last call
+			if (buffered > 0)
+			{
+				int const fill = (std::min)(64 - buffered, n);
+				std::memcpy(l.buffer + buffered, p, fill);
+				p += fill;
+				n -= fill;
+				if (buffered + fill < 64) continue;
+
+				u32* s = l.state;
+				u8 const* b = l.buffer;
+				k.sha1->compress(&s, &b, 1, 1);
+			}
+
+			lanes[num_active] = &l;
+			state[num_active] = l.state;
+			ptr[num_active] = p;
+			left[num_active] = n;
+			common_blocks = (std::min)(common_blocks, n / 64);
+			++num_active;
+		}
+
+		if (num_active == 0) return;
+
+		// the blocks all lanes have are compressed in lockstep
+		if (common_blocks > 0)
+		{
+			k.sha1_multi->compress(state, ptr, num_active, common_blocks);
+			for (int i = 0; i < num_active; ++i)
+			{
+				ptr[i] += common_blocks * 64;
+				left[i] -= common_blocks * 64;
+			}
+		}
+
+		// and whatever is left over one lane at a time, with the kernel that's
+		// best at that
+		for (int i = 0; i < num_active; ++i)
+		{
+			int const blocks = left[i] / 64;
+			if (blocks > 0)
+			{
+				k.sha1->compress(&state[i], &ptr[i], 1, blocks);
+				ptr[i] += blocks * 64;
+				left[i] -= blocks * 64;
+			}
+			std::memcpy(lanes[i]->buffer, ptr[i], left[i]);
+		}
+	}
+
+	sha1_hash multi_hasher::final(int lane)
+	{
+		TORRENT_ASSERT(lane >= 0);
+		TORRENT_ASSERT(lane < m_num_lanes);
+		lane_t& l = m_lanes[lane];
+
+		// append the 0x80 terminator, pad with zeroes and end with the message
+		// length in bits, big endian. This may spill over into a second block
+		u8 block[128];
+		int const buffered = int(l.count & 63);
+		int const size = buffered + 9 <= 64 ? 64 : 128;
+		std::memcpy(block, l.buffer, buffered);
+		block[buffered] = 0x80;
+		std::memset(block + buffered + 1, 0, size - buffered - 1);
+		boost::uint64_t const bits = l.count * 8;
+		for (int i = 0; i < 8; ++i)
+			block[size - 1 - i] = u8(bits >> (i * 8));
+
+		u32* s = l.state;
+		u8 const* b = block;
+		selected_kernels().sha1->compress(&s, &b, 1, size / 64);
+
+		sha1_hash ret;
+		for (int i = 0; i < 20; ++i)
+			ret[i] = u8(l.state[i >> 2] >> ((3 - (i & 3)) * 8));
+		return ret;
+	}
+
+	int multi_hasher::preferred_lanes()
+	{
+		return selected_kernels().sha1_multi_lanes;
+	}
+}
+
@@ -71,10 +71,33 @@ namespace libtorrent
 	// Set the prime P and the generator, generate local public key
 	dh_key_exchange::dh_key_exchange()
 	{
-#ifdef TORRENT_USE_GCRYPT
 		// create local key
-		gcry_randomize(m_dh_local_secret, sizeof(m_dh_local_secret), GCRY_STRONG_RANDOM);
+		random_secret(m_dh_local_secret);
+		compute_local_key();
+	}
+
+	dh_key_exchange::dh_key_exchange(char const* secret)
+	{
+		memcpy(m_dh_local_secret, secret, sizeof(m_dh_local_secret));
+		compute_local_key();
+	}
+
+	void dh_key_exchange::random_secret(char* secret)
+	{
+#ifdef TORRENT_USE_GCRYPT
+		gcry_randomize(secret, 96, GCRY_STRONG_RANDOM);
+#else
+		for (int i = 0; i < 96; ++i)
+			secret[i] = random() & 0xff;
+#endif
+	}
 
+	// local key = (2 ^ secret) % prime. This is the expensive part of the
+	// key exchange, and it only depends on the secret. It doesn't touch any
+	// global state, so it may run on any thread
+	void dh_key_exchange::compute_local_key()
+	{
+#ifdef TORRENT_USE_GCRYPT
 		// build gcrypt big ints from the prime and the secret
 		gcry_mpi_t prime = 0;
 		gcry_mpi_t secret = 0;
@@ -109,10 +132,6 @@ get_out:
 		if (secret) gcry_mpi_release(secret);
 
 #elif defined TORRENT_USE_OPENSSL
-		// create local key
-		for (int i = 0; i < sizeof(m_dh_local_secret); ++i)
-			m_dh_local_secret[i] = random() & 0xff;
-
 		BIGNUM* prime = 0;
 		BIGNUM* secret = 0;
 		BIGNUM* key = 0;
@@ -144,10 +163,6 @@ get_out:
 		if (secret) BN_free(secret);
 		if (prime) BN_free(prime);
 #elif defined TORRENT_USE_TOMMATH
-		// create local key
-		for (int i = 0; i < int(sizeof(m_dh_local_secret)); ++i)
-			m_dh_local_secret[i] = random() & 0xff;
-
 		mp_int prime;
 		mp_int secret;
 		mp_int key;
@@ -310,29 +325,25 @@ get_out:
 
 void rc4_init(const unsigned char* in, unsigned long len, rc4 *state)
 {
-	unsigned char key[256], tmp, *s;
+	unsigned char key[256];
+	boost::uint32_t tmp, *s;
 	int keylen, x, y, j;
 
 	TORRENT_ASSERT(state != 0);
 	TORRENT_ASSERT(len <= 256);
 
-	state->x = 0;
-	while (len--) {
-		state->buf[state->x++] = *in++;
-	}
-
 	/* extract the key */
-	s = state->buf;
-	memcpy(key, s, 256);
-	keylen = state->x;
+	keylen = len;
+	memcpy(key, in, len);
 
 	/* make RC4 perm and shuffle */
+	s = state->buf;
 	for (x = 0; x < 256; x++) {
 		s[x] = x;
 	}
 
 	for (j = x = y = 0; x < 256; x++) {
-		y = (y + state->buf[x] + key[j++]) & 255;
+		y = (y + s[x] + key[j++]) & 255;
 		if (j == keylen) {
 			j = 0; 
 		}
@@ -344,28 +355,69 @@ void rc4_init(const unsigned char* in, unsigned long len, rc4 *state)
 
 unsigned long rc4_encrypt(unsigned char *out, unsigned long outlen, rc4 *state)
 {
-	unsigned char x, y, *s, tmp;
-	unsigned long n;
+	rc4_encrypt(out, out, outlen, state);
+	return outlen;
+}
 
+// the keystream is generated 8 bytes at a time and xored into the data a
+// word at a time. Keeping the permutation in words, and the indices in
+// registers, is what makes this faster than the byte at a time loop
+#define RC4_STEP \
+	x = (x + 1) & 255; \
+	sx = s[x]; \
+	y = (y + sx) & 255; \
+	sy = s[y]; \
+	s[x] = sy; \
+	s[y] = sx; \
+	ks = s[(sx + sy) & 255];
+
+#if defined BOOST_BIG_ENDIAN
+#define RC4_SHIFT(i) ((7 - i) * 8)
+#else
+#define RC4_SHIFT(i) (i * 8)
+#endif
+
+void rc4_encrypt(unsigned char* out, unsigned char const* in
+	, unsigned long len, rc4* state)
+{
 	TORRENT_ASSERT(out != 0);
+	TORRENT_ASSERT(in != 0);
 	TORRENT_ASSERT(state != 0);
 
-	n = outlen;
-	x = state->x;
-	y = state->y;
-	s = state->buf;
-	while (outlen--) {
-		x = (x + 1) & 255;
-		y = (y + s[x]) & 255;
-		tmp = s[x]; s[x] = s[y]; s[y] = tmp;
-		tmp = (s[x] + s[y]) & 255;
-		*out++ ^= s[tmp];
+	boost::uint32_t x = state->x;
+	boost::uint32_t y = state->y;
+	boost::uint32_t sx, sy, ks;
+	boost::uint32_t* s = state->buf;
+
+	while (len >= 8) {
+		boost::uint64_t k = 0;
+		for (int i = 0; i < 8; ++i) {
+			RC4_STEP
+			k |= boost::uint64_t(ks) << RC4_SHIFT(i);
+		}
+
+		boost::uint64_t d;
+		memcpy(&d, in, 8);
+		d ^= k;
+		memcpy(out, &d, 8);
+		in += 8;
+		out += 8;
+		len -= 8;
 	}
+
+	while (len > 0) {
+		RC4_STEP
+		*out++ = *in++ ^ ks;
+		--len;
+	}
+
 	state->x = x;
 	state->y = y;
-	return n;
 }
 
+#undef RC4_SHIFT
+#undef RC4_STEP
+
 #endif
 
 #endif // #ifndef TORRENT_DISABLE_ENCRYPTION
@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include <vector>
+#include <memory> // for auto_ptr
 #include <boost/limits.hpp>
 #include <boost/bind.hpp>
 #include <boost/cstdint.hpp>
@@ -63,7 +64,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/alloca.hpp"
 #include "libtorrent/disk_interface.hpp"
 #include "libtorrent/bandwidth_manager.hpp"
-#include "libtorrent/request_blocks.hpp" // for request_a_block
+#include "libtorrent/request_blocks.hpp"
 #include "libtorrent/performance_counters.hpp" // for counters
 #include "libtorrent/alert_manager.hpp" // for alert_manageralert_manager
 
@@ -71,6 +72,38 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <set>
 #endif
 
+#if TORRENT_USE_SENDFILE
+#include <sys/sendfile.h>
+#include <errno.h>
+#endif
+
+#if TORRENT_USE_MSG_ZEROCOPY
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+
+// these may be missing from older system headers, even though the running
+// kernel supports them. Kernels that don't fail setting SO_ZEROCOPY, which
+// disables zero-copy sends
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED 1
+#endif
+#endif
+
+#ifdef TORRENT_LINUX
+#include <netinet/tcp.h> // for TCP_INFO
+#endif
+
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
 #include "libtorrent/escape_string.hpp"
 #include "libtorrent/socket_io.hpp"
@@ -83,17 +116,6 @@ using boost::shared_ptr;
 namespace libtorrent
 {
 
-	enum
-	{
-		// the limits of the download queue size
-		min_request_queue = 2,
-	};
-
-	int round_up8(int v)
-	{
-		return ((v & 7) == 0) ? v : v + (8 - (v & 7));
-	}
-
 #if defined TORRENT_REQUEST_LOGGING
 	void write_request_log(FILE* f, sha1_hash const& ih
 		, peer_connection* p, peer_request const& r)
@@ -131,12 +153,18 @@ namespace libtorrent
 		, m_peer_info(pack.peerinfo)
 		, m_counters(*pack.stats_counters)
 		, m_num_pieces(0)
-		, m_recv_start(0)
+		, m_recv_buffer(*pack.allocator, *pack.stats_counters)
 		, m_max_out_request_queue(m_settings.get_int(settings_pack::max_out_request_queue))
 		, m_remote(*pack.endp)
+#if TORRENT_USE_MSG_ZEROCOPY
+		, m_zerocopy_sends(0)
+		, m_zerocopy_done(0)
+		, m_zerocopy_state(0)
+#endif
 		, m_disk_thread(*pack.disk_thread)
 		, m_allocator(*pack.allocator)
 		, m_ios(*pack.ios)
+		, m_transport_rtt(0)
 		, m_work(m_ios)
 		, m_last_piece(time_now())
 		, m_last_request(time_now())
@@ -154,16 +182,12 @@ namespace libtorrent
 		, m_downloaded_at_last_round(0)
 		, m_uploaded_at_last_round(0)
 		, m_uploaded_at_last_unchoke(0)
-		, m_soft_packet_size(0)
 		, m_outstanding_bytes(0)
-		, m_disk_recv_buffer(*pack.allocator, 0)
 		, m_last_seen_complete(0)
 		, m_receiving_block(piece_block::invalid)
 		, m_timeout_extend(0)
 		, m_extension_outstanding_bytes(0)
 		, m_queued_time_critical(0)
-		, m_recv_end(0)
-		, m_disk_recv_buffer_size(0)
 		, m_reading_bytes(0)
 		, m_picker_options(0)
 		, m_num_invalid_requests(0)
@@ -911,8 +935,6 @@ namespace libtorrent
 			m_connecting = false;
 		}
 
-		m_disk_recv_buffer_size = 0;
-
 #ifndef TORRENT_DISABLE_EXTENSIONS
 		m_extensions.clear();
 #endif
@@ -1088,7 +1110,7 @@ namespace libtorrent
 		return m_requests;
 	}
 
-	time_duration peer_connection::download_queue_time(int extra_bytes) const
+	int peer_connection::queue_download_rate() const
 	{
 		boost::shared_ptr<torrent> t = m_torrent.lock();
 		TORRENT_ASSERT(t);
@@ -1121,14 +1143,30 @@ namespace libtorrent
 			rate = m_statistics.transfer_rate(stat::download_payload);
 		}
 
-		// avoid division by zero
-		if (rate < 50) rate = 50;
-
 		// average of current rate and peak
 //		rate = (rate + m_download_rate_peak) / 2;
 
-		return milliseconds((m_outstanding_bytes
-			+ m_queued_time_critical * t->block_size() * 1000) / rate);
+		return rate;
+	}
+
+	boost::int64_t peer_connection::queued_bytes(int extra_bytes) const
+	{
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		TORRENT_ASSERT(t);
+
+		return boost::int64_t(m_outstanding_bytes) + extra_bytes
+			+ m_queued_time_critical * t->block_size();
+	}
+
+	time_duration peer_connection::download_queue_time(int extra_bytes) const
+	{
+		return download_time(queued_bytes(extra_bytes), queue_download_rate());
+	}
+
+	time_duration peer_connection::block_arrival_time(int extra_bytes) const
+	{
+		return libtorrent::block_arrival_time(queued_bytes(extra_bytes)
+			, queue_download_rate(), m_transport_rtt);
 	}
 
 	void peer_connection::add_stat(size_type downloaded, size_type uploaded)
@@ -2610,6 +2648,7 @@ namespace libtorrent
 
 		disk_buffer_holder holder(m_allocator, buffer);
 		std::memcpy(buffer, data, p.length);
+		m_counters.inc_stats_counter(counters::recv_copied_bytes, p.length);
 		incoming_piece(p, holder);
 	}
 
@@ -2620,8 +2659,7 @@ namespace libtorrent
 		boost::shared_ptr<torrent> t = m_torrent.lock();
 		TORRENT_ASSERT(t);
 
-		TORRENT_ASSERT(!m_disk_recv_buffer);
-		TORRENT_ASSERT(m_disk_recv_buffer_size == 0);
+		TORRENT_ASSERT(!m_recv_buffer.has_disk_buffer());
 
 		// we're not receiving any block right now
 		m_receiving_block = piece_block::invalid;
@@ -2918,6 +2956,22 @@ namespace libtorrent
 
 		if (is_disconnecting()) return;
 
+		defer_block_requests();
+	}
+
+	void peer_connection::defer_block_requests()
+	{
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		if (!t) return;
+		t->defer_block_requests(this);
+	}
+
+	void peer_connection::request_deferred_blocks()
+	{
+		TORRENT_ASSERT(!is_disconnecting());
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		if (!t) return;
+
 		if (request_a_block(*t, *this))
 			m_counters.inc_stats_counter(counters::incoming_piece_picks);
 		send_block_requests();
@@ -4015,13 +4069,16 @@ namespace libtorrent
 		}
 #endif
 
+#if TORRENT_USE_MSG_ZEROCOPY
+		abort_zero_copy_sends();
+#endif
+
 		if ((m_channel_state[upload_channel] & peer_info::bw_network) == 0)
 		{
 			// make sure we free up all send buffers that are owned
 			// by the disk thread
 			m_send_buffer.clear();
-			m_disk_recv_buffer.reset();
-			m_disk_recv_buffer_size = 0;
+			m_recv_buffer.free_disk_buffers();
 		}
 
 		// we cannot do this in a constructor
@@ -4367,8 +4424,8 @@ namespace libtorrent
 		p.remote_dl_rate = m_remote_dl_rate;
 		p.send_buffer_size = m_send_buffer.capacity();
 		p.used_send_buffer = m_send_buffer.size();
-		p.receive_buffer_size = m_recv_buffer.capacity() + m_disk_recv_buffer_size;
-		p.used_receive_buffer = m_recv_pos;
+		p.receive_buffer_size = m_recv_buffer.capacity();
+		p.used_receive_buffer = m_recv_buffer.pos();
 		p.write_state = m_channel_state[upload_channel];
 		p.read_state = m_channel_state[download_channel];
 		
@@ -4404,12 +4461,15 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 
-		TORRENT_ASSERT(m_packet_size > 0);
-		TORRENT_ASSERT(m_recv_pos <= m_packet_size - disk_buffer_size);
-		TORRENT_ASSERT(!m_disk_recv_buffer);
-		TORRENT_ASSERT(m_disk_recv_buffer_size == 0);
+		TORRENT_ASSERT(m_recv_buffer.packet_size() > 0);
+		TORRENT_ASSERT(m_recv_buffer.pos() <= m_recv_buffer.packet_size() - disk_buffer_size);
+		TORRENT_ASSERT(!m_recv_buffer.has_disk_buffer());
 		TORRENT_ASSERT(disk_buffer_size <= 16 * 1024);
 
+		// if the start of this message was received speculatively, as a
+		// piece message, the payload is already in a disk buffer
+		if (m_recv_buffer.adopt_spec_buffer(disk_buffer_size)) return true;
+
 		if (disk_buffer_size == 0) return true;
 
 		if (disk_buffer_size > 16 * 1024)
@@ -4418,14 +4478,10 @@ namespace libtorrent
 			return false;
 		}
 
-		// first free the old buffer
-		m_disk_recv_buffer.reset();
-		// then allocate a new one
-
 		bool exceeded = false;
-		m_disk_recv_buffer.reset(m_allocator.allocate_disk_buffer(exceeded, self(), "receive buffer"));
+		char* buf = m_allocator.allocate_disk_buffer(exceeded, self(), "receive buffer");
 
-		if (!m_disk_recv_buffer)
+		if (buf == 0)
 		{
 			disconnect(errors::no_memory, op_alloc_recvbuf);
 			return false;
@@ -4441,79 +4497,26 @@ namespace libtorrent
 			m_channel_state[download_channel] |= peer_info::bw_disk;
 		}
 
-		m_disk_recv_buffer_size = disk_buffer_size;
+		m_recv_buffer.assign_disk_buffer(buf, disk_buffer_size);
 		return true;
 	}
 
 	char* peer_connection::release_disk_receive_buffer()
 	{
-		if (!m_disk_recv_buffer) return 0;
-
-		TORRENT_ASSERT(m_disk_recv_buffer_size <= m_recv_end);
-		TORRENT_ASSERT(m_recv_start <= m_recv_end - m_disk_recv_buffer_size);
-		m_recv_end -= m_disk_recv_buffer_size;
-		m_disk_recv_buffer_size = 0;
-		return m_disk_recv_buffer.release();
+		return m_recv_buffer.release_disk_buffer();
 	}
 	
-	// size = the packet size to remove from the receive buffer
-	// packet_size = the next packet size to receive in the buffer
-	// offset = the offset into the receive buffer where to remove `size` bytes
 	void peer_connection::cut_receive_buffer(int size, int packet_size, int offset)
 	{
 		INVARIANT_CHECK;
-
-		TORRENT_ASSERT(packet_size > 0);
-		TORRENT_ASSERT(int(m_recv_buffer.size()) >= size);
-		TORRENT_ASSERT(int(m_recv_buffer.size()) >= m_recv_pos);
-		TORRENT_ASSERT(m_recv_pos >= size + offset);
-		TORRENT_ASSERT(offset >= 0);
-		TORRENT_ASSERT(m_recv_buffer.size() >= m_recv_end);
-		TORRENT_ASSERT(m_recv_start <= m_recv_end);
-		TORRENT_ASSERT(size >= 0);
-
-		if (offset > 0)
-		{
-			TORRENT_ASSERT(m_recv_start - size <= m_recv_end);
-
-			if (size > 0)
-				std::memmove(&m_recv_buffer[0] + m_recv_start + offset
-					, &m_recv_buffer[0] + m_recv_start + offset + size
-					, m_recv_end - m_recv_start - size - offset);
-
-			m_recv_pos -= size;
-			m_recv_end -= size;
-
-#ifdef TORRENT_DEBUG
-			std::fill(m_recv_buffer.begin() + m_recv_end, m_recv_buffer.end(), 0xcc);
-#endif
-		}
-		else
-		{
-			TORRENT_ASSERT(m_recv_start + size <= m_recv_end);
-			m_recv_start += size;
-			m_recv_pos -= size;
-		}
-
-		m_packet_size = packet_size;
+		m_recv_buffer.cut(size, packet_size, offset);
 	}
 
 	// the purpose of this function is to free up and cut off all messages
 	// in the receive buffer that have been parsed and processed.
 	void peer_connection::normalize_receive_buffer()
 	{
-		TORRENT_ASSERT(m_recv_end >= m_recv_start);
-		if (m_recv_start == 0) return;
-
-		if (m_recv_end > m_recv_start)
-			std::memmove(&m_recv_buffer[0], &m_recv_buffer[0] + m_recv_start, m_recv_end - m_recv_start);
-
-		m_recv_end -= m_recv_start;
-		m_recv_start = 0;
-
-#ifdef TORRENT_DEBUG
-		std::fill(m_recv_buffer.begin() + m_recv_end, m_recv_buffer.end(), 0xcc);
-#endif
+		m_recv_buffer.normalize();
 	}
 
 	void peer_connection::superseed_piece(int replace_piece, int new_piece)
@@ -4568,23 +4571,50 @@ namespace libtorrent
 
 		// calculate the desired download queue size
 		const int queue_time = m_settings.get_int(settings_pack::request_queue_time);
-		// (if the latency is more than this, the download will stall)
-		// so, the queue size is queue_time * down_rate / 16 kiB
-		// (16 kB is the size of each request)
-		// the minimum number of requests is 2 and the maximum is 48
 		// the block size doesn't have to be 16. So we first query the
 		// torrent for it
 		boost::shared_ptr<torrent> t = m_torrent.lock();
 		const int block_size = t->block_size();
 
 		TORRENT_ASSERT(block_size > 0);
-		
-		m_desired_queue_size = queue_time * download_rate / block_size;
 
-		if (m_desired_queue_size > m_max_out_request_queue)
-			m_desired_queue_size = m_max_out_request_queue;
-		if (m_desired_queue_size < min_request_queue)
-			m_desired_queue_size = min_request_queue;
+		int const rtt = m_settings.get_bool(settings_pack::bdp_request_queue)
+			? m_transport_rtt : 0;
+		m_desired_queue_size = libtorrent::desired_queue_size(download_rate
+			, block_size, queue_time, rtt, m_max_out_request_queue);
+	}
+
+	int peer_connection::transport_rtt() const
+	{
+		utp_stream const* utp = m_socket->get<utp_stream>();
+#ifdef TORRENT_USE_OPENSSL
+		if (utp == 0)
+		{
+			ssl_stream<utp_stream>* s = m_socket->get<ssl_stream<utp_stream> >();
+			if (s) utp = &s->next_layer();
+		}
+#endif
+		if (utp) return utp->rtt() * 1000;
+
+#if defined TORRENT_LINUX && defined TCP_INFO
+		tcp::socket* tcp = m_socket->get<tcp::socket>();
+#ifdef TORRENT_USE_OPENSSL
+		if (tcp == 0)
+		{
+			ssl_stream<tcp::socket>* s = m_socket->get<ssl_stream<tcp::socket> >();
+			if (s) tcp = &s->next_layer();
+		}
+#endif
+		if (tcp == 0) return 0;
+
+		tcp_info info;
+		socklen_t len = sizeof(info);
+		if (getsockopt(tcp->native_handle(), IPPROTO_TCP, TCP_INFO, &info, &len) != 0)
+			return 0;
+		return int(info.tcpi_rtt);
+#else
+		return 0;
+#endif
 	}
 
 	void peer_connection::second_tick(int tick_interval_ms)
@@ -4638,6 +4668,12 @@ namespace libtorrent
 			return;
 		}
 
+#if TORRENT_USE_MSG_ZEROCOPY
+		// release the buffers of zero-copy sends that completed after the
+		// connection stopped sending
+		reap_zero_copy_completions();
+#endif
+
 		if (m_endgame_mode
 			&& m_interesting
 			&& m_download_queue.empty()
@@ -4790,6 +4826,10 @@ namespace libtorrent
 
 		if (!t->ready_for_connections()) return;
 
+		if (m_settings.get_bool(settings_pack::bdp_request_queue)
+			|| m_settings.get_bool(settings_pack::streaming_deadline_estimates))
+			m_transport_rtt = transport_rtt();
+
 		update_desired_queue_size();
 
 		if (m_desired_queue_size == m_max_out_request_queue 
@@ -5060,9 +5100,14 @@ namespace libtorrent
 				// the callback function may be called immediately, instead of being posted
 				if (!t->need_loaded()) return;
 				t->inc_refcount("async_read");
+
+				// blocks that aren't in the cache may be sent straight from
+				// the file, in which case there's no point in caching them
+				int const read_flags = can_send_from_file()
+					? disk_io_job::zero_copy | disk_io_job::volatile_read : 0;
 				m_disk_thread.async_read(&t->storage(), r
 					, boost::bind(&peer_connection::on_disk_read_complete
-					, self(), _1, r, time_now_hires()), this);
+					, self(), _1, r, time_now_hires()), this, read_flags);
 			}
 			m_requests.erase(m_requests.begin() + i);
 
@@ -5181,10 +5226,17 @@ namespace libtorrent
 
 		TORRENT_ASSERT(j->ret == r.length);
 
+		// if the zero_copy flag is still set, the block wasn't read. We got
+		// the file region it's stored in instead
+		std::auto_ptr<file_region> region;
+		if (j->flags & disk_io_job::zero_copy)
+			region.reset((file_region*)j->buffer);
+
 		// even if we're disconnecting, we need to free this block
 		// otherwise the disk thread will hang, waiting for the network
 		// thread to be done with it
-		disk_buffer_holder buffer(m_allocator, *j);
+		disk_buffer_holder buffer(m_allocator, (char*)NULL);
+		if (region.get() == NULL) buffer.reset(*j);
 
 		if (m_disconnecting) return;
 
@@ -5220,6 +5272,12 @@ namespace libtorrent
 		{
 			t->add_suggest_piece(r.piece);
 		}
+
+		if (region.get())
+		{
+			write_piece_from_file(r, region.release());
+			return;
+		}
 		write_piece(r, buffer);
 	}
 
@@ -5260,7 +5318,7 @@ namespace libtorrent
 		if (channel == download_channel)
 		{
 			return (std::max)((std::max)(m_outstanding_bytes
-				, m_packet_size - m_recv_pos) + 30
+				, m_recv_buffer.packet_size() - m_recv_buffer.pos()) + 30
 				, int(boost::int64_t(m_statistics.download_rate()) * 2
 					/ (1000 / m_settings.get_int(settings_pack::tick_interval))));
 		}
@@ -5448,6 +5506,29 @@ namespace libtorrent
 		}
 
 		TORRENT_ASSERT((m_channel_state[upload_channel] & peer_info::bw_network) == 0);
+
+#if TORRENT_USE_SENDFILE
+		size_type file_offset;
+		int file_bytes;
+		if (m_send_buffer.front_file(file_offset, file_bytes) != -1)
+		{
+			send_from_file(amount_to_send);
+			return;
+		}
+#endif
+
+#if TORRENT_USE_MSG_ZEROCOPY
+		// pinning the pages and being notified when the kernel is done with
+		// them has a cost of its own. Zero-copy sends only pay off when
+		// there's a fair amount of block data to send
+		if (m_send_buffer.zero_copy_bytes(amount_to_send) >= 10 * 1024
+			&& can_send_zero_copy())
+		{
+			send_zero_copy(amount_to_send);
+			return;
+		}
+#endif
+
 #ifdef TORRENT_VERBOSE_LOGGING
 		peer_log(">>> ASYNC_WRITE [ bytes: %d ]", amount_to_send);
 #endif
@@ -5496,11 +5577,10 @@ namespace libtorrent
 	{
 		INVARIANT_CHECK;
 
-		TORRENT_ASSERT(!m_disk_recv_buffer);
+		TORRENT_ASSERT(!m_recv_buffer.has_disk_buffer());
 		TORRENT_ASSERT(m_channel_state[download_channel] & peer_info::bw_disk);
 
-		m_disk_recv_buffer.reset(buffer);
-		m_disk_recv_buffer_size = buffer_size;
+		m_recv_buffer.assign_disk_buffer(buffer, buffer_size);
 
 		m_counters.inc_stats_counter(counters::num_peers_down_disk, -1);
 		m_channel_state[download_channel] &= ~peer_info::bw_disk;
@@ -5559,15 +5639,29 @@ namespace libtorrent
 			return 0;
 		}
 
-		int max_receive = m_packet_size - m_recv_pos;
+		int max_receive = m_recv_buffer.max_receive();
+
+		// a speculative read that was cut short, before reaching the disk
+		// buffer, leaves it empty
+		m_recv_buffer.reset_spec_buffer();
+
+		// if the next message is likely to be a piece message, read its
+		// header and as much of the payload as we expect it to have. The
+		// payload is read into a disk buffer, to save copying it out of
+		// the receive buffer
+		int const header_size = m_recv_buffer.has_disk_buffer()
+			|| m_recv_buffer.soft_packet_size() ? 0 : expected_piece_header_size();
 
 		boost::array<asio::mutable_buffer, 2> vec;
 		int num_bufs = 0;
 		// only apply the contiguous receive buffer when we don't have any
 		// outstanding requests. When we're likely to receive pieces, we'll
-		// save more time from avoiding copying data from the socket
-		if ((m_settings.get_bool(settings_pack::contiguous_recv_buffer)
-			|| m_download_queue.empty()) && !m_disk_recv_buffer)
+		// save more time from avoiding copying data from the socket. Even
+		// with the contiguous receive buffer, a message expected to be a
+		// piece is received speculatively, below
+		if (((m_settings.get_bool(settings_pack::contiguous_recv_buffer)
+			&& header_size == 0) || m_download_queue.empty())
+			&& !m_recv_buffer.has_disk_buffer())
 		{
 			if (s == read_sync)
 			{
@@ -5589,12 +5683,8 @@ namespace libtorrent
 			return 0;
 		}
 
-		TORRENT_ASSERT(m_packet_size > 0);
 		TORRENT_ASSERT(max_receive >= 0);
 
-		if (m_recv_pos >= m_soft_packet_size) m_soft_packet_size = 0;
-		if (m_soft_packet_size && max_receive > m_soft_packet_size - m_recv_pos)
-			max_receive = m_soft_packet_size - m_recv_pos;
 		int quota_left = m_quota[download_channel];
 		if (max_receive > quota_left)
 			max_receive = quota_left;
@@ -5605,43 +5695,32 @@ namespace libtorrent
 			return 0;
 		}
 
-		TORRENT_ASSERT(m_recv_pos >= 0);
-		TORRENT_ASSERT(m_packet_size > 0);
-
-		int regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
+		m_ses.acquire_recv_buffer(m_recv_buffer.storage());
 
-		if (int(m_recv_buffer.size()) < regular_buffer_size)
-			m_recv_buffer.resize(round_up8(regular_buffer_size));
-
-		if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos + max_receive)
-		{
-			// only receive into regular buffer
-			TORRENT_ASSERT(m_recv_pos + max_receive <= int(m_recv_buffer.size()));
-			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos], max_receive);
-			num_bufs = 1;
-		}
-		else if (m_recv_pos >= regular_buffer_size)
-		{
-			// only receive into disk buffer
-			TORRENT_ASSERT(m_recv_pos - regular_buffer_size >= 0);
-			TORRENT_ASSERT(m_recv_pos - regular_buffer_size + max_receive <= m_disk_recv_buffer_size);
-			vec[0] = asio::buffer(m_disk_recv_buffer.get() + m_recv_pos - regular_buffer_size, max_receive);
-			num_bufs = 1;
+		boost::shared_ptr<torrent> t = m_torrent.lock();
+		if (header_size > 0 && quota_left > header_size
+			&& t && t->valid_metadata() && !m_download_queue.empty())
+		{
+			piece_block const& b = m_download_queue.front().block;
+			int const block_size = (std::min)(t->block_size()
+				, t->torrent_file().piece_size(b.piece_index)
+				- b.block_index * t->block_size());
+
+			bool exceeded = false;
+			disk_buffer_holder spec_buffer(m_allocator
+				, m_allocator.allocate_disk_buffer(exceeded
+				, boost::shared_ptr<disk_observer>(), "receive buffer"));
+
+			// when we're short of disk buffers, leave them to the messages
+			// we know are pieces
+			if (spec_buffer && !exceeded && block_size > 0)
+			{
+				max_receive = (std::min)(header_size + block_size, quota_left);
+				m_recv_buffer.speculate(spec_buffer.release(), header_size);
+			}
 		}
-		else
-		{
-			// receive into both regular and disk buffer
-			TORRENT_ASSERT(max_receive + m_recv_pos > regular_buffer_size);
-			TORRENT_ASSERT(m_recv_pos < regular_buffer_size);
-			TORRENT_ASSERT(max_receive - regular_buffer_size
-				+ m_recv_pos <= m_disk_recv_buffer_size);
 
-			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos]
-				, regular_buffer_size - m_recv_pos);
-			vec[1] = asio::buffer(m_disk_recv_buffer.get()
-				, max_receive - regular_buffer_size + m_recv_pos);
-			num_bufs = 2;
-		}
+		num_bufs = m_recv_buffer.reserve(vec, max_receive);
 
 		if (s == read_async)
 		{
@@ -5707,57 +5786,9 @@ namespace libtorrent
 		return ret;
 	}
 
-#ifndef TORRENT_DISABLE_ENCRYPTION
-
-	// returns the last 'bytes' from the receive buffer
-	std::pair<buffer::interval, buffer::interval> peer_connection::wr_recv_buffers(int bytes)
-	{
-		TORRENT_ASSERT(bytes <= m_recv_pos);
-
-		std::pair<buffer::interval, buffer::interval> vec;
-		int regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
-		TORRENT_ASSERT(regular_buffer_size >= 0);
-		if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos)
-		{
-			vec.first = buffer::interval(&m_recv_buffer[0] + m_recv_start
-				+ m_recv_pos - bytes, &m_recv_buffer[0] + m_recv_start + m_recv_pos);
-			vec.second = buffer::interval(0,0);
-		}
-		else if (m_recv_pos - bytes >= regular_buffer_size)
-		{
-			vec.first = buffer::interval(m_disk_recv_buffer.get() + m_recv_pos
-				- regular_buffer_size - bytes, m_disk_recv_buffer.get() + m_recv_pos
-				- regular_buffer_size);
-			vec.second = buffer::interval(0,0);
-		}
-		else
-		{
-			TORRENT_ASSERT(m_recv_pos - bytes < regular_buffer_size);
-			TORRENT_ASSERT(m_recv_pos > regular_buffer_size);
-			vec.first = buffer::interval(&m_recv_buffer[0] + m_recv_start + m_recv_pos - bytes
-				, &m_recv_buffer[0] + m_recv_start + regular_buffer_size);
-			vec.second = buffer::interval(m_disk_recv_buffer.get()
-				, m_disk_recv_buffer.get() + m_recv_pos - regular_buffer_size);
-		}
-		TORRENT_ASSERT(vec.first.left() + vec.second.left() == bytes);
-		return vec;
-	}
-#endif
-
 	void peer_connection::reset_recv_buffer(int packet_size)
 	{
-		TORRENT_ASSERT(m_recv_buffer.size() >= m_recv_end);
-		TORRENT_ASSERT(packet_size > 0);
-		if (m_recv_end > m_packet_size)
-		{
-			cut_receive_buffer(m_packet_size, packet_size);
-			return;
-		}
-
-		m_recv_pos = 0;
-		m_recv_start = 0;
-		m_recv_end = 0;
-		m_packet_size = packet_size;
+		m_recv_buffer.reset(packet_size);
 	}
 
 	void peer_connection::append_send_buffer(char* buffer, int size
@@ -5781,6 +5812,19 @@ namespace libtorrent
 			, userdata, ref);
 	}
 
+	void free_file_region(char*, void* userdata, block_cache_reference)
+	{
+		delete (file_region*)userdata;
+	}
+
+	void peer_connection::append_send_file(file_region* region, int size)
+	{
+		TORRENT_ASSERT(region);
+		TORRENT_ASSERT(region->file);
+		m_send_buffer.append_file(region->file->native_handle(), region->offset
+			, size, &free_file_region, region);
+	}
+
 	void session_free_buffer(char* buffer, void* userdata, block_cache_reference)
 	{
 		aux::session_interface* ses = (aux::session_interface*)userdata;
@@ -5895,13 +5939,13 @@ namespace libtorrent
 
 		if (buffer_size > 2097152) buffer_size = 2097152;
 
-		m_recv_buffer.resize(m_recv_pos + buffer_size);
-		TORRENT_ASSERT(m_recv_start == 0);
+		m_ses.acquire_recv_buffer(m_recv_buffer.storage());
+		char* recv_buf = m_recv_buffer.reserve(buffer_size);
 
 		// utp sockets aren't thread safe...
 		if (is_utp(*m_socket))
 		{
-			bytes_transferred = m_socket->read_some(asio::buffer(&m_recv_buffer[m_recv_pos]
+			bytes_transferred = m_socket->read_some(asio::buffer(recv_buf
 				, buffer_size), ec);
 
 			if (ec)
@@ -5925,7 +5969,7 @@ namespace libtorrent
 #endif
 			socket_job j;
 			j.type = socket_job::read_job;
-			j.recv_buf = &m_recv_buffer[m_recv_pos];
+			j.recv_buf = recv_buf;
 			j.buf_size = buffer_size;
 			j.peer = self();
 			m_ses.post_socket_job(j);
@@ -6024,12 +6068,9 @@ namespace libtorrent
 				return;
 			}
 	
-			TORRENT_ASSERT(m_packet_size > 0);
 			TORRENT_ASSERT(bytes_transferred > 0);
 
-			m_recv_end += bytes_transferred;
-			TORRENT_ASSERT(m_recv_pos <= int(m_recv_buffer.size()
-				+ m_disk_recv_buffer_size));
+			m_recv_buffer.received(bytes_transferred);
 
 			int bytes = bytes_transferred;
 			int sub_transferred = 0;
@@ -6039,10 +6080,7 @@ namespace libtorrent
 				size_type cur_payload_dl = m_statistics.last_payload_downloaded();
 				size_type cur_protocol_dl = m_statistics.last_protocol_downloaded();
 #endif
-				int packet_size = m_soft_packet_size ? m_soft_packet_size : m_packet_size;
-				int limit = packet_size > m_recv_pos ? packet_size - m_recv_pos : packet_size;
-				sub_transferred = (std::min)(bytes, limit);
-				m_recv_pos += sub_transferred;
+				sub_transferred = m_recv_buffer.advance_pos(bytes);
 				on_receive(error, sub_transferred);
 				bytes -= sub_transferred;
 				TORRENT_ASSERT(sub_transferred > 0);
@@ -6060,19 +6098,14 @@ namespace libtorrent
 
 			normalize_receive_buffer();
 
-			TORRENT_ASSERT(m_recv_pos == m_recv_end);
-
-			TORRENT_ASSERT(m_packet_size > 0);
+			TORRENT_ASSERT(m_recv_buffer.packet_size() > 0);
 
-			if (m_peer_choked
-				&& m_recv_pos == 0
-				&& (m_recv_buffer.capacity() - m_packet_size) > 128)
-			{
-				// round up to an even 8 bytes since that's the RC4 blocksize
-				buffer(round_up8(m_packet_size)).swap(m_recv_buffer);
-			}
-
-			if (m_recv_pos >= m_soft_packet_size) m_soft_packet_size = 0;
+			// when there's no partially received message, the receive buffer
+			// is handed back to the session. The next read picks one up again
+			// once there is something to read, so idle connections don't
+			// hold on to any receive buffer
+			if (m_recv_buffer.empty())
+				m_ses.release_recv_buffer(m_recv_buffer.storage());
 
 			if (num_loops > read_loops) break;
 
@@ -6408,6 +6441,305 @@ namespace libtorrent
 	// SEND DATA
 	// --------------------------
 
+#if TORRENT_USE_SENDFILE
+	// the first entry in the send buffer is a file range. Send (up to)
+	// amount bytes of it with sendfile(). The socket is in non-blocking mode
+	// so this doesn't stall the network thread. The write is completed by
+	// on_send_data() just like an async_write would be, or if the socket
+	// isn't writable, by on_send_ready() once it is
+	void peer_connection::send_from_file(int amount)
+	{
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		TORRENT_ASSERT(s);
+
+		size_type offset = 0;
+		int size = 0;
+		int const fd = m_send_buffer.front_file(offset, size);
+		TORRENT_ASSERT(fd != -1);
+		if (amount > size) amount = size;
+
+#ifdef TORRENT_VERBOSE_LOGGING
+		peer_log(">>> SENDFILE [ bytes: %d offset: %" PRId64 " ]", amount, offset);
+#endif
+
+#if TORRENT_USE_ASSERTS
+		TORRENT_ASSERT(!m_socket_is_writing);
+		m_socket_is_writing = true;
+#endif
+		m_channel_state[upload_channel] |= peer_info::bw_network;
+
+		error_code ec;
+		s->non_blocking(true, ec);
+
+		off_t file_offset = offset;
+		ssize_t ret = 0;
+		if (!ec)
+		{
+			ret = ::sendfile(s->native_handle(), fd, &file_offset, amount);
+			if (ret < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				{
+#if defined TORRENT_ASIO_DEBUGGING
+					add_outstanding_async("peer_connection::on_send_ready");
+#endif
+					s->async_write_some(asio::null_buffers(), make_write_handler(
+						boost::bind(&peer_connection::on_send_ready, self(), _1)));
+					return;
+				}
+				ec.assign(errno, boost::system::generic_category());
+				ret = 0;
+			}
+			else if (ret == 0)
+			{
+				// the file is shorter than it's supposed to be
+				ec = errors::file_too_short;
+			}
+		}
+
+		if (ret > 0)
+			m_counters.inc_stats_counter(counters::sent_zero_copy_bytes, ret);
+
+#if defined TORRENT_ASIO_DEBUGGING
+		add_outstanding_async("peer_connection::on_send_data");
+#endif
+		m_ses.get_io_service().post(boost::bind(&peer_connection::on_send_data
+			, self(), ec, std::size_t(ret)));
+	}
+#endif // TORRENT_USE_SENDFILE
+
+#if TORRENT_USE_MSG_ZEROCOPY
+	bool peer_connection::can_send_zero_copy()
+	{
+		if (m_zerocopy_state < 0) return false;
+		if (!m_settings.get_bool(settings_pack::zero_copy_send)) return false;
+
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		if (s == NULL)
+		{
+			m_zerocopy_state = -1;
+			return false;
+		}
+
+		if (m_zerocopy_state == 0)
+		{
+			int one = 1;
+			if (::setsockopt(s->native_handle(), SOL_SOCKET, SO_ZEROCOPY
+				, &one, sizeof(one)) != 0)
+			{
+				// the kernel doesn't support MSG_ZEROCOPY
+				m_zerocopy_state = -1;
+				return false;
+			}
+			m_zerocopy_state = 1;
+		}
+		return true;
+	}
+
+	// sends (up to) amount bytes from the front of the send buffer with
+	// MSG_ZEROCOPY, in a single non-blocking call, like send_from_file().
+	// The kernel keeps reading from the buffers after the call returns, so
+	// the send buffer holds on to the buffers that are popped, until the
+	// kernel reports on the socket's error queue that it's done with them
+	void peer_connection::send_zero_copy(int amount)
+	{
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		TORRENT_ASSERT(s);
+
+		// free the buffers of earlier sends the kernel is done with
+		reap_zero_copy_completions();
+
+		std::vector<asio::const_buffer> const& vec = m_send_buffer.build_iovec(amount);
+		TORRENT_ASSERT(!vec.empty());
+		int const num_bufs = int(vec.size());
+		iovec* iov = TORRENT_ALLOCA(iovec, num_bufs);
+		for (int i = 0; i < num_bufs; ++i)
+		{
+			iov[i].iov_base = const_cast<void*>(asio::buffer_cast<void const*>(vec[i]));
+			iov[i].iov_len = asio::buffer_size(vec[i]);
+		}
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = num_bufs;
+
+#ifdef TORRENT_VERBOSE_LOGGING
+		peer_log(">>> ZEROCOPY_SEND [ bytes: %d buffers: %d ]", amount, num_bufs);
+#endif
+
+#if TORRENT_USE_ASSERTS
+		TORRENT_ASSERT(!m_socket_is_writing);
+		m_socket_is_writing = true;
+#endif
+		m_channel_state[upload_channel] |= peer_info::bw_network;
+
+		error_code ec;
+		bool zero_copy = true;
+		ssize_t ret = ::sendmsg(s->native_handle(), &msg
+			, MSG_ZEROCOPY | MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0 && errno == ENOBUFS)
+		{
+			// the limit of memory pinned by zero-copy sends on this socket
+			// is reached. Copy this one
+			zero_copy = false;
+			ret = ::sendmsg(s->native_handle(), &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		}
+
+		if (ret < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			{
+#if defined TORRENT_ASIO_DEBUGGING
+				add_outstanding_async("peer_connection::on_send_ready");
+#endif
+				s->async_write_some(asio::null_buffers(), make_write_handler(
+					boost::bind(&peer_connection::on_send_ready, self(), _1)));
+				return;
+			}
+			ec.assign(errno, boost::system::generic_category());
+			ret = 0;
+		}
+		else if (zero_copy)
+		{
+			// the kernel numbers the zero-copy sends on a socket the same
+			// way. Buffers popped from now on may be part of this send
+			++m_zerocopy_sends;
+			m_send_buffer.hold_popped(true, m_zerocopy_sends);
+			m_counters.inc_stats_counter(counters::sent_msg_zerocopy_bytes, ret);
+		}
+
+#if defined TORRENT_ASIO_DEBUGGING
+		add_outstanding_async("peer_connection::on_send_data");
+#endif
+		m_ses.get_io_service().post(boost::bind(&peer_connection::on_send_data
+			, self(), ec, std::size_t(ret)));
+	}
+
+	// reads the notifications of completed zero-copy sends from the socket's
+	// error queue and frees the buffers held for them
+	void peer_connection::reap_zero_copy_completions()
+	{
+		if (m_zerocopy_done == m_zerocopy_sends) return;
+
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		TORRENT_ASSERT(s);
+
+		for (;;)
+		{
+			char control[128];
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if (::recvmsg(s->native_handle(), &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+				break;
+
+			for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm))
+			{
+				if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+					&& !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+					continue;
+
+				sock_extended_err const* err
+					= reinterpret_cast<sock_extended_err const*>(CMSG_DATA(cm));
+				if (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY || err->ee_errno != 0)
+					continue;
+
+				if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				{
+					// the kernel copied the data anyway (it always does on the
+					// loopback device, for instance). Zero-copy sends only add
+					// overhead on this connection then
+					m_counters.inc_stats_counter(counters::msg_zerocopy_copied);
+					m_zerocopy_state = -1;
+				}
+
+				// sends [ee_info, ee_data] have completed
+				m_zerocopy_completed.push_back(std::make_pair(
+					boost::uint32_t(err->ee_info), boost::uint32_t(err->ee_data)));
+			}
+		}
+
+		// sends on a TCP socket complete in order, but their notifications
+		// may be coalesced or delivered out of order. Only advance over
+		// ranges that connect to the sends known to be done
+		bool progress = true;
+		while (progress)
+		{
+			progress = false;
+			for (int i = 0; i < int(m_zerocopy_completed.size()); ++i)
+			{
+				std::pair<boost::uint32_t, boost::uint32_t> const r = m_zerocopy_completed[i];
+				if (boost::int32_t(r.first - m_zerocopy_done) > 0) continue;
+				if (boost::int32_t(r.second + 1 - m_zerocopy_done) > 0)
+					m_zerocopy_done = r.second + 1;
+				m_zerocopy_completed.erase(m_zerocopy_completed.begin() + i);
+				progress = true;
+				break;
+			}
+		}
+
+		m_send_buffer.release_held(m_zerocopy_done);
+		if (m_zerocopy_done == m_zerocopy_sends)
+			m_send_buffer.hold_popped(false);
+	}
+
+	// called when the connection is closed. A graceful close keeps sending
+	// what's queued on the socket, so if the kernel may still be reading
+	// from buffers of zero-copy sends, reset the connection instead. That
+	// drops the queued data, and the held buffers can be freed
+	void peer_connection::abort_zero_copy_sends()
+	{
+		if (m_zerocopy_done == m_zerocopy_sends) return;
+
+		reap_zero_copy_completions();
+		if (m_zerocopy_done == m_zerocopy_sends) return;
+
+		tcp::socket* s = m_socket->get<tcp::socket>();
+		TORRENT_ASSERT(s);
+
+#ifdef TORRENT_VERBOSE_LOGGING
+		peer_log("*** ABORT ZEROCOPY [ outstanding sends: %d ]"
+			, int(m_zerocopy_sends - m_zerocopy_done));
+#endif
+
+		linger l;
+		l.l_onoff = 1;
+		l.l_linger = 0;
+		::setsockopt(s->native_handle(), SOL_SOCKET, SO_LINGER, &l, sizeof(l));
+		error_code ec;
+		s->close(ec);
+
+		m_zerocopy_done = m_zerocopy_sends;
+		m_zerocopy_completed.clear();
+		m_send_buffer.release_held(m_zerocopy_done);
+		m_send_buffer.hold_popped(false);
+	}
+#endif // TORRENT_USE_MSG_ZEROCOPY
+
+#if TORRENT_USE_SENDFILE || TORRENT_USE_MSG_ZEROCOPY
+	void peer_connection::on_send_ready(error_code const& error)
+	{
+#if defined TORRENT_ASIO_DEBUGGING
+		complete_async("peer_connection::on_send_ready");
+#endif
+#if TORRENT_USE_ASSERTS
+		TORRENT_ASSERT(m_socket_is_writing);
+		m_socket_is_writing = false;
+#endif
+		TORRENT_ASSERT(m_channel_state[upload_channel] & peer_info::bw_network);
+		m_channel_state[upload_channel] &= ~peer_info::bw_network;
+
+		if (error)
+		{
+			disconnect(error, op_sock_write);
+			return;
+		}
+
+		setup_send();
+	}
+#endif // TORRENT_USE_SENDFILE || TORRENT_USE_MSG_ZEROCOPY
+
 	void peer_connection::on_send_data(error_code const& error
 		, std::size_t bytes_transferred)
 	{
@@ -6440,6 +6772,9 @@ namespace libtorrent
 		TORRENT_ASSERT(m_channel_state[upload_channel] & peer_info::bw_network);
 
 		m_send_buffer.pop_front(bytes_transferred);
+#if TORRENT_USE_MSG_ZEROCOPY
+		reap_zero_copy_completions();
+#endif
 
 		ptime now = time_now_hires();
 
@@ -6477,7 +6812,7 @@ namespace libtorrent
 			// make sure we free up all send buffers that are owned
 			// by the disk thread
 			m_send_buffer.clear();
-			m_disk_recv_buffer.reset();
+			m_recv_buffer.free_disk_buffers();
 			return;
 		}
 
@@ -6519,10 +6854,9 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(m_in_use == 1337);
 		TORRENT_ASSERT(m_queued_time_critical <= int(m_request_queue.size()));
-		TORRENT_ASSERT(m_recv_end >= m_recv_start);
 		TORRENT_ASSERT(m_accept_fast.size() == m_accept_fast_piece_cnt.size());
 
-		TORRENT_ASSERT(bool(m_disk_recv_buffer) == (m_disk_recv_buffer_size > 0));
+		m_recv_buffer.check_invariant();
 
 		for (int i = 0; i < 2; ++i)
 		{
@@ -6744,11 +7078,11 @@ namespace libtorrent
 						std::find(m_download_queue.begin(), m_download_queue.end()
 						, piece_block(i->index, j)) != m_download_queue.end())
 					{
-						TORRENT_ASSERT(i->info[j].peer == m_remote);
+						TORRENT_ASSERT(p.block_peer(i->info[j]) == m_remote);
 					}
 					else
 					{
-						TORRENT_ASSERT(i->info[j].peer != m_remote || i->info[j].finished);
+						TORRENT_ASSERT(p.block_peer(i->info[j]) != m_remote || i->info[j].finished);
 					}
 				}
 			}
@@ -43,11 +43,12 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/random.hpp"
 #include "libtorrent/alloca.hpp"
 #include "libtorrent/performance_counters.hpp" // for counters
+#include "libtorrent/byteswap.hpp"
+#include "libtorrent/torrent_peer.hpp"
 
 #if TORRENT_USE_ASSERTS
 #include "libtorrent/peer_connection.hpp"
 #include "libtorrent/torrent.hpp"
-#include "libtorrent/torrent_peer.hpp"
 #endif
 
 #ifdef TORRENT_USE_VALGRIND
@@ -56,6 +57,16 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/invariant_check.hpp"
 
+// SSE2 is part of the x86-64 baseline, on 32 bit x86 it has to be enabled
+// explicitly
+#if defined __SSE2__ || defined _M_X64 || defined _M_AMD64 \
+	|| (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define TORRENT_PICKER_SSE2 1
+#include <emmintrin.h>
+#else
+#define TORRENT_PICKER_SSE2 0
+#endif
+
 #define TORRENT_PIECE_PICKER_INVARIANT_CHECK INVARIANT_CHECK
 //#define TORRENT_NO_EXPENSIVE_INVARIANT_CHECK
 //#define TORRENT_PIECE_PICKER_INVARIANT_CHECK
@@ -65,10 +76,63 @@ namespace libtorrent
 
 	const piece_block piece_block::invalid(0x7FFFF, 0x1FFF);
 
+	namespace
+	{
+		// v may not be 0. Bit 31 is bit 0 in the bitfield
+		int count_leading_zeros(boost::uint32_t v)
+		{
+			TORRENT_ASSERT(v != 0);
+#if defined __GNUC__
+			return __builtin_clz(v);
+#elif defined _MSC_VER
+			unsigned long index;
+			_BitScanReverse(&index, v);
+			return 31 - index;
+#else
+			int ret = 0;
+			while ((v & 0x80000000) == 0) { v <<= 1; ++ret; }
+			return ret;
+#endif
+		}
+
+		int count_trailing_zeros(boost::uint32_t v)
+		{
+			TORRENT_ASSERT(v != 0);
+#if defined __GNUC__
+			return __builtin_ctz(v);
+#elif defined _MSC_VER
+			unsigned long index;
+			_BitScanForward(&index, v);
+			return index;
+#else
+			int ret = 0;
+			while ((v & 1) == 0) { v >>= 1; ++ret; }
+			return ret;
+#endif
+		}
+
+		// returns true if the 4 words starting at a and b have no bits set
+		// in common
+		bool none_common4(boost::uint32_t const* a, boost::uint32_t const* b)
+		{
+#if TORRENT_PICKER_SSE2
+			__m128i const v = _mm_and_si128(
+				_mm_loadu_si128(reinterpret_cast<__m128i const*>(a))
+				, _mm_loadu_si128(reinterpret_cast<__m128i const*>(b)));
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) == 0xffff;
+#else
+			return ((a[0] & b[0]) | (a[1] & b[1])
+				| (a[2] & b[2]) | (a[3] & b[3])) == 0;
+#endif
+		}
+	}
+
 	piece_picker::piece_picker()
 		: m_seeds(0)
+		, m_availability(1, 0)
 		, m_num_passed(0)
 		, m_priority_boundries(1, int(m_pieces.size()))
+		, m_block_peers(1, block_peer_entry(0))
 		, m_blocks_per_piece(0)
 		, m_blocks_in_last_piece(0)
 		, m_num_filtered(0)
@@ -105,6 +169,9 @@ namespace libtorrent
 		for (int i = 0; i < num_download_categories; ++i)
 			m_downloads[i].clear();
 		m_block_info.clear();
+		m_free_block_infos.clear();
+		m_block_peers.assign(1, block_peer_entry(0));
+		m_free_block_peers.clear();
 
 		m_num_filtered += m_num_have_filtered;
 		m_num_have_filtered = 0;
@@ -121,6 +188,12 @@ namespace libtorrent
 			i->have_peers.clear();
 #endif
 		}
+		m_availability.assign(1, total_num_pieces);
+
+		m_free_pieces.resize(total_num_pieces);
+		m_open_pieces.resize(total_num_pieces);
+		for (int i = 0; i < total_num_pieces; ++i)
+			update_pick_state(i);
 
 		for (std::vector<piece_pos>::iterator i = m_piece_map.begin() + m_cursor
 			, end(m_piece_map.end()); i != end && (i->have() || i->filtered());
@@ -177,12 +250,19 @@ namespace libtorrent
 		check_piece_state();
 #endif
 
-		int num_downloads = 0;
-		for (int k = 0; k < num_download_categories; ++k) num_downloads += m_downloads[k].size();
-
-		int block_index = num_downloads * m_blocks_per_piece;
-		if (int(m_block_info.size()) < block_index + m_blocks_per_piece)
+		// reuse the block_info slot of a piece that's no longer downloading
+		// if there is one, otherwise allocate a new one at the end
+		int block_index;
+		if (!m_free_block_infos.empty())
+		{
+			block_index = m_free_block_infos.back() * m_blocks_per_piece;
+			m_free_block_infos.pop_back();
+		}
+		else
 		{
+			block_index = int(m_block_info.size());
+			TORRENT_ASSERT(block_index % m_blocks_per_piece == 0);
+
 			block_info* base = NULL;
 			if (!m_block_info.empty()) base = &m_block_info[0];
 			m_block_info.resize(block_index + m_blocks_per_piece);
@@ -203,9 +283,6 @@ namespace libtorrent
 		// always insert into bucket 0 (piece_downloading)
 		downloading_piece ret;
 		ret.index = piece;
-		std::vector<downloading_piece>::iterator i = std::lower_bound(m_downloads[0].begin()
-			, m_downloads[0].end(), ret);
-		TORRENT_ASSERT(i == m_downloads[0].end() || i->index != piece);
 		ret.info = &m_block_info[block_index];
 		TORRENT_ASSERT(ret.info >= &m_block_info[0]);
 		TORRENT_ASSERT(ret.info < &m_block_info[0] + m_block_info.size());
@@ -217,7 +294,8 @@ namespace libtorrent
 		{
 			ret.info[i].num_peers = 0;
 			ret.info[i].state = block_info::state_none;
-			ret.info[i].peer = 0;
+			// the blocks of a free slot don't refer to any peer
+			TORRENT_ASSERT(ret.info[i].peer == 0);
 #ifdef TORRENT_USE_VALGRIND
 			VALGRIND_CHECK_VALUE_IS_DEFINED(ret.info[i].peer);
 #endif
@@ -230,12 +308,13 @@ namespace libtorrent
 		VALGRIND_CHECK_VALUE_IS_DEFINED(ret.info);
 		VALGRIND_CHECK_VALUE_IS_DEFINED(ret.index);
 #endif
-		i = m_downloads[0].insert(i, ret);
+		m_piece_map[piece].download_index = m_downloads[0].size();
+		m_downloads[0].push_back(ret);
 
 #if TORRENT_USE_INVARIANT_CHECKS
 		check_piece_state();
 #endif
-		return i;
+		return m_downloads[0].end() - 1;
 	}
 
 	void piece_picker::erase_download_piece(std::vector<downloading_piece>::iterator i)
@@ -252,38 +331,87 @@ namespace libtorrent
 		int prev_size = m_downloads[queue].size();
 #endif
 
-		int total_downloading_pieces = 0;
-		for (int k = 0; k < num_download_categories; ++k) total_downloading_pieces += m_downloads[k].size();
+		// return the block_info slot to the free list, releasing the peers
+		// its blocks refer to
+		TORRENT_ASSERT((i->info - &m_block_info[0]) % m_blocks_per_piece == 0);
+		for (int k = 0; k < m_blocks_per_piece; ++k)
+			set_block_peer(i->info[k], 0);
+		m_free_block_infos.push_back((i->info - &m_block_info[0]) / m_blocks_per_piece);
 
-		std::vector<downloading_piece>::iterator other;
-		bool found = false;
-		for (int k = 0; k < num_download_categories; ++k)
+		int const index = i->index;
+		remove_dl_piece(queue, i);
+		m_piece_map[index].state = piece_pos::piece_open;
+		update_pick_state(index);
+
+		TORRENT_ASSERT(prev_size == m_downloads[queue].size() + 1);
+
+#if TORRENT_USE_INVARIANT_CHECKS
+		check_piece_state();
+#endif
+	}
+
+	void piece_picker::set_block_peer(block_info& info, void* peer)
+	{
+		TORRENT_ASSERT(info.peer < m_block_peers.size());
+		if (m_block_peers[info.peer].peer == peer) return;
+
+		if (info.peer != 0)
 		{
-			other = std::find_if(
-				m_downloads[k].begin(), m_downloads[k].end()
-				, boost::bind(&downloading_piece::info, _1)
-			== &m_block_info[(total_downloading_pieces - 1) * m_blocks_per_piece]);
-			if (other != m_downloads[k].end())
+			block_peer_entry& e = m_block_peers[info.peer];
+			TORRENT_ASSERT(e.refs > 0);
+			if (--e.refs == 0)
 			{
-				found = true;
-				break;
+				e.peer = 0;
+				m_free_block_peers.push_back(info.peer);
 			}
+			info.peer = 0;
 		}
-		TORRENT_ASSERT(found);
 
-		if (found && i->index != other->index)
+		if (peer == 0) return;
+
+		// the slot stored in the torrent_peer may be stale (from a
+		// previous piece picker, or freed and taken by another peer),
+		// so it's only used if the entry still refers back to this peer
+		torrent_peer* tp = static_cast<torrent_peer*>(peer);
+		int index = find_block_peer(tp);
+		if (index == 0)
 		{
-			std::copy(other->info, other->info + m_blocks_per_piece, i->info);
-			other->info = i->info;
+			if (!m_free_block_peers.empty())
+			{
+				index = m_free_block_peers.back();
+				m_free_block_peers.pop_back();
+				m_block_peers[index].peer = peer;
+			}
+			else if (int(m_block_peers.size()) <= max_block_peers)
+			{
+				index = int(m_block_peers.size());
+				m_block_peers.push_back(block_peer_entry(peer));
+			}
+			else
+			{
+				// every entry is referenced by some block, and
+				// block_info::peer can't index any more. The block is
+				// recorded without a peer, just like blocks downloaded in
+				// a previous session. It still downloads normally, it
+				// just won't be attributed to (or cleared with) this peer
+#ifdef TORRENT_PICKER_LOG
+				std::cerr << "[" << this << "] " << "block peer table full" << std::endl;
+#endif
+				return;
+			}
+			tp->picker_slot = index;
 		}
-		m_piece_map[i->index].state = piece_pos::piece_open;
-		m_downloads[queue].erase(i);
-
-		TORRENT_ASSERT(prev_size == m_downloads[queue].size() + 1);
+		info.peer = index;
+		++m_block_peers[index].refs;
+	}
 
-#if TORRENT_USE_INVARIANT_CHECKS
-		check_piece_state();
-#endif
+	int piece_picker::find_block_peer(torrent_peer const* peer) const
+	{
+		int const index = peer->picker_slot;
+		if (index == 0 || index >= int(m_block_peers.size())) return 0;
+		if (m_block_peers[index].peer != peer) return 0;
+		TORRENT_ASSERT(m_block_peers[index].refs > 0);
+		return index;
 	}
 
 	std::vector<piece_picker::downloading_piece> piece_picker::get_download_queue() const
@@ -324,20 +452,20 @@ namespace libtorrent
 			if (!m_downloads[k].empty())
 			{
 				for (std::vector<downloading_piece>::const_iterator i = m_downloads[k].begin();
-						i != m_downloads[k].end() - 1; ++i)
+						i != m_downloads[k].end(); ++i)
 				{
 					downloading_piece const& dp = *i;
-					downloading_piece const& next = *(i + 1);
-//					TORRENT_ASSERT(dp.finished + dp.writing >= next.finished + next.writing);
-					TORRENT_ASSERT(dp.index < next.index);
+					TORRENT_ASSERT(m_piece_map[dp.index].state == k + 1);
+					TORRENT_ASSERT(int(m_piece_map[dp.index].download_index)
+						== i - m_downloads[k].begin());
 					TORRENT_ASSERT(dp.info >= &m_block_info[0]);
 					TORRENT_ASSERT(dp.info < &m_block_info[0] + m_block_info.size());
 					TORRENT_ASSERT((dp.info - &m_block_info[0]) % m_blocks_per_piece == 0);
 					for (int k = 0; k < m_blocks_per_piece; ++k)
 					{
-						if (dp.info[k].peer)
+						if (block_peer(dp.info[k]))
 						{
-							torrent_peer* p = (torrent_peer*)dp.info[k].peer;
+							torrent_peer* p = (torrent_peer*)block_peer(dp.info[k]);
 							TORRENT_ASSERT(p->in_use);
 							TORRENT_ASSERT(p->connection == NULL || static_cast<peer_connection*>(p->connection)->m_in_use);
 						}
@@ -438,26 +566,54 @@ namespace libtorrent
 		TORRENT_ASSERT(m_num_filtered >= 0);
 		TORRENT_ASSERT(m_seeds >= 0);
 
+		// every entry in the block peer table is referenced by exactly
+		// as many blocks as its reference count says
+		{
+			std::vector<int> refs(m_block_peers.size(), 0);
+			for (std::vector<block_info>::const_iterator i = m_block_info.begin()
+				, end(m_block_info.end()); i != end; ++i)
+			{
+				TORRENT_ASSERT(i->peer < m_block_peers.size());
+				++refs[i->peer];
+			}
+			TORRENT_ASSERT(m_block_peers[0].peer == 0);
+			int num_used = 0;
+			for (int i = 1; i < int(m_block_peers.size()); ++i)
+			{
+				TORRENT_ASSERT(m_block_peers[i].refs == refs[i]);
+				if (refs[i] == 0)
+				{
+					TORRENT_ASSERT(m_block_peers[i].peer == 0);
+					continue;
+				}
+				++num_used;
+				TORRENT_ASSERT(find_block_peer(static_cast<torrent_peer*>(
+					m_block_peers[i].peer)) == i);
+			}
+			TORRENT_ASSERT(num_used + int(m_free_block_peers.size())
+				== int(m_block_peers.size()) - 1);
+		}
+
 		for (int k = 0; k < num_download_categories; ++k)
 		{
 			if (!m_downloads[k].empty())
 			{
 				for (std::vector<downloading_piece>::const_iterator i = m_downloads[k].begin();
-						i != m_downloads[k].end() - 1; ++i)
+						i != m_downloads[k].end(); ++i)
 				{
 					downloading_piece const& dp = *i;
-					downloading_piece const& next = *(i + 1);
-//					TORRENT_ASSERT(dp.finished + dp.writing >= next.finished + next.writing);
-					TORRENT_ASSERT(dp.index < next.index);
+					TORRENT_ASSERT(m_piece_map[dp.index].state == k + 1);
+					TORRENT_ASSERT(int(m_piece_map[dp.index].download_index)
+						== i - m_downloads[k].begin());
 					TORRENT_ASSERT(dp.info >= &m_block_info[0]);
 					TORRENT_ASSERT(dp.info < &m_block_info[0] + m_block_info.size());
 					TORRENT_ASSERT((dp.info - &m_block_info[0]) % m_blocks_per_piece == 0);
 #if TORRENT_USE_ASSERTS
 					for (int k = 0; k < m_blocks_per_piece; ++k)
 					{
-						if (dp.info[k].peer)
+						if (block_peer(dp.info[k]))
 						{
-							torrent_peer* p = (torrent_peer*)dp.info[k].peer;
+							torrent_peer* p = (torrent_peer*)block_peer(dp.info[k]);
 							TORRENT_ASSERT(p->in_use);
 							TORRENT_ASSERT(p->connection == NULL
 								|| static_cast<peer_connection*>(p->connection)->m_in_use);
@@ -486,7 +642,7 @@ namespace libtorrent
 				for (int k = 0; k < num_blocks; ++k)
 				{
 					TORRENT_ASSERT(i->info[k].piece_index == i->index);
-					TORRENT_ASSERT(i->info[k].peer == 0 || static_cast<torrent_peer*>(i->info[k].peer)->in_use);
+					TORRENT_ASSERT(i->info[k].peer == 0 || static_cast<torrent_peer*>(block_peer(i->info[k]))->in_use);
 					if (i->info[k].state == block_info::state_finished)
 					{
 						++num_finished;
@@ -591,12 +747,17 @@ namespace libtorrent
 		int num_filtered = 0;
 		int num_have_filtered = 0;
 		int num_have = 0;
+		std::vector<int> availability(m_availability.size(), 0);
 		for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin();
 			i != m_piece_map.end(); ++i)
 		{
 			int index = static_cast<int>(i - m_piece_map.begin());
 			piece_pos const& p = *i;
 
+			TORRENT_ASSERT(m_free_pieces[index] == (!p.have() && !p.filtered()));
+			TORRENT_ASSERT(m_open_pieces[index] == (!p.have() && !p.filtered()
+				&& !p.downloading()));
+
 			if (p.filtered())
 			{
 				if (p.index != piece_pos::we_have_index)
@@ -611,6 +772,10 @@ namespace libtorrent
 			if (p.index == piece_pos::we_have_index)
 				++num_have;
 
+			int const avail = int(p.peer_count) + p.have();
+			TORRENT_ASSERT(avail < int(availability.size()));
+			++availability[avail];
+
 #if 0
 			if (t != 0)
 			{
@@ -707,6 +872,7 @@ namespace libtorrent
 		TORRENT_ASSERT(num_have == m_num_have);
 		TORRENT_ASSERT(num_filtered == m_num_filtered);
 		TORRENT_ASSERT(num_have_filtered == m_num_have_filtered);
+		TORRENT_ASSERT(availability == m_availability);
 
 		if (!m_dirty)
 		{
@@ -725,35 +891,13 @@ namespace libtorrent
 		const int num_pieces = m_piece_map.size();
 
 		if (num_pieces == 0) return std::make_pair(1, 0);
-		int min_availability = piece_pos::max_peer_count;
-		// find the lowest availability count
-		// count the number of pieces that have that availability
-		// and also the number of pieces that have more than that.
-		int integer_part = 0;
-		int fraction_part = 0;
-		for (std::vector<piece_pos>::const_iterator i = m_piece_map.begin()
-			, end(m_piece_map.end()); i != end; ++i)
-		{
-			int peer_count = int(i->peer_count);
-			// take ourself into account
-			if (i->have()) ++peer_count;
-			if (min_availability > peer_count)
-			{
-				min_availability = peer_count;
-				fraction_part += integer_part;
-				integer_part = 1;
-			}
-			else if (peer_count == min_availability)
-			{
-				++integer_part;
-			}
-			else
-			{
-				TORRENT_ASSERT(peer_count > min_availability);
-				++fraction_part;
-			}
-		}
-		TORRENT_ASSERT(integer_part + fraction_part == num_pieces);
+		// find the lowest availability count (m_availability already takes
+		// ourself into account). The pieces that have that availability
+		// make up the integer part, the ones with higher availability the
+		// fraction
+		int min_availability = 0;
+		while (m_availability[min_availability] == 0) ++min_availability;
+		int const fraction_part = num_pieces - m_availability[min_availability];
 		return std::make_pair(min_availability + m_seeds, fraction_part * 1000 / num_pieces);
 	}
 
@@ -1083,11 +1227,12 @@ namespace libtorrent
 #endif
 
 		++m_seeds;
-		if (m_seeds == 1)
+		if (m_seeds == 1 && m_availability[0] > 0)
 		{
 			// when m_seeds is increased from 0 to 1
 			// we may have to add pieces that previously
-			// didn't have any peers
+			// didn't have any peers. If there aren't any
+			// such pieces, no piece changes priority
 			m_dirty = true;
 		}
 #ifdef TORRENT_DEBUG_REFCOUNTS
@@ -1109,7 +1254,7 @@ namespace libtorrent
 		if (m_seeds > 0)
 		{
 			--m_seeds;
-			if (m_seeds == 0)
+			if (m_seeds == 0 && m_availability[0] > 0)
 			{
 				// when m_seeds is decreased from 1 to 0
 				// we may have to remove pieces that previously
@@ -1140,6 +1285,11 @@ namespace libtorrent
 			--i->peer_count;
 		}
 
+		// every piece lost one peer, shift the histogram down one step
+		TORRENT_ASSERT(m_availability[0] == 0);
+		m_availability.erase(m_availability.begin());
+		if (m_availability.empty()) m_availability.push_back(0);
+
 		m_dirty = true;
 	}
 
@@ -1153,7 +1303,7 @@ namespace libtorrent
 		std::cerr << "[" << this << "] " << "inc_refcount(" << index << ")" << std::endl;
 #endif
 		piece_pos& p = m_piece_map[index];
-	
+
 #ifdef TORRENT_DEBUG_REFCOUNTS
 		TORRENT_ASSERT(p.have_peers.count(peer) == 0);
 		p.have_peers.insert(peer);
@@ -1161,6 +1311,8 @@ namespace libtorrent
 
 		int prev_priority = p.priority(this);
 		++p.peer_count;
+		int const availability = int(p.peer_count) + p.have();
+		move_availability(availability - 1, availability);
 		if (m_dirty) return;
 		int new_priority = p.priority(this);
 		if (prev_priority == new_priority) return;
@@ -1170,6 +1322,18 @@ namespace libtorrent
 			update(prev_priority, p.index);
 	}
 
+	void piece_picker::move_availability(int from, int to)
+	{
+		TORRENT_ASSERT(from >= 0);
+		TORRENT_ASSERT(to >= 0);
+		TORRENT_ASSERT(from < int(m_availability.size()));
+		TORRENT_ASSERT(m_availability[from] > 0);
+		--m_availability[from];
+		if (to >= int(m_availability.size()))
+			m_availability.resize(to + 1, 0);
+		++m_availability[to];
+	}
+
 	// this function decrements the m_seeds counter
 	// and increments the peer counter on every piece
 	// instead. Sometimes of we connect to a seed that
@@ -1189,6 +1353,9 @@ namespace libtorrent
 			++i->peer_count;
 		}
 
+		// every piece gained one peer, shift the histogram up one step
+		m_availability.insert(m_availability.begin(), 0);
+
 		m_dirty = true;
 	}
 
@@ -1223,6 +1390,8 @@ namespace libtorrent
 
 		TORRENT_ASSERT(p.peer_count > 0);
 		--p.peer_count;
+		int const availability = int(p.peer_count) + p.have();
+		move_availability(availability + 1, availability);
 		if (m_dirty) return;
 		if (prev_priority >= 0) update(prev_priority, p.index);
 	}
@@ -1232,6 +1401,7 @@ namespace libtorrent
 #ifdef TORRENT_EXPENSIVE_INVARIANT_CHECKS
 		TORRENT_PIECE_PICKER_INVARIANT_CHECK;
 #endif
+		TORRENT_ASSERT(bitmask.size() <= int(m_piece_map.size()));
 
 #ifdef TORRENT_PICKER_LOG
 		std::cerr << "[" << this << "] " << "inc_refcount(bitfield)" << std::endl;
@@ -1246,77 +1416,39 @@ namespace libtorrent
 			return;
 		}
 
-		const int size = (std::min)(50, int(bitmask.size()/2));
-
-		// this is an optimization where if just a few
-		// pieces end up changing, instead of making
-		// the piece list dirty, just update those pieces
-		// instead
-		int* incremented = TORRENT_ALLOCA(int, size);
-		int num_inc = 0;
-
-		if (!m_dirty)
+		// the pieces the peer has are visited a word at a time, and each one
+		// is moved to its new priority bucket right away (unless the piece
+		// list already needs a rebuild). This costs time proportional to the
+		// number of pieces the peer has, rather than making the next pick
+		// rebuild and shuffle the whole piece list. The bitfield is stored
+		// as 32 bit words in network byte order with the trailing bits cleared
+		boost::uint32_t const* words = reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+		int const num_words = bitmask.num_words();
+		for (int w = 0; w < num_words; ++w)
 		{
-			// first count how many pieces we're updating. If it's few (less than half)
-			// we'll just update them one at a time. Othewise we'll just update the counters
-			// and mark the picker as dirty, so we'll rebuild it next time we need it.
-			// this only matters if we're not already dirty, in which case the fasted
-			// thing to do is to just update the counters and be done
-			int index = 0;
-			for (bitfield::const_iterator i = bitmask.begin()
-				, end(bitmask.end()); i != end; ++i, ++index)
-			{
-				if (!*i) continue;
-				if (num_inc < size) incremented[num_inc] = index;
-				++num_inc;
-				if (num_inc >= size) break;
-			}
-
-			if (num_inc < size)
+			boost::uint32_t v = ntohl(words[w]);
+			while (v != 0)
 			{
-				// not that many pieces were updated
-				// just update those individually instead of
-				// rebuilding the whole piece list
-				for (int i = 0; i < num_inc; ++i)
-				{
-					int piece = incremented[i];
-					piece_pos& p = m_piece_map[piece];
-					int prev_priority = p.priority(this);
-					++p.peer_count;
-#ifdef TORRENT_DEBUG_REFCOUNTS
-					TORRENT_ASSERT(p.have_peers.count(peer) == 0);
-					p.have_peers.insert(peer);
-#endif
-					int new_priority = p.priority(this);
-					if (prev_priority == new_priority) continue;
-					else if (prev_priority >= 0) update(prev_priority, p.index);
-					else add(piece);
-				}
-				return;
-			}
-		}
+				int const bit = count_leading_zeros(v);
+				v &= ~(0x80000000 >> bit);
+				int const index = w * 32 + bit;
 
-		int index = 0;
-		bool updated = false;
-		for (bitfield::const_iterator i = bitmask.begin()
-			, end(bitmask.end()); i != end; ++i, ++index)
-		{
-			if (*i)
-			{
+				piece_pos& p = m_piece_map[index];
 #ifdef TORRENT_DEBUG_REFCOUNTS
-				TORRENT_ASSERT(m_piece_map[index].have_peers.count(peer) == 0);
-				m_piece_map[index].have_peers.insert(peer);
-#endif
-
-				++m_piece_map[index].peer_count;
-				updated = true;
+				TORRENT_ASSERT(p.have_peers.count(peer) == 0);
+				p.have_peers.insert(peer);
+#endif
+				int const prev_priority = m_dirty ? -1 : p.priority(this);
+				++p.peer_count;
+				int const availability = int(p.peer_count) + p.have();
+				move_availability(availability - 1, availability);
+				if (m_dirty) continue;
+				int const new_priority = p.priority(this);
+				if (prev_priority == new_priority) continue;
+				else if (prev_priority >= 0) update(prev_priority, p.index);
+				else add(index);
 			}
 		}
-
-		// if we're already dirty, no point in doing anything more
-		if (m_dirty) return;
-
-		if (updated) m_dirty = true;
 	}
 
 	void piece_picker::dec_refcount(bitfield const& bitmask, const void* peer)
@@ -1339,72 +1471,18 @@ namespace libtorrent
 			return;
 		}
 
-		const int size = (std::min)(50, int(bitmask.size()/2));
-
-		// this is an optimization where if just a few
-		// pieces end up changing, instead of making
-		// the piece list dirty, just update those pieces
-		// instead
-		int* decremented = TORRENT_ALLOCA(int, size);
-		int num_dec = 0;
-
-		if (!m_dirty)
+		// see inc_refcount(bitfield)
+		boost::uint32_t const* words = reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+		int const num_words = bitmask.num_words();
+		for (int w = 0; w < num_words; ++w)
 		{
-			// first count how many pieces we're updating. If it's few (less than half)
-			// we'll just update them one at a time. Othewise we'll just update the counters
-			// and mark the picker as dirty, so we'll rebuild it next time we need it.
-			// this only matters if we're not already dirty, in which case the fasted
-			// thing to do is to just update the counters and be done
-			int index = 0;
-			for (bitfield::const_iterator i = bitmask.begin()
-				, end(bitmask.end()); i != end; ++i, ++index)
+			boost::uint32_t v = ntohl(words[w]);
+			while (v != 0)
 			{
-				if (!*i) continue;
-				if (num_dec < size) decremented[num_dec] = index;
-				++num_dec;
-				if (num_dec >= size) break;
-			}
-
-			if (num_dec < size)
-			{
-				// not that many pieces were updated
-				// just update those individually instead of
-				// rebuilding the whole piece list
-				for (int i = 0; i < num_dec; ++i)
-				{
-					int piece = decremented[i];
-					piece_pos& p = m_piece_map[piece];
-					int prev_priority = p.priority(this);
-
-					if (p.peer_count == 0)
-					{
-						TORRENT_ASSERT(m_seeds > 0);
-						// this is the case where we have one or more
-						// seeds, and one of them saying: I don't have this
-						// piece anymore. we need to break up one of the seed
-						// counters into actual peer counters on the pieces
-						break_one_seed();
-					}
+				int const bit = count_leading_zeros(v);
+				v &= ~(0x80000000 >> bit);
+				int const index = w * 32 + bit;
 
-#ifdef TORRENT_DEBUG_REFCOUNTS
-					TORRENT_ASSERT(p.have_peers.count(peer) == 1);
-					p.have_peers.erase(peer);
-#endif
-					TORRENT_ASSERT(p.peer_count > 0);
-					--p.peer_count;
-					if (!m_dirty && prev_priority >= 0) update(prev_priority, p.index);
-				}
-				return;
-			}
-		}
-
-		int index = 0;
-		bool updated = false;
-		for (bitfield::const_iterator i = bitmask.begin()
-			, end(bitmask.end()); i != end; ++i, ++index)
-		{
-			if (*i)
-			{
 				piece_pos& p = m_piece_map[index];
 				if (p.peer_count == 0)
 				{
@@ -1420,17 +1498,14 @@ namespace libtorrent
 				TORRENT_ASSERT(p.have_peers.count(peer) == 1);
 				p.have_peers.erase(peer);
 #endif
-
+				int const prev_priority = m_dirty ? -1 : p.priority(this);
 				TORRENT_ASSERT(p.peer_count > 0);
 				--p.peer_count;
-				updated = true;
+				int const availability = int(p.peer_count) + p.have();
+				move_availability(availability + 1, availability);
+				if (!m_dirty && prev_priority >= 0) update(prev_priority, p.index);
 			}
 		}
-
-		// if we're already dirty, no point in doing anything more
-		if (m_dirty) return;
-
-		if (updated) m_dirty = true;
 	}
 
 	void piece_picker::update_pieces() const
@@ -1577,6 +1652,8 @@ namespace libtorrent
 
 		--m_num_have;
 		p.set_not_have();
+		move_availability(int(p.peer_count) + 1, int(p.peer_count));
+		update_pick_state(index);
 
 		if (m_dirty) return;
 		if (p.priority(this) >= 0) add(index);
@@ -1644,6 +1721,8 @@ namespace libtorrent
 		++m_num_have;
 		++m_num_passed;
 		p.set_have();
+		move_availability(int(p.peer_count), int(p.peer_count) + 1);
+		update_pick_state(index);
 		if (m_cursor == m_reverse_cursor - 1 &&
 			m_cursor == index)
 		{
@@ -1765,6 +1844,7 @@ namespace libtorrent
 		TORRENT_ASSERT(m_num_have_filtered >= 0);
 		
 		p.piece_priority = new_piece_priority;
+		update_pick_state(index);
 		int new_priority = p.priority(this);
 
 		if (p.state > 0)
@@ -1991,7 +2071,10 @@ namespace libtorrent
 			for (std::vector<int>::const_iterator i = m_pieces.begin();
 				i != m_pieces.end() && piece_priority(*i) == 7; ++i)
 			{
-				if (!is_piece_free(*i, pieces)) continue;
+				// m_pieces only holds pieces we don't have and that aren't
+				// filtered, the peer having it is all that's left to check
+				if (!pieces[*i]) continue;
+				TORRENT_ASSERT(is_piece_free(*i, pieces));
 				num_blocks = add_blocks(*i, pieces
 					, interesting_blocks, backup_blocks
 					, backup_blocks2, num_blocks
@@ -2005,10 +2088,11 @@ namespace libtorrent
 			{
 				if (options & reverse)
 				{
-					for (int i = m_reverse_cursor - 1; i >= m_cursor; --i)
-					{	
+					for (int i = find_last_piece(m_free_pieces, pieces, m_cursor, m_reverse_cursor);
+						i >= m_cursor; i = find_last_piece(m_free_pieces, pieces, m_cursor, i))
+					{
 						pc.inc_stats_counter(counters::piece_picker_sequential_loops);
-						if (!is_piece_free(i, pieces)) continue;
+						TORRENT_ASSERT(is_piece_free(i, pieces));
 						// we've already added prio 7 pieces
 						if (piece_priority(i) == 7) continue;
 						num_blocks = add_blocks(i, pieces
@@ -2021,10 +2105,11 @@ namespace libtorrent
 				}
 				else
 				{
-					for (int i = m_cursor; i < m_reverse_cursor; ++i)
+					for (int i = find_first_piece(m_free_pieces, pieces, m_cursor, m_reverse_cursor);
+						i < m_reverse_cursor; i = find_first_piece(m_free_pieces, pieces, i + 1, m_reverse_cursor))
 					{
 						pc.inc_stats_counter(counters::piece_picker_sequential_loops);
-						if (!is_piece_free(i, pieces)) continue;
+						TORRENT_ASSERT(is_piece_free(i, pieces));
 						// we've already added prio 7 pieces
 						if (piece_priority(i) == 7) continue;
 						num_blocks = add_blocks(i, pieces
@@ -2069,7 +2154,8 @@ namespace libtorrent
 					{
 						pc.inc_stats_counter(counters::piece_picker_reverse_rare_loops);
 
-						if (!is_piece_free(m_pieces[p], pieces)) continue;
+						if (!pieces[m_pieces[p]]) continue;
+						TORRENT_ASSERT(is_piece_free(m_pieces[p], pieces));
 						num_blocks = add_blocks(m_pieces[p], pieces
 							, interesting_blocks, backup_blocks
 							, backup_blocks2, num_blocks
@@ -2094,7 +2180,8 @@ namespace libtorrent
 					if ((options & time_critical_mode) && piece_priority(*i) != 7)
 						break;
 
-					if (!is_piece_free(*i, pieces)) continue;
+					if (!pieces[*i]) continue;
+					TORRENT_ASSERT(is_piece_free(*i, pieces));
 
 					num_blocks = add_blocks(*i, pieces
 						, interesting_blocks, backup_blocks
@@ -2112,7 +2199,8 @@ namespace libtorrent
 			for (std::vector<int>::const_iterator i = m_pieces.begin();
 				i != m_pieces.end() && piece_priority(*i) == 7; ++i)
 			{
-				if (!is_piece_free(*i, pieces)) continue;
+				if (!pieces[*i]) continue;
+				TORRENT_ASSERT(is_piece_free(*i, pieces));
 				num_blocks = add_blocks(*i, pieces
 					, interesting_blocks, backup_blocks
 					, backup_blocks2, num_blocks
@@ -2129,22 +2217,44 @@ namespace libtorrent
 			// pieces are)
 			int start_piece = random() % m_piece_map.size();
 
+			int const num_pieces = int(m_piece_map.size());
 			int piece = start_piece;
+			// the number of pieces, starting at piece and wrapping around at
+			// the end, that are left to look at
+			int left = num_pieces;
 			while (num_blocks > 0)
 			{
 				bool done = false;
 				// skip pieces we can't pick, and suggested pieces
 				// since we've already picked those
-				while (!can_pick(piece, pieces)
-					|| std::find(suggested_pieces.begin()
-						, suggested_pieces.end(), piece)
-						!= suggested_pieces.end())
+				for (;;)
 				{
 					pc.inc_stats_counter(counters::piece_picker_rand_start_loops);
+					int const stop = (std::min)(num_pieces, piece + left);
+					int next = find_first_piece(m_open_pieces, pieces, piece, stop);
+					if (next == stop && piece + left > num_pieces)
+					{
+						// wrap around to the start of the torrent
+						left -= num_pieces - piece;
+						piece = 0;
+						next = find_first_piece(m_open_pieces, pieces, 0, left);
+						if (next == left) next = stop;
+					}
+					// could not find any more pieces
+					if (next == stop) { done = true; break; }
+
+					left -= next - piece;
+					piece = next;
+
+					if (std::find(suggested_pieces.begin()
+						, suggested_pieces.end(), piece)
+						== suggested_pieces.end()) break;
+
 					++piece;
-					if (piece == int(m_piece_map.size())) piece = 0;
+					--left;
+					if (piece == num_pieces) piece = 0;
 					// could not find any more pieces
-					if (piece == start_piece) { done = true; break; }
+					if (left == 0) { done = true; break; }
 				}
 				if (done) break;
 
@@ -2168,10 +2278,11 @@ namespace libtorrent
 						--num_blocks;
 					}
 				}
+				left -= end - piece;
 				piece = end;
-				if (piece == int(m_piece_map.size())) piece = 0;
+				if (piece == num_pieces) piece = 0;
 				// could not find any more pieces
-				if (piece == start_piece) break;
+				if (left <= 0) break;
 			}
 		}
 
@@ -2273,10 +2384,10 @@ namespace libtorrent
 			for (int j = 0; j < num_blocks_in_piece; ++j)
 			{
 				block_info const& info = dp->info[j];
-				TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(info.peer)->in_use);
+				TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(block_peer(info))->in_use);
 				TORRENT_ASSERT(info.piece_index == dp->index);
 				if (info.state != block_info::state_requested
-					|| info.peer == peer)
+					|| block_peer(info) == peer)
 					continue;
 				temp.push_back(piece_block(dp->index, j));
 			}
@@ -2362,7 +2473,7 @@ namespace libtorrent
 					block_info const& info = k->info[j];
 					TORRENT_ASSERT(info.piece_index == k->index);
 					if (info.state == block_info::state_finished) continue;
-					TORRENT_ASSERT(info.peer != 0);
+					TORRENT_ASSERT(block_peer(info) != 0);
 				}
 				*/
 			}
@@ -2394,20 +2505,95 @@ namespace libtorrent
 	bool piece_picker::is_piece_free(int piece, bitfield const& bitmask) const
 	{
 		TORRENT_ASSERT(piece >= 0 && piece < int(m_piece_map.size()));
-		return bitmask[piece]
-			&& !m_piece_map[piece].have()
-			&& !m_piece_map[piece].filtered();
+		TORRENT_ASSERT(m_free_pieces[piece] == (!m_piece_map[piece].have()
+			&& !m_piece_map[piece].filtered()));
+		return bitmask[piece] && m_free_pieces[piece];
 	}
 
 	bool piece_picker::can_pick(int piece, bitfield const& bitmask) const
 	{
 		TORRENT_ASSERT(piece >= 0 && piece < int(m_piece_map.size()));
-		return bitmask[piece]
-			&& !m_piece_map[piece].have()
-			// TODO: when expanding pieces for cache stripe reasons,
-			// the !downloading condition doesn't make much sense
+		// TODO: when expanding pieces for cache stripe reasons,
+		// the !downloading condition doesn't make much sense
+		TORRENT_ASSERT(m_open_pieces[piece] == (!m_piece_map[piece].have()
 			&& !m_piece_map[piece].downloading()
-			&& !m_piece_map[piece].filtered();
+			&& !m_piece_map[piece].filtered()));
+		return bitmask[piece] && m_open_pieces[piece];
+	}
+
+	void piece_picker::update_pick_state(int index)
+	{
+		piece_pos const& p = m_piece_map[index];
+		if (p.have() || p.filtered())
+		{
+			m_free_pieces.clear_bit(index);
+			m_open_pieces.clear_bit(index);
+			return;
+		}
+		m_free_pieces.set_bit(index);
+		if (p.downloading()) m_open_pieces.clear_bit(index);
+		else m_open_pieces.set_bit(index);
+	}
+
+	int piece_picker::find_first_piece(bitfield const& column
+		, bitfield const& bitmask, int start, int end) const
+	{
+		TORRENT_ASSERT(start >= 0);
+		TORRENT_ASSERT(end <= column.size());
+		TORRENT_ASSERT(column.size() == bitmask.size());
+		if (start >= end) return end;
+
+		// the bitfields are stored as 32 bit words in network byte order,
+		// with the trailing bits cleared
+		boost::uint32_t const* a = reinterpret_cast<boost::uint32_t const*>(column.bytes());
+		boost::uint32_t const* b = reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+
+		int word = start / 32;
+		int const last_word = (end - 1) / 32;
+
+		// mask off the bits before start in the first word
+		boost::uint32_t v = ntohl(a[word] & b[word]) & (0xffffffff >> (start & 31));
+		while (v == 0)
+		{
+			if (word == last_word) return end;
+			++word;
+			// skip ahead 128 pieces at a time over ranges where there's
+			// nothing to pick
+			while (word + 4 <= last_word && none_common4(a + word, b + word))
+				word += 4;
+			v = ntohl(a[word] & b[word]);
+		}
+		int const ret = word * 32 + count_leading_zeros(v);
+		return ret < end ? ret : end;
+	}
+
+	int piece_picker::find_last_piece(bitfield const& column
+		, bitfield const& bitmask, int start, int end) const
+	{
+		TORRENT_ASSERT(start >= 0);
+		TORRENT_ASSERT(end <= column.size());
+		TORRENT_ASSERT(column.size() == bitmask.size());
+		if (start >= end) return start - 1;
+
+		boost::uint32_t const* a = reinterpret_cast<boost::uint32_t const*>(column.bytes());
+		boost::uint32_t const* b = reinterpret_cast<boost::uint32_t const*>(bitmask.bytes());
+
+		int word = (end - 1) / 32;
+		int const first_word = start / 32;
+
+		// mask off the bits from end and on in the last word
+		boost::uint32_t v = ntohl(a[word] & b[word])
+			& (0xffffffff << (31 - ((end - 1) & 31)));
+		while (v == 0)
+		{
+			if (word == first_word) return start - 1;
+			--word;
+			while (word - 4 >= first_word && none_common4(a + word - 3, b + word - 3))
+				word -= 4;
+			v = ntohl(a[word] & b[word]);
+		}
+		int const ret = word * 32 + 31 - count_trailing_zeros(v);
+		return ret >= start ? ret : start - 1;
 	}
 
 #if TORRENT_USE_INVARIANT_CHECKS
@@ -2416,18 +2602,25 @@ namespace libtorrent
 		for (std::vector<block_info>::iterator i = m_block_info.begin()
 			, end(m_block_info.end()); i != end; ++i)
 		{
-			TORRENT_ASSERT(i->peer == 0 || static_cast<torrent_peer*>(i->peer)->in_use);
+			void* peer = block_peer(*i);
+			TORRENT_ASSERT(peer == 0 || static_cast<torrent_peer*>(peer)->in_use);
 		}
 	}
 #endif
 
 	void piece_picker::clear_peer(void* peer)
 	{
-		for (std::vector<block_info>::iterator i = m_block_info.begin()
-			, end(m_block_info.end()); i != end; ++i)
+		if (peer == 0) return;
+		int const index = find_block_peer(static_cast<torrent_peer*>(peer));
+		if (index == 0) return;
+
+		// clearing the last block referring to the peer frees its entry
+		for (std::vector<block_info>::iterator k = m_block_info.begin()
+			, end(m_block_info.end()); k != end; ++k)
 		{
-			if (i->peer == peer) i->peer = 0;
+			if (k->peer == index) set_block_peer(*k, 0);
 		}
+		TORRENT_ASSERT(m_block_peers[index].peer == 0);
 	}
 
 	namespace
@@ -2436,7 +2629,8 @@ namespace libtorrent
 		// blocks from this piece.
 		// the second bool is true if this is the only active peer that is requesting
 		// and downloading blocks from this piece. Active means having a connection.
-		boost::tuple<bool, bool> requested_from(piece_picker::downloading_piece const& p
+		boost::tuple<bool, bool> requested_from(piece_picker const& picker
+			, piece_picker::downloading_piece const& p
 			, int num_blocks_in_piece, void* peer)
 		{
 			bool exclusive = true;
@@ -2444,10 +2638,10 @@ namespace libtorrent
 			for (int j = 0; j < num_blocks_in_piece; ++j)
 			{
 				piece_picker::block_info const& info = p.info[j];
-				TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(info.peer)->in_use);
+				TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(picker.block_peer(info))->in_use);
 				TORRENT_ASSERT(info.piece_index == p.index);
 				if (info.state != piece_picker::block_info::state_none
-					&& info.peer != peer)
+					&& picker.block_peer(info) != peer)
 				{
 					exclusive = false;
 					if (info.state == piece_picker::block_info::state_requested
@@ -2557,7 +2751,7 @@ namespace libtorrent
 		bool exclusive;
 		bool exclusive_active;
 		boost::tie(exclusive, exclusive_active)
-			= requested_from(dp, num_blocks_in_piece, peer);
+			= requested_from(*this, dp, num_blocks_in_piece, peer);
 
 		// peers on parole are only allowed to pick blocks from
 		// pieces that only they have downloaded/requested from
@@ -2737,28 +2931,35 @@ namespace libtorrent
 		int queue, int index)
 	{
 		TORRENT_ASSERT(queue >= 0 && queue < num_download_categories);
-//		return std::find_if(m_downloads[queue].begin(), m_downloads[queue].end(), has_index(index));
-		downloading_piece cmp;
-		cmp.index = index;
-		std::vector<piece_picker::downloading_piece>::iterator i = std::lower_bound(
-			m_downloads[queue].begin(), m_downloads[queue].end(), cmp);
-		if (i == m_downloads[queue].end()) return i;
-		if (i->index == index) return i;
-		return m_downloads[queue].end();
+		piece_pos const& p = m_piece_map[index];
+		if (p.state != queue + 1) return m_downloads[queue].end();
+		TORRENT_ASSERT(int(p.download_index) < int(m_downloads[queue].size()));
+		TORRENT_ASSERT(m_downloads[queue][p.download_index].index == index);
+		return m_downloads[queue].begin() + p.download_index;
 	}
 
 	std::vector<piece_picker::downloading_piece>::const_iterator piece_picker::find_dl_piece(
 		int queue, int index) const
 	{
 		TORRENT_ASSERT(queue >= 0 && queue < num_download_categories);
-//		return std::find_if(m_downloads[queue].begin(), m_downloads[queue].end(), has_index(index));
-		downloading_piece cmp;
-		cmp.index = index;
-		std::vector<piece_picker::downloading_piece>::const_iterator i = std::lower_bound(
-			m_downloads[queue].begin(), m_downloads[queue].end(), cmp);
-		if (i == m_downloads[queue].end()) return i;
-		if (i->index == index) return i;
-		return m_downloads[queue].end();
+		piece_pos const& p = m_piece_map[index];
+		if (p.state != queue + 1) return m_downloads[queue].end();
+		TORRENT_ASSERT(int(p.download_index) < int(m_downloads[queue].size()));
+		TORRENT_ASSERT(m_downloads[queue][p.download_index].index == index);
+		return m_downloads[queue].begin() + p.download_index;
+	}
+
+	void piece_picker::remove_dl_piece(int queue, dlpiece_iter i)
+	{
+		TORRENT_ASSERT(queue >= 0 && queue < num_download_categories);
+		std::vector<downloading_piece>& list = m_downloads[queue];
+		TORRENT_ASSERT(i >= list.begin() && i < list.end());
+		if (i != list.end() - 1)
+		{
+			*i = list.back();
+			m_piece_map[i->index].download_index = i - list.begin();
+		}
+		list.pop_back();
 	}
 
 	std::vector<piece_picker::downloading_piece>::iterator piece_picker::update_piece_state(
@@ -2810,19 +3011,14 @@ namespace libtorrent
 		// the correct list
 		TORRENT_ASSERT(find_dl_piece(current_state - 1, dp->index) == dp);
 
-		// remove the download_piece from the list corresponding
-		// to the old state
+		// move the download_piece from the list corresponding
+		// to the old state to the end of the list corresponding
+		// to the new state
 		downloading_piece dp_info = *dp;
-		m_downloads[current_state - 1].erase(dp);
-
-		// insert the download_piece in the list corresponding to
-		// the new state
-		downloading_piece cmp;
-		cmp.index = dp_info.index;
-		std::vector<downloading_piece>::iterator i = std::lower_bound(
-			m_downloads[new_state - 1].begin(), m_downloads[new_state - 1].end(), cmp);
-		TORRENT_ASSERT(i == m_downloads[new_state - 1].end() || i->index != dp_info.index);
-		i = m_downloads[new_state - 1].insert(i, dp_info);
+		remove_dl_piece(current_state - 1, dp);
+		p.download_index = m_downloads[new_state - 1].size();
+		m_downloads[new_state - 1].push_back(dp_info);
+		std::vector<downloading_piece>::iterator i = m_downloads[new_state - 1].end() - 1;
 
 		int prio = p.priority(this);
 		p.state = new_state;
@@ -2943,6 +3139,7 @@ namespace libtorrent
 			TORRENT_ASSERT(prio < int(m_priority_boundries.size())
 				|| m_dirty);
 			p.state = piece_pos::piece_downloading;
+			update_pick_state(block.piece_index);
 			if (prio >= 0 && !m_dirty) update(prio, p.index);
 
 			dlpiece_iter dp = add_download_piece(block.piece_index);
@@ -2950,7 +3147,7 @@ namespace libtorrent
 			block_info& info = dp->info[block.block_index];
 			TORRENT_ASSERT(info.piece_index == block.piece_index);
 			info.state = block_info::state_requested;
-			info.peer = peer;
+			set_block_peer(info, peer);
 			info.num_peers = 1;
 #if TORRENT_USE_ASSERTS
 			TORRENT_ASSERT(info.peers.count(peer) == 0);
@@ -2981,7 +3178,7 @@ namespace libtorrent
 			TORRENT_ASSERT(info.state == block_info::state_none
 				|| (info.state == block_info::state_requested
 					&& (info.num_peers > 0)));
-			info.peer = peer;
+			set_block_peer(info, peer);
 			if (info.state != block_info::state_requested)
 			{
 				info.state = block_info::state_requested;
@@ -3068,6 +3265,7 @@ namespace libtorrent
 			TORRENT_ASSERT(prio < int(m_priority_boundries.size())
 				|| m_dirty);
 			p.state = piece_pos::piece_downloading;
+			update_pick_state(block.piece_index);
 			// prio being -1 can happen if a block is requested before
 			// the piece priority was set to 0
 			if (prio >= 0 && !m_dirty) update(prio, p.index);
@@ -3079,7 +3277,7 @@ namespace libtorrent
 			TORRENT_ASSERT(&info < &m_block_info[0] + m_block_info.size());
 			TORRENT_ASSERT(info.piece_index == block.piece_index);
 			info.state = block_info::state_writing;
-			info.peer = peer;
+			set_block_peer(info, peer);
 			info.num_peers = 0;
 #if TORRENT_USE_ASSERTS
 			info.peers.clear();
@@ -3098,7 +3296,7 @@ namespace libtorrent
 			TORRENT_ASSERT(&info < &m_block_info[0] + m_block_info.size());
 			TORRENT_ASSERT(info.piece_index == block.piece_index);
 
-			info.peer = peer;
+			set_block_peer(info, peer);
 			if (info.state == block_info::state_requested) --i->requested;
 			TORRENT_ASSERT(i->requested >= 0);
 			if (info.state == block_info::state_writing
@@ -3196,7 +3394,7 @@ namespace libtorrent
 		if (info.state == block_info::state_finished) return;
 		if (info.state == block_info::state_writing) --i->writing;
 
-		info.peer = 0;
+		set_block_peer(info, 0);
 		info.state = block_info::state_none;
 		if (i->passed_hash_check)
 		{
@@ -3256,7 +3454,7 @@ namespace libtorrent
 		if (info.state == block_info::state_finished) return;
 
 		TORRENT_ASSERT(info.num_peers == 0);
-		info.peer = peer;
+		set_block_peer(info, peer);
 		TORRENT_ASSERT(info.state == block_info::state_writing
 			|| peer == 0);
 		TORRENT_ASSERT(i->writing >= 0);
@@ -3306,6 +3504,7 @@ namespace libtorrent
 			TORRENT_ASSERT(prio < int(m_priority_boundries.size())
 				|| m_dirty);
 			p.state = piece_pos::piece_downloading;
+			update_pick_state(block.piece_index);
 			if (prio >= 0 && !m_dirty) update(prio, p.index);
 
 			dlpiece_iter dp = add_download_piece(block.piece_index);
@@ -3314,7 +3513,7 @@ namespace libtorrent
 			TORRENT_ASSERT(&info >= &m_block_info[0]);
 			TORRENT_ASSERT(&info < &m_block_info[0] + m_block_info.size());
 			TORRENT_ASSERT(info.piece_index == block.piece_index);
-			info.peer = peer;
+			set_block_peer(info, peer);
 			TORRENT_ASSERT(info.state == block_info::state_none);
 			TORRENT_ASSERT(info.num_peers == 0);
 			++dp->finished;
@@ -3344,7 +3543,7 @@ namespace libtorrent
 			// pointer is set to NULL. If so, preserve the previous peer
 			// pointer, instead of forgetting who we downloaded this block from
 			if (info.state != block_info::state_writing || peer != 0)
-				info.peer = peer;
+				set_block_peer(info, peer);
 
 			++i->finished;
 			if (info.state == block_info::state_writing)
@@ -3407,7 +3606,7 @@ namespace libtorrent
 		{
 			if (i->info[j].state != block_info::state_requested) continue;
 			if (i->info[j].peer == 0) continue;
-			d.push_back(i->info[j].peer);
+			d.push_back(block_peer(i->info[j]));
 		}
 	}
 
@@ -3430,8 +3629,8 @@ namespace libtorrent
 			&& i->info < &m_block_info[0] + m_block_info.size());
 		for (int j = 0, end(blocks_in_piece(index)); j != end; ++j)
 		{
-			TORRENT_ASSERT(i->info[j].peer == 0 || static_cast<torrent_peer*>(i->info[j].peer)->in_use);
-			d.push_back(i->info[j].peer);
+			TORRENT_ASSERT(i->info[j].peer == 0 || static_cast<torrent_peer*>(block_peer(i->info[j]))->in_use);
+			d.push_back(block_peer(i->info[j]));
 		}
 	}
 
@@ -3447,7 +3646,7 @@ namespace libtorrent
 		if (i->info[block.block_index].state == block_info::state_none)
 			return 0;
 
-		void* peer = i->info[block.block_index].peer;
+		void* peer = block_peer(i->info[block.block_index]);
 		TORRENT_ASSERT(peer == 0 || static_cast<torrent_peer*>(peer)->in_use);
 		return peer;
 	}
@@ -3479,7 +3678,7 @@ namespace libtorrent
 		block_info& info = i->info[block.block_index];
 		TORRENT_ASSERT(&info >= &m_block_info[0]);
 		TORRENT_ASSERT(&info < &m_block_info[0] + m_block_info.size());
-		TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(info.peer)->in_use);
+		TORRENT_ASSERT(info.peer == 0 || static_cast<torrent_peer*>(block_peer(info))->in_use);
 		TORRENT_ASSERT(info.piece_index == block.piece_index);
 
 		TORRENT_ASSERT(info.state != block_info::state_none);
@@ -3495,7 +3694,7 @@ namespace libtorrent
 #endif
 		TORRENT_ASSERT(info.num_peers > 0);
 		if (info.num_peers > 0) --info.num_peers;
-		if (info.peer == peer) info.peer = 0;
+		if (block_peer(info) == peer) set_block_peer(info, 0);
 		TORRENT_ASSERT(info.peers.size() == info.num_peers);
 
 		TORRENT_ASSERT(int(block.block_index) < blocks_in_piece(block.piece_index));
@@ -3504,7 +3703,7 @@ namespace libtorrent
 		if (info.num_peers > 0) return;
 
 		// clear the downloader of this block
-		info.peer = 0;
+		set_block_peer(info, 0);
 
 		// clear this block as being downloaded
 		info.state = block_info::state_none;
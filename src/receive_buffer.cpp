@@ -0,0 +1,437 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/receive_buffer.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/assert.hpp"
+
+#include <algorithm> // for min
+#include <cstring> // for memcpy, memmove
+
+namespace libtorrent
+{
+	namespace
+	{
+		int round_up8(int v)
+		{
+			return ((v & 7) == 0) ? v : v + (8 - (v & 7));
+		}
+	}
+
+	receive_buffer::receive_buffer(buffer_allocator_interface& allocator
+		, counters& cnt)
+		: m_counters(cnt)
+		, m_disk_recv_buffer(allocator, 0)
+		, m_spec_recv_buffer(allocator, 0)
+		, m_packet_size(0)
+		, m_soft_packet_size(0)
+		, m_recv_start(0)
+		, m_recv_pos(0)
+		, m_recv_end(0)
+		, m_disk_recv_buffer_size(0)
+		, m_spec_recv_offset(0)
+	{}
+
+	int receive_buffer::max_receive()
+	{
+		TORRENT_ASSERT(m_packet_size > 0);
+		int ret = m_packet_size - m_recv_pos;
+		TORRENT_ASSERT(ret >= 0);
+
+		if (m_recv_pos >= m_soft_packet_size) m_soft_packet_size = 0;
+		if (m_soft_packet_size && ret > m_soft_packet_size - m_recv_pos)
+			ret = m_soft_packet_size - m_recv_pos;
+		return ret;
+	}
+
+	char* receive_buffer::reserve(int size)
+	{
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(m_recv_start == 0);
+		TORRENT_ASSERT(!m_disk_recv_buffer);
+		TORRENT_ASSERT(!m_spec_recv_buffer);
+
+		m_recv_buffer.resize(m_recv_end + size);
+		return &m_recv_buffer[0] + m_recv_end;
+	}
+
+	int receive_buffer::reserve(boost::array<asio::mutable_buffer, 2>& vec
+		, int size)
+	{
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(m_recv_pos >= 0);
+		TORRENT_ASSERT(m_packet_size > 0);
+
+		int const regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
+		if (int(m_recv_buffer.size()) < regular_buffer_size)
+			m_recv_buffer.resize(round_up8(regular_buffer_size));
+
+		if (m_spec_recv_buffer)
+		{
+			// receive the header into the regular buffer and the rest
+			// into the speculative disk buffer
+			int const header_size = m_spec_recv_offset - m_recv_pos;
+			TORRENT_ASSERT(size > header_size);
+			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos], header_size);
+			vec[1] = asio::buffer(m_spec_recv_buffer.get(), size - header_size);
+			return 2;
+		}
+		else if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos + size)
+		{
+			// only receive into regular buffer
+			TORRENT_ASSERT(m_recv_pos + size <= int(m_recv_buffer.size()));
+			vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos], size);
+			return 1;
+		}
+		else if (m_recv_pos >= regular_buffer_size)
+		{
+			// only receive into disk buffer
+			TORRENT_ASSERT(m_recv_pos - regular_buffer_size >= 0);
+			TORRENT_ASSERT(m_recv_pos - regular_buffer_size + size <= m_disk_recv_buffer_size);
+			vec[0] = asio::buffer(m_disk_recv_buffer.get() + m_recv_pos - regular_buffer_size, size);
+			return 1;
+		}
+
+		// receive into both regular and disk buffer
+		TORRENT_ASSERT(size + m_recv_pos > regular_buffer_size);
+		TORRENT_ASSERT(m_recv_pos < regular_buffer_size);
+		TORRENT_ASSERT(size - regular_buffer_size
+			+ m_recv_pos <= m_disk_recv_buffer_size);
+
+		vec[0] = asio::buffer(&m_recv_buffer[m_recv_pos]
+			, regular_buffer_size - m_recv_pos);
+		vec[1] = asio::buffer(m_disk_recv_buffer.get()
+			, size - regular_buffer_size + m_recv_pos);
+		return 2;
+	}
+
+	void receive_buffer::speculate(char* buf, int header_size)
+	{
+		TORRENT_ASSERT(buf);
+		TORRENT_ASSERT(header_size > 0);
+		TORRENT_ASSERT(m_recv_start == 0);
+		TORRENT_ASSERT(!m_disk_recv_buffer);
+		TORRENT_ASSERT(!m_spec_recv_buffer);
+
+		m_spec_recv_buffer.reset(buf);
+		if (int(m_recv_buffer.size()) < m_recv_pos + header_size)
+			m_recv_buffer.resize(round_up8(m_recv_pos + header_size));
+		m_spec_recv_offset = m_recv_pos + header_size;
+	}
+
+	void receive_buffer::reset_spec_buffer()
+	{
+		TORRENT_ASSERT(!m_spec_recv_buffer || m_recv_end <= m_spec_recv_offset);
+		m_spec_recv_buffer.reset();
+	}
+
+	void receive_buffer::received(int bytes)
+	{
+		TORRENT_ASSERT(m_packet_size > 0);
+		TORRENT_ASSERT(bytes > 0);
+
+		m_recv_end += bytes;
+		TORRENT_ASSERT(m_recv_pos <= int(m_recv_buffer.size()
+			+ m_disk_recv_buffer_size));
+
+		// nothing was received into the speculative disk buffer
+		if (m_spec_recv_buffer && m_recv_end <= m_spec_recv_offset)
+			m_spec_recv_buffer.reset();
+	}
+
+	int receive_buffer::advance_pos(int bytes)
+	{
+		int const packet_size = m_soft_packet_size ? m_soft_packet_size : m_packet_size;
+		int const limit = packet_size > m_recv_pos ? packet_size - m_recv_pos : packet_size;
+		int const sub_transferred = (std::min)(bytes, limit);
+
+		// the speculative disk buffer wasn't taken by a piece message.
+		// Before the bytes received into it are passed on, they need
+		// to be where they would have been received otherwise
+		if (m_spec_recv_buffer
+			&& m_recv_start + m_recv_pos + sub_transferred > m_spec_recv_offset)
+			copy_spec_buffer();
+
+		m_recv_pos += sub_transferred;
+		if (m_recv_pos >= m_soft_packet_size) m_soft_packet_size = 0;
+		return sub_transferred;
+	}
+
+	// size = the packet size to remove from the receive buffer
+	// packet_size = the next packet size to receive in the buffer
+	// offset = the offset into the receive buffer where to remove `size` bytes
+	void receive_buffer::cut(int size, int packet_size, int offset)
+	{
+		TORRENT_ASSERT(packet_size > 0);
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= size);
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= m_recv_pos);
+		TORRENT_ASSERT(m_recv_pos >= size + offset);
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= (m_spec_recv_buffer
+			? m_spec_recv_offset : m_recv_end));
+		TORRENT_ASSERT(m_recv_start <= m_recv_end);
+		TORRENT_ASSERT(size >= 0);
+
+		if (offset > 0)
+		{
+			TORRENT_ASSERT(m_recv_start - size <= m_recv_end);
+
+			// the bytes in the speculative disk buffer stay where they are,
+			// it just stands in for an earlier part of the receive buffer
+			int const end = m_spec_recv_buffer ? m_spec_recv_offset : m_recv_end;
+			if (size > 0)
+				std::memmove(&m_recv_buffer[0] + m_recv_start + offset
+					, &m_recv_buffer[0] + m_recv_start + offset + size
+					, end - m_recv_start - size - offset);
+
+			m_recv_pos -= size;
+			m_recv_end -= size;
+			if (m_spec_recv_buffer) m_spec_recv_offset -= size;
+
+#ifdef TORRENT_DEBUG
+			std::fill(m_recv_buffer.begin() + end - size, m_recv_buffer.end(), 0xcc);
+#endif
+		}
+		else
+		{
+			TORRENT_ASSERT(m_recv_start + size <= m_recv_end);
+			m_recv_start += size;
+			m_recv_pos -= size;
+		}
+
+		m_packet_size = packet_size;
+	}
+
+	void receive_buffer::reset(int packet_size)
+	{
+		TORRENT_ASSERT(int(m_recv_buffer.size()) >= (m_spec_recv_buffer
+			? m_spec_recv_offset : m_recv_end));
+		TORRENT_ASSERT(packet_size > 0);
+		if (m_recv_end > m_packet_size)
+		{
+			cut(m_packet_size, packet_size);
+			return;
+		}
+
+		// nothing has been received past the end of this packet, so there
+		// is nothing in the speculative disk buffer either
+		m_spec_recv_buffer.reset();
+		m_recv_pos = 0;
+		m_recv_start = 0;
+		m_recv_end = 0;
+		m_packet_size = packet_size;
+	}
+
+	// the purpose of this function is to free up and cut off all messages
+	// in the receive buffer that have been parsed and processed.
+	void receive_buffer::normalize()
+	{
+		TORRENT_ASSERT(m_recv_end >= m_recv_start);
+		if (m_recv_start == 0) return;
+
+		if (m_spec_recv_buffer) copy_spec_buffer();
+
+		// the bytes received into the disk buffer are counted by
+		// m_recv_end, but they're not in the regular buffer
+		int const end = m_disk_recv_buffer
+			? (std::min)(m_recv_end, m_recv_start + m_packet_size - m_disk_recv_buffer_size)
+			: m_recv_end;
+
+		int const size = (std::max)(end - m_recv_start, 0);
+		if (size > 0)
+			std::memmove(&m_recv_buffer[0], &m_recv_buffer[0] + m_recv_start, size);
+
+		m_recv_end -= m_recv_start;
+		m_recv_start = 0;
+
+#ifdef TORRENT_DEBUG
+		std::fill(m_recv_buffer.begin() + size, m_recv_buffer.end(), 0xcc);
+#endif
+	}
+
+	void receive_buffer::copy_spec_buffer()
+	{
+		TORRENT_ASSERT(m_spec_recv_buffer);
+		int const size = m_recv_end - m_spec_recv_offset;
+		if (size > 0)
+		{
+			if (int(m_recv_buffer.size()) < m_recv_end)
+				m_recv_buffer.resize(m_recv_end);
+			std::memcpy(&m_recv_buffer[0] + m_spec_recv_offset
+				, m_spec_recv_buffer.get(), size);
+			m_counters.inc_stats_counter(counters::recv_copied_bytes, size);
+		}
+		m_spec_recv_buffer.reset();
+	}
+
+	bool receive_buffer::adopt_spec_buffer(int disk_buffer_size)
+	{
+		TORRENT_ASSERT(m_packet_size > 0);
+		TORRENT_ASSERT(!m_disk_recv_buffer);
+		if (!m_spec_recv_buffer) return false;
+
+		// if the start of this message was received speculatively, as a
+		// piece message, the payload is already in a disk buffer
+		if (disk_buffer_size > 0 && disk_buffer_size <= 16 * 1024
+			&& m_recv_start + m_packet_size - disk_buffer_size == m_spec_recv_offset
+			&& m_recv_end - m_spec_recv_offset <= disk_buffer_size)
+		{
+			m_disk_recv_buffer.reset(m_spec_recv_buffer.release());
+			m_disk_recv_buffer_size = disk_buffer_size;
+			return true;
+		}
+		copy_spec_buffer();
+		return false;
+	}
+
+	void receive_buffer::assign_disk_buffer(char* buf, int size)
+	{
+		TORRENT_ASSERT(buf);
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(!m_disk_recv_buffer);
+		TORRENT_ASSERT(!m_spec_recv_buffer);
+		TORRENT_ASSERT(size <= m_packet_size);
+
+		// the bytes of a speculative read that wasn't adopted may already
+		// have been copied into the regular buffer, past the part of the
+		// message it keeps. Move them to where they'd have been received
+		// with the disk buffer in place
+		int const regular_end = m_recv_start + m_packet_size - size;
+		if (m_recv_end > regular_end)
+		{
+			int const payload = (std::min)(m_recv_end
+				, m_recv_start + m_packet_size) - regular_end;
+			std::memcpy(buf, &m_recv_buffer[0] + regular_end, payload);
+			if (m_recv_end > regular_end + payload)
+				std::memmove(&m_recv_buffer[0] + regular_end
+					, &m_recv_buffer[0] + regular_end + payload
+					, m_recv_end - regular_end - payload);
+		}
+
+		m_disk_recv_buffer.reset(buf);
+		m_disk_recv_buffer_size = size;
+	}
+
+	char* receive_buffer::release_disk_buffer()
+	{
+		if (!m_disk_recv_buffer) return 0;
+
+		TORRENT_ASSERT(m_disk_recv_buffer_size <= m_recv_end);
+		TORRENT_ASSERT(m_recv_start <= m_recv_end - m_disk_recv_buffer_size);
+		m_recv_end -= m_disk_recv_buffer_size;
+		m_counters.inc_stats_counter(counters::recv_zero_copy_bytes
+			, m_disk_recv_buffer_size);
+		m_disk_recv_buffer_size = 0;
+		return m_disk_recv_buffer.release();
+	}
+
+	void receive_buffer::free_disk_buffers()
+	{
+		m_disk_recv_buffer.reset();
+		m_disk_recv_buffer_size = 0;
+		m_spec_recv_buffer.reset();
+	}
+
+	buffer::const_interval receive_buffer::get() const
+	{
+		if (m_recv_buffer.empty())
+		{
+			TORRENT_ASSERT(m_recv_pos == 0);
+			return buffer::interval(0,0);
+		}
+		int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
+		return buffer::const_interval(&m_recv_buffer[0] + m_recv_start
+			, &m_recv_buffer[0] + m_recv_start + rcv_pos);
+	}
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+	buffer::interval receive_buffer::mutable_buffer()
+	{
+		if (m_recv_buffer.empty())
+		{
+			TORRENT_ASSERT(m_recv_pos == 0);
+			return buffer::interval(0,0);
+		}
+		TORRENT_ASSERT(!m_disk_recv_buffer);
+		TORRENT_ASSERT(m_disk_recv_buffer_size == 0);
+		int rcv_pos = (std::min)(m_recv_pos, int(m_recv_buffer.size()));
+		return buffer::interval(&m_recv_buffer[0] + m_recv_start
+			, &m_recv_buffer[0] + m_recv_start + rcv_pos);
+	}
+
+	// returns the last 'bytes' from the receive buffer
+	std::pair<buffer::interval, buffer::interval> receive_buffer::mutable_buffers(int bytes)
+	{
+		TORRENT_ASSERT(bytes <= m_recv_pos);
+
+		std::pair<buffer::interval, buffer::interval> vec;
+		int regular_buffer_size = m_packet_size - m_disk_recv_buffer_size;
+		TORRENT_ASSERT(regular_buffer_size >= 0);
+		if (!m_disk_recv_buffer || regular_buffer_size >= m_recv_pos)
+		{
+			vec.first = buffer::interval(&m_recv_buffer[0] + m_recv_start
+				+ m_recv_pos - bytes, &m_recv_buffer[0] + m_recv_start + m_recv_pos);
+			vec.second = buffer::interval(0,0);
+		}
+		else if (m_recv_pos - bytes >= regular_buffer_size)
+		{
+			vec.first = buffer::interval(m_disk_recv_buffer.get() + m_recv_pos
+				- regular_buffer_size - bytes, m_disk_recv_buffer.get() + m_recv_pos
+				- regular_buffer_size);
+			vec.second = buffer::interval(0,0);
+		}
+		else
+		{
+			TORRENT_ASSERT(m_recv_pos - bytes < regular_buffer_size);
+			TORRENT_ASSERT(m_recv_pos > regular_buffer_size);
+			vec.first = buffer::interval(&m_recv_buffer[0] + m_recv_start + m_recv_pos - bytes
+				, &m_recv_buffer[0] + m_recv_start + regular_buffer_size);
+			vec.second = buffer::interval(m_disk_recv_buffer.get()
+				, m_disk_recv_buffer.get() + m_recv_pos - regular_buffer_size);
+		}
+		TORRENT_ASSERT(vec.first.left() + vec.second.left() == bytes);
+		return vec;
+	}
+#endif
+
+#if TORRENT_USE_INVARIANT_CHECKS
+	void receive_buffer::check_invariant() const
+	{
+		TORRENT_ASSERT(m_recv_end >= m_recv_start);
+		TORRENT_ASSERT(bool(m_disk_recv_buffer) == (m_disk_recv_buffer_size > 0));
+		TORRENT_ASSERT(!m_spec_recv_buffer || !m_disk_recv_buffer);
+		TORRENT_ASSERT(!m_spec_recv_buffer
+			|| m_recv_start + m_recv_pos <= m_spec_recv_offset);
+	}
+#endif
+}
+
@@ -0,0 +1,87 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/receive_buffer_pool.hpp"
+#include "libtorrent/assert.hpp"
+
+namespace libtorrent
+{
+	receive_buffer_pool::receive_buffer_pool()
+		: m_max_buffers(0)
+		, m_max_capacity(0)
+	{}
+
+	void receive_buffer_pool::acquire(buffer& b)
+	{
+		if (b.capacity() > 0 || m_buffers.empty()) return;
+		b.swap(m_buffers.back());
+		m_buffers.pop_back();
+		b.clear();
+	}
+
+	void receive_buffer_pool::release(buffer& b)
+	{
+		if (b.capacity() == 0) return;
+		if (int(m_buffers.size()) >= m_max_buffers
+			|| int(b.capacity()) > m_max_capacity)
+		{
+			buffer().swap(b);
+			return;
+		}
+		// the empty buffer is copied into the deque, which doesn't move
+		// the elements already in it
+		m_buffers.push_back(buffer());
+		m_buffers.back().swap(b);
+		TORRENT_ASSERT(b.capacity() == 0);
+	}
+
+	void receive_buffer_pool::set_limits(int max_buffers, int max_capacity)
+	{
+		TORRENT_ASSERT(max_buffers >= 0);
+		m_max_buffers = max_buffers;
+		m_max_capacity = max_capacity;
+
+		// copying a buffer doesn't carry its capacity over, so the buffers
+		// to keep are swapped into a new pool rather than erasing the others
+		std::deque<buffer> keep;
+		for (std::deque<buffer>::iterator i = m_buffers.begin()
+			, end(m_buffers.end()); i != end; ++i)
+		{
+			if (int(keep.size()) >= m_max_buffers) break;
+			if (int(i->capacity()) > m_max_capacity) continue;
+			keep.push_back(buffer());
+			keep.back().swap(*i);
+		}
+		m_buffers.swap(keep);
+	}
+}
+
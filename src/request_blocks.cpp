@@ -36,11 +36,19 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/socket_type.hpp"
 #include "libtorrent/peer_info.hpp" // for peer_info flags
 #include "libtorrent/performance_counters.hpp" // for counters
+#include "libtorrent/request_blocks.hpp"
+#include "libtorrent/torrent_peer.hpp"
 
 #include <vector>
 
 namespace libtorrent
 {
+	enum
+	{
+		// the limits of the download queue size
+		min_request_queue = 2,
+	};
+
 	// returns the rank of a peer's source. We have an affinity
 	// to connecting to peers with higher rank. This is to avoid
 	// problems when our peer list is diluted by stale peers from
@@ -292,5 +300,66 @@ namespace libtorrent
 		return true;
 	}
 
+	int desired_queue_size(int rate, int block_size, int queue_time
+		, int rtt, int max_queue)
+	{
+		TORRENT_ASSERT(block_size > 0);
+
+		boost::int64_t desired;
+		if (rtt > 0)
+		{
+			// the bandwidth-delay product is the number of bytes that need
+			// to be in flight to keep the link busy. Requesting twice that
+			// lets the download rate, and with it the queue, grow until the
+			// link (rather than the queue) is the bottleneck
+			desired = boost::int64_t(rate) * 2 * rtt / 1000000 / block_size + 1;
+		}
+		else
+		{
+			// (if the latency is more than this, the download will stall)
+			// so, the queue size is queue_time * down_rate / 16 kiB
+			// (16 kB is the size of each request)
+			desired = boost::int64_t(queue_time) * rate / block_size;
+		}
+
+		if (desired > max_queue) desired = max_queue;
+		if (desired < min_request_queue) desired = min_request_queue;
+		return int(desired);
+	}
+
+	time_duration download_time(boost::int64_t bytes, int rate)
+	{
+		// avoid division by zero
+		if (rate < 50) rate = 50;
+		return milliseconds(bytes * 1000 / rate);
+	}
+
+	time_duration block_arrival_time(boost::int64_t queued_bytes, int rate
+		, int rtt)
+	{
+		return download_time(queued_bytes, rate) + microseconds(rtt);
+	}
+
+	bool deadline_at_risk(piece_picker const& picker
+		, piece_picker::downloading_piece const& pi
+		, int blocks_in_piece, ptime deadline, ptime now)
+	{
+		// this also covers pieces that aren't being downloaded, which don't
+		// have any block info
+		if (pi.requested == 0) return false;
+
+		for (int k = 0; k < blocks_in_piece; ++k)
+		{
+			if (pi.info[k].state != piece_picker::block_info::state_requested)
+				continue;
+
+			torrent_peer* tp = static_cast<torrent_peer*>(picker.block_peer(pi.info[k]));
+			// the peer we requested it from is gone
+			if (tp == 0 || tp->connection == 0) return true;
+
+			if (now + tp->connection->block_arrival_time(0) > deadline) return true;
+		}
+		return false;
+	}
 }
 
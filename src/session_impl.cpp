@@ -1181,6 +1181,8 @@ namespace aux {
 #ifndef TORRENT_DISABLE_DHT
 		update_dht_announce_interval();
 #endif
+		update_recv_buffer_pool();
+		update_dh_key_pool();
 
 #if defined TORRENT_LOGGING || defined TORRENT_VERBOSE_LOGGING
 		session_log(" done starting session");
@@ -1703,6 +1705,12 @@ namespace aux {
 			TORRENT_ASSERT_VAL(conn == int(m_connections.size()) + 1, conn);
 		}
 
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// no more handshakes will be made, stop the thread computing keys
+		// for them
+		m_dh_keys.set_size(0);
+#endif
+
 #if defined(TORRENT_VERBOSE_LOGGING) || defined(TORRENT_LOGGING)
 		session_log(" connection queue: %d", m_half_open.size());
 #endif
@@ -5535,6 +5543,12 @@ retry:
 		if (i == m_obfuscated_torrents.end()) return NULL;
 		return i->second.get();
 	}
+
+	dh_key_exchange* session_impl::take_dh_key()
+	{
+		TORRENT_ASSERT(is_single_thread());
+		return m_dh_keys.take();
+	}
 #endif
 
 	boost::weak_ptr<torrent> session_impl::find_torrent(std::string const& uuid) const
@@ -7105,6 +7119,24 @@ retry:
 		m_alerts.set_alert_queue_size_limit(m_settings.get_int(settings_pack::alert_queue_size));
 	}
 
+	void session_impl::update_recv_buffer_pool()
+	{
+		// buffers larger than this were grown to receive a burst of data
+		// and are not worth holding on to
+		m_recv_buffers.set_limits((std::max)(m_settings.get_int(
+			settings_pack::recv_buffer_pool_size), 0), 64 * 1024);
+	}
+
+	void session_impl::update_dh_key_pool()
+	{
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		// once aborted, the worker thread is not started again
+		if (m_abort) return;
+		m_dh_keys.set_size((std::max)(m_settings.get_int(
+			settings_pack::dh_key_pool_size), 0));
+#endif
+	}
+
 	bool session_impl::preemptive_unchoke() const
 	{
 		return m_num_unchoked < m_allowed_upload_slots;
@@ -7736,6 +7768,18 @@ retry:
 #endif
 	}	
 
+	void session_impl::acquire_recv_buffer(buffer& b)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		m_recv_buffers.acquire(b);
+	}
+
+	void session_impl::release_recv_buffer(buffer& b)
+	{
+		TORRENT_ASSERT(is_single_thread());
+		m_recv_buffers.release(b);
+	}
+
 #if TORRENT_USE_INVARIANT_CHECKS
 	void session_impl::check_invariant() const
 	{
@@ -104,6 +104,17 @@ namespace libtorrent
 		METRIC(peer, connection_attempt_loops)
 		METRIC(peer, incoming_connections)
 
+		// the number of encrypted handshakes that used a DH key computed
+		// ahead of time by the key pool, and the number of ones that found
+		// the pool empty and computed their key on the network thread. See
+		// the dh_key_pool_size setting
+		METRIC(peer, dh_key_pool_hits)
+		METRIC(peer, dh_key_pool_misses)
+
+		// the cumulative time the network thread spent computing DH keys
+		// and shared secrets for encrypted handshakes, in microseconds
+		METRIC(peer, dh_handshake_time)
+
 		// the number of peer connections for each kind of socket.
 		// these counts include half-open (connecting) peers.
 		METRIC(peer, num_tcp_peers)
@@ -173,6 +184,28 @@ namespace libtorrent
 		// were downloaded multiple times (from different peers)
 		METRIC(net, recv_redundant_bytes)
 
+		// the number of payload bytes sent to peers straight from the file
+		// they're stored in, without being copied into a disk buffer. See
+		// the zero_copy_upload setting
+		METRIC(net, sent_zero_copy_bytes)
+
+		// the number of bytes sent to peers with MSG_ZEROCOPY, and the
+		// number of times the kernel reported it had to copy the data
+		// anyway. Connections stop using MSG_ZEROCOPY once that happens.
+		// See the zero_copy_send setting
+		METRIC(net, sent_msg_zerocopy_bytes)
+		METRIC(net, msg_zerocopy_copied)
+
+		// the number of payload bytes received from peers straight into
+		// the disk buffers they're written from
+		METRIC(net, recv_zero_copy_bytes)
+
+		// the number of bytes copied from the receive buffer into disk
+		// buffers. This includes payload received with the contiguous
+		// receive buffer as well as bytes received speculatively into a disk
+		// buffer, as part of a message that turned out not to be a piece
+		METRIC(net, recv_copied_bytes)
+
 		// is false by default and set to true when
 		// the first incoming connection is established
 		// this is used to know if the client is behind
@@ -282,6 +315,14 @@ namespace libtorrent
 		METRIC(picker, interesting_piece_picks)
 		METRIC(picker, hash_fail_piece_picks)
 
+		// the number of time critical pieces (see set_piece_deadline()) that
+		// completed before and after their deadline, and the number of time
+		// critical blocks requested from an additional peer because the
+		// original request was stalled or not expected to arrive in time
+		METRIC(picker, piece_deadlines_met)
+		METRIC(picker, piece_deadlines_missed)
+		METRIC(picker, redundant_time_critical_requests)
+
 		METRIC(disk, write_cache_blocks)
 		METRIC(disk, read_cache_blocks)
 
@@ -292,6 +333,15 @@ namespace libtorrent
 		METRIC(disk, pinned_blocks)
 		METRIC(disk, disk_blocks_in_use)
 		METRIC(disk, queued_disk_jobs)
+
+		// the number of disk jobs queued in each job class: reads for
+		// peers, writes, hashing and everything else (checking, moving
+		// files etc.)
+		METRIC(disk, queued_read_jobs)
+		METRIC(disk, queued_write_jobs)
+		METRIC(disk, queued_hash_jobs)
+		METRIC(disk, queued_maintenance_jobs)
+
 		METRIC(disk, num_read_jobs)
 		METRIC(disk, num_write_jobs)
 		METRIC(disk, num_jobs)
@@ -313,6 +363,23 @@ namespace libtorrent
 		METRIC(disk, arc_write_size)
 		METRIC(disk, arc_volatile_size)
 
+		// when adaptive_cache_split is enabled, this is the number of blocks
+		// the write cache is currently allowed to use before dirty blocks are
+		// flushed in favour of evicting read blocks. It grows when blocks need
+		// to be read back for hashing and shrinks on ARC ghost hits. It's 0
+		// when the adaptive split is disabled
+		METRIC(disk, arc_write_target)
+
+		// when use_disk_cache_arena is enabled, the number of blocks in the
+		// arena and how many of them are free. arena_fragmented_pages is the
+		// number of 2 MiB pages that are partially in use, and
+		// arena_huge_pages is 1 if the arena is backed by explicitly reserved
+		// huge pages (rather than transparent huge pages, if any)
+		METRIC(disk, arena_blocks)
+		METRIC(disk, arena_free_blocks)
+		METRIC(disk, arena_fragmented_pages)
+		METRIC(disk, arena_huge_pages)
+
 		// the number of blocks written and read from disk in total. A block is
 		// 16 kiB.
 		METRIC(disk, num_blocks_written)
@@ -333,6 +400,27 @@ namespace libtorrent
 		// hash a piece (when verifying against the piece hash)
 		METRIC(disk, num_read_back)
 
+		// when using the io_uring disk back-end, the number of batches
+		// submitted to the ring and the total number of read and write
+		// operations completed through it
+		METRIC(disk, num_io_uring_batches)
+		METRIC(disk, num_io_uring_ops)
+
+		// the number of read jobs that were completed by handing back a file
+		// region, to be sent with sendfile(), rather than reading the block
+		// into memory
+		METRIC(disk, num_zero_copy_reads)
+
+		// the number of times a piece in each of the ARC lists of the disk
+		// cache was accessed. A hit in one of the ghost lists means the piece
+		// had been evicted from the read cache and was requested again
+		METRIC(disk, arc_write_hits)
+		METRIC(disk, arc_volatile_hits)
+		METRIC(disk, arc_mru_hits)
+		METRIC(disk, arc_mru_ghost_hits)
+		METRIC(disk, arc_mfu_hits)
+		METRIC(disk, arc_mfu_ghost_hits)
+
 		// cumulative time spent in various disk jobs, as well
 		// as total for all disk jobs. Measured in microseconds
 		METRIC(disk, disk_read_time)
@@ -340,6 +428,19 @@ namespace libtorrent
 		METRIC(disk, disk_hash_time)
 		METRIC(disk, disk_job_time)
 
+		// cumulative time jobs of each class spent waiting in the disk job
+		// queue, in microseconds, and the number of jobs of each class that
+		// have been started. The average latency of a class is its queue
+		// time divided by its number of jobs
+		METRIC(disk, disk_read_queue_time)
+		METRIC(disk, disk_write_queue_time)
+		METRIC(disk, disk_hash_queue_time)
+		METRIC(disk, disk_maintenance_queue_time)
+		METRIC(disk, disk_read_jobs)
+		METRIC(disk, disk_write_jobs)
+		METRIC(disk, disk_hash_jobs)
+		METRIC(disk, disk_maintenance_jobs)
+
 		// the number of wasted downloaded bytes by reason of the bytes being
 		// wasted.
 		METRIC(ses, waste_piece_timed_out)
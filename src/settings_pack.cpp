@@ -200,6 +200,12 @@ namespace libtorrent
 		SET_NOPREV(prefer_rc4, false, 0),
 		SET_NOPREV(proxy_hostnames, true, 0),
 		SET_NOPREV(proxy_peer_connections, true, 0),
+		SET_NOPREV(adaptive_cache_split, false, 0),
+		SET_NOPREV(zero_copy_upload, false, 0),
+		SET_NOPREV(use_disk_cache_arena, false, 0),
+		SET_NOPREV(streaming_deadline_estimates, false, 0),
+		SET_NOPREV(bdp_request_queue, false, 0),
+		SET_NOPREV(zero_copy_send, false, 0),
 	};
 
 	int_setting_entry_t int_settings[settings_pack::num_int_settings] =
@@ -333,7 +339,15 @@ namespace libtorrent
 		SET(inactive_up_rate, 2048, 0),
 		SET_NOPREV(proxy_type, settings_pack::none, &session_impl::update_proxy),
 		SET_NOPREV(proxy_port, 0, &session_impl::update_proxy),
-		SET_NOPREV(i2p_port, 0, &session_impl::update_i2p_bridge)
+		SET_NOPREV(i2p_port, 0, &session_impl::update_i2p_bridge),
+		SET_NOPREV(disk_io_backend, settings_pack::posix_disk_io, 0),
+		SET_NOPREV(disk_read_weight, 8, 0),
+		SET_NOPREV(disk_write_weight, 4, 0),
+		SET_NOPREV(disk_hash_weight, 4, 0),
+		SET_NOPREV(disk_maintenance_weight, 1, 0),
+		SET_NOPREV(read_elevator_window, 0, 0),
+		SET_NOPREV(recv_buffer_pool_size, 64, &session_impl::update_recv_buffer_pool),
+		SET_NOPREV(dh_key_pool_size, 32, &session_impl::update_dh_key_pool)
 	};
 
 #undef SET
@@ -24,6 +24,7 @@ typedef boost::uint32_t u32;
 typedef boost::uint8_t u8;
 
 #include "libtorrent/config.hpp"
+#include "libtorrent/hash_kernels.hpp"
 
 namespace libtorrent
 {
@@ -42,89 +43,12 @@ TORRENT_EXPORT void SHA1_final(u8* digest, sha_ctx* context);
 
 namespace
 {
-	union CHAR64LONG16
+	// the compression function is picked at runtime, to make use of the
+	// SHA extensions when the CPU has them. See hash_kernels.cpp
+	void SHA1transform(u32 state[5], u8 const* buffer, u32 blocks)
 	{
-		u8 c[64];
-		u32 l[16];
-	};
-
-#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
-
-// blk0() and blk() perform the initial expand.
-// I got the idea of expanding during the round function from SSLeay
-	struct little_endian_blk0
-	{
-		static u32 apply(CHAR64LONG16* block, int i)
-		{
-			return block->l[i] = (rol(block->l[i],24)&0xFF00FF00)
-				| (rol(block->l[i],8)&0x00FF00FF);
-		}
-	};
-
-	struct big_endian_blk0
-	{
-		static u32 apply(CHAR64LONG16* block, int i)
-		{
-			return  block->l[i];
-		}
-	};
-
-
-#define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15] \
-    ^block->l[(i+2)&15]^block->l[i&15],1))
-
-// (R0+R1), R2, R3, R4 are the different operations used in SHA1
-#define R0(v,w,x,y,z,i) z+=((w&(x^y))^y)+BlkFun::apply(block, i)+0x5A827999+rol(v,5);w=rol(w,30);
-#define R1(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk(i)+0x5A827999+rol(v,5);w=rol(w,30);
-#define R2(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0x6ED9EBA1+rol(v,5);w=rol(w,30);
-#define R3(v,w,x,y,z,i) z+=(((w|x)&y)|(w&x))+blk(i)+0x8F1BBCDC+rol(v,5);w=rol(w,30);
-#define R4(v,w,x,y,z,i) z+=(w^x^y)+blk(i)+0xCA62C1D6+rol(v,5);w=rol(w,30);
-
-	// Hash a single 512-bit block. This is the core of the algorithm.
-	template <class BlkFun>
-	void SHA1transform(u32 state[5], u8 const buffer[64])
-	{
-		using namespace std;
-		u32 a, b, c, d, e;
-
-		CHAR64LONG16* block;
-		u8 workspace[64];
-		block = (CHAR64LONG16*)workspace;
-		memcpy(block, buffer, 64);
-
-		// Copy context->state[] to working vars
-		a = state[0];
-		b = state[1];
-		c = state[2];
-		d = state[3];
-		e = state[4];
-		// 4 rounds of 20 operations each. Loop unrolled.
-		R0(a,b,c,d,e, 0); R0(e,a,b,c,d, 1); R0(d,e,a,b,c, 2); R0(c,d,e,a,b, 3);
-		R0(b,c,d,e,a, 4); R0(a,b,c,d,e, 5); R0(e,a,b,c,d, 6); R0(d,e,a,b,c, 7);
-		R0(c,d,e,a,b, 8); R0(b,c,d,e,a, 9); R0(a,b,c,d,e,10); R0(e,a,b,c,d,11);
-		R0(d,e,a,b,c,12); R0(c,d,e,a,b,13); R0(b,c,d,e,a,14); R0(a,b,c,d,e,15);
-		R1(e,a,b,c,d,16); R1(d,e,a,b,c,17); R1(c,d,e,a,b,18); R1(b,c,d,e,a,19);
-		R2(a,b,c,d,e,20); R2(e,a,b,c,d,21); R2(d,e,a,b,c,22); R2(c,d,e,a,b,23);
-		R2(b,c,d,e,a,24); R2(a,b,c,d,e,25); R2(e,a,b,c,d,26); R2(d,e,a,b,c,27);
-		R2(c,d,e,a,b,28); R2(b,c,d,e,a,29); R2(a,b,c,d,e,30); R2(e,a,b,c,d,31);
-		R2(d,e,a,b,c,32); R2(c,d,e,a,b,33); R2(b,c,d,e,a,34); R2(a,b,c,d,e,35);
-		R2(e,a,b,c,d,36); R2(d,e,a,b,c,37); R2(c,d,e,a,b,38); R2(b,c,d,e,a,39);
-		R3(a,b,c,d,e,40); R3(e,a,b,c,d,41); R3(d,e,a,b,c,42); R3(c,d,e,a,b,43);
-		R3(b,c,d,e,a,44); R3(a,b,c,d,e,45); R3(e,a,b,c,d,46); R3(d,e,a,b,c,47);
-		R3(c,d,e,a,b,48); R3(b,c,d,e,a,49); R3(a,b,c,d,e,50); R3(e,a,b,c,d,51);
-		R3(d,e,a,b,c,52); R3(c,d,e,a,b,53); R3(b,c,d,e,a,54); R3(a,b,c,d,e,55);
-		R3(e,a,b,c,d,56); R3(d,e,a,b,c,57); R3(c,d,e,a,b,58); R3(b,c,d,e,a,59);
-		R4(a,b,c,d,e,60); R4(e,a,b,c,d,61); R4(d,e,a,b,c,62); R4(c,d,e,a,b,63);
-		R4(b,c,d,e,a,64); R4(a,b,c,d,e,65); R4(e,a,b,c,d,66); R4(d,e,a,b,c,67);
-		R4(c,d,e,a,b,68); R4(b,c,d,e,a,69); R4(a,b,c,d,e,70); R4(e,a,b,c,d,71);
-		R4(d,e,a,b,c,72); R4(c,d,e,a,b,73); R4(b,c,d,e,a,74); R4(a,b,c,d,e,75);
-		R4(e,a,b,c,d,76); R4(d,e,a,b,c,77); R4(c,d,e,a,b,78); R4(b,c,d,e,a,79);
-		// Add the working vars back into context.state[]
-		state[0] += a;
-		state[1] += b;
-		state[2] += c;
-		state[3] += d;
-		state[4] += e;
+		u32* s = state;
+		selected_kernels().sha1->compress(&s, &buffer, 1, blocks);
 	}
 
 #ifdef VERBOSE
@@ -142,7 +66,6 @@ namespace
 	}
 #endif
 
-	template <class BlkFun>
 	void internal_update(sha_ctx* context, u8 const* data, u32 len)
 	{
 		using namespace std;
@@ -157,10 +80,12 @@ namespace
 		if ((j + len) > 63)
 		{
 			memcpy(&context->buffer[j], data, (i = 64-j));
-			SHA1transform<BlkFun>(context->state, context->buffer);
-			for ( ; i + 63 < len; i += 64)
+			SHA1transform(context->state, context->buffer, 1);
+			u32 const blocks = (len - i) / 64;
+			if (blocks > 0)
 			{
-				SHA1transform<BlkFun>(context->state, &data[i]);
+				SHA1transform(context->state, &data[i], blocks);
+				i += blocks * 64;
 			}
 			j = 0;
 		}
@@ -173,14 +98,6 @@ namespace
 		SHAPrintContext(context, "after ");
 #endif
 	}
-
-#if !defined BOOST_BIG_ENDIAN && !defined BOOST_LITTLE_ENDIAN
-	bool is_big_endian()
-	{
-		u32 test = 1;
-		return *reinterpret_cast<u8*>(&test) == 0;
-	}
-#endif
 }
 
 // SHA1Init - Initialize new context
@@ -201,20 +118,7 @@ void SHA1_init(sha_ctx* context)
 
 void SHA1_update(sha_ctx* context, u8 const* data, u32 len)
 {
-	// GCC standard defines for endianness
-	// test with: cpp -dM /dev/null
-#if defined BOOST_BIG_ENDIAN
-	internal_update<big_endian_blk0>(context, data, len);
-#elif defined BOOST_LITTLE_ENDIAN
-	internal_update<little_endian_blk0>(context, data, len);
-#else
-	// select different functions depending on endianess
-	// and figure out the endianess runtime
-	if (is_big_endian())
-		internal_update<big_endian_blk0>(context, data, len);
-	else
-		internal_update<little_endian_blk0>(context, data, len);
-#endif
+	internal_update(context, data, len);
 }
 
 
@@ -53,6 +53,7 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/config.hpp"
 #include "libtorrent/storage.hpp"
+#include "libtorrent/io_uring.hpp"
 #include "libtorrent/torrent.hpp"
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/session.hpp"
@@ -1024,7 +1025,7 @@ namespace libtorrent
 		, int slot, int offset, int flags, storage_error& ec)
 	{
 		fileop op = { &file::readv
-			, file::read_only | flags };
+			, file::read_only | flags, 0, 0, 0 };
 #ifdef TORRENT_SIMULATE_SLOW_READ
 		boost::thread::sleep(boost::get_system_time()
 			+ boost::posix_time::milliseconds(1000));
@@ -1036,10 +1037,67 @@ namespace libtorrent
 		, int slot, int offset, int flags, storage_error& ec)
 	{
 		fileop op = { &file::writev
-			, file::read_write | flags };
+			, file::read_write | flags, 0, 0, 0 };
 		return readwritev(bufs, slot, offset, num_bufs, op, ec);
 	}
 
+	int default_storage::submit_readv(io_uring_queue& q, int queue_slot
+		, file::iovec_t const* bufs, int num_bufs, int slot, int offset
+		, int flags, storage_error& ec)
+	{
+		fileop op = { &file::readv
+			, file::read_only | flags, 0, &q, queue_slot };
+		return readwritev(bufs, slot, offset, num_bufs, op, ec);
+	}
+
+	int default_storage::submit_writev(io_uring_queue& q, int queue_slot
+		, file::iovec_t const* bufs, int num_bufs, int slot, int offset
+		, int flags, storage_error& ec)
+	{
+		fileop op = { &file::writev
+			, file::read_write | flags, 0, &q, queue_slot };
+		return readwritev(bufs, slot, offset, num_bufs, op, ec);
+	}
+
+	file_handle default_storage::map_file_region(int slot, int offset, int size
+		, int flags, size_type& file_offset, storage_error& ec)
+	{
+		TORRENT_ASSERT(slot >= 0);
+		TORRENT_ASSERT(slot < m_files.num_pieces());
+		TORRENT_ASSERT(offset >= 0);
+		TORRENT_ASSERT(size > 0);
+		TORRENT_ASSERT(files().is_loaded());
+
+		boost::uint64_t torrent_offset = slot * boost::uint64_t(m_files.piece_length()) + offset;
+		int file_index = files().file_index_at_offset(torrent_offset);
+		size_type offset_in_file = torrent_offset - files().file_offset(file_index);
+
+		// the range has to be stored in a single, regular file. Pad files
+		// and files whose data lives in the part file are read normally
+		if (offset_in_file + size > files().file_size(file_index)
+			|| files().pad_file_at(file_index)
+			|| (file_index < int(m_file_priority.size())
+				&& m_file_priority[file_index] == 0))
+			return file_handle();
+
+		error_code e;
+		file_handle handle = open_file(file_index, file::read_only | flags, e);
+		if (!handle || e)
+		{
+			ec.ec = e;
+			ec.file = file_index;
+			ec.operation = storage_error::open;
+			return file_handle();
+		}
+
+		// files opened in unbuffered mode can't be sent from directly,
+		// since the offset isn't necessarily aligned
+		if (handle->open_mode() & file::no_cache) return file_handle();
+
+		file_offset = files().file_base(file_index) + offset_in_file;
+		return handle;
+	}
+
 	// much of what needs to be done when reading and writing 
 	// is buffer management and piece to file mapping. Most
 	// of that is the same for reading and writing. This function
@@ -1082,6 +1140,10 @@ namespace libtorrent
 		int counter = 0;
 #endif
 
+		// the number of bytes handed off to op.queue. These are
+		// not counted in the return value
+		int queued_bytes = 0;
+
 		file::iovec_t* tmp_bufs = TORRENT_ALLOCA(file::iovec_t, num_bufs);
 		file::iovec_t* current_buf = TORRENT_ALLOCA(file::iovec_t, num_bufs);
 		copy_bufs(bufs, size, current_buf);
@@ -1216,6 +1278,22 @@ namespace libtorrent
 
 				size_type adjusted_offset = files().file_base(file_index) + file_offset;
 
+				// files opened in no_cache mode may need to be synced after
+				// writing, those are always written synchronously
+				if (op.queue && (handle->open_mode() & file::no_cache) == 0
+					&& ((op.mode & file::rw_mask) == file::read_only
+						? op.queue->prep_readv(handle, adjusted_offset
+							, tmp_bufs, num_tmp_bufs, op.slot, file_index)
+						: op.queue->prep_writev(handle, adjusted_offset
+							, tmp_bufs, num_tmp_bufs, op.slot, file_index)))
+				{
+					queued_bytes += file_bytes_left;
+					file_offset = 0;
+					advance_bufs(current_buf, file_bytes_left);
+					TORRENT_ASSERT(count_bufs(current_buf, bytes_left - file_bytes_left) <= num_bufs);
+					continue;
+				}
+
 #ifdef TORRENT_DISK_STATS
 				int flags = ((op.mode & file::rw_mask) == file::read_only) ? op_read : op_write;
 				write_access_log(adjusted_offset, handle->file_id(), op_start | flags, time_now_hires());
@@ -1245,7 +1323,7 @@ namespace libtorrent
 			advance_bufs(current_buf, bytes_transferred);
 			TORRENT_ASSERT(count_bufs(current_buf, bytes_left - file_bytes_left) <= num_bufs);
 		}
-		return size;
+		return size - queued_bytes;
 	}
 
 
@@ -126,4 +126,59 @@ namespace libtorrent
 		m_size = rhs.m_size;
 		rhs.m_size = tmp2;
 	}
+
+	atomic_tailqueue::atomic_tailqueue(): m_head(0) {}
+
+	bool atomic_tailqueue::push_back(tailqueue_node* e)
+	{
+		TORRENT_ASSERT(e->next == 0);
+		return push_chain(e, e);
+	}
+
+	bool atomic_tailqueue::append(tailqueue& rhs)
+	{
+		if (rhs.empty()) return false;
+
+		// the stack is linked newest first, so the nodes are reversed
+		// before they're pushed, to keep them in order
+		tailqueue_node* last = rhs.get_all();
+		tailqueue_node* first = 0;
+		tailqueue_node* e = last;
+		while (e)
+		{
+			tailqueue_node* next = e->next;
+			e->next = first;
+			first = e;
+			e = next;
+		}
+		return push_chain(first, last);
+	}
+
+	bool atomic_tailqueue::push_chain(tailqueue_node* first, tailqueue_node* last)
+	{
+		tailqueue_node* head = m_head.load(boost::memory_order_relaxed);
+		do
+		{
+			last->next = head;
+		} while (!m_head.compare_exchange_weak(head, first
+			, boost::memory_order_release, boost::memory_order_relaxed));
+		return head == 0;
+	}
+
+	void atomic_tailqueue::get_all(tailqueue& out)
+	{
+		// taking the whole stack at once means nodes are never removed
+		// from under a thread that's pushing, which makes this safe
+		// to call from more than one thread too
+		tailqueue_node* e = m_head.exchange(0, boost::memory_order_acquire);
+		tailqueue tmp;
+		while (e)
+		{
+			tailqueue_node* next = e->next;
+			e->next = 0;
+			tmp.push_front(e);
+			e = next;
+		}
+		out.append(tmp);
+	}
 }
@@ -169,6 +169,9 @@ namespace libtorrent
 		, m_started(ses.session_time())
 		, m_checking_piece(0)
 		, m_num_checked_pieces(0)
+		, m_checking_rate(0)
+		, m_checking_rate_pieces(0)
+		, m_checking_rate_start(time_now())
 		, m_refcount(0)
 		, m_error_file(error_file_none)
 		, m_average_piece_time(0)
@@ -2446,25 +2449,19 @@ namespace libtorrent
 	{
 		TORRENT_ASSERT(should_check_files());
 
-		int num_outstanding = m_ses.settings().get_int(settings_pack::checking_mem_usage) * block_size()
-			/ m_torrent_file->piece_length();
-		if (num_outstanding <= 0) num_outstanding = 1;
+		int const num_pieces = m_torrent_file->num_pieces();
 
 		// we might already have some outstanding jobs, if we were paused and
 		// resumed quickly, before the outstanding jobs completed
-		if (m_checking_piece >= m_torrent_file->num_pieces())
+		if (m_checking_piece >= num_pieces)
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 			debug_log("start_checking, checking_piece >= num_pieces. %d >= %d"
-				, m_checking_piece, m_torrent_file->num_pieces());
+				, m_checking_piece, num_pieces);
 #endif
 			return;
 		}
 
-		// subtract the number of pieces we already have outstanding
-		num_outstanding -= (m_checking_piece - m_num_checked_pieces);
-		if (num_outstanding < 0) num_outstanding = 0;
-
 		if (!need_loaded())
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
@@ -2473,14 +2470,34 @@ namespace libtorrent
 			return;
 		}
 
-		for (int i = 0; i < num_outstanding; ++i)
+		// the pieces are checked a run of consecutive pieces at a time, each
+		// run read with a single read. The checking memory is split between
+		// enough runs to keep every hasher thread busy, with one more being
+		// read. A run is never larger than 16 MiB, unless a single piece is
+		// larger than that
+		int const piece_length = m_torrent_file->piece_length();
+		int const max_outstanding = (std::max)(1, int(boost::int64_t(
+			m_ses.settings().get_int(settings_pack::checking_mem_usage))
+			* block_size() / piece_length));
+		int const num_runs = (std::max)(m_ses.settings().get_int(
+			settings_pack::hashing_threads), 1) + 1;
+		int const pieces_per_run = (std::max)(1, (std::min)(
+			max_outstanding / num_runs, 16 * 1024 * 1024 / piece_length));
+
+		// subtract the number of pieces we already have outstanding
+		int outstanding = m_checking_piece - m_num_checked_pieces;
+
+		// always keep at least one run outstanding, even if it exceeds the
+		// memory limit
+		while (m_checking_piece < num_pieces
+			&& (outstanding == 0 || outstanding + pieces_per_run <= max_outstanding))
 		{
+			int const n = (std::min)(pieces_per_run, num_pieces - m_checking_piece);
 			inc_refcount("start_checking");
-			m_ses.disk_thread().async_hash(m_storage.get(), m_checking_piece++
-				, disk_io_job::sequential_access | disk_io_job::volatile_read
-				, boost::bind(&torrent::on_piece_hashed
-					, shared_from_this(), _1), (void*)1);
-			if (m_checking_piece >= m_torrent_file->num_pieces()) break;
+			m_ses.disk_thread().async_check_pieces(m_storage.get(), m_checking_piece, n
+				, boost::bind(&torrent::on_pieces_checked, shared_from_this(), _1));
+			m_checking_piece += n;
+			outstanding += n;
 		}
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
 		debug_log("start_checking, m_checking_piece: %d", m_checking_piece);
@@ -2491,7 +2508,7 @@ namespace libtorrent
 
 	// This is only used for checking of torrents. i.e. force-recheck or initial checking
 	// of existing files
-	void torrent::on_piece_hashed(disk_io_job const* j)
+	void torrent::on_pieces_checked(disk_io_job const* j)
 	{
 		// hold a reference until this function returns
 		torrent_ref_holder h(this, "start_checking");
@@ -2505,8 +2522,9 @@ namespace libtorrent
 		{
 			m_checking_piece = 0;
 			m_num_checked_pieces = 0;
+			m_checking_rate = 0;
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-			debug_log("on_piece_hashed, disk_check_aborted");
+			debug_log("on_pieces_checked, disk_check_aborted");
 #endif
 			pause();
 			return;
@@ -2514,82 +2532,76 @@ namespace libtorrent
 
 		state_updated();
 
-		++m_num_checked_pieces;
-
 		if (j->ret < 0)
 		{
-			if (j->error.ec == boost::system::errc::no_such_file_or_directory
-				|| j->error.ec == boost::asio::error::eof
-#ifdef TORRENT_WINDOWS
-				|| j->error.ec == error_code(ERROR_HANDLE_EOF, system_category())
-#endif
-				)
-			{
-				// skip this file by updating m_checking_piece to the first piece following it
-				file_storage const& st = m_torrent_file->files();
-				boost::uint64_t file_size = st.file_size(j->error.file);
-				int last = st.map_file(j->error.file, file_size, 0).piece;
-				if (m_checking_piece < last)
-				{
-					int diff = last - m_checking_piece;
-					m_num_checked_pieces += diff;
-					m_checking_piece += diff;
-				}
-			}
-			else
-			{
-				m_checking_piece = 0;
-				m_num_checked_pieces = 0;
-				if (m_ses.alerts().should_post<file_error_alert>())
-					m_ses.alerts().post_alert(file_error_alert(j->error.ec,
-						resolve_filename(j->error.file), j->error.operation_str(), get_handle()));
+			m_checking_piece = 0;
+			m_num_checked_pieces = 0;
+			m_checking_rate = 0;
+			if (m_ses.alerts().should_post<file_error_alert>())
+				m_ses.alerts().post_alert(file_error_alert(j->error.ec,
+					resolve_filename(j->error.file), j->error.operation_str(), get_handle()));
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
-				debug_log("on_piece_hashed, fatal disk error: (%d) %s", j->error.ec.value(), j->error.ec.message().c_str());
+			debug_log("on_pieces_checked, fatal disk error: (%d) %s", j->error.ec.value(), j->error.ec.message().c_str());
 #endif
-				auto_managed(false);
-				pause();
-				set_error(j->error.ec, j->error.file);
+			auto_managed(false);
+			pause();
+			set_error(j->error.ec, j->error.file);
 
-				// recalculate auto-managed torrents sooner
-				// in order to start checking the next torrent
-				m_ses.trigger_auto_manage();
-				return;
-			}
+			// recalculate auto-managed torrents sooner
+			// in order to start checking the next torrent
+			m_ses.trigger_auto_manage();
+			return;
 		}
 
+		int const num_pieces = j->d.num_pieces;
+		m_num_checked_pieces += num_pieces;
 		m_progress_ppm = size_type(m_num_checked_pieces) * 1000000 / torrent_file().num_pieces();
 
+		// the checking rate is measured over windows of a second or so. A
+		// window much longer than that means checking was paused in
+		// between, and it's not counted
+		m_checking_rate_pieces += num_pieces;
+		ptime const now = time_now_hires();
+		int const elapsed = total_milliseconds(now - m_checking_rate_start);
+		if (elapsed >= 1000)
+		{
+			if (elapsed < 5000)
+				m_checking_rate = boost::int64_t(m_checking_rate_pieces) * 1000 / elapsed;
+			m_checking_rate_start = now;
+			m_checking_rate_pieces = 0;
+		}
+
 		// we're using the piece hashes here, we need the torrent to be loaded
 		if (!need_loaded())
 		{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
-			debug_log("on_piece_hashed, need_loaded failed");
+			debug_log("on_pieces_checked, need_loaded failed");
 #endif
 			return;
 		}
 
-		if (m_ses.settings().get_bool(settings_pack::disable_hash_checks)
-			|| sha1_hash(j->d.piece_hash) == m_torrent_file->hash_for_piece(j->piece))
+		bool const disable_hash_checks
+			= m_ses.settings().get_bool(settings_pack::disable_hash_checks);
+		for (int i = 0; i < num_pieces; ++i)
 		{
+			int const piece = j->piece + i;
+			if (!disable_hash_checks
+				&& sha1_hash(j->buffer + i * 20) != m_torrent_file->hash_for_piece(piece))
+				continue;
+
 			if (has_picker() || !m_have_all)
 			{
 				need_picker();
-				m_picker->we_have(j->piece);
+				m_picker->we_have(piece);
 				update_gauge();
 			}
-			we_have(j->piece);
-		}
-		else
-		{
-			// if the hash failed, remove it from the cache
-			if (m_storage)
-				m_ses.disk_thread().clear_piece(m_storage.get(), j->piece);
+			we_have(piece);
 		}
 
 		if (m_num_checked_pieces < m_torrent_file->num_pieces())
 		{
-			// we're not done yet, issue another job
+			// we're not done yet, issue more jobs
 			if (m_checking_piece >= m_torrent_file->num_pieces())
 			{
 				// actually, we already have outstanding jobs for
@@ -2610,32 +2622,17 @@ namespace libtorrent
 			if (!should_check_files())
 			{
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-				debug_log("on_piece_hashed, checking paused");
-#endif
-				return;
-			}
-
-			if (!need_loaded())
-			{
-#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING || defined TORRENT_ERROR_LOGGING
-				debug_log("on_piece_hashed, need_loaded failed");
+				debug_log("on_pieces_checked, checking paused");
 #endif
 				return;
 			}
 
-			inc_refcount("start_checking");
-			m_ses.disk_thread().async_hash(m_storage.get(), m_checking_piece++
-				, disk_io_job::sequential_access | disk_io_job::volatile_read
-				, boost::bind(&torrent::on_piece_hashed
-					, shared_from_this(), _1), (void*)1);
-#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-			debug_log("on_piece_hashed, m_checking_piece: %d", m_checking_piece);
-#endif
+			start_checking();
 			return;
 		}
 
 #if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_LOGGING
-		debug_log("on_piece_hashed, completed");
+		debug_log("on_pieces_checked, completed");
 #endif
 		// we're done checking!
 		files_checked();
@@ -2647,6 +2644,7 @@ namespace libtorrent
 		// reset the checking state
 		m_checking_piece = 0;
 		m_num_checked_pieces = 0;
+		m_checking_rate = 0;
 	}
 
 #ifndef TORRENT_NO_DEPRECATED
@@ -4967,6 +4965,10 @@ namespace libtorrent
 					read_piece(i->piece);
 				}
 
+				inc_stats_counter(time_now() > i->deadline
+					? counters::piece_deadlines_missed
+					: counters::piece_deadlines_met);
+
 				// if first_requested is min_time(), it wasn't requested as a critical piece
 				// and we shouldn't adjust any average download times
 				if (i->first_requested != min_time())
@@ -7057,7 +7059,8 @@ namespace libtorrent
 				}
 				else
 				{
-					torrent_peer* p = static_cast<torrent_peer*>(i->info[j].peer);
+					torrent_peer* p = static_cast<torrent_peer*>(
+						m_picker->block_peer(i->info[j]));
 					TORRENT_ASSERT(p->in_use);
 					if (p->connection)
 					{
@@ -10006,6 +10009,16 @@ namespace libtorrent
 		}
 	}
 
+	// the time we expect it to take until a block requested from p right now
+	// has been received. With use_estimates this includes the round-trip time
+	// of the request
+	time_duration block_delivery_time(peer_connection const* p
+		, int block_size, bool use_estimates)
+	{
+		return use_estimates ? p->block_arrival_time(block_size)
+			: p->download_queue_time(block_size);
+	}
+
 	void pick_time_critical_block(std::vector<peer_connection*>& peers
 		, std::vector<peer_connection*>& ignore_peers
 		, std::set<peer_connection*>& peers_with_requests
@@ -10013,7 +10026,10 @@ namespace libtorrent
 		, time_critical_piece* i
 		, piece_picker* picker
 		, int blocks_in_piece
-		, int timed_out)
+		, int timed_out
+		, int block_size
+		, bool use_estimates
+		, counters& cnt)
 	{
 		std::vector<piece_block> interesting_blocks;
 		std::vector<piece_block> backup1;
@@ -10110,6 +10126,18 @@ namespace libtorrent
 			bool already_requested = std::find_if(dq.begin(), dq.end()
 				, has_block(b)) != dq.end();
 
+			// a redundant request is only worth it if this peer is expected
+			// to deliver the block before the deadline. Since the peers are
+			// sorted by delivery time, no other peer will either
+			if (busy_mode && use_estimates && !already_requested
+				&& now + c.block_arrival_time(block_size) > i->deadline)
+			{
+#if TORRENT_DEBUG_STREAMING > 1
+				printf("no peer can deliver in time, done\n");
+#endif
+				break;
+			}
+
 			if (already_requested)
 			{
 				// if the piece is stalled, we may end up picking a block
@@ -10171,6 +10199,8 @@ namespace libtorrent
 				printf("requested block [%d, %d]\n"
 					, b.piece_index, b.block_index);
 #endif
+				if (busy_mode)
+					cnt.inc_stats_counter(counters::redundant_time_critical_requests);
 				peers_with_requests.insert(peers_with_requests.begin(), &c);
 			}
 
@@ -10189,8 +10219,9 @@ namespace libtorrent
 			}
 
 			// resort p, since it will have a higher download_queue_time now
-			while (p != peers.end()-1 && (*p)->download_queue_time()
-				> (*(p+1))->download_queue_time())
+			while (p != peers.end()-1
+				&& block_delivery_time(*p, block_size, use_estimates)
+				> block_delivery_time(*(p+1), block_size, use_estimates))
 			{
 				std::iter_swap(p, p+1);
 				++p;
@@ -10198,6 +10229,22 @@ namespace libtorrent
 		} while (!interesting_blocks.empty());
 	}
 
+	void torrent::defer_block_requests(peer_connection* c)
+	{
+		TORRENT_ASSERT(m_ses.is_single_thread());
+		if (m_deferred_requests.add(c->self()))
+		{
+			m_ses.get_io_service().post(boost::bind(
+				&torrent::request_deferred_blocks, shared_from_this()));
+		}
+	}
+
+	void torrent::request_deferred_blocks()
+	{
+		TORRENT_ASSERT(m_ses.is_single_thread());
+		m_deferred_requests.request_blocks();
+	}
+
 	void torrent::request_time_critical_pieces()
 	{
 		TORRENT_ASSERT(m_ses.is_single_thread());
@@ -10217,12 +10264,19 @@ namespace libtorrent
 		std::remove_copy_if(m_connections.begin(), m_connections.end()
 			, std::back_inserter(peers), !boost::bind(&peer_connection::can_request_time_critical, _1));
 
+		// in streaming mode, peers are ranked by when we expect a block
+		// requested now to arrive, which includes their round-trip time, and
+		// deadlines are compared against those estimates
+		bool const use_estimates = settings().get_bool(
+			settings_pack::streaming_deadline_estimates);
+		int const block = block_size();
+
 		// sort by the time we believe it will take this peer to send us all
 		// blocks we've requested from it. The shorter time, the better candidate
 		// it is to request a time critical block from.
 		std::sort(peers.begin(), peers.end()
-			, boost::bind(&peer_connection::download_queue_time, _1, 16*1024)
-			< boost::bind(&peer_connection::download_queue_time, _2, 16*1024));
+			, boost::bind(&block_delivery_time, _1, block, use_estimates)
+			< boost::bind(&block_delivery_time, _2, block, use_estimates));
 
 		// remove the bottom 10% of peers from the candidate set.
 		// this is just to remove outliers that might stall downloads
@@ -10266,8 +10320,18 @@ namespace libtorrent
 			// the +1000 is to compensate for the fact that we only call this
 			// function once per second, so if we need to request it 500 ms from
 			// now, we should request it right away
+			int horizon = m_average_piece_time + m_piece_time_deviation * 4;
+
+			// in streaming mode, also make sure to start requesting the piece
+			// no later than the fastest peer could download it in one go
+			if (use_estimates)
+			{
+				horizon = (std::max)(horizon, int(total_milliseconds(
+					peers[0]->block_arrival_time(m_torrent_file->piece_size(i->piece)))));
+			}
+
 			if (i != m_time_critical_pieces.begin() && i->deadline > now
-				+ milliseconds(m_average_piece_time + m_piece_time_deviation * 4 + 1000))
+				+ milliseconds(horizon + 1000))
 			{
 				// don't request pieces whose deadline is too far in the future
 				// this is one of the termination conditions. We don't want to
@@ -10306,6 +10370,13 @@ namespace libtorrent
 					timed_out = total_milliseconds(now - i->last_requested)
 						/ (std::max)(int(m_average_piece_time + m_piece_time_deviation / 2), 1);
 
+				// in streaming mode, don't wait for the piece to time out if a
+				// peer we requested a block from isn't expected to deliver it
+				// in time. Allow one more request for those blocks right away
+				if (use_estimates && timed_out == 0
+					&& deadline_at_risk(*m_picker, pi, blocks_in_piece, i->deadline, now))
+					timed_out = 1;
+
 #if TORRENT_DEBUG_STREAMING > 0
 				i->timed_out = timed_out;
 #endif
@@ -10343,7 +10414,8 @@ namespace libtorrent
 			pick_time_critical_block(peers, ignore_peers
 				, peers_with_requests
 				, pi, &*i, m_picker.get()
-				, blocks_in_piece, timed_out);
+				, blocks_in_piece, timed_out, block, use_estimates
+				, m_ses.stats_counters());
 
 			// put back the peers we ignored into the peer list for the next piece
 			if (!ignore_peers.empty())
@@ -10354,8 +10426,8 @@ namespace libtorrent
 				// TODO: instead of resorting the whole list, insert the peers
 				// directly into the right place
 				std::sort(peers.begin(), peers.end()
-					, boost::bind(&peer_connection::download_queue_time, _1, 16*1024)
-					< boost::bind(&peer_connection::download_queue_time, _2, 16*1024));
+					, boost::bind(&block_delivery_time, _1, block, use_estimates)
+					< boost::bind(&block_delivery_time, _2, block, use_estimates));
 			}
 
 			// if this peer's download time exceeds 2 seconds, we're done.
@@ -10842,7 +10914,7 @@ namespace libtorrent
 				if (info[k].state == piece_picker::block_info::state_requested)
 				{
 					block = 0;
-					torrent_peer* p = static_cast<torrent_peer*>(info[k].peer);
+					torrent_peer* p = static_cast<torrent_peer*>(m_picker->block_peer(info[k]));
 					if (p && p->connection)
 					{
 						peer_connection* peer = static_cast<peer_connection*>(p->connection);
@@ -11100,6 +11172,8 @@ namespace libtorrent
 		// transfer rate
 		st->download_rate = m_stat.download_rate();
 		st->upload_rate = m_stat.upload_rate();
+		st->checking_rate = m_state == torrent_status::checking_files
+			? m_checking_rate : 0;
 		st->download_payload_rate = m_stat.download_payload_rate();
 		st->upload_payload_rate = m_stat.upload_payload_rate();
 
@@ -96,6 +96,7 @@ namespace libtorrent
 		, queue_position(0)
 		, download_rate(0)
 		, upload_rate(0)
+		, checking_rate(0)
 		, download_payload_rate(0)
 		, upload_payload_rate(0)
 		, num_seeds(0)
@@ -140,6 +140,7 @@ namespace libtorrent
 		, last_optimistically_unchoked(0)
 		, last_connected(0)
 		, port(port)
+		, picker_slot(0)
 		, hashfails(0)
 		, failcount(0)
 		, connectable(conn)
@@ -771,6 +771,11 @@ int utp_stream::recv_delay() const
 	return m_impl ? m_impl->m_recv_delay : 0;
 }
 
+int utp_stream::rtt() const
+{
+	return m_impl ? m_impl->m_rtt.mean() : 0;
+}
+
 utp_stream::utp_stream(asio::io_service& io_service)
 	: m_io_service(io_service)
 	, m_impl(0)
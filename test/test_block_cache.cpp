@@ -37,6 +37,7 @@ POSSIBILITY OF SUCH DAMAGE.
 #include "libtorrent/disk_io_thread.hpp"
 #include "libtorrent/storage.hpp"
 #include "libtorrent/alert_dispatcher.hpp"
+#include "libtorrent/performance_counters.hpp"
 
 #include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
@@ -351,6 +352,20 @@ void test_arc_promote()
 	TEST_EQUAL(status.arc_write_size, 0);
 	TEST_EQUAL(status.arc_volatile_size, 0);
 
+	// inserting the block isn't a hit, both reads are. Each is counted
+	// in the list the piece was in when it was found
+	counters c;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::arc_mru_hits], 2);
+	TEST_EQUAL(c[counters::arc_mfu_hits], 0);
+
+	READ_BLOCK(0, 0, 3);
+	TEST_CHECK(ret >= 0);
+	RETURN_BUFFER;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::arc_mru_hits], 2);
+	TEST_EQUAL(c[counters::arc_mfu_hits], 1);
+
 	tailqueue jobs;
 	bc.clear(jobs);
 }
@@ -406,6 +421,49 @@ void test_arc_unghost()
 	bc.clear(jobs);
 }
 
+void test_arc_adaptive()
+{
+	TEST_SETUP;
+
+	// adaptive splitting is off by default
+	TEST_EQUAL(bc.write_cache_target(), -1);
+
+	sett.set_int(settings_pack::cache_size, 100);
+	sett.set_bool(settings_pack::adaptive_cache_split, true);
+	bc.set_settings(sett);
+
+	// the write cache starts out with half of the cache
+	TEST_EQUAL(bc.write_cache_target(), 50);
+
+	INSERT(0, 0);
+
+	tailqueue jobs;
+	bc.evict_piece(pe, jobs);
+
+	// a hit in the ghost list should grow the read cache at the
+	// expense of the write cache
+	bc.cache_hit(pe, (void*)1, false);
+	TEST_EQUAL(bc.write_cache_target(), 50 - pe->blocks_in_piece);
+
+	// reading back a block from a read piece doesn't affect the split
+	bc.write_cache_miss(pe, 1);
+	TEST_EQUAL(bc.write_cache_target(), 50 - pe->blocks_in_piece);
+
+	counters c;
+	bc.update_stats_counters(c);
+	TEST_EQUAL(c[counters::arc_mru_hits], 0);
+	TEST_EQUAL(c[counters::arc_mru_ghost_hits], 1);
+	TEST_EQUAL(c[counters::arc_mfu_hits], 0);
+	TEST_EQUAL(c[counters::arc_mfu_ghost_hits], 0);
+	TEST_EQUAL(c[counters::arc_write_target], 50 - pe->blocks_in_piece);
+
+	WRITE_BLOCK(1, 0);
+	bc.write_cache_miss(pe, 1);
+	TEST_EQUAL(bc.write_cache_target(), 51 - pe->blocks_in_piece);
+
+	bc.clear(jobs);
+}
+
 void test_iovec()
 {
 	TEST_SETUP;
@@ -442,6 +500,66 @@ void test_unaligned_read()
 	bc.clear(jobs);
 }
 
+void test_shards()
+{
+	TEST_SETUP;
+
+	test_storage_impl* st2 = new test_storage_impl;
+	boost::shared_ptr<piece_manager> pm2(boost::make_shared<piece_manager>(st2, boost::shared_ptr<int>(new int), &fs));
+	st2->m_settings = &sett;
+
+	int const shard1 = bc.shard_index(pm.get());
+	int const shard2 = bc.shard_index(pm2.get());
+	TEST_CHECK(shard1 >= 0 && shard1 < block_cache::num_shards);
+	TEST_CHECK(shard2 >= 0 && shard2 < block_cache::num_shards);
+	TEST_CHECK(&bc.cache_mutex(pm.get()) == &bc.shard_mutex(shard1));
+	TEST_CHECK(&bc.cache_mutex(&wj) == &bc.shard_mutex(shard1));
+
+	// one read block in the first storage
+	INSERT(0, 0);
+	TEST_EQUAL(bc.num_pieces(shard1), 1);
+	TEST_CHECK(bc.find_piece(pm.get(), 0) == pe);
+
+	// and one dirty block in the second
+	wj.storage = pm2;
+	WRITE_BLOCK(0, 0);
+	TEST_CHECK(pe != NULL);
+	TEST_CHECK(bc.find_piece(pm2.get(), 0) == pe);
+	TEST_CHECK(bc.find_piece(pm2.get(), 0) != bc.find_piece(pm.get(), 0));
+
+	// the stats are aggregated over all shards
+	bc.get_stats(&status);
+	TEST_EQUAL(status.read_cache_size, 1);
+	TEST_EQUAL(status.write_cache_size, 1);
+	TEST_EQUAL(status.arc_mru_size, 1);
+	TEST_EQUAL(status.arc_write_size, 1);
+
+	if (shard1 != shard2)
+	{
+		TEST_EQUAL(bc.num_pieces(shard1), 1);
+		TEST_EQUAL(bc.num_pieces(shard2), 1);
+
+		// evicting from the second storage's shard can't touch the
+		// read block in the first one, and the dirty block can't be evicted
+		ret = bc.try_evict_blocks(shard2, 1);
+		TEST_EQUAL(ret, 1);
+		bc.get_stats(&status);
+		TEST_EQUAL(status.read_cache_size, 1);
+	}
+
+	ret = bc.try_evict_blocks(shard1, 1);
+	TEST_EQUAL(ret, 0);
+	bc.get_stats(&status);
+	TEST_EQUAL(status.read_cache_size, 0);
+	TEST_EQUAL(status.write_cache_size, 1);
+
+	tailqueue jobs;
+	bc.clear(jobs);
+	TEST_EQUAL(jobs.size(), 1);
+	TEST_EQUAL(bc.num_pieces(shard1), 0);
+	TEST_EQUAL(bc.num_pieces(shard2), 0);
+}
+
 int test_main()
 {
 	test_write();
@@ -450,8 +568,10 @@ int test_main()
 	test_evict();
 	test_arc_promote();
 	test_arc_unghost();
+	test_arc_adaptive();
 	test_iovec();
 	test_unaligned_read();
+	test_shards();
 
 	// TODO: test try_evict_blocks
 	// TODO: test evicting volatile pieces, to see them be removed
@@ -34,9 +34,15 @@ POSSIBILITY OF SUCH DAMAGE.
 #include <vector>
 #include <utility>
 #include <set>
+#include <cctype>
 
 #include "libtorrent/buffer.hpp"
 #include "libtorrent/chained_buffer.hpp"
+#include "libtorrent/receive_buffer_pool.hpp"
+#include "libtorrent/receive_buffer.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/io.hpp"
+#include "libtorrent/pe_crypto.hpp"
 #include "libtorrent/socket.hpp"
 
 #include "test.hpp"
@@ -319,10 +325,496 @@ void test_chained_buffer()
 	TEST_CHECK(buffer_list.empty());
 }
 
+int num_file_ranges_freed = 0;
+
+void free_file_range(char* m, void* userdata, block_cache_reference ref)
+{
+	TEST_CHECK(m == NULL);
+	TEST_CHECK(userdata == (void*)0x1337);
+	++num_file_ranges_freed;
+}
+
+void test_chained_buffer_file()
+{
+	char data[] = "foobar";
+	{
+		chained_buffer b;
+
+		char* b1 = allocate_buffer(512);
+		std::memcpy(b1, data, 6);
+		b.append_buffer(b1, 512, 6, &free_buffer, (void*)0x1337);
+
+		b.append_file(42, 1000, 0x4000, &free_file_range, (void*)0x1337);
+		TEST_EQUAL(b.size(), 6 + 0x4000);
+		TEST_EQUAL(b.capacity(), 512 + 0x4000);
+
+		// nothing can be appended to a file range
+		TEST_EQUAL(b.space_in_last_buffer(), 0);
+		TEST_CHECK(b.append(data, 6) == NULL);
+
+		size_type offset = 0;
+		int size = 0;
+		TEST_EQUAL(b.front_file(offset, size), -1);
+
+		// the iovec stops at the file range
+		std::vector<asio::const_buffer> const& iovec = b.build_iovec(b.size());
+		TEST_EQUAL(iovec.size(), 1);
+		TEST_CHECK(compare_chained_buffer(b, "foo", 3));
+
+		b.pop_front(6);
+		TEST_CHECK(buffer_list.empty());
+		TEST_EQUAL(b.front_file(offset, size), 42);
+		TEST_EQUAL(offset, 1000);
+		TEST_EQUAL(size, 0x4000);
+		TEST_CHECK(b.build_iovec(b.size()).empty());
+
+		b.pop_front(100);
+		TEST_EQUAL(b.front_file(offset, size), 42);
+		TEST_EQUAL(offset, 1100);
+		TEST_EQUAL(size, 0x4000 - 100);
+		TEST_EQUAL(b.size(), 0x4000 - 100);
+		TEST_EQUAL(b.space_in_last_buffer(), 0);
+		TEST_EQUAL(num_file_ranges_freed, 0);
+
+		b.pop_front(0x4000 - 100);
+		TEST_CHECK(b.empty());
+		TEST_EQUAL(num_file_ranges_freed, 1);
+
+		// file ranges that were never sent are released too
+		b.append_file(42, 0, 0x4000, &free_file_range, (void*)0x1337);
+	}
+	TEST_EQUAL(num_file_ranges_freed, 2);
+}
+
+void to_upper(char* buf, int len, void* userdata)
+{
+	TEST_CHECK(userdata == (void*)0x1337);
+	for (int i = 0; i < len; ++i) buf[i] = toupper(buf[i]);
+}
+
+void test_chained_buffer_tail()
+{
+	char data[] = "foobar";
+	chained_buffer b;
+
+	// nothing to do on an empty tail
+	b.apply_to_tail(0, &to_upper, (void*)0x1337);
+
+	char* b1 = allocate_buffer(512);
+	std::memcpy(b1, data, 6);
+	b.append_buffer(b1, 512, 6, &free_buffer, (void*)0x1337);
+	b.apply_to_tail(2, &to_upper, (void*)0x1337);
+	TEST_CHECK(compare_chained_buffer(b, "foobAR", 6));
+
+	// the tail may span several buffers and start in the middle of one
+	b.append(data, 6);
+	char* b2 = allocate_buffer(6);
+	std::memcpy(b2, data, 6);
+	b.append_buffer(b2, 6, 6, &free_buffer, (void*)0x1337);
+	char* b3 = allocate_buffer(6);
+	std::memcpy(b3, data, 6);
+	b.append_buffer(b3, 6, 6, &free_buffer, (void*)0x1337);
+	b.apply_to_tail(15, &to_upper, (void*)0x1337);
+	TEST_CHECK(compare_chained_buffer(b, "foobARfooBARFOOBARFOOBAR", 24));
+
+	// the tail never reaches into bytes that have been popped
+	b.pop_front(20);
+	b.apply_to_tail(4, &to_upper, (void*)0x1337);
+	TEST_CHECK(compare_chained_buffer(b, "OBAR", 4));
+	b.pop_front(4);
+	TEST_CHECK(b.empty());
+}
+
+void test_chained_buffer_hold()
+{
+	char data[] = "foobar";
+	{
+		chained_buffer b;
+
+		char* b1 = allocate_buffer(6);
+		std::memcpy(b1, data, 6);
+		b.append_buffer(b1, 6, 6, &free_buffer, (void*)0x1337);
+		char* b2 = allocate_buffer(0x4000);
+		b.append_buffer(b2, 0x4000, 0x4000, &free_buffer, (void*)0x1337);
+		b.set_zero_copy_back();
+		char* b3 = allocate_buffer(6);
+		std::memcpy(b3, data, 6);
+		b.append_buffer(b3, 6, 6, &free_buffer, (void*)0x1337);
+
+		TEST_EQUAL(b.zero_copy_bytes(3), 0);
+		TEST_EQUAL(b.zero_copy_bytes(100), 94);
+		TEST_EQUAL(b.zero_copy_bytes(b.size()), 0x4000);
+
+		// buffers popped while holding are not freed until they're released
+		b.hold_popped(true, 1);
+		b.pop_front(6);
+		TEST_EQUAL(b.num_held(), 1);
+		TEST_EQUAL(buffer_list.size(), 3);
+		TEST_EQUAL(b.zero_copy_bytes(b.size()), 0x4000);
+
+		b.hold_popped(true, 2);
+		b.pop_front(0x4000);
+		TEST_EQUAL(b.num_held(), 2);
+		TEST_EQUAL(buffer_list.size(), 3);
+
+		b.release_held(0);
+		TEST_EQUAL(b.num_held(), 2);
+		b.release_held(1);
+		TEST_EQUAL(b.num_held(), 1);
+		TEST_EQUAL(buffer_list.size(), 2);
+		b.release_held(2);
+		TEST_EQUAL(b.num_held(), 0);
+		TEST_EQUAL(buffer_list.size(), 1);
+
+		// once no longer holding, popped buffers are freed right away
+		b.hold_popped(false);
+		b.pop_front(6);
+		TEST_EQUAL(b.num_held(), 0);
+		TEST_CHECK(buffer_list.empty());
+		TEST_CHECK(b.empty());
+
+		// tags wrap around
+		char* b4 = allocate_buffer(6);
+		b.append_buffer(b4, 6, 6, &free_buffer, (void*)0x1337);
+		b.hold_popped(true, 0xffffffff);
+		b.pop_front(6);
+		TEST_EQUAL(b.num_held(), 1);
+		b.release_held(0xfffffffe);
+		TEST_EQUAL(b.num_held(), 1);
+		b.release_held(0);
+		TEST_EQUAL(b.num_held(), 0);
+		TEST_CHECK(buffer_list.empty());
+
+		// clearing the chain (when the connection is closed) frees the
+		// buffers in it, but not the ones held for sends the kernel hasn't
+		// reported as done
+		char* b6 = allocate_buffer(6);
+		b.append_buffer(b6, 6, 6, &free_buffer, (void*)0x1337);
+		b.hold_popped(true, 1);
+		b.pop_front(6);
+		char* b7 = allocate_buffer(6);
+		b.append_buffer(b7, 6, 6, &free_buffer, (void*)0x1337);
+		TEST_EQUAL(b.num_held(), 1);
+		TEST_EQUAL(buffer_list.size(), 2);
+		b.clear();
+		TEST_CHECK(b.empty());
+		TEST_EQUAL(b.num_held(), 1);
+		TEST_EQUAL(buffer_list.size(), 1);
+		TEST_CHECK(buffer_list.count(b6) == 1);
+		b.release_held(1);
+		TEST_EQUAL(b.num_held(), 0);
+		TEST_CHECK(buffer_list.empty());
+
+		// buffers still held when the chain is destructed are freed
+		char* b5 = allocate_buffer(6);
+		b.append_buffer(b5, 6, 6, &free_buffer, (void*)0x1337);
+		b.hold_popped(true, 1);
+		b.pop_front(6);
+		TEST_EQUAL(b.num_held(), 1);
+	}
+	TEST_CHECK(buffer_list.empty());
+}
+
+void test_receive_buffer_pool()
+{
+	receive_buffer_pool pool;
+	pool.set_limits(2, 1024);
+
+	// an empty buffer has nothing to give back
+	buffer b0;
+	pool.release(b0);
+	TEST_EQUAL(pool.size(), 0);
+
+	// the pool is empty, acquire leaves the buffer without memory
+	pool.acquire(b0);
+	TEST_EQUAL(b0.capacity(), 0);
+
+	buffer b1(100);
+	char* mem1 = b1.begin();
+	pool.release(b1);
+	TEST_EQUAL(b1.capacity(), 0);
+	TEST_EQUAL(b1.size(), 0);
+	TEST_EQUAL(pool.size(), 1);
+
+	// buffers that are too large aren't kept
+	buffer b2(2048);
+	pool.release(b2);
+	TEST_EQUAL(b2.capacity(), 0);
+	TEST_EQUAL(pool.size(), 1);
+
+	// neither are buffers exceeding the max number of buffers
+	buffer b3(200);
+	buffer b4(300);
+	pool.release(b3);
+	pool.release(b4);
+	TEST_EQUAL(b4.capacity(), 0);
+	TEST_EQUAL(pool.size(), 2);
+
+	// a buffer that already has memory keeps it
+	buffer b5(10);
+	char* mem5 = b5.begin();
+	pool.acquire(b5);
+	TEST_CHECK(b5.begin() == mem5);
+	TEST_EQUAL(pool.size(), 2);
+
+	pool.acquire(b0);
+	TEST_EQUAL(b0.capacity(), 200);
+	TEST_EQUAL(b0.size(), 0);
+	pool.acquire(b1);
+	TEST_CHECK(b1.begin() == mem1);
+	TEST_EQUAL(b1.capacity(), 100);
+	TEST_EQUAL(pool.size(), 0);
+
+	pool.release(b0);
+	pool.release(b1);
+	TEST_EQUAL(pool.size(), 2);
+
+	// lowering the limits frees buffers right away
+	pool.set_limits(2, 150);
+	TEST_EQUAL(pool.size(), 1);
+	pool.acquire(b2);
+	TEST_EQUAL(b2.capacity(), 100);
+	pool.release(b2);
+	pool.set_limits(0, 150);
+	TEST_EQUAL(pool.size(), 0);
+}
+
+struct test_allocator : buffer_allocator_interface
+{
+	char* allocate_disk_buffer(char const*) { return (char*)malloc(0x4000); }
+	void free_disk_buffer(char* b) { free(b); }
+	void reclaim_block(block_cache_reference) {}
+	char* allocate_disk_buffer(bool& exceeded
+		, boost::shared_ptr<disk_observer>, char const* category)
+	{
+		exceeded = false;
+		return allocate_disk_buffer(category);
+	}
+	char* async_allocate_disk_buffer(char const* category
+		, boost::function<void(char*)> const&)
+	{ return allocate_disk_buffer(category); }
+};
+
+// a piece message for block 2 of piece 1, with a 16 kiB payload
+std::vector<char> piece_message()
+{
+	std::vector<char> ret(13 + 0x4000);
+	char* ptr = &ret[0];
+	detail::write_int32(9 + 0x4000, ptr);
+	detail::write_uint8(7, ptr);
+	detail::write_int32(1, ptr);
+	detail::write_int32(0x8000, ptr);
+	for (int i = 0; i < 0x4000; ++i) ret[13 + i] = char(i * 7);
+	return ret;
+}
+
+// copies the next bytes of 'stream' into the buffers returned by
+// receive_buffer::reserve(), the way a read from the socket would
+int receive(receive_buffer& rb, char const* stream, int size)
+{
+	boost::array<asio::mutable_buffer, 2> vec;
+	int num_bufs = rb.reserve(vec, size);
+	for (int i = 0; i < num_bufs; ++i)
+	{
+		int n = asio::buffer_size(vec[i]);
+		memcpy(asio::buffer_cast<char*>(vec[i]), stream, n);
+		stream += n;
+	}
+	rb.received(size);
+	return num_bufs;
+}
+
+#ifndef TORRENT_DISABLE_ENCRYPTION
+void decrypt_last(receive_buffer& rb, rc4_handler& rc4, int bytes)
+{
+	std::pair<buffer::interval, buffer::interval> wr_buf = rb.mutable_buffers(bytes);
+	rc4.decrypt(wr_buf.first.begin, wr_buf.first.left());
+	if (wr_buf.second.left()) rc4.decrypt(wr_buf.second.begin, wr_buf.second.left());
+}
+#endif
+
+// receives a piece message with a speculative read, passing it on to
+// the protocol layer the way bt_peer_connection does. The first read
+// receives 'first_read' bytes, the rest is received with a second one
+void test_speculative_piece(int first_read, bool encrypted)
+{
+	test_allocator alloc;
+	counters cnt;
+	receive_buffer rb(alloc, cnt);
+	rb.reset(5);
+
+	std::vector<char> msg = piece_message();
+	std::vector<char> stream = msg;
+#ifndef TORRENT_DISABLE_ENCRYPTION
+	rc4_handler enc;
+	rc4_handler dec;
+	if (encrypted)
+	{
+		unsigned char key[20];
+		memset(key, 0x42, sizeof(key));
+		enc.set_outgoing_key(key, sizeof(key));
+		dec.set_incoming_key(key, sizeof(key));
+		enc.encrypt(&stream[0], stream.size());
+	}
+#endif
+
+	rb.speculate(alloc.allocate_disk_buffer("receive buffer"), 13);
+	TEST_CHECK(rb.has_spec_buffer());
+	TEST_EQUAL(receive(rb, &stream[0], first_read), 2);
+
+	// the length prefix and message id
+	int bytes = first_read;
+	int sub = rb.advance_pos(bytes);
+	TEST_EQUAL(sub, 5);
+	bytes -= sub;
+#ifndef TORRENT_DISABLE_ENCRYPTION
+	if (encrypted) decrypt_last(rb, dec, sub);
+#endif
+	TEST_CHECK(memcmp(rb.get().begin, &msg[0], 5) == 0);
+
+	// the message turns out to be a piece message. Its payload is already
+	// in the speculative disk buffer
+	rb.cut(4, 9 + 0x4000);
+	TEST_CHECK(rb.adopt_spec_buffer(0x4000));
+	TEST_CHECK(rb.has_disk_buffer());
+	TEST_CHECK(!rb.has_spec_buffer());
+
+	sub = rb.advance_pos(bytes);
+	TEST_EQUAL(sub, bytes);
+#ifndef TORRENT_DISABLE_ENCRYPTION
+	if (encrypted) decrypt_last(rb, dec, sub);
+#endif
+	TEST_CHECK(memcmp(rb.get().begin, &msg[4], 9) == 0);
+
+	if (first_read < int(msg.size()))
+	{
+		TEST_CHECK(!rb.packet_finished());
+		rb.normalize();
+		TEST_EQUAL(rb.max_receive(), int(msg.size()) - first_read);
+		TEST_EQUAL(receive(rb, &stream[first_read], msg.size() - first_read), 1);
+		sub = rb.advance_pos(msg.size() - first_read);
+		TEST_EQUAL(sub, int(msg.size()) - first_read);
+#ifndef TORRENT_DISABLE_ENCRYPTION
+		if (encrypted) decrypt_last(rb, dec, sub);
+#endif
+		TEST_CHECK(memcmp(rb.get().begin, &msg[4], 9) == 0);
+	}
+	TEST_CHECK(rb.packet_finished());
+
+	char* disk_buffer = rb.release_disk_buffer();
+	TEST_CHECK(disk_buffer != 0);
+	TEST_CHECK(memcmp(disk_buffer, &msg[13], 0x4000) == 0);
+	alloc.free_disk_buffer(disk_buffer);
+	TEST_EQUAL(cnt[counters::recv_zero_copy_bytes], 0x4000);
+	TEST_EQUAL(cnt[counters::recv_copied_bytes], 0);
+
+	rb.reset(5);
+	rb.normalize();
+	TEST_CHECK(rb.empty());
+}
+
+void test_receive_buffer_spec_copy()
+{
+	test_allocator alloc;
+	counters cnt;
+	receive_buffer rb(alloc, cnt);
+	rb.reset(5);
+
+	// have (9 bytes), unchoke (5 bytes) and a 1 byte bitfield (6 bytes)
+	char const stream[] = "\0\0\0\x05\x04\0\0\0\x03"
+		"\0\0\0\x01\x01"
+		"\0\0\0\x02\x05\xab";
+
+	// 13 bytes are received into the regular buffer and 7 into the
+	// speculative disk buffer
+	rb.speculate(alloc.allocate_disk_buffer("receive buffer"), 13);
+	TEST_EQUAL(receive(rb, stream, 20), 2);
+
+	TEST_EQUAL(rb.advance_pos(20), 5);
+	rb.cut(4, 5);
+	// the have message isn't a piece, there's no disk buffer to adopt
+	TEST_EQUAL(rb.advance_pos(15), 4);
+	TEST_CHECK(rb.has_spec_buffer());
+	TEST_CHECK(memcmp(rb.get().begin, stream + 4, 5) == 0);
+	rb.reset(5);
+
+	// passing on the unchoke message reaches into the speculative disk
+	// buffer. It's copied back into the regular buffer
+	TEST_EQUAL(rb.advance_pos(11), 5);
+	TEST_CHECK(!rb.has_spec_buffer());
+	TEST_EQUAL(cnt[counters::recv_copied_bytes], 7);
+	TEST_CHECK(memcmp(rb.get().begin, stream + 9, 5) == 0);
+	rb.cut(4, 1);
+	TEST_CHECK(rb.packet_finished());
+	rb.reset(5);
+
+	TEST_EQUAL(rb.advance_pos(6), 5);
+	TEST_CHECK(memcmp(rb.get().begin, stream + 14, 5) == 0);
+	rb.cut(4, 2);
+	TEST_EQUAL(rb.advance_pos(1), 1);
+	TEST_CHECK(memcmp(rb.get().begin, stream + 18, 2) == 0);
+	TEST_CHECK(rb.packet_finished());
+	rb.reset(5);
+
+	rb.normalize();
+	TEST_CHECK(rb.empty());
+	TEST_EQUAL(cnt[counters::recv_zero_copy_bytes], 0);
+}
+
+void test_receive_buffer_spec_cut()
+{
+	test_allocator alloc;
+	counters cnt;
+	receive_buffer rb(alloc, cnt);
+	rb.reset(20);
+
+	char stream[16];
+	for (int i = 0; i < 16; ++i) stream[i] = char('a' + i);
+
+	// 3 bytes are received into the speculative disk buffer
+	rb.speculate(alloc.allocate_disk_buffer("receive buffer"), 13);
+	TEST_EQUAL(receive(rb, stream, 16), 2);
+	TEST_EQUAL(rb.advance_pos(10), 10);
+
+	// cutting bytes out of the middle of the message moves the offset
+	// the speculative disk buffer stands in for along with them
+	rb.cut(2, 18, 3);
+	TEST_CHECK(rb.has_spec_buffer());
+	TEST_EQUAL(rb.pos(), 8);
+
+	TEST_EQUAL(rb.advance_pos(6), 6);
+	TEST_CHECK(!rb.has_spec_buffer());
+	TEST_EQUAL(cnt[counters::recv_copied_bytes], 3);
+	buffer::const_interval recv = rb.get();
+	TEST_EQUAL(recv.left(), 14);
+	TEST_CHECK(memcmp(recv.begin, stream, 3) == 0);
+	TEST_CHECK(memcmp(recv.begin + 3, stream + 5, 11) == 0);
+}
+
+void test_receive_buffer()
+{
+	// the whole message is received with the speculative read
+	test_speculative_piece(13 + 0x4000, false);
+	// the speculative read is cut short, the rest of the payload is
+	// received into the adopted disk buffer
+	test_speculative_piece(13 + 1000, false);
+#ifndef TORRENT_DISABLE_ENCRYPTION
+	test_speculative_piece(13 + 0x4000, true);
+	test_speculative_piece(13 + 1000, true);
+#endif
+	test_receive_buffer_spec_copy();
+	test_receive_buffer_spec_cut();
+}
+
 int test_main()
 {
 	test_buffer();
 	test_chained_buffer();
+	test_chained_buffer_file();
+	test_chained_buffer_tail();
+	test_chained_buffer_hold();
+	test_receive_buffer_pool();
+	test_receive_buffer();
 	return 0;
 }
 
@@ -0,0 +1,169 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "setup_transfer.hpp"
+#include "libtorrent/create_torrent.hpp"
+#include "libtorrent/torrent_info.hpp"
+#include "libtorrent/file.hpp"
+#include "libtorrent/hasher.hpp"
+#include "libtorrent/bencode.hpp"
+
+#include <boost/bind.hpp>
+
+using namespace libtorrent;
+
+namespace
+{
+	// the last file is empty, and the total size is not a multiple of
+	// the piece size
+	const int file_sizes[] =
+	{ 5, 16 - 5, 16000, 17, 10, 8000, 8000, 1,1,1,1,1,100,1,1,1,1,100,1,1,1,1,1,1
+		,1,1,1,1,1,1,13,65000,34,75,2,30,400,500,23000,900,43000,400,4300,6
+		, 300000, 1000000, 0};
+	const int num_files = sizeof(file_sizes)/sizeof(file_sizes[0]);
+
+	void count_progress(int p, int* counter)
+	{
+		TEST_EQUAL(p, *counter);
+		++*counter;
+	}
+
+	boost::shared_ptr<torrent_info> make_torrent(int flags, int piece_size
+		, error_code& ec)
+	{
+		// the optimize flag reorders the files and adds pad files, so every
+		// torrent needs its own file_storage
+		file_storage fs;
+		add_files(fs, combine_path("tmp1_create_torrent", "test_torrent_dir"));
+		libtorrent::create_torrent t(fs, piece_size, 0x4000, flags);
+		int progress = 0;
+		set_piece_hashes(t, "tmp1_create_torrent"
+			, boost::bind(&count_progress, _1, &progress), ec);
+		if (ec) return boost::shared_ptr<torrent_info>();
+		TEST_EQUAL(progress, t.num_pieces());
+
+		std::vector<char> buf;
+		bencode(std::back_inserter(buf), t.generate());
+		return boost::shared_ptr<torrent_info>(new torrent_info(&buf[0], buf.size(), ec));
+	}
+
+	sha1_hash hash_file(std::string const& path)
+	{
+		hasher h;
+		error_code ec;
+		file f(path, file::read_only, ec);
+		TEST_CHECK(!ec);
+		char buf[4096];
+		size_type offset = 0;
+		for (;;)
+		{
+			file::iovec_t b = { buf, sizeof(buf) };
+			int ret = int(f.readv(offset, &b, 1, ec));
+			if (ret <= 0) break;
+			h.update(buf, ret);
+			offset += ret;
+		}
+		return h.final();
+	}
+
+	void test_piece_size(int piece_size, int flags)
+	{
+		fprintf(stderr, "piece size: %d flags: %x\n", piece_size, flags);
+
+		error_code ec;
+		boost::shared_ptr<torrent_info> reference = make_torrent(flags, piece_size, ec);
+		if (ec) fprintf(stderr, "ERROR: set_piece_hashes: (%d) %s\n"
+			, ec.value(), ec.message().c_str());
+		TEST_CHECK(!ec);
+
+		boost::shared_ptr<torrent_info> ti = make_torrent(
+			flags | libtorrent::create_torrent::parallel_hashing, piece_size, ec);
+		if (ec) fprintf(stderr, "ERROR: set_piece_hashes: (%d) %s\n"
+			, ec.value(), ec.message().c_str());
+		TEST_CHECK(!ec);
+		if (!ti || !reference) return;
+
+		TEST_EQUAL(ti->num_pieces(), reference->num_pieces());
+		for (int i = 0; i < ti->num_pieces(); ++i)
+			TEST_EQUAL(ti->hash_for_piece(i), reference->hash_for_piece(i));
+		TEST_EQUAL(ti->info_hash(), reference->info_hash());
+
+		ti = make_torrent(flags | libtorrent::create_torrent::calculate_file_hashes
+			, piece_size, ec);
+		TEST_CHECK(!ec);
+		if (!ti) return;
+
+		for (int i = 0; i < ti->num_pieces(); ++i)
+			TEST_EQUAL(ti->hash_for_piece(i), reference->hash_for_piece(i));
+
+		file_storage const& files = ti->files();
+		for (int i = 0; i < files.num_files(); ++i)
+		{
+			if (files.pad_file_at(i)) continue;
+			TEST_EQUAL(files.hash(i), hash_file(files.file_path(i, "tmp1_create_torrent")));
+		}
+	}
+}
+
+int test_main()
+{
+	error_code ec;
+	remove_all("tmp1_create_torrent", ec);
+	create_directory("tmp1_create_torrent", ec);
+	create_directory(combine_path("tmp1_create_torrent", "test_torrent_dir"), ec);
+
+	std::srand(10);
+	create_random_files(combine_path("tmp1_create_torrent", "test_torrent_dir")
+		, file_sizes, num_files);
+
+	test_piece_size(0x4000, 0);
+	test_piece_size(0x4000, libtorrent::create_torrent::optimize);
+	test_piece_size(0x10000, 0);
+	// pieces larger than the chunks the parallel reader aims for
+	test_piece_size(8 * 1024 * 1024, 0);
+
+	// a missing file is reported as an error
+	file_storage fs;
+	add_files(fs, combine_path("tmp1_create_torrent", "test_torrent_dir"));
+	remove(combine_path("tmp1_create_torrent", combine_path("test_torrent_dir"
+		, combine_path("test_dir2", "test10"))), ec);
+	TEST_CHECK(!ec);
+
+	libtorrent::create_torrent t(fs, 0x4000, -1, libtorrent::create_torrent::parallel_hashing);
+	set_piece_hashes(t, "tmp1_create_torrent", ec);
+	TEST_CHECK(ec);
+
+	remove_all("tmp1_create_torrent", ec);
+	return 0;
+}
+
@@ -0,0 +1,148 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/disk_arena.hpp"
+#include "libtorrent/thread.hpp"
+
+#include <set>
+#include <vector>
+#include <boost/bind.hpp>
+
+using namespace libtorrent;
+
+void test_allocate()
+{
+	disk_arena a;
+	TEST_CHECK(!a.is_open());
+
+	error_code ec;
+	// 200 blocks of 16 kiB spans two 2 MiB pages
+	a.open(0x4000, 200, ec);
+	TEST_CHECK(!ec);
+	if (ec) return;
+	TEST_CHECK(a.is_open());
+	TEST_EQUAL(a.num_blocks(), 200);
+	TEST_EQUAL(a.num_free(), 200);
+	TEST_EQUAL(a.fragmented_pages(), 0);
+
+	std::set<char*> blocks;
+	for (int i = 0; i < 200; ++i)
+	{
+		char* b = a.allocate();
+		TEST_CHECK(b != NULL);
+		TEST_CHECK(a.contains(b));
+		TEST_CHECK(blocks.insert(b).second);
+		// make sure the memory is actually usable
+		memset(b, i, 0x4000);
+	}
+	TEST_EQUAL(a.num_free(), 0);
+	TEST_CHECK(a.allocate() == NULL);
+
+	// the first page is full, and so is the second one (which only has
+	// 72 blocks in it)
+	TEST_EQUAL(a.fragmented_pages(), 0);
+
+	char* first = *blocks.begin();
+	a.free(first);
+	TEST_EQUAL(a.num_free(), 1);
+	TEST_EQUAL(a.fragmented_pages(), 1);
+
+	// the block we just freed is the one handed out next
+	TEST_CHECK(a.allocate() == first);
+	TEST_EQUAL(a.fragmented_pages(), 0);
+
+	char buf[10];
+	TEST_CHECK(!a.contains(buf));
+
+	for (std::set<char*>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+		a.free(*i);
+	TEST_EQUAL(a.num_free(), 200);
+	TEST_EQUAL(a.fragmented_pages(), 0);
+
+	a.close();
+	TEST_CHECK(!a.is_open());
+}
+
+void allocate_and_free(disk_arena* a, int rounds)
+{
+	std::vector<char*> held;
+	for (int i = 0; i < rounds; ++i)
+	{
+		for (int k = 0; k < 8; ++k)
+		{
+			char* b = a->allocate();
+			if (b == NULL) break;
+			// if two threads got the same block, this will be caught by
+			// the check in the other thread
+			memset(b, 0, 4);
+			memcpy(b, &b, sizeof(b));
+			held.push_back(b);
+		}
+		for (std::vector<char*>::iterator j = held.begin(); j != held.end(); ++j)
+		{
+			char* b = *j;
+			char* stored;
+			memcpy(&stored, b, sizeof(stored));
+			TEST_CHECK(stored == b);
+			a->free(b);
+		}
+		held.clear();
+	}
+}
+
+void test_threads()
+{
+	disk_arena a;
+	error_code ec;
+	a.open(0x4000, 64, ec);
+	TEST_CHECK(!ec);
+	if (ec) return;
+
+	thread t1(boost::bind(&allocate_and_free, &a, 10000));
+	thread t2(boost::bind(&allocate_and_free, &a, 10000));
+	thread t3(boost::bind(&allocate_and_free, &a, 10000));
+	t1.join();
+	t2.join();
+	t3.join();
+
+	TEST_EQUAL(a.num_free(), 64);
+	TEST_EQUAL(a.fragmented_pages(), 0);
+}
+
+int test_main()
+{
+	test_allocate();
+	test_threads();
+	return 0;
+}
+
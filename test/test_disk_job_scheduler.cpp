@@ -0,0 +1,250 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/disk_job_scheduler.hpp"
+#include "libtorrent/disk_io_job.hpp"
+
+#include <boost/shared_ptr.hpp>
+
+using namespace libtorrent;
+
+namespace
+{
+	// the scheduler only uses the storage pointer to tell storages apart,
+	// these are never dereferenced
+	char storage_ids[4];
+
+	struct null_deleter { void operator()(void const*) const {} };
+
+	boost::shared_ptr<piece_manager> fake_storage(int i)
+	{
+		return boost::shared_ptr<piece_manager>(
+			reinterpret_cast<piece_manager*>(&storage_ids[i]), null_deleter());
+	}
+
+	void init_jobs(disk_io_job* jobs, int num, int action, int storage)
+	{
+		for (int i = 0; i < num; ++i)
+		{
+			jobs[i].action = action;
+			jobs[i].storage = fake_storage(storage);
+			jobs[i].piece = i;
+		}
+	}
+}
+
+void test_job_classes()
+{
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::read)
+		== disk_job_scheduler::read_class);
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::write)
+		== disk_job_scheduler::write_class);
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::flush_hashed)
+		== disk_job_scheduler::write_class);
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::hash)
+		== disk_job_scheduler::hash_class);
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::check_pieces)
+		== disk_job_scheduler::maintenance_class);
+	TEST_CHECK(disk_job_scheduler::job_class(disk_io_job::move_storage)
+		== disk_job_scheduler::maintenance_class);
+}
+
+void test_storage_turns()
+{
+	disk_job_scheduler s;
+	disk_io_job a[6];
+	disk_io_job b[2];
+	init_jobs(a, 6, disk_io_job::read, 0);
+	init_jobs(b, 2, disk_io_job::read, 1);
+
+	for (int i = 0; i < 6; ++i) s.push_back(&a[i]);
+	for (int i = 0; i < 2; ++i) s.push_back(&b[i]);
+	TEST_EQUAL(s.size(), 8);
+	TEST_EQUAL(s.size(disk_job_scheduler::read_class), 8);
+
+	// the storages take turns, and each storage's jobs run in order
+	disk_io_job* expected[] = { &a[0], &b[0], &a[1], &b[1], &a[2], &a[3], &a[4], &a[5] };
+	for (int i = 0; i < 8; ++i)
+	{
+		TEST_CHECK(s.peek(disk_job_scheduler::read_class) == expected[i]);
+		TEST_CHECK(s.pop_front() == expected[i]);
+	}
+	TEST_CHECK(s.empty());
+	TEST_CHECK(s.pop_front() == NULL);
+	TEST_CHECK(s.peek(disk_job_scheduler::read_class) == NULL);
+}
+
+void test_class_weights()
+{
+	disk_job_scheduler s;
+	s.set_weight(disk_job_scheduler::read_class, 8);
+	s.set_weight(disk_job_scheduler::maintenance_class, 1);
+
+	disk_io_job reads[100];
+	disk_io_job checks[100];
+	init_jobs(reads, 100, disk_io_job::read, 0);
+	init_jobs(checks, 100, disk_io_job::check_pieces, 1);
+	for (int i = 0; i < 100; ++i) s.push_back(&checks[i]);
+	for (int i = 0; i < 100; ++i) s.push_back(&reads[i]);
+
+	// the maintenance jobs were queued first, but only get one in nine
+	// turns
+	int num_reads = 0;
+	for (int i = 0; i < 90; ++i)
+	{
+		disk_io_job* j = s.pop_front();
+		if (j->action == disk_io_job::read) ++num_reads;
+	}
+	TEST_EQUAL(num_reads, 80);
+	TEST_EQUAL(s.size(disk_job_scheduler::read_class), 20);
+	TEST_EQUAL(s.size(disk_job_scheduler::maintenance_class), 90);
+
+	// a class that's been idle doesn't get to catch up. Run the
+	// maintenance jobs on their own for a while, then queue up more reads
+	while (s.size(disk_job_scheduler::read_class) > 0)
+		s.pop_front(disk_job_scheduler::read_class);
+	for (int i = 0; i < 40; ++i) s.pop_front();
+	TEST_EQUAL(s.size(disk_job_scheduler::maintenance_class), 50);
+
+	disk_io_job more_reads[64];
+	init_jobs(more_reads, 64, disk_io_job::read, 0);
+	for (int i = 0; i < 64; ++i) s.push_back(&more_reads[i]);
+	num_reads = 0;
+	for (int i = 0; i < 18; ++i)
+	{
+		disk_io_job* j = s.pop_front();
+		if (j->action == disk_io_job::read) ++num_reads;
+	}
+	TEST_CHECK(num_reads >= 14);
+	TEST_CHECK(num_reads < 18);
+
+	tailqueue left;
+	s.remove_jobs(fake_storage(0).get(), left);
+	s.remove_jobs(fake_storage(1).get(), left);
+	TEST_CHECK(s.empty());
+	TEST_EQUAL(left.size(), 50 + 64 - 18);
+	left.get_all();
+}
+
+void test_urgent_and_remove()
+{
+	disk_job_scheduler s;
+	disk_io_job a[3];
+	disk_io_job b[3];
+	disk_io_job fence;
+	init_jobs(a, 3, disk_io_job::write, 0);
+	init_jobs(b, 3, disk_io_job::hash, 1);
+	fence.action = disk_io_job::release_files;
+	fence.storage = fake_storage(1);
+
+	tailqueue jobs;
+	for (int i = 0; i < 3; ++i) jobs.push_back(&a[i]);
+	for (int i = 0; i < 3; ++i) jobs.push_back(&b[i]);
+	s.append(jobs);
+	TEST_CHECK(jobs.empty());
+	s.push_front(&fence);
+	TEST_EQUAL(s.size(), 7);
+	TEST_EQUAL(s.size(disk_job_scheduler::write_class), 3);
+	TEST_EQUAL(s.size(disk_job_scheduler::hash_class), 3);
+	TEST_EQUAL(s.size(disk_job_scheduler::maintenance_class), 0);
+
+	// removing the jobs of storage 1 takes the fence job too
+	tailqueue removed;
+	s.remove_jobs(fake_storage(1).get(), removed);
+	TEST_EQUAL(removed.size(), 4);
+	TEST_EQUAL(s.size(), 3);
+	TEST_EQUAL(s.size(disk_job_scheduler::hash_class), 0);
+	removed.get_all();
+
+	// jobs pushed to the front run before anything else
+	fence.next = NULL;
+	s.push_front(&fence);
+	TEST_CHECK(s.pop_front() == &fence);
+	for (int i = 0; i < 3; ++i)
+		TEST_CHECK(s.pop_front() == &a[i]);
+	TEST_CHECK(s.empty());
+}
+
+void test_elevator_order()
+{
+	// piece, offset, storage
+	int const reads[][3] = {
+		{ 7, 0x4000, 0 },
+		{ 2, 0x8000, 1 },
+		{ 7, 0x0000, 0 },
+		{ 3, 0x0000, 0 },
+		{ 7, 0x8000, 0 },
+		{ 2, 0x4000, 1 },
+		{ 7, 0x4000, 0 },
+	};
+	int const num_reads = sizeof(reads) / sizeof(reads[0]);
+
+	disk_io_job jobs[num_reads];
+	disk_io_job* sorted[num_reads];
+	for (int i = 0; i < num_reads; ++i)
+	{
+		jobs[i].action = disk_io_job::read;
+		jobs[i].piece = reads[i][0];
+		jobs[i].d.io.offset = reads[i][1];
+		jobs[i].d.io.buffer_size = 0x4000;
+		jobs[i].storage = fake_storage(reads[i][2]);
+		sorted[i] = &jobs[i];
+	}
+
+	disk_job_scheduler::sort_reads(sorted, num_reads);
+
+	// the reads are grouped by storage, and ordered by piece and offset.
+	// The two reads of the same block keep their order
+	int const order[] = { 3, 2, 0, 6, 4, 5, 1 };
+	for (int i = 0; i < num_reads; ++i)
+		TEST_CHECK(sorted[i] == &jobs[order[i]]);
+
+	// piece 3 is on its own, piece 7 has two adjacent reads, then a
+	// read of the same block again and the block after it
+	TEST_EQUAL(disk_job_scheduler::contiguous_reads(sorted, num_reads), 1);
+	TEST_EQUAL(disk_job_scheduler::contiguous_reads(sorted + 1, num_reads - 1), 2);
+	TEST_EQUAL(disk_job_scheduler::contiguous_reads(sorted + 3, num_reads - 3), 2);
+	TEST_EQUAL(disk_job_scheduler::contiguous_reads(sorted + 5, num_reads - 5), 2);
+	// a run never reaches into another storage
+	TEST_EQUAL(disk_job_scheduler::contiguous_reads(sorted + 4, 2), 1);
+}
+
+int test_main()
+{
+	test_job_classes();
+	test_storage_turns();
+	test_class_weights();
+	test_urgent_and_remove();
+	test_elevator_order();
+	return 0;
+}
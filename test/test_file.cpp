@@ -31,6 +31,7 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/file.hpp"
+#include "libtorrent/io_uring.hpp"
 #include "test.hpp"
 #include "setup_transfer.hpp" // for test_sleep
 #include <string.h> // for strcmp
@@ -103,10 +104,80 @@ void test_stat()
 	TEST_CHECK(diff >= 2 && diff <= 4);
 }
 
+void test_io_uring()
+{
+	error_code ec;
+	io_uring_queue q;
+	q.open(4, ec);
+	if (ec)
+	{
+		// not built with io_uring support, or the kernel doesn't support it
+		fprintf(stderr, "io_uring not available: %s\n", ec.message().c_str());
+		TEST_CHECK(!q.is_open());
+		libtorrent::file_handle f(new file);
+		file::iovec_t b = {(void*)"test", 4};
+		q.reset(1);
+		TEST_CHECK(!q.prep_writev(f, 0, &b, 1, 0, 0));
+		return;
+	}
+	TEST_CHECK(q.is_open());
+
+	libtorrent::file_handle f(new file("test_io_uring", file::read_write, ec));
+	TEST_CHECK(!ec);
+	if (ec) return;
+
+	// queue more writes than there are entries in the ring
+	char bufs[16][1024];
+	q.reset(16);
+	for (int i = 0; i < 16; ++i)
+	{
+		memset(bufs[i], 'a' + i, sizeof(bufs[i]));
+		file::iovec_t b = { bufs[i], sizeof(bufs[i]) };
+		TEST_CHECK(q.prep_writev(f, i * sizeof(bufs[i]), &b, 1, i, 0));
+	}
+	TEST_EQUAL(q.submit_and_wait(), 16);
+	TEST_EQUAL(q.num_pending(), 0);
+	for (int i = 0; i < 16; ++i)
+	{
+		TEST_CHECK(!q.error(i));
+		TEST_EQUAL(q.bytes_transferred(i), int(sizeof(bufs[i])));
+	}
+
+	// read it all back in two operations tagged with the same slot
+	char read_bufs[16][1024];
+	memset(read_bufs, 0, sizeof(read_bufs));
+	file::iovec_t iov[16];
+	for (int i = 0; i < 16; ++i)
+	{
+		iov[i].iov_base = read_bufs[i];
+		iov[i].iov_len = sizeof(read_bufs[i]);
+	}
+	q.reset(1);
+	TEST_CHECK(q.prep_readv(f, 0, iov, 8, 0, 0));
+	TEST_CHECK(q.prep_readv(f, 8 * sizeof(read_bufs[0]), iov + 8, 8, 0, 0));
+	TEST_EQUAL(q.submit_and_wait(), 2);
+	TEST_CHECK(!q.error(0));
+	TEST_EQUAL(q.bytes_transferred(0), int(sizeof(read_bufs)));
+	TEST_CHECK(memcmp(read_bufs, bufs, sizeof(bufs)) == 0);
+
+	// reading past the end is a short read, not an error
+	q.reset(1);
+	TEST_CHECK(q.prep_readv(f, sizeof(bufs), iov, 1, 0, 0));
+	q.submit_and_wait();
+	TEST_CHECK(!q.error(0));
+	TEST_EQUAL(q.bytes_transferred(0), 0);
+
+	q.close();
+	TEST_CHECK(!q.is_open());
+	f.reset();
+	remove("test_io_uring", ec);
+}
+
 int test_main()
 {
 	test_create_directory();
 	test_stat();
+	test_io_uring();
 
 	error_code ec;
 
@@ -0,0 +1,164 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/hash_kernels.hpp"
+#include "libtorrent/sha1_hash.hpp"
+#include "libtorrent/escape_string.hpp" // from_hex
+
+#include <boost/crc.hpp>
+#include <cstring>
+#include <cstdlib> // for rand
+#include <vector>
+
+using namespace libtorrent;
+
+// pads ``msg`` into one or two 64 byte blocks, the way SHA-1 does
+int pad_message(char const* msg, boost::uint8_t* block)
+{
+	int const len = std::strlen(msg);
+	int const size = len + 9 <= 64 ? 64 : 128;
+	std::memset(block, 0, size);
+	std::memcpy(block, msg, len);
+	block[len] = 0x80;
+	block[size - 1] = boost::uint8_t(len * 8);
+	block[size - 2] = boost::uint8_t((len * 8) >> 8);
+	return size / 64;
+}
+
+void test_sha1_kernel(sha1_kernel const& k)
+{
+	fprintf(stderr, "testing sha1 kernel: %s\n", k.name);
+
+	// test vectors from RFC 3174
+	char const* msg[2] =
+	{
+		"abc",
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"
+	};
+	char const* expected[2] =
+	{
+		"A9993E364706816ABA3E25717850C26C9CD0D89D",
+		"84983E441C3BD26EBAAE4AA1F95129E5E54670F1"
+	};
+
+	boost::uint8_t block[2][128];
+	int blocks[2];
+	for (int i = 0; i < 2; ++i)
+		blocks[i] = pad_message(msg[i], block[i]);
+	TEST_EQUAL(blocks[0], 1);
+	TEST_EQUAL(blocks[1], 2);
+
+	// every number of lanes, alternating the messages. The number of blocks
+	// is the same for all lanes, so each call is for a single message
+	for (int m = 0; m < 2; ++m)
+	{
+		for (int lanes = 1; lanes <= 8; ++lanes)
+		{
+			boost::uint32_t state[8][5];
+			boost::uint32_t* s[8];
+			boost::uint8_t const* data[8];
+			for (int l = 0; l < lanes; ++l)
+			{
+				state[l][0] = 0x67452301;
+				state[l][1] = 0xefcdab89;
+				state[l][2] = 0x98badcfe;
+				state[l][3] = 0x10325476;
+				state[l][4] = 0xc3d2e1f0;
+				s[l] = state[l];
+				data[l] = block[m];
+			}
+
+			k.compress(s, data, lanes, blocks[m]);
+
+			sha1_hash result;
+			from_hex(expected[m], 40, (char*)&result[0]);
+			for (int l = 0; l < lanes; ++l)
+			{
+				sha1_hash h;
+				for (int i = 0; i < 20; ++i)
+					h[i] = boost::uint8_t(state[l][i >> 2] >> ((3 - (i & 3)) * 8));
+				TEST_CHECK(h == result);
+			}
+		}
+	}
+}
+
+void test_crc32c_kernel(crc32c_kernel const& k)
+{
+	fprintf(stderr, "testing crc32c kernel: %s\n", k.name);
+
+	std::vector<boost::uint64_t> buf(100);
+	for (int i = 0; i < int(buf.size()); ++i)
+		buf[i] = (boost::uint64_t(std::rand()) << 32) | std::rand();
+
+	for (int len = 0; len <= int(buf.size()); len += 7)
+	{
+		boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+		crc.process_bytes(&buf[0], len * 8);
+		TEST_EQUAL(k.crc32c(&buf[0], len), crc.checksum());
+	}
+
+	boost::uint32_t v = 0x12345678;
+	boost::crc_optimal<32, 0x1EDC6F41, 0xFFFFFFFF, 0xFFFFFFFF, true, true> crc;
+	crc.process_bytes(&v, 4);
+	TEST_EQUAL(k.crc32c_32(v), crc.checksum());
+}
+
+int test_main()
+{
+	// every kernel this CPU can run has to agree with the reference
+	for (sha1_kernel const* k = sha1_kernels(); k->name; ++k)
+	{
+		if (!k->supported()) continue;
+		test_sha1_kernel(*k);
+	}
+
+	for (crc32c_kernel const* k = crc32c_kernels(); k->name; ++k)
+	{
+		if (!k->supported()) continue;
+		test_crc32c_kernel(*k);
+	}
+
+	hash_kernels const& sel = selected_kernels();
+	TEST_CHECK(sel.sha1 != NULL);
+	TEST_CHECK(sel.sha1_multi != NULL);
+	TEST_CHECK(sel.crc32c != NULL);
+	TEST_EQUAL(sel.sha1->lanes, 1);
+	TEST_CHECK(sel.sha1->supported());
+	TEST_CHECK(sel.sha1_multi->supported());
+	TEST_CHECK(sel.crc32c->supported());
+	TEST_CHECK(sel.sha1_multi_lanes >= 1);
+
+	return 0;
+}
+
@@ -31,7 +31,11 @@ POSSIBILITY OF SUCH DAMAGE.
 */
 
 #include "libtorrent/hasher.hpp"
+#include "libtorrent/multi_hasher.hpp"
 #include <boost/lexical_cast.hpp>
+#include <cstdlib> // for rand
+#include <vector>
+#include <algorithm>
 #include "libtorrent/escape_string.hpp" // from_hex
 
 #include "test.hpp"
@@ -59,6 +63,65 @@ char const* result_array[4] =
 	"DEA356A2CDDD90C7A7ECEDC5EBB563934F460452"
 };
 
+void test_multi_hasher()
+{
+	// the test vectors, one in each lane. They're fed one lane at a time,
+	// as they are of different lengths
+	multi_hasher mh(4);
+	for (int test = 0; test < 4; ++test)
+	{
+		char const* data[4] = { NULL, NULL, NULL, NULL };
+		data[test] = test_array[test];
+		for (int i = 0; i < repeat_count[test]; ++i)
+			mh.update(data, std::strlen(test_array[test]));
+	}
+
+	for (int test = 0; test < 4; ++test)
+	{
+		sha1_hash result;
+		from_hex(result_array[test], 40, (char*)&result[0]);
+		TEST_CHECK(result == mh.final(test));
+	}
+
+	// all lanes in lockstep, with buffers that aren't multiples of the
+	// block size, and with one lane running ahead of the others
+	for (int lanes = 1; lanes <= multi_hasher::max_lanes; ++lanes)
+	{
+		std::vector<char> buf[multi_hasher::max_lanes];
+		for (int i = 0; i < lanes; ++i)
+		{
+			buf[i].resize(3 * 16384 + 100 + i);
+			std::generate(buf[i].begin(), buf[i].end(), &std::rand);
+		}
+
+		multi_hasher h(lanes);
+		char const* data[multi_hasher::max_lanes] = { NULL };
+
+		data[0] = &buf[0][0];
+		h.update(data, 33);
+		for (int i = 1; i < lanes; ++i) data[i] = &buf[i][0];
+		data[0] = &buf[0][33];
+		h.update(data, 16384);
+		for (int i = 0; i < lanes; ++i) data[i] += 16384;
+		h.update(data, 2 * 16384 - 33);
+		for (int i = 0; i < lanes; ++i) data[i] += 2 * 16384 - 33;
+		for (int i = 0; i < lanes; ++i)
+		{
+			char const* tail[multi_hasher::max_lanes] = { NULL };
+			tail[i] = data[i];
+			h.update(tail, &buf[i][0] + buf[i].size() - data[i]);
+		}
+
+		for (int i = 0; i < lanes; ++i)
+			TEST_CHECK(h.final(i) == hasher(&buf[i][0], buf[i].size()).final());
+
+		h.reset();
+		for (int i = 0; i < lanes; ++i) data[i] = &buf[i][0];
+		h.update(data, 100);
+		for (int i = 0; i < lanes; ++i)
+			TEST_CHECK(h.final(i) == hasher(&buf[i][0], 100).final());
+	}
+}
 
 int test_main()
 {
@@ -75,6 +138,8 @@ int test_main()
 		TEST_CHECK(result == h.final());
 	}
 
+	test_multi_hasher();
+
 	return 0;
 }
 
@@ -35,7 +35,9 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "libtorrent/hasher.hpp"
 #include "libtorrent/pe_crypto.hpp"
+#include "libtorrent/dh_key_pool.hpp"
 #include "libtorrent/session.hpp"
+#include "libtorrent/thread.hpp"
 #include "libtorrent/random.hpp"
 
 #include "setup_transfer.hpp"
@@ -162,12 +164,64 @@ void test_enc_handler(libtorrent::encryption_handler* a, libtorrent::encryption_
 		TEST_CHECK(!std::equal(buf, buf + buf_len, cmp_buf));
 		a->decrypt(buf, buf_len);
 		TEST_CHECK(std::equal(buf, buf + buf_len, cmp_buf));
-		
+
+		// encrypting into a copy continues the same key stream
+		char* copy = new char[buf_len];
+		int const split = buf_len / 3;
+		a->encrypt(buf, split);
+		a->encrypt_copy(copy + split, buf + split, buf_len - split);
+		std::memcpy(copy, buf, split);
+		TEST_CHECK(std::equal(buf + split, buf + buf_len, cmp_buf + split));
+		b->decrypt(copy, buf_len);
+		TEST_CHECK(std::equal(copy, copy + buf_len, cmp_buf));
+		delete[] copy;
+
 		delete[] buf;
 		delete[] cmp_buf;
 	}
 }
 
+void test_dh_key_pool()
+{
+	using namespace libtorrent;
+
+	// the local key only depends on the secret
+	char secret[96];
+	dh_key_exchange::random_secret(secret);
+	dh_key_exchange k1(secret);
+	dh_key_exchange k2(secret);
+	TEST_CHECK(std::equal(k1.get_local_key(), k1.get_local_key() + 96, k2.get_local_key()));
+
+	dh_key_pool pool;
+	TEST_EQUAL(pool.size(), 0);
+	TEST_CHECK(pool.take() == NULL);
+
+	pool.set_size(4);
+	for (int i = 0; i < 100 && pool.size() < 4; ++i) libtorrent::sleep(100);
+	TEST_EQUAL(pool.size(), 4);
+
+	// keys from the pool work like any other
+	dh_key_exchange* k = pool.take();
+	TEST_CHECK(k != NULL);
+	if (k == NULL) return;
+	dh_key_exchange remote;
+	k->compute_secret(remote.get_local_key());
+	remote.compute_secret(k->get_local_key());
+	TEST_CHECK(std::equal(k->get_secret(), k->get_secret() + 96, remote.get_secret()));
+	delete k;
+
+	// the taken key is replaced
+	for (int i = 0; i < 100 && pool.size() < 4; ++i) libtorrent::sleep(100);
+	TEST_EQUAL(pool.size(), 4);
+
+	pool.set_size(1);
+	TEST_EQUAL(pool.size(), 1);
+
+	pool.set_size(0);
+	TEST_EQUAL(pool.size(), 0);
+	TEST_CHECK(pool.take() == NULL);
+}
+
 #endif
 
 int test_main()
@@ -209,6 +263,9 @@ int test_main()
 	rc42.set_incoming_key(&test1_key[0], 20);
 	rc42.set_outgoing_key(&test2_key[0], 20);
 	test_enc_handler(&rc41, &rc42);
+
+	fprintf(stderr, "testing DH key pool\n");
+	test_dh_key_pool();
 	
 #ifdef TORRENT_USE_VALGRIND
 	const int timeout = 10;
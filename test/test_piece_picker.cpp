@@ -1203,6 +1203,422 @@ int test_main()
 	print_availability(p);
 	TEST_CHECK(verify_availability(p, "1110111111111111"));
 
+// ========================================================
+
+	// test picking from a sparse bitfield, where the pickable pieces are
+	// spread out over many words of the packed piece state
+	print_title("test sparse bitfield");
+	{
+		const int num_pieces = 1000;
+		p.reset(new piece_picker);
+		p->init(blocks_per_piece, blocks_per_piece, num_pieces);
+		p->inc_refcount_all(&tmp0);
+		p->we_have(31);
+		p->set_piece_priority(200, 0);
+
+		bitfield peer_has(num_pieces, false);
+		int const peer_pieces[] = { 0, 5, 31, 32, 200, 511, 999 };
+		for (int i = 0; i < int(sizeof(peer_pieces)/sizeof(peer_pieces[0])); ++i)
+			peer_has.set_bit(peer_pieces[i]);
+
+		// we have 31 and 200 is filtered
+		int const expected[] = { 0, 5, 32, 511, 999 };
+		int const num_expected = sizeof(expected)/sizeof(expected[0]);
+
+		int const modes[] = { piece_picker::sequential
+			, piece_picker::sequential | piece_picker::reverse, 0 };
+		for (int m = 0; m < int(sizeof(modes)/sizeof(modes[0])); ++m)
+		{
+			picked.clear();
+			p->pick_pieces(peer_has, picked, num_pieces * blocks_per_piece, 0, 0
+				, piece_picker::fast, modes[m], empty_vector, 20, pc);
+			TEST_CHECK(verify_pick(p, picked));
+			TEST_EQUAL(int(picked.size()), num_expected * blocks_per_piece);
+
+			std::vector<int> picked_pieces;
+			for (std::vector<piece_block>::iterator i = picked.begin()
+				, end(picked.end()); i != end; ++i)
+			{
+				if (picked_pieces.empty() || picked_pieces.back() != int(i->piece_index))
+					picked_pieces.push_back(i->piece_index);
+			}
+			TEST_EQUAL(int(picked_pieces.size()), num_expected);
+			if (int(picked_pieces.size()) != num_expected) continue;
+
+			// sequential picks in order, reverse sequential backwards and
+			// random mode in any order
+			if (modes[m] & piece_picker::reverse)
+				std::reverse(picked_pieces.begin(), picked_pieces.end());
+			else if (modes[m] == 0)
+				std::sort(picked_pieces.begin(), picked_pieces.end());
+			TEST_CHECK(std::equal(picked_pieces.begin(), picked_pieces.end(), expected));
+		}
+
+		// once a piece is being downloaded, random mode won't start on it
+		p->mark_as_downloading(piece_block(511, 0), &tmp1, piece_picker::fast);
+		for (int i = 0; i < 20; ++i)
+		{
+			picked.clear();
+			p->pick_pieces(peer_has, picked, 1, 0, 0
+				, piece_picker::fast, 0, empty_vector, 20, pc);
+			TEST_EQUAL(int(picked.size()), 1);
+			if (picked.empty()) continue;
+			TEST_CHECK(picked[0].piece_index != 511);
+			TEST_CHECK(std::find(expected, expected + num_expected
+				, int(picked[0].piece_index)) != expected + num_expected);
+		}
+	}
+
+// ========================================================
+
+	// stress test with many peers and thousands of partial pieces, moving
+	// blocks through all states in random order. The picker's state is
+	// compared against a simple model of every block
+	print_title("test large swarm");
+	{
+		const int num_pieces = 5000;
+		const int swarm_size = 64;
+		std::vector<boost::shared_ptr<ipv4_peer> > swarm;
+		for (int i = 0; i < swarm_size; ++i)
+		{
+			swarm.push_back(boost::shared_ptr<ipv4_peer>(new ipv4_peer(endp, false, 0)));
+#if TORRENT_USE_ASSERTS
+			swarm.back()->in_use = true;
+#endif
+		}
+
+		p.reset(new piece_picker);
+		p->init(blocks_per_piece, blocks_per_piece, num_pieces);
+		for (int i = 0; i < swarm_size; ++i)
+		{
+			bitfield peer_has(num_pieces, false);
+			for (int k = 0; k < num_pieces; ++k)
+				if (libtorrent::random() % 4 == 0) peer_has.set_bit(k);
+			p->inc_refcount(peer_has, swarm[i].get());
+		}
+
+		// the model. The state of each block, and the peer it's requested
+		// from or written by
+		std::vector<int> block_state(num_pieces * blocks_per_piece
+			, piece_picker::block_info::state_none);
+		std::vector<void*> block_peer(num_pieces * blocks_per_piece, (void*)0);
+		std::vector<int> requested;
+		std::vector<int> writing;
+		std::vector<int> finished_blocks(num_pieces, 0);
+		std::set<int> have;
+
+		for (int op = 0; op < 60000; ++op)
+		{
+			int const action = libtorrent::random() % 10;
+			if (action < 4)
+			{
+				// request a block from a random peer
+				int const b = libtorrent::random() % (num_pieces * blocks_per_piece);
+				piece_block const block(b / blocks_per_piece, b % blocks_per_piece);
+				if (have.count(block.piece_index)) continue;
+				if (block_state[b] != piece_picker::block_info::state_none) continue;
+				void* peer = swarm[libtorrent::random() % swarm_size].get();
+				TEST_CHECK(p->mark_as_downloading(block, peer, piece_picker::fast));
+				block_state[b] = piece_picker::block_info::state_requested;
+				block_peer[b] = peer;
+				requested.push_back(b);
+			}
+			else if (action < 6 && !requested.empty())
+			{
+				// a requested block is received
+				int const idx = libtorrent::random() % requested.size();
+				int const b = requested[idx];
+				requested[idx] = requested.back();
+				requested.pop_back();
+				piece_block const block(b / blocks_per_piece, b % blocks_per_piece);
+				TEST_CHECK(p->mark_as_writing(block, block_peer[b]));
+				block_state[b] = piece_picker::block_info::state_writing;
+				writing.push_back(b);
+			}
+			else if (action < 8 && !writing.empty())
+			{
+				// a block is written to disk. When the last block of a piece
+				// is, the piece passes the hash check
+				int const idx = libtorrent::random() % writing.size();
+				int const b = writing[idx];
+				writing[idx] = writing.back();
+				writing.pop_back();
+				piece_block const block(b / blocks_per_piece, b % blocks_per_piece);
+				p->mark_as_finished(block, block_peer[b]);
+				block_state[b] = piece_picker::block_info::state_finished;
+				if (++finished_blocks[block.piece_index] == blocks_per_piece)
+				{
+					TEST_CHECK(p->is_piece_finished(block.piece_index));
+					p->piece_passed(block.piece_index);
+					p->we_have(block.piece_index);
+					have.insert(block.piece_index);
+				}
+			}
+			else if (!requested.empty())
+			{
+				// a request is cancelled or times out
+				int const idx = libtorrent::random() % requested.size();
+				int const b = requested[idx];
+				requested[idx] = requested.back();
+				requested.pop_back();
+				piece_block const block(b / blocks_per_piece, b % blocks_per_piece);
+				p->abort_download(block, block_peer[b]);
+				block_state[b] = piece_picker::block_info::state_none;
+				block_peer[b] = 0;
+			}
+
+			if ((op % 5000) != 0) continue;
+
+			// compare the picker against the model
+			int num_downloading = 0;
+			for (int k = 0; k < num_pieces; ++k)
+			{
+				if (have.count(k))
+				{
+					TEST_CHECK(p->have_piece(k));
+					continue;
+				}
+				bool downloading = false;
+				for (int j = 0; j < blocks_per_piece; ++j)
+				{
+					int const b = k * blocks_per_piece + j;
+					piece_block const block(k, j);
+					TEST_CHECK(p->is_requested(block)
+						== (block_state[b] == piece_picker::block_info::state_requested));
+					TEST_CHECK(p->is_downloaded(block)
+						== (block_state[b] >= piece_picker::block_info::state_writing));
+					TEST_CHECK(p->is_finished(block)
+						== (block_state[b] == piece_picker::block_info::state_finished));
+					if (block_state[b] != piece_picker::block_info::state_none)
+						downloading = true;
+				}
+				if (downloading) ++num_downloading;
+			}
+			TEST_EQUAL(p->get_download_queue_size(), num_downloading);
+			fprintf(stderr, "op: %d downloading pieces: %d have: %d\n"
+				, op, num_downloading, int(have.size()));
+
+			// and make sure picking still works, and only picks blocks that
+			// are free
+			picked.clear();
+			p->pick_pieces(string2vec(std::string(num_pieces, '*').c_str()), picked
+				, 100, 0, swarm[0].get(), piece_picker::fast
+				, piece_picker::rarest_first | piece_picker::prioritize_partials
+				, empty_vector, 20, pc);
+			TEST_CHECK(verify_pick(p, picked));
+		}
+	}
+
+// ========================================================
+
+	// peers with large bitfields and have_all connecting and disconnecting.
+	// The availability, distributed copies and rarest-first order are
+	// compared against a model after every change
+	print_title("test bitfield churn");
+	{
+		const int num_pieces = 3000;
+		const int swarm_size = 40;
+		std::vector<boost::shared_ptr<ipv4_peer> > swarm;
+		std::vector<bitfield> swarm_has(swarm_size);
+		std::vector<bool> connected(swarm_size, false);
+		for (int i = 0; i < swarm_size; ++i)
+		{
+			swarm.push_back(boost::shared_ptr<ipv4_peer>(new ipv4_peer(endp, false, 0)));
+#if TORRENT_USE_ASSERTS
+			swarm.back()->in_use = true;
+#endif
+		}
+
+		p.reset(new piece_picker);
+		p->init(blocks_per_piece, blocks_per_piece, num_pieces);
+		std::vector<int> availability(num_pieces, 0);
+		std::vector<bool> have(num_pieces, false);
+
+		for (int op = 0; op < 400; ++op)
+		{
+			int const peer = libtorrent::random() % swarm_size;
+			if (connected[peer])
+			{
+				if (swarm_has[peer].all_set()) p->dec_refcount_all(swarm[peer].get());
+				else p->dec_refcount(swarm_has[peer], swarm[peer].get());
+				for (int k = 0; k < num_pieces; ++k)
+					if (swarm_has[peer][k]) --availability[k];
+				connected[peer] = false;
+			}
+			else
+			{
+				// between no pieces and all of them
+				int const density = libtorrent::random() % 6;
+				swarm_has[peer].resize(num_pieces, density == 5);
+				if (density < 5)
+				{
+					swarm_has[peer].clear_all();
+					for (int k = 0; k < num_pieces; ++k)
+						if (int(libtorrent::random() % 5) < density) swarm_has[peer].set_bit(k);
+				}
+				if (swarm_has[peer].all_set()) p->inc_refcount_all(swarm[peer].get());
+				else p->inc_refcount(swarm_has[peer], swarm[peer].get());
+				for (int k = 0; k < num_pieces; ++k)
+					if (swarm_has[peer][k]) ++availability[k];
+				connected[peer] = true;
+			}
+
+			if ((op % 10) == 0)
+			{
+				int const piece = libtorrent::random() % num_pieces;
+				if (!have[piece])
+				{
+					p->we_have(piece);
+					have[piece] = true;
+				}
+			}
+
+			// no piece can have more than swarm_size + 1 copies
+			int const infinity = swarm_size + 2;
+			int min_avail = infinity;
+			int min_avail_count = 0;
+			int min_wanted = infinity;
+			for (int k = 0; k < num_pieces; ++k)
+			{
+				TEST_EQUAL(p->get_availability(k), availability[k]);
+				int const a = availability[k] + (have[k] ? 1 : 0);
+				if (a < min_avail) { min_avail = a; min_avail_count = 0; }
+				if (a == min_avail) ++min_avail_count;
+				if (!have[k] && availability[k] > 0)
+					min_wanted = (std::min)(min_wanted, availability[k]);
+			}
+
+			std::pair<int, int> dc = p->distributed_copies();
+			TEST_EQUAL(dc.first, min_avail);
+			TEST_EQUAL(dc.second, (num_pieces - min_avail_count) * 1000 / num_pieces);
+
+			picked.clear();
+			p->pick_pieces(string2vec(std::string(num_pieces, '*').c_str()), picked
+				, 1, 0, 0, piece_picker::fast, piece_picker::rarest_first
+				, empty_vector, 20, pc);
+			if (min_wanted == infinity)
+			{
+				TEST_CHECK(picked.empty());
+			}
+			else
+			{
+				TEST_CHECK(!picked.empty());
+				if (!picked.empty())
+					TEST_EQUAL(availability[picked[0].piece_index], min_wanted);
+			}
+		}
+	}
+
+// ========================================================
+
+	// test the table of peers blocks refer to
+	print_title("test block peers");
+	p = setup_picker("1111111", "       ", "1111111", "");
+	p->mark_as_downloading(piece_block(0, 0), &tmp1, piece_picker::fast);
+	p->mark_as_downloading(piece_block(0, 1), &tmp2, piece_picker::fast);
+	p->mark_as_downloading(piece_block(1, 0), &tmp1, piece_picker::fast);
+	TEST_CHECK(p->get_downloader(piece_block(0, 0)) == &tmp1);
+	TEST_CHECK(p->get_downloader(piece_block(0, 1)) == &tmp2);
+	TEST_CHECK(p->get_downloader(piece_block(1, 0)) == &tmp1);
+
+	{
+		std::vector<piece_picker::downloading_piece> dl = p->get_download_queue();
+		TEST_EQUAL(dl.size(), 2);
+		for (int i = 0; i < int(dl.size()); ++i)
+		{
+			TEST_CHECK(p->block_peer(dl[i].info[0]) == &tmp1);
+			TEST_CHECK(p->block_peer(dl[i].info[2]) == 0);
+		}
+	}
+
+	// clearing a peer only affects the blocks it was downloading
+	p->clear_peer(&tmp1);
+	TEST_CHECK(p->get_downloader(piece_block(0, 0)) == 0);
+	TEST_CHECK(p->get_downloader(piece_block(0, 1)) == &tmp2);
+	TEST_CHECK(p->get_downloader(piece_block(1, 0)) == 0);
+
+	// a peer that doesn't refer to any block is a no-op
+	p->clear_peer(&tmp3);
+	TEST_CHECK(p->get_downloader(piece_block(0, 1)) == &tmp2);
+
+	// the freed entry is reused by the next peer
+	p->mark_as_downloading(piece_block(0, 2), &tmp3, piece_picker::fast);
+	p->mark_as_writing(piece_block(0, 1), &tmp2);
+	p->mark_as_finished(piece_block(0, 1), &tmp2);
+	TEST_CHECK(p->get_downloader(piece_block(0, 1)) == &tmp2);
+	TEST_CHECK(p->get_downloader(piece_block(0, 2)) == &tmp3);
+
+	// when the piece is done, its blocks release their peers
+	for (int i = 0; i < blocks_per_piece; ++i)
+	{
+		piece_block const b(0, i);
+		if (i == 1) continue;
+		torrent_peer* peer = i == 0 ? &tmp1 : i == 2 ? &tmp3 : &tmp4;
+		if (!p->is_requested(b))
+			p->mark_as_downloading(b, peer, piece_picker::fast);
+		p->mark_as_writing(b, peer);
+		p->mark_as_finished(b, peer);
+	}
+	p->piece_passed(0);
+	p->we_have(0);
+	TEST_CHECK(p->have_piece(0));
+	p->mark_as_downloading(piece_block(2, 0), &tmp2, piece_picker::fast);
+	TEST_CHECK(p->get_downloader(piece_block(2, 0)) == &tmp2);
+	p->abort_download(piece_block(2, 0), &tmp2);
+	TEST_CHECK(p->get_downloader(piece_block(2, 0)) == 0);
+
+	// when more peers are referenced than block_info::peer can index, the
+	// blocks of the extra peers are recorded without a peer
+	print_title("test block peer table full");
+	{
+		const int max_peers = 0xffff;
+		std::vector<boost::shared_ptr<ipv4_peer> > swarm;
+		for (int i = 0; i < max_peers + 1; ++i)
+		{
+			swarm.push_back(boost::shared_ptr<ipv4_peer>(new ipv4_peer(endp, false, 0)));
+#if TORRENT_USE_ASSERTS
+			swarm.back()->in_use = true;
+#endif
+		}
+
+		const int num_pieces = (max_peers + 2 + blocks_per_piece - 1) / blocks_per_piece;
+		p.reset(new piece_picker);
+		p->init(blocks_per_piece, blocks_per_piece, num_pieces);
+		for (int i = 0; i < max_peers; ++i)
+		{
+			piece_block const b(i / blocks_per_piece, i % blocks_per_piece);
+			p->mark_as_downloading(b, swarm[i].get(), piece_picker::fast);
+		}
+		bool all_attributed = true;
+		for (int i = 0; i < max_peers; ++i)
+		{
+			piece_block const b(i / blocks_per_piece, i % blocks_per_piece);
+			if (p->get_downloader(b) != swarm[i].get()) all_attributed = false;
+		}
+		TEST_CHECK(all_attributed);
+
+		piece_block const extra(max_peers / blocks_per_piece, max_peers % blocks_per_piece);
+		TEST_CHECK(p->mark_as_downloading(extra, swarm[max_peers].get(), piece_picker::fast));
+		TEST_CHECK(p->is_requested(extra));
+		TEST_CHECK(p->get_downloader(extra) == 0);
+		p->abort_download(extra, swarm[max_peers].get());
+		TEST_CHECK(!p->is_requested(extra));
+
+		// once a peer is cleared, its entry is free for the next peer
+		p->clear_peer(swarm[0].get());
+		TEST_CHECK(p->get_downloader(piece_block(0, 0)) == 0);
+		p->mark_as_downloading(extra, swarm[max_peers].get(), piece_picker::fast);
+		TEST_CHECK(p->get_downloader(extra) == swarm[max_peers].get());
+
+		// the cleared peer still remembers the entry it had, but it's
+		// taken by someone else now
+		piece_block const extra2((max_peers + 1) / blocks_per_piece
+			, (max_peers + 1) % blocks_per_piece);
+		p->mark_as_downloading(extra2, swarm[0].get(), piece_picker::fast);
+		TEST_CHECK(p->get_downloader(extra2) == 0);
+		TEST_CHECK(p->get_downloader(extra) == swarm[max_peers].get());
+	}
+
 // ========================================================
 
 // MISSING TESTS:
@@ -0,0 +1,159 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "libtorrent/piece_picker.hpp"
+#include "libtorrent/torrent_peer.hpp"
+#include "libtorrent/bitfield.hpp"
+#include "libtorrent/performance_counters.hpp"
+#include "libtorrent/random.hpp"
+#include "libtorrent/time.hpp"
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+#include <cstdio>
+
+#include "test.hpp"
+
+using namespace libtorrent;
+
+// measures the time it takes to pick blocks on large torrents, where
+// the piece picker's state doesn't fit in the CPU cache. In each setup we
+// have 90% of the pieces and the peer we pick from has a random 10%, so
+// most pieces the picker looks at can't be picked.
+
+namespace
+{
+	const int blocks_per_piece = 16;
+	const int num_peers = 10;
+
+	tcp::endpoint endp;
+	ipv4_peer peer0(endp, false, 0);
+	ipv4_peer peer1(endp, false, 0);
+	ipv4_peer peer2(endp, false, 0);
+	ipv4_peer peer3(endp, false, 0);
+	ipv4_peer peer4(endp, false, 0);
+	ipv4_peer peer5(endp, false, 0);
+	ipv4_peer peer6(endp, false, 0);
+	ipv4_peer peer7(endp, false, 0);
+	ipv4_peer peer8(endp, false, 0);
+	ipv4_peer peer9(endp, false, 0);
+	torrent_peer* peers[num_peers] = { &peer0, &peer1, &peer2, &peer3
+		, &peer4, &peer5, &peer6, &peer7, &peer8, &peer9 };
+
+	// the peer we pick pieces from
+	ipv4_peer picking_peer(endp, false, 0);
+
+	bitfield random_bitfield(int num_pieces, int percent)
+	{
+		bitfield ret(num_pieces, false);
+		for (int i = 0; i < num_pieces; ++i)
+			if (int(libtorrent::random() % 100) < percent) ret.set_bit(i);
+		return ret;
+	}
+
+	boost::shared_ptr<piece_picker> setup_picker(int num_pieces
+		, bitfield const& peer_has)
+	{
+		boost::shared_ptr<piece_picker> p(new piece_picker);
+		p->init(blocks_per_piece, blocks_per_piece, num_pieces);
+
+		// give the pieces different availability, to spread them across
+		// the priority levels in rarest first mode
+		for (int i = 0; i < num_peers; ++i)
+			p->inc_refcount(random_bitfield(num_pieces, 50), peers[i]);
+		p->inc_refcount(peer_has, &picking_peer);
+
+		for (int i = 0; i < num_pieces; ++i)
+			if (libtorrent::random() % 10 != 0) p->we_have(i);
+		return p;
+	}
+
+	void bench_pick(piece_picker const& p, bitfield const& peer_has
+		, int num_pieces, int options, char const* name)
+	{
+		const std::vector<int> suggested;
+		counters pc;
+		std::vector<piece_block> picked;
+		picked.reserve(blocks_per_piece * 4);
+
+		// the first pick after a change may have to rebuild the priority
+		// buckets. That's not what's measured here
+		p.pick_pieces(peer_has, picked, blocks_per_piece * 4, 0, 0
+			, piece_picker::fast, options, suggested, 20, pc);
+
+		const int rounds = 2000;
+		int total_picked = 0;
+		ptime start = time_now_hires();
+		for (int i = 0; i < rounds; ++i)
+		{
+			picked.clear();
+			p.pick_pieces(peer_has, picked, blocks_per_piece * 4, 0, 0
+				, piece_picker::fast, options, suggested, 20, pc);
+			total_picked += int(picked.size());
+		}
+		ptime end = time_now_hires();
+
+		TEST_CHECK(total_picked > 0);
+		fprintf(stderr, "%8d pieces %-20s %8.2f us per pick (%d blocks)\n"
+			, num_pieces, name
+			, double(total_microseconds(end - start)) / rounds
+			, total_picked / rounds);
+	}
+}
+
+int test_main()
+{
+#if TORRENT_USE_ASSERTS
+	for (int i = 0; i < num_peers; ++i) peers[i]->in_use = true;
+	picking_peer.in_use = true;
+#endif
+
+	// piece_block limits the number of pieces to piece_picker::max_pieces,
+	// just under 2^19
+	int const sizes[] = { 10000, 100000, 500000 };
+	for (int s = 0; s < int(sizeof(sizes)/sizeof(sizes[0])); ++s)
+	{
+		int const num_pieces = sizes[s];
+		bitfield peer_has = random_bitfield(num_pieces, 10);
+		boost::shared_ptr<piece_picker> p = setup_picker(num_pieces, peer_has);
+
+		bench_pick(*p, peer_has, num_pieces, piece_picker::rarest_first
+			, "rarest-first");
+		bench_pick(*p, peer_has, num_pieces, piece_picker::sequential
+			, "sequential");
+		bench_pick(*p, peer_has, num_pieces, piece_picker::sequential
+			| piece_picker::reverse, "reverse-sequential");
+		bench_pick(*p, peer_has, num_pieces, 0, "random");
+	}
+	return 0;
+}
+
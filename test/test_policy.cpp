@@ -97,6 +97,8 @@ struct mock_peer_connection : peer_connection_interface
 	virtual bool is_choked() const { return m_choked; }
 	virtual bool failed() const { return false; }
 	virtual libtorrent::stat const& statistics() const { return m_stat; }
+	virtual time_duration block_arrival_time(int) const
+	{ return milliseconds(0); }
 };
 
 struct mock_torrent
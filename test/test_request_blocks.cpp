@@ -0,0 +1,305 @@
+/*
+
+Copyright (c) 2014, Arvid Norberg
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions
+are met:
+
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in
+      the documentation and/or other materials provided with the distribution.
+    * Neither the name of the author nor the names of its
+      contributors may be used to endorse or promote products derived
+      from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "test.hpp"
+#include "libtorrent/request_blocks.hpp"
+#include "libtorrent/piece_picker.hpp"
+#include "libtorrent/torrent_peer.hpp"
+#include "libtorrent/peer_connection_interface.hpp"
+#include "libtorrent/peer_id.hpp"
+#include "libtorrent/stat.hpp"
+
+#include <boost/make_shared.hpp>
+
+using namespace libtorrent;
+
+struct mock_peer_connection : peer_connection_interface
+{
+	mock_peer_connection(time_duration arrival) : m_arrival(arrival) {}
+	virtual ~mock_peer_connection() {}
+#if defined TORRENT_VERBOSE_LOGGING || defined TORRENT_ERROR_LOGGING
+	virtual void peer_log(char const*, ...) const {}
+#endif
+
+	time_duration m_arrival;
+	tcp::endpoint m_remote;
+	peer_id m_id;
+	libtorrent::stat m_stat;
+
+	virtual void get_peer_info(peer_info&) const {}
+	virtual tcp::endpoint const& remote() const { return m_remote; }
+	virtual tcp::endpoint local_endpoint() const { return m_remote; }
+	virtual void disconnect(error_code const&
+		, peer_connection_interface::operation_t, int = 0) {}
+	virtual peer_id const& pid() const { return m_id; }
+	virtual void set_holepunch_mode() {}
+	virtual torrent_peer* peer_info_struct() const { return 0; }
+	virtual void set_peer_info(torrent_peer*) {}
+	virtual bool is_outgoing() const { return true; }
+	virtual void add_stat(size_type, size_type) {}
+	virtual bool fast_reconnect() const { return false; }
+	virtual bool is_choked() const { return false; }
+	virtual bool failed() const { return false; }
+	virtual libtorrent::stat const& statistics() const { return m_stat; }
+	virtual time_duration block_arrival_time(int) const { return m_arrival; }
+};
+
+void test_download_time()
+{
+	// 16 kiB at 16 kiB/s
+	TEST_EQUAL(total_milliseconds(download_time(0x4000, 0x4000)), 1000);
+	// 4 outstanding blocks at 1 MiB/s
+	TEST_EQUAL(total_milliseconds(download_time(4 * 0x4000, 1024 * 1024)), 62);
+	// the estimate doesn't overflow for large queues
+	TEST_EQUAL(total_milliseconds(download_time(boost::int64_t(1) << 32, 1024 * 1024)), 4096000);
+	TEST_EQUAL(total_milliseconds(download_time(0, 1000)), 0);
+	// a peer we haven't received anything from is assumed to send 50 B/s
+	TEST_EQUAL(total_milliseconds(download_time(100, 0)), 2000);
+	TEST_EQUAL(total_milliseconds(download_time(100, 10)), 2000);
+}
+
+void test_block_arrival_time()
+{
+	int const MiB = 1024 * 1024;
+
+	// nothing queued, the block arrives one round-trip after requesting it
+	TEST_EQUAL(total_milliseconds(block_arrival_time(0, MiB, 50000)), 50);
+
+	// the round-trip time is only added once, not once per queued request
+	TEST_EQUAL(total_milliseconds(block_arrival_time(MiB, MiB, 50000)), 1050);
+
+	// a peer with a deep queue. 4 MiB (256 blocks) outstanding at 2 MiB/s
+	// with a 30 ms round-trip time makes a deadline 2.1 seconds from now
+	TEST_EQUAL(total_milliseconds(block_arrival_time(4 * MiB, 2 * MiB, 30000)), 2030);
+	TEST_CHECK(block_arrival_time(4 * MiB, 2 * MiB, 30000) <= milliseconds(2100));
+	// but not with another half second worth of requests ahead of it
+	TEST_CHECK(block_arrival_time(5 * MiB, 2 * MiB, 30000) > milliseconds(2100));
+
+	// if the transport doesn't know the round-trip time, it's just the
+	// time it takes to download what's queued
+	TEST_EQUAL(total_milliseconds(block_arrival_time(MiB, MiB, 0)), 1000);
+}
+
+void test_desired_queue_size()
+{
+	int const kiB = 1024;
+	int const MiB = 1024 * 1024;
+	int const ms = 1000;
+
+	// twice the bandwidth-delay product, plus one
+	// 1 MiB/s * 100 ms * 2 = 12.8 blocks
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 100 * ms, 500), 13);
+	// the same with smaller blocks
+	TEST_EQUAL(desired_queue_size(MiB, 8 * kiB, 3, 100 * ms, 500), 26);
+	// higher latency needs a deeper queue for the same rate
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 400 * ms, 500), 52);
+	// 10 MiB/s * 200 ms * 2 = 256 blocks
+	TEST_EQUAL(desired_queue_size(10 * MiB, 16 * kiB, 3, 200 * ms, 500), 257);
+	// a low latency peer doesn't get seconds worth of requests
+	TEST_EQUAL(desired_queue_size(10 * MiB, 16 * kiB, 3, 5 * ms, 500), 7);
+
+	// without a round-trip time, queue_time seconds worth of blocks
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 0, 500), 192);
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 1, 0, 500), 64);
+
+	// the upper limit
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 100 * ms, 13), 13);
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 100 * ms, 12), 12);
+	TEST_EQUAL(desired_queue_size(10 * MiB, 16 * kiB, 3, 200 * ms, 250), 250);
+	TEST_EQUAL(desired_queue_size(MiB, 16 * kiB, 3, 0, 100), 100);
+	// 1 GiB/s with a 1 second round-trip time doesn't overflow
+	TEST_EQUAL(desired_queue_size(1024 * MiB, 16 * kiB, 3, 1000 * ms, 500), 500);
+
+	// the lower limit is 2 requests
+	// 80 kiB/s * 100 ms * 2 = 1 block
+	TEST_EQUAL(desired_queue_size(80 * kiB, 16 * kiB, 3, 100 * ms, 500), 2);
+	TEST_EQUAL(desired_queue_size(80 * kiB - 1, 16 * kiB, 3, 100 * ms, 500), 2);
+	TEST_EQUAL(desired_queue_size(0, 16 * kiB, 3, 100 * ms, 500), 2);
+	TEST_EQUAL(desired_queue_size(0, 16 * kiB, 3, 0, 500), 2);
+	TEST_EQUAL(desired_queue_size(16 * kiB, 16 * kiB, 3, 0, 500), 3);
+}
+
+void test_deadline_at_risk()
+{
+	tcp::endpoint endp;
+	ipv4_peer fast_peer(endp, false, 0);
+	ipv4_peer slow_peer(endp, false, 0);
+	ipv4_peer gone_peer(endp, false, 0);
+#if TORRENT_USE_ASSERTS
+	fast_peer.in_use = true;
+	slow_peer.in_use = true;
+	gone_peer.in_use = true;
+#endif
+	piece_picker p;
+	p.init(4, 4, 3);
+	for (int i = 0; i < 3; ++i) p.inc_refcount(i, &fast_peer);
+
+	ptime const now = time_now();
+	piece_picker::downloading_piece pi;
+
+	// no block requested
+	p.piece_info(0, pi);
+	TEST_CHECK(!deadline_at_risk(p, pi, 4, now, now));
+
+	// piece 0: one block from the fast peer, one finished block from the
+	// slow peer
+	p.mark_as_downloading(piece_block(0, 0), &fast_peer, piece_picker::fast);
+	p.mark_as_downloading(piece_block(0, 1), &slow_peer, piece_picker::slow);
+	p.mark_as_writing(piece_block(0, 1), &slow_peer);
+
+	// piece 1: one block from each peer
+	p.mark_as_downloading(piece_block(1, 0), &fast_peer, piece_picker::fast);
+	p.mark_as_downloading(piece_block(1, 3), &slow_peer, piece_picker::slow);
+
+	// piece 2: the peer we requested the block from has disconnected
+	p.mark_as_downloading(piece_block(2, 2), &gone_peer, piece_picker::slow);
+
+	// the connections are attached once the picker is done with the peers,
+	// since in debug builds it expects them to be real peer_connections
+	mock_peer_connection fast(milliseconds(100));
+	mock_peer_connection slow(seconds(5));
+	fast_peer.connection = &fast;
+	slow_peer.connection = &slow;
+
+	// only outstanding requests count
+	p.piece_info(0, pi);
+	TEST_CHECK(!deadline_at_risk(p, pi, 4, now + seconds(1), now));
+	TEST_CHECK(deadline_at_risk(p, pi, 4, now + milliseconds(50), now));
+
+	// the slow peer can't make a deadline 1 second from now, so the block
+	// needs to be requested from another peer
+	p.piece_info(1, pi);
+	TEST_CHECK(deadline_at_risk(p, pi, 4, now + seconds(1), now));
+	TEST_CHECK(!deadline_at_risk(p, pi, 4, now + seconds(10), now));
+
+	p.piece_info(2, pi);
+	TEST_CHECK(deadline_at_risk(p, pi, 4, now + seconds(10), now));
+
+	fast_peer.connection = 0;
+	slow_peer.connection = 0;
+}
+
+// the peers deferred_requests picks blocks for, in the order it does
+std::vector<int> picked;
+
+struct mock_peer
+{
+	mock_peer(int id_, int speed_)
+		: id(id_), speed(speed_), disconnecting(false), speed_calls(0) {}
+
+	int peer_speed() { ++speed_calls; return speed; }
+	bool is_disconnecting() const { return disconnecting; }
+	void request_deferred_blocks() { picked.push_back(id); }
+
+	int id;
+	int speed;
+	bool disconnecting;
+	int speed_calls;
+};
+
+void test_deferred_requests()
+{
+	typedef boost::shared_ptr<mock_peer> peer_ptr;
+	deferred_requests<mock_peer> batch;
+	TEST_CHECK(batch.empty());
+
+	peer_ptr slow1 = boost::make_shared<mock_peer>(1, 0);
+	peer_ptr fast1 = boost::make_shared<mock_peer>(2, 2);
+	peer_ptr medium = boost::make_shared<mock_peer>(3, 1);
+	peer_ptr slow2 = boost::make_shared<mock_peer>(4, 0);
+	peer_ptr fast2 = boost::make_shared<mock_peer>(5, 2);
+
+	// only the first peer added needs the batch to be scheduled
+	TEST_CHECK(batch.add(slow1));
+	TEST_CHECK(!batch.add(fast1));
+	TEST_CHECK(!batch.add(medium));
+	TEST_CHECK(!batch.add(slow2));
+	TEST_CHECK(!batch.add(fast2));
+
+	// a peer receiving more pieces in the same round is only added once
+	TEST_CHECK(!batch.add(fast1));
+	TEST_CHECK(!batch.add(slow1));
+	TEST_EQUAL(batch.size(), 5);
+
+	// fast peers first, and peers of the same speed in the order they
+	// were added
+	picked.clear();
+	batch.request_blocks();
+	TEST_CHECK(batch.empty());
+	TEST_EQUAL(picked.size(), 5);
+	int const expected[] = {2, 5, 3, 1, 4};
+	for (int i = 0; i < (std::min)(int(picked.size()), 5); ++i)
+		TEST_EQUAL(picked[i], expected[i]);
+
+	// the speed of each peer is only determined once per batch
+	TEST_EQUAL(fast1->speed_calls, 1);
+	TEST_EQUAL(slow1->speed_calls, 1);
+
+	// the batch starts over once it has been served
+	TEST_CHECK(batch.add(medium));
+	TEST_CHECK(!batch.add(fast1));
+
+	// a peer disconnecting while it's waiting is skipped, but kept alive
+	// until the batch is done with it
+	peer_ptr gone = boost::make_shared<mock_peer>(6, 2);
+	TEST_CHECK(!batch.add(gone));
+	gone->disconnecting = true;
+	boost::weak_ptr<mock_peer> gone_weak = gone;
+	gone.reset();
+	TEST_CHECK(!gone_weak.expired());
+
+	picked.clear();
+	batch.request_blocks();
+	TEST_CHECK(gone_weak.expired());
+	TEST_EQUAL(picked.size(), 2);
+	if (picked.size() == 2)
+	{
+		TEST_EQUAL(picked[0], 2);
+		TEST_EQUAL(picked[1], 3);
+	}
+
+	// nothing to do for an empty batch
+	picked.clear();
+	batch.request_blocks();
+	TEST_CHECK(picked.empty());
+}
+
+int test_main()
+{
+	test_download_time();
+	test_block_arrival_time();
+	test_desired_queue_size();
+	test_deadline_at_risk();
+	test_deferred_requests();
+	return 0;
+}
+
@@ -95,6 +95,32 @@ void on_check_resume_data(disk_io_job const* j, bool* done)
 	*done = true;
 }
 
+void on_check_pieces(disk_io_job const* j, std::vector<sha1_hash>* hashes, bool* done)
+{
+	std::cerr << time_now_string() << " on_check_pieces ret: " << j->ret
+		<< " piece: " << j->piece << " num_pieces: " << j->d.num_pieces << std::endl;
+	TEST_EQUAL(j->ret, 0);
+	if (j->ret == 0)
+	{
+		for (int i = 0; i < j->d.num_pieces; ++i)
+			hashes->push_back(sha1_hash(j->buffer + i * 20));
+	}
+	*done = true;
+}
+
+void on_read_block(disk_io_job const* j, disk_io_thread* io
+	, char const* data, int piece_size, int* outstanding)
+{
+	disk_buffer_holder buffer(*io, *j);
+	TEST_EQUAL(j->ret, j->d.io.buffer_size);
+	if (j->ret > 0)
+	{
+		TEST_CHECK(std::equal(j->buffer, j->buffer + j->ret
+			, data + j->piece * piece_size + j->d.io.offset));
+	}
+	--*outstanding;
+}
+
 void print_error(char const* call, int ret, storage_error const& ec)
 {
 	fprintf(stderr, "%s: %s() returned: %d error: \"%s\" in file: %d operation: %d\n"
@@ -403,6 +429,231 @@ void test_check_files(std::string const& test_path
 	ios.reset();
 	run_until(ios, done);
 
+	// hash all pieces in a single run. test2.tmp does not exist, so the
+	// pieces it covers are expected to come back as all zeroes
+	std::vector<sha1_hash> hashes;
+	done = false;
+	io.async_check_pieces(pm.get(), 0, fs.num_pieces()
+		, boost::bind(&on_check_pieces, _1, &hashes, &done));
+	io.submit_jobs();
+	ios.reset();
+	run_until(ios, done);
+
+	TEST_EQUAL(int(hashes.size()), fs.num_pieces());
+	if (int(hashes.size()) == fs.num_pieces())
+	{
+		TEST_CHECK(hashes[0] == info->hash_for_piece(0));
+		TEST_CHECK(hashes[1] == sha1_hash());
+		TEST_CHECK(hashes[2] == sha1_hash());
+		TEST_CHECK(hashes[3] == info->hash_for_piece(3));
+	}
+
+	// and the last two pieces on their own, starting in the middle of
+	// the missing file
+	hashes.clear();
+	done = false;
+	io.async_check_pieces(pm.get(), 2, 2
+		, boost::bind(&on_check_pieces, _1, &hashes, &done));
+	io.submit_jobs();
+	ios.reset();
+	run_until(ios, done);
+
+	TEST_EQUAL(int(hashes.size()), 2);
+	if (hashes.size() == 2)
+	{
+		TEST_CHECK(hashes[0] == sha1_hash());
+		TEST_CHECK(hashes[1] == info->hash_for_piece(3));
+	}
+
+	io.set_num_threads(0);
+}
+
+// reads all the blocks of a few pieces, in the opposite order of where
+// they are stored, with the disk thread reading in elevator order
+void test_elevator_reads(std::string const& test_path, bool use_cache)
+{
+	error_code ec;
+	const int piece_size = 4 * block_size;
+	const int num_pieces = 4;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+	if (ec && ec != boost::system::errc::no_such_file_or_directory)
+		std::cerr << "remove_all '" << combine_path(test_path, "temp_storage")
+		<< "': " << ec.message() << std::endl;
+
+	file_storage fs;
+	fs.add_file("temp_storage/test1.tmp", piece_size * num_pieces);
+	fs.set_piece_length(piece_size);
+	fs.set_num_pieces(num_pieces);
+
+	std::vector<char> data(piece_size * num_pieces);
+	std::generate(data.begin(), data.end(), random_byte);
+
+	create_directory(combine_path(test_path, "temp_storage"), ec);
+	if (ec) std::cerr << "create_directory: " << ec.message() << std::endl;
+
+	std::ofstream f;
+	f.open(combine_path(test_path, combine_path("temp_storage", "test1.tmp")).c_str()
+		, std::ios::trunc | std::ios::binary);
+	f.write(&data[0], data.size());
+	f.close();
+
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	counters cnt;
+	disk_io_thread io(ios, NULL, cnt, NULL);
+	storage_params p;
+	p.files = &fs;
+	p.path = test_path;
+	p.pool = &fp;
+	p.mode = storage_mode_sparse;
+
+	settings_pack pack;
+	pack.set_int(settings_pack::read_elevator_window, 50);
+	pack.set_bool(settings_pack::use_read_cache, use_cache);
+	io.set_settings(&pack);
+	io.set_num_threads(1);
+
+	boost::shared_ptr<void> dummy;
+	boost::shared_ptr<piece_manager> pm = boost::make_shared<piece_manager>(new default_storage(p), dummy, &fs);
+
+	int outstanding = 0;
+	for (int i = num_pieces * piece_size - block_size; i >= 0; i -= block_size)
+	{
+		peer_request r;
+		r.piece = i / piece_size;
+		r.start = i % piece_size;
+		r.length = block_size;
+		io.async_read(pm.get(), r, boost::bind(&on_read_block, _1, &io
+			, &data[0], piece_size, &outstanding), NULL);
+		++outstanding;
+	}
+	io.submit_jobs();
+
+	while (outstanding > 0)
+	{
+		ios.reset();
+		ios.run_one(ec);
+		if (ec) break;
+	}
+	TEST_EQUAL(outstanding, 0);
+
+	// hand back the references to the blocks that were read into the cache
+	ios.reset();
+	ios.poll(ec);
+
+	// without the cache, the adjacent blocks of each piece are read
+	// together
+	if (!use_cache)
+	{
+		TEST_EQUAL(cnt[counters::num_blocks_read], 16);
+		TEST_CHECK(cnt[counters::num_read_ops] < 16);
+	}
+
+	io.set_num_threads(0);
+}
+
+// the number of times a read was served from the cache, as counted by the
+// ARC lists
+int arc_hits(disk_io_thread& io)
+{
+	counters c;
+	io.update_stats_counters(c);
+	return int(c[counters::arc_write_hits] + c[counters::arc_volatile_hits]
+		+ c[counters::arc_mru_hits] + c[counters::arc_mru_ghost_hits]
+		+ c[counters::arc_mfu_hits] + c[counters::arc_mfu_ghost_hits]);
+}
+
+void read_block(disk_io_thread& io, io_service& ios, piece_manager* pm
+	, char const* data, int piece_size, int piece, int block)
+{
+	int outstanding = 1;
+	peer_request r;
+	r.piece = piece;
+	r.start = block * block_size;
+	r.length = block_size;
+	io.async_read(pm, r, boost::bind(&on_read_block, _1, &io
+		, data, piece_size, &outstanding), NULL);
+	io.submit_jobs();
+
+	error_code ec;
+	while (outstanding > 0)
+	{
+		ios.reset();
+		ios.run_one(ec);
+		if (ec) break;
+	}
+	TEST_EQUAL(outstanding, 0);
+
+	// hand back the reference to the block in the cache
+	ios.reset();
+	ios.poll(ec);
+}
+
+// reads that miss the cache are not counted as hits, even though the
+// blocks they read are inserted into the cache and read from there
+void test_read_cache_hits(std::string const& test_path)
+{
+	error_code ec;
+	const int piece_size = 4 * block_size;
+	const int num_pieces = 2;
+	remove_all(combine_path(test_path, "temp_storage"), ec);
+	if (ec && ec != boost::system::errc::no_such_file_or_directory)
+		std::cerr << "remove_all '" << combine_path(test_path, "temp_storage")
+		<< "': " << ec.message() << std::endl;
+
+	file_storage fs;
+	fs.add_file("temp_storage/test1.tmp", piece_size * num_pieces);
+	fs.set_piece_length(piece_size);
+	fs.set_num_pieces(num_pieces);
+
+	std::vector<char> data(piece_size * num_pieces);
+	std::generate(data.begin(), data.end(), random_byte);
+
+	create_directory(combine_path(test_path, "temp_storage"), ec);
+	if (ec) std::cerr << "create_directory: " << ec.message() << std::endl;
+
+	std::ofstream f;
+	f.open(combine_path(test_path, combine_path("temp_storage", "test1.tmp")).c_str()
+		, std::ios::trunc | std::ios::binary);
+	f.write(&data[0], data.size());
+	f.close();
+
+	file_pool fp;
+	libtorrent::asio::io_service ios;
+	counters cnt;
+	disk_io_thread io(ios, NULL, cnt, NULL);
+	storage_params p;
+	p.files = &fs;
+	p.path = test_path;
+	p.pool = &fp;
+	p.mode = storage_mode_sparse;
+
+	// no read-ahead, each read only brings in the block it asks for
+	settings_pack pack;
+	pack.set_bool(settings_pack::use_read_cache, true);
+	pack.set_int(settings_pack::read_cache_line_size, 1);
+	io.set_settings(&pack);
+	io.set_num_threads(1);
+
+	boost::shared_ptr<void> dummy;
+	boost::shared_ptr<piece_manager> pm = boost::make_shared<piece_manager>(new default_storage(p), dummy, &fs);
+
+	// a cold read, the piece isn't in the cache
+	read_block(io, ios, pm.get(), &data[0], piece_size, 0, 0);
+	TEST_EQUAL(cnt[counters::num_blocks_read], 1);
+	TEST_EQUAL(arc_hits(io), 0);
+
+	// the piece is in the cache, but not this block
+	read_block(io, ios, pm.get(), &data[0], piece_size, 0, 2);
+	TEST_EQUAL(cnt[counters::num_blocks_read], 2);
+	TEST_EQUAL(arc_hits(io), 0);
+
+	// both blocks are in the cache now
+	read_block(io, ios, pm.get(), &data[0], piece_size, 0, 0);
+	read_block(io, ios, pm.get(), &data[0], piece_size, 0, 2);
+	TEST_EQUAL(cnt[counters::num_blocks_read], 2);
+	TEST_EQUAL(arc_hits(io), 2);
+
 	io.set_num_threads(0);
 }
 
@@ -528,6 +779,11 @@ void run_test(std::string const& test_path, bool unbuffered)
 	std::cerr << "=== test 6 ===" << std::endl;
 	test_check_files(test_path, storage_mode_sparse, unbuffered);
 	test_check_files(test_path, storage_mode_compact, unbuffered);
+
+	test_elevator_reads(test_path, true);
+	test_elevator_reads(test_path, false);
+
+	test_read_cache_hits(test_path);
 }
 
 void test_fastresume(std::string const& test_path)
@@ -49,21 +49,49 @@ enum test_flags_t
 	seed_mode = 4,
 	time_critical = 8,
 	suggest = 16,
-	explicit_cache = 32
+	explicit_cache = 32,
+	streaming = 64
 };
 
+// returns the number of time critical pieces that were downloaded before
+// and after their deadline, respectively
+std::pair<int, int> deadline_counters(libtorrent::session& ses)
+{
+	using namespace libtorrent;
+	int const met_idx = find_metric_idx("picker.piece_deadlines_met");
+	int const missed_idx = find_metric_idx("picker.piece_deadlines_missed");
+	TEST_CHECK(met_idx >= 0);
+	TEST_CHECK(missed_idx >= 0);
+	if (met_idx < 0 || missed_idx < 0) return std::make_pair(0, 0);
+
+	ses.post_session_stats();
+	ptime end = time_now() + seconds(5);
+	while (time_now() < end)
+	{
+		if (ses.wait_for_alert(end - time_now()) == 0) break;
+		std::auto_ptr<alert> a = ses.pop_alert();
+		session_stats_alert const* s = alert_cast<session_stats_alert>(a.get());
+		if (s == 0) continue;
+		return std::make_pair(int(s->values[met_idx])
+			, int(s->values[missed_idx]));
+	}
+	TEST_ERROR("no session_stats_alert");
+	return std::make_pair(0, 0);
+}
+
 void test_swarm(int flags = 0)
 {
 	using namespace libtorrent;
 	namespace lt = libtorrent;
 
-	fprintf(stderr, "\n\n ==== TEST SWARM === %s%s%s%s%s%s ===\n\n\n"
+	fprintf(stderr, "\n\n ==== TEST SWARM === %s%s%s%s%s%s%s ===\n\n\n"
 		, (flags & super_seeding) ? "super-seeding ": ""
 		, (flags & strict_super_seeding) ? "strict-super-seeding ": ""
 		, (flags & seed_mode) ? "seed-mode ": ""
 		, (flags & time_critical) ? "time-critical ": ""
 		, (flags & suggest) ? "suggest ": ""
 		, (flags & explicit_cache) ? "explicit-cache ": ""
+		, (flags & streaming) ? "streaming ": ""
 		);
 
 	// in case the previous run was terminated
@@ -103,6 +131,9 @@ void test_swarm(int flags = 0)
 		pack.set_int(settings_pack::explicit_cache_interval, 5);
 	}
 
+	if (flags & streaming)
+		pack.set_bool(settings_pack::streaming_deadline_estimates, true);
+
 	// this is to avoid everything finish from a single peer
 	// immediately. To make the swarm actually connect all
 	// three peers before finishing.
@@ -185,6 +216,16 @@ void test_swarm(int flags = 0)
 
 	if (tor2.status().is_seeding && tor3.status().is_seeding) std::cerr << "done\n";
 
+	if (flags & time_critical)
+	{
+		// every piece with a deadline is counted once, as met or missed
+		std::pair<int, int> deadlines = deadline_counters(ses2);
+		std::cerr << "deadlines met: " << deadlines.first
+			<< " missed: " << deadlines.second << std::endl;
+		TEST_CHECK(deadlines.first + deadlines.second >= 1);
+		TEST_CHECK(deadlines.first + deadlines.second <= 3);
+	}
+
 	// make sure the files are deleted
 	ses1.remove_torrent(tor1, lt::session::delete_files);
 	ses2.remove_torrent(tor2, lt::session::delete_files);
@@ -243,6 +284,9 @@ int test_main()
 	// with time critical pieces
 	test_swarm(time_critical);
 
+	// with deadline estimates for time critical pieces
+	test_swarm(time_critical | streaming);
+
 	// with seed mode
 	test_swarm(seed_mode);
 
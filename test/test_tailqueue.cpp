@@ -32,6 +32,10 @@ POSSIBILITY OF SUCH DAMAGE.
 
 #include "test.hpp"
 #include "libtorrent/tailqueue.hpp"
+#include "libtorrent/thread.hpp"
+
+#include <boost/bind.hpp>
+#include <vector>
 
 using namespace libtorrent;
 
@@ -78,6 +82,100 @@ void build_chain(tailqueue& q, char const* str)
 	check_chain(q, expected);
 }
 
+struct counted_node : tailqueue_node
+{
+	counted_node(int t, int s) : thread(t), seq(s) {}
+	int thread;
+	int seq;
+};
+
+void push_nodes(atomic_tailqueue* q, int thread, int count)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		// alternate between single nodes and chains of two
+		if ((i & 1) == 0 || i + 1 == count)
+		{
+			q->push_back(new counted_node(thread, i));
+			continue;
+		}
+		tailqueue chain;
+		chain.push_back(new counted_node(thread, i));
+		chain.push_back(new counted_node(thread, i + 1));
+		q->append(chain);
+		++i;
+	}
+}
+
+void test_atomic_tailqueue()
+{
+	atomic_tailqueue q;
+	tailqueue t1;
+	tailqueue t2;
+
+	TEST_EQUAL(q.empty(), true);
+
+	// the nodes come out in the order they were added
+	TEST_EQUAL(q.push_back(new test_node('a')), true);
+	TEST_EQUAL(q.push_back(new test_node('b')), false);
+	build_chain(t2, "cde");
+	TEST_EQUAL(q.append(t2), false);
+	check_chain(t2, "");
+	TEST_EQUAL(q.empty(), false);
+
+	// and are appended to what's already in the queue
+	build_chain(t1, "12");
+	q.get_all(t1);
+	check_chain(t1, "12abcde");
+	TEST_EQUAL(t1.size(), 7);
+	TEST_EQUAL(q.empty(), true);
+
+	// appending an empty queue does nothing
+	TEST_EQUAL(q.append(t2), false);
+	TEST_EQUAL(q.empty(), true);
+
+	build_chain(t2, "xy");
+	TEST_EQUAL(q.append(t2), true);
+	free_chain(t1);
+	q.get_all(t1);
+	check_chain(t1, "xy");
+
+	free_chain(t1);
+	free_chain(t2);
+
+	// any number of threads can add to the queue while it's being
+	// drained. Each thread's nodes must come out in order
+	const int num_threads = 3;
+	const int num_nodes = 20000;
+	thread th1(boost::bind(&push_nodes, &q, 0, num_nodes));
+	thread th2(boost::bind(&push_nodes, &q, 1, num_nodes));
+	thread th3(boost::bind(&push_nodes, &q, 2, num_nodes));
+
+	std::vector<int> next_seq(num_threads, 0);
+	int received = 0;
+	bool in_order = true;
+	while (received < num_threads * num_nodes)
+	{
+		tailqueue nodes;
+		q.get_all(nodes);
+		while (!nodes.empty())
+		{
+			counted_node* n = (counted_node*)nodes.pop_front();
+			if (n->seq != next_seq[n->thread]) in_order = false;
+			next_seq[n->thread] = n->seq + 1;
+			++received;
+			delete n;
+		}
+	}
+	th1.join();
+	th2.join();
+	th3.join();
+
+	TEST_CHECK(in_order);
+	TEST_EQUAL(received, num_threads * num_nodes);
+	TEST_EQUAL(q.empty(), true);
+}
+
 int test_main()
 {
 	tailqueue t1;
@@ -157,6 +255,8 @@ int test_main()
 
 	free_chain(t1);
 	free_chain(t2);
+
+	test_atomic_tailqueue();
 	return 0;
 }
 
@@ -361,6 +361,8 @@ reports = [
 	('piece_picker_loops', 'loops through piece picker', '', '', [ \
 		'piece_picker_partial_loops', 'piece_picker_suggest_loops', 'piece_picker_sequential_loops', 'piece_picker_reverse_rare_loops',
 		'piece_picker_rare_loops', 'piece_picker_rand_start_loops', 'piece_picker_rand_loops', 'piece_picker_busy_loops'], {'type': stacked}),
+	('piece_deadlines', 'num', '', 'time critical pieces completed before and after their deadline', ['piece_deadlines_met', \
+		'piece_deadlines_missed', 'redundant_time_critical_requests']),
 	('picker_partials', 'pieces', '', '', ['num downloading partial pieces', 'num full partial pieces', 'num finished partial pieces', \
 		'num 0-priority partial pieces'], {'type':stacked}),
 	('picker_full_partials_distribution', 'full pieces', '', '', ['num full partial pieces'], {'type': histogram, 'binwidth': 5, 'numbins': 120}),